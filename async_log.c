@@ -0,0 +1,228 @@
+#include "async_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+
+// 日志记录（二进制格式，写线程负责格式化时间）
+typedef struct {
+    atomic_size_t sequence;             // Vyukov 有界队列的槽位序号
+    int priority;
+    int to_stdout;
+    struct timespec timestamp;
+    uint16_t length;
+    char message[ASYNC_LOG_MSG_SIZE];
+} async_log_record_t;
+
+// 调用点限速状态
+typedef struct {
+    const char* site;
+    time_t window;
+    uint32_t count;
+} async_log_site_t;
+
+static async_log_record_t ring[ASYNC_LOG_RING_SIZE];
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;
+
+static async_log_site_t sites[ASYNC_LOG_SITE_SLOTS];
+static int site_rate_limit = 0;
+
+static atomic_uint_fast64_t dropped_count;
+static atomic_uint_fast64_t suppressed_count;
+
+static pthread_t writer_thread;
+static pthread_mutex_t wakeup_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int writer_sleeping;
+static atomic_int writer_running;
+static int started = 0;
+
+uint64_t async_log_dropped(void) {
+    return atomic_load_explicit(&dropped_count, memory_order_relaxed);
+}
+
+uint64_t async_log_suppressed(void) {
+    return atomic_load_explicit(&suppressed_count, memory_order_relaxed);
+}
+
+// 按调用点限速（计数允许少量竞争误差）
+static int site_allowed(const char* site, time_t now) {
+    if (site_rate_limit <= 0) {
+        return 1;
+    }
+
+    uintptr_t hash = (uintptr_t)site;
+    hash ^= hash >> 17;
+    async_log_site_t* entry = &sites[(hash * 0x9E3779B1u) % ASYNC_LOG_SITE_SLOTS];
+
+    if (entry->site != site || entry->window != now) {
+        entry->site = site;
+        entry->window = now;
+        entry->count = 0;
+    }
+    return ++entry->count <= (uint32_t)site_rate_limit;
+}
+
+int async_log_vwrite(int priority, int to_stdout, const char* format, va_list args) {
+    if (!started) {
+        return 0;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (!site_allowed(format, now.tv_sec)) {
+        atomic_fetch_add_explicit(&suppressed_count, 1, memory_order_relaxed);
+        return 1;
+    }
+
+    // 申请槽位
+    async_log_record_t* record;
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        record = &ring[pos & (ASYNC_LOG_RING_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // 缓冲区已满，丢弃而不阻塞转发
+            atomic_fetch_add_explicit(&dropped_count, 1, memory_order_relaxed);
+            return 1;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    record->priority = priority;
+    record->to_stdout = to_stdout;
+    record->timestamp = now;
+    int length = vsnprintf(record->message, sizeof(record->message), format, args);
+    if (length < 0) {
+        length = 0;
+    } else if (length >= (int)sizeof(record->message)) {
+        length = sizeof(record->message) - 1;
+    }
+    record->length = (uint16_t)length;
+    atomic_store_explicit(&record->sequence, pos + 1, memory_order_release);
+
+    // 写线程休眠时才唤醒
+    if (atomic_load_explicit(&writer_sleeping, memory_order_acquire)) {
+        pthread_mutex_lock(&wakeup_mutex);
+        pthread_cond_signal(&wakeup_cond);
+        pthread_mutex_unlock(&wakeup_mutex);
+    }
+    return 1;
+}
+
+// 取出一条记录处理，没有可用记录时返回 0
+static int drain_one(char* cached_timestamp, time_t* cached_second) {
+    async_log_record_t* record = &ring[dequeue_pos & (ASYNC_LOG_RING_SIZE - 1)];
+    size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+    if (sequence != dequeue_pos + 1) {
+        return 0;
+    }
+
+    if (record->to_stdout) {
+        // 时间戳按秒缓存，只有秒数变化时才重新格式化
+        if (record->timestamp.tv_sec != *cached_second) {
+            struct tm tm_info;
+            localtime_r(&record->timestamp.tv_sec, &tm_info);
+            strftime(cached_timestamp, 64, "%Y-%m-%d %H:%M:%S", &tm_info);
+            *cached_second = record->timestamp.tv_sec;
+        }
+        printf("[%s] %.*s\n", cached_timestamp, record->length, record->message);
+    }
+    syslog(record->priority, "%.*s", record->length, record->message);
+
+    atomic_store_explicit(&record->sequence, dequeue_pos + ASYNC_LOG_RING_SIZE, memory_order_release);
+    dequeue_pos++;
+    return 1;
+}
+
+static void* writer_main(void* arg) {
+    (void)arg;
+    char cached_timestamp[64] = "";
+    time_t cached_second = 0;
+
+    for (;;) {
+        int written = 0;
+        while (drain_one(cached_timestamp, &cached_second)) {
+            written++;
+        }
+        if (written) {
+            fflush(stdout);
+            continue;
+        }
+
+        if (!atomic_load(&writer_running)) {
+            break;
+        }
+
+        // 队列为空，休眠等待唤醒（带超时以防唤醒丢失）
+        pthread_mutex_lock(&wakeup_mutex);
+        atomic_store_explicit(&writer_sleeping, 1, memory_order_seq_cst);
+        async_log_record_t* next = &ring[dequeue_pos & (ASYNC_LOG_RING_SIZE - 1)];
+        if (atomic_load_explicit(&next->sequence, memory_order_acquire) != dequeue_pos + 1 &&
+            atomic_load(&writer_running)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 50 * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&wakeup_cond, &wakeup_mutex, &deadline);
+        }
+        atomic_store_explicit(&writer_sleeping, 0, memory_order_seq_cst);
+        pthread_mutex_unlock(&wakeup_mutex);
+    }
+
+    return NULL;
+}
+
+int async_log_start(int rate_limit) {
+    if (started) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < ASYNC_LOG_RING_SIZE; i++) {
+        atomic_init(&ring[i].sequence, i);
+    }
+    atomic_init(&enqueue_pos, 0);
+    dequeue_pos = 0;
+    site_rate_limit = rate_limit;
+    memset(sites, 0, sizeof(sites));
+    atomic_store(&writer_running, 1);
+
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        return -1;
+    }
+
+    started = 1;
+    return 0;
+}
+
+void async_log_set_rate_limit(int rate_limit) {
+    site_rate_limit = rate_limit;
+}
+
+void async_log_stop(void) {
+    if (!started) {
+        return;
+    }
+
+    started = 0;
+    atomic_store(&writer_running, 0);
+    pthread_mutex_lock(&wakeup_mutex);
+    pthread_cond_signal(&wakeup_cond);
+    pthread_mutex_unlock(&wakeup_mutex);
+    pthread_join(writer_thread, NULL);
+}
@@ -0,0 +1,29 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+// 异步日志：调用方只把消息格式化进无锁环形缓冲区（MPSC），
+// 时间戳格式化、stdout 输出和 syslog 都由独立的写线程完成；缓冲区满时丢弃并计数而不是阻塞
+
+#define ASYNC_LOG_RING_SIZE 4096        // 环形缓冲区槽位数（2的幂）
+#define ASYNC_LOG_MSG_SIZE 480          // 单条消息最大长度
+#define ASYNC_LOG_SITE_SLOTS 256        // 限速表大小（按调用点的格式字符串区分）
+
+// 启动写线程；rate_limit 为每个调用点每秒允许的消息数，0表示不限速
+int async_log_start(int rate_limit);
+
+// 调整每个调用点的限速（配置重载时使用）
+void async_log_set_rate_limit(int rate_limit);
+
+// 刷出剩余日志并停止写线程
+void async_log_stop(void);
+
+// 写入一条日志，未启动时返回 0（调用方应同步输出）
+int async_log_vwrite(int priority, int to_stdout, const char* format, va_list args);
+
+uint64_t async_log_dropped(void);       // 缓冲区满丢弃的条数
+uint64_t async_log_suppressed(void);    // 被限速丢弃的条数
+
+#endif // ASYNC_LOG_H
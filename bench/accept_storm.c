@@ -0,0 +1,317 @@
+// 重连风暴基准：-n 个客户端同时连接转发器（模拟分支网络抖动后所有 RDP 客户端一起重连），
+// 每个客户端连上后立即发送一个输入消息（相当于 RDP 的 X.224 连接请求），收到目标的回显即视为恢复。
+// 风暴期间 -e 个已建立的会话持续做输入往返，衡量已有会话是否仍能及时转发。
+//
+// 输出 JSON：全部客户端恢复的用时，单个客户端恢复时间的 p50/p99/max，超过1秒才恢复的客户端数
+// （监听队列溢出、SYN 被丢弃后要等客户端重传），失败和超时的客户端数，以及已有会话在风暴期间的
+// 往返延迟。目标使用 bench_target（回显输入消息）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "bench_proto.h"
+#include "metrics.h"
+
+#define STORM_SLOW_US 1000000           // 超过1秒恢复的客户端视为经历了 SYN 重传
+
+typedef enum {
+    CLIENT_CONNECTING = 0,
+    CLIENT_WAIT_ECHO,
+    CLIENT_DONE,
+    CLIENT_FAILED
+} client_state_t;
+
+typedef struct {
+    int fd;
+    client_state_t state;
+    uint64_t start_us;
+    uint64_t recovery_us;   // 从发起连接到收到回显的时间
+    size_t received;
+    bench_msg_t msg;
+} storm_client_t;
+
+typedef struct {
+    const char* host;
+    int port;
+    int clients;            // 同时重连的客户端数
+    int established;        // 风暴期间持续往返的已建立会话数
+    int timeout;            // 等待全部恢复的最长时间（秒）
+    int interval_ms;        // 已建立会话每次往返之间的间隔
+} storm_options_t;
+
+static storm_options_t options = {
+    .host = "127.0.0.1",
+    .port = 15900,
+    .clients = 500,
+    .established = 4,
+    .timeout = 30,
+    .interval_ms = 10,
+};
+
+static volatile int storm_running = 1;
+static metrics_histogram_t established_latency;
+static uint64_t established_errors;
+
+static int recv_all(int fd, void* data, size_t size) {
+    char* bytes = (char*)data;
+    size_t received = 0;
+    while (received < size) {
+        ssize_t n = recv(fd, bytes + received, size - received, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        received += n;
+    }
+    return 0;
+}
+
+static int forwarder_address(struct sockaddr_in* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(options.port);
+    return inet_pton(AF_INET, options.host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+// 已建立的会话：依次做输入往返，直到风暴结束
+static void* established_main(void* arg) {
+    int* fds = (int*)arg;
+    while (storm_running) {
+        for (int i = 0; i < options.established; i++) {
+            if (fds[i] < 0) {
+                continue;
+            }
+            bench_msg_t msg = { BENCH_MSG_INPUT, 0, metrics_now_us() };
+            if (send(fds[i], &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg) ||
+                recv_all(fds[i], &msg, sizeof(msg)) < 0) {
+                established_errors++;
+                close(fds[i]);
+                fds[i] = -1;
+                continue;
+            }
+            metrics_hist_record(&established_latency, metrics_now_us() - msg.timestamp_us);
+        }
+        usleep(options.interval_ms * 1000);
+    }
+    return NULL;
+}
+
+static void client_fail(storm_client_t* client) {
+    client->state = CLIENT_FAILED;
+    close(client->fd);
+    client->fd = -1;
+}
+
+// 推进一个客户端的状态：连接完成后发送输入消息，收齐回显后完成
+static void client_step(storm_client_t* client, short revents, metrics_histogram_t* recovery) {
+    if (client->state == CLIENT_CONNECTING) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error) {
+            client_fail(client);
+            return;
+        }
+        client->msg.type = BENCH_MSG_INPUT;
+        client->msg.length = 0;
+        client->msg.timestamp_us = client->start_us;
+        if (send(client->fd, &client->msg, sizeof(client->msg), MSG_NOSIGNAL) != sizeof(client->msg)) {
+            client_fail(client);
+            return;
+        }
+        client->state = CLIENT_WAIT_ECHO;
+        return;
+    }
+
+    if (client->state == CLIENT_WAIT_ECHO && (revents & (POLLIN | POLLHUP | POLLERR))) {
+        ssize_t n = recv(client->fd, (char*)&client->msg + client->received,
+                         sizeof(client->msg) - client->received, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+        if (n <= 0) {
+            client_fail(client);
+            return;
+        }
+        client->received += n;
+        if (client->received == sizeof(client->msg)) {
+            client->state = CLIENT_DONE;
+            client->recovery_us = metrics_now_us() - client->start_us;
+            metrics_hist_record(recovery, client->recovery_us);
+        }
+    }
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -H host      forwarder address (default 127.0.0.1)\n"
+            "  -p port      forwarder port (default 15900)\n"
+            "  -n clients   clients reconnecting at once (default %d)\n"
+            "  -e sessions  established sessions doing round trips during the storm (default %d)\n"
+            "  -T seconds   give up waiting for recovery after this long (default %d)\n"
+            "  -i ms        interval between round trips of established sessions (default %d)\n",
+            prog, options.clients, options.established, options.timeout, options.interval_ms);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:n:e:T:i:h")) != -1) {
+        switch (opt) {
+            case 'H': options.host = optarg; break;
+            case 'p': options.port = atoi(optarg); break;
+            case 'n': options.clients = atoi(optarg); break;
+            case 'e': options.established = atoi(optarg); break;
+            case 'T': options.timeout = atoi(optarg); break;
+            case 'i': options.interval_ms = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (options.clients <= 0 || options.established < 0 || options.timeout <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    struct sockaddr_in addr;
+    if (forwarder_address(&addr) < 0) {
+        fprintf(stderr, "invalid host %s\n", options.host);
+        return 1;
+    }
+
+    // 风暴前建立的会话
+    int* established_fds = malloc((options.established + 1) * sizeof(int));
+    for (int i = 0; i < options.established; i++) {
+        established_fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        bench_msg_t msg = { BENCH_MSG_INPUT, 0, 0 };
+        if (established_fds[i] < 0 ||
+            connect(established_fds[i], (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            send(established_fds[i], &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg) ||
+            recv_all(established_fds[i], &msg, sizeof(msg)) < 0) {
+            perror("established session");
+            return 1;
+        }
+        int flag = 1;
+        setsockopt(established_fds[i], IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+    pthread_t established_thread;
+    if (options.established > 0) {
+        pthread_create(&established_thread, NULL, established_main, established_fds);
+        usleep(100 * 1000);
+    }
+
+    // 所有客户端同时发起连接
+    storm_client_t* clients = calloc(options.clients, sizeof(storm_client_t));
+    struct pollfd* pfds = calloc(options.clients, sizeof(struct pollfd));
+    int* poll_index = calloc(options.clients, sizeof(int));
+    metrics_histogram_t recovery;
+    memset(&recovery, 0, sizeof(recovery));
+
+    uint64_t storm_start = metrics_now_us();
+    for (int i = 0; i < options.clients; i++) {
+        storm_client_t* client = &clients[i];
+        client->start_us = metrics_now_us();
+        client->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (client->fd < 0) {
+            client->state = CLIENT_FAILED;
+            continue;
+        }
+        int flag = 1;
+        setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        if (connect(client->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+            client_fail(client);
+        }
+    }
+
+    uint64_t deadline = storm_start + (uint64_t)options.timeout * 1000000;
+    uint64_t last_done_us = storm_start;
+    int pending = options.clients;
+    while (pending > 0 && metrics_now_us() < deadline) {
+        int count = 0;
+        for (int i = 0; i < options.clients; i++) {
+            if (clients[i].state == CLIENT_CONNECTING || clients[i].state == CLIENT_WAIT_ECHO) {
+                pfds[count].fd = clients[i].fd;
+                pfds[count].events = clients[i].state == CLIENT_CONNECTING ? POLLOUT : POLLIN;
+                pfds[count].revents = 0;
+                poll_index[count++] = i;
+            }
+        }
+        pending = count;
+        if (count == 0 || poll(pfds, count, 100) <= 0) {
+            continue;
+        }
+        for (int j = 0; j < count; j++) {
+            if (pfds[j].revents) {
+                storm_client_t* client = &clients[poll_index[j]];
+                client_step(client, pfds[j].revents, &recovery);
+                if (client->state == CLIENT_DONE) {
+                    last_done_us = metrics_now_us();
+                }
+            }
+        }
+    }
+
+    storm_running = 0;
+    if (options.established > 0) {
+        pthread_join(established_thread, NULL);
+    }
+
+    int done = 0, failed = 0, timed_out = 0, slow = 0;
+    for (int i = 0; i < options.clients; i++) {
+        if (clients[i].state == CLIENT_DONE) {
+            done++;
+            slow += clients[i].recovery_us > STORM_SLOW_US;
+        } else if (clients[i].state == CLIENT_FAILED) {
+            failed++;
+        } else {
+            timed_out++;
+        }
+    }
+    printf("{\n");
+    printf("  \"clients\": %d,\n", options.clients);
+    printf("  \"recovered\": %d,\n", done);
+    printf("  \"failed\": %d,\n", failed);
+    printf("  \"timed_out\": %d,\n", timed_out);
+    printf("  \"recovery_time_ms\": %.1f,\n", (last_done_us - storm_start) / 1000.0);
+    printf("  \"client_recovery_us\": { \"p50\": %llu, \"p99\": %llu, \"max\": %llu },\n",
+           (unsigned long long)metrics_hist_quantile(&recovery, 0.50),
+           (unsigned long long)metrics_hist_quantile(&recovery, 0.99),
+           (unsigned long long)recovery.max_us);
+    printf("  \"clients_over_1s\": %d,\n", slow);
+    printf("  \"established_sessions\": %d,\n", options.established);
+    printf("  \"established_roundtrip_us\": { \"p50\": %llu, \"p99\": %llu, \"max\": %llu },\n",
+           (unsigned long long)metrics_hist_quantile(&established_latency, 0.50),
+           (unsigned long long)metrics_hist_quantile(&established_latency, 0.99),
+           (unsigned long long)established_latency.max_us);
+    printf("  \"established_errors\": %llu\n", (unsigned long long)established_errors);
+    printf("}\n");
+
+    for (int i = 0; i < options.clients; i++) {
+        if (clients[i].fd >= 0) {
+            close(clients[i].fd);
+        }
+    }
+    for (int i = 0; i < options.established; i++) {
+        if (established_fds[i] >= 0) {
+            close(established_fds[i]);
+        }
+    }
+    free(clients);
+    free(pfds);
+    free(poll_index);
+    free(established_fds);
+    return timed_out > 0 || failed > 0 ? 2 : 0;
+}
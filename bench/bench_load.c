@@ -0,0 +1,419 @@
+// 基准测试负载生成器：通过 rdp_forwarder 运行多个并发会话，模拟 RDP 流量形态
+//   - 交互会话：小的输入事件突发（1-4个事件），测量往返延迟
+//   - 位图更新：周期性请求大块服务器到客户端数据，测量吞吐量
+//   - 空闲会话：建立连接后保持静默（如最小化的远程桌面窗口）
+//   - 连接风暴：短连接建立/关闭，测量接受速率
+// 结果以 JSON 输出，便于跟踪回归
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "bench_proto.h"
+#include "metrics.h"
+
+typedef struct {
+    const char* host;
+    int port;
+    int sessions;           // 活跃会话数
+    int idle_sessions;      // 空闲会话数
+    int duration;           // 负载阶段时长（秒）
+    int bitmap_size;        // 位图更新最大字节数
+    int bitmap_interval_ms; // 每个会话的位图更新间隔
+    int think_ms;           // 输入突发之间的间隔
+    int churn_seconds;      // 连接风暴阶段时长（秒）
+    int churn_threads;
+    int forwarder_pid;      // 用于统计转发器CPU时间
+} bench_options_t;
+
+typedef struct {
+    int index;
+    metrics_histogram_t input_latency;
+    metrics_histogram_t bitmap_latency;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t errors;
+} session_result_t;
+
+typedef struct {
+    metrics_histogram_t connect_latency;
+    uint64_t connections;
+    uint64_t errors;
+} churn_result_t;
+
+static bench_options_t options = {
+    .host = "127.0.0.1",
+    .port = 15900,
+    .sessions = 50,
+    .idle_sessions = 100,
+    .duration = 10,
+    .bitmap_size = 262144,
+    .bitmap_interval_ms = 100,
+    .think_ms = 5,
+    .churn_seconds = 3,
+    .churn_threads = 4,
+    .forwarder_pid = 0,
+};
+
+static uint64_t phase_deadline_us;
+
+static uint32_t next_random(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static int recv_all(int fd, void* data, size_t size) {
+    char* bytes = (char*)data;
+    size_t received = 0;
+    while (received < size) {
+        ssize_t n = recv(fd, bytes + received, size - received, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        received += n;
+    }
+    return 0;
+}
+
+static int send_all(int fd, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t n = send(fd, bytes + sent, size - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+static int connect_forwarder(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    inet_pton(AF_INET, options.host, &addr.sin_addr);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    return fd;
+}
+
+// 发送一个输入事件并等待回显，返回往返时间（微秒），失败返回 -1
+static int64_t input_roundtrip(int fd) {
+    bench_msg_t msg = { BENCH_MSG_INPUT, 0, metrics_now_us() };
+    if (send_all(fd, &msg, sizeof(msg)) < 0 || recv_all(fd, &msg, sizeof(msg)) < 0) {
+        return -1;
+    }
+    return (int64_t)(metrics_now_us() - msg.timestamp_us);
+}
+
+static void* session_main(void* arg) {
+    session_result_t* result = (session_result_t*)arg;
+    uint32_t seed = 0x9E3779B9u * (result->index + 1);
+    char sink[65536];
+
+    int fd = connect_forwarder();
+    if (fd < 0) {
+        result->errors++;
+        return NULL;
+    }
+
+    // 各会话的位图更新时间错开
+    uint64_t next_bitmap = metrics_now_us() + (next_random(&seed) % options.bitmap_interval_ms) * 1000ULL;
+
+    while (metrics_now_us() < phase_deadline_us) {
+        int burst = 1 + next_random(&seed) % 4;
+        for (int i = 0; i < burst; i++) {
+            int64_t rtt = input_roundtrip(fd);
+            if (rtt < 0) {
+                result->errors++;
+                goto done;
+            }
+            metrics_hist_record(&result->input_latency, rtt);
+            result->bytes_sent += sizeof(bench_msg_t);
+            result->bytes_received += sizeof(bench_msg_t);
+        }
+
+        uint64_t now = metrics_now_us();
+        if (now >= next_bitmap) {
+            // 位图更新大小在 [bitmap_size/4, bitmap_size] 之间
+            uint32_t size = options.bitmap_size / 4 + next_random(&seed) % (options.bitmap_size * 3 / 4 + 1);
+            bench_msg_t msg = { BENCH_MSG_BITMAP, size, now };
+            if (send_all(fd, &msg, sizeof(msg)) < 0 || recv_all(fd, &msg, sizeof(msg)) < 0) {
+                result->errors++;
+                goto done;
+            }
+            uint32_t remaining = size;
+            while (remaining > 0) {
+                uint32_t chunk = remaining < sizeof(sink) ? remaining : sizeof(sink);
+                if (recv_all(fd, sink, chunk) < 0) {
+                    result->errors++;
+                    goto done;
+                }
+                remaining -= chunk;
+            }
+            metrics_hist_record(&result->bitmap_latency, metrics_now_us() - msg.timestamp_us);
+            result->bytes_sent += sizeof(bench_msg_t);
+            result->bytes_received += sizeof(bench_msg_t) + size;
+            next_bitmap = now + options.bitmap_interval_ms * 1000ULL;
+        }
+
+        if (options.think_ms > 0) {
+            usleep(options.think_ms * 1000);
+        }
+    }
+
+done:
+    close(fd);
+    return NULL;
+}
+
+static void* churn_main(void* arg) {
+    churn_result_t* result = (churn_result_t*)arg;
+
+    while (metrics_now_us() < phase_deadline_us) {
+        uint64_t start = metrics_now_us();
+        int fd = connect_forwarder();
+        if (fd < 0) {
+            result->errors++;
+            continue;
+        }
+        // 第一个回显到达说明目标连接已建立并完成转发
+        if (input_roundtrip(fd) < 0) {
+            result->errors++;
+        } else {
+            metrics_hist_record(&result->connect_latency, metrics_now_us() - start);
+            result->connections++;
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+// 读取进程累计CPU时间（秒），失败返回 -1
+static double process_cpu_seconds(int pid) {
+    if (pid <= 0) {
+        return -1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+
+    char line[1024];
+    if (!fgets(line, sizeof(line), fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    // 进程名可能包含空格，从最后一个 ')' 之后开始解析
+    char* p = strrchr(line, ')');
+    if (!p) {
+        return -1;
+    }
+    unsigned long utime = 0, stime = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void print_histogram(const char* name, const metrics_histogram_t* hist, int last) {
+    printf("    \"%s\": {\"count\": %llu, \"mean_us\": %.1f, \"p50_us\": %llu, \"p99_us\": %llu, "
+           "\"p999_us\": %llu, \"max_us\": %llu}%s\n",
+           name, (unsigned long long)hist->count,
+           hist->count ? (double)hist->sum_us / hist->count : 0.0,
+           (unsigned long long)metrics_hist_quantile(hist, 0.50),
+           (unsigned long long)metrics_hist_quantile(hist, 0.99),
+           (unsigned long long)metrics_hist_quantile(hist, 0.999),
+           (unsigned long long)hist->max_us, last ? "" : ",");
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -H host        forwarder address (default 127.0.0.1)\n"
+            "  -p port        forwarder port (default 15900)\n"
+            "  -s sessions    active sessions (default 50)\n"
+            "  -i sessions    idle sessions (default 100)\n"
+            "  -d seconds     load phase duration (default 10)\n"
+            "  -b bytes       max bitmap update size (default 262144)\n"
+            "  -I ms          bitmap interval per session (default 100)\n"
+            "  -t ms          think time between input bursts (default 5)\n"
+            "  -c seconds     connection churn phase duration, 0 to skip (default 3)\n"
+            "  -C threads     churn threads (default 4)\n"
+            "  -P pid         forwarder pid for CPU accounting\n",
+            program);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:s:i:d:b:I:t:c:C:P:h")) != -1) {
+        switch (opt) {
+            case 'H': options.host = optarg; break;
+            case 'p': options.port = atoi(optarg); break;
+            case 's': options.sessions = atoi(optarg); break;
+            case 'i': options.idle_sessions = atoi(optarg); break;
+            case 'd': options.duration = atoi(optarg); break;
+            case 'b': options.bitmap_size = atoi(optarg); break;
+            case 'I': options.bitmap_interval_ms = atoi(optarg); break;
+            case 't': options.think_ms = atoi(optarg); break;
+            case 'c': options.churn_seconds = atoi(optarg); break;
+            case 'C': options.churn_threads = atoi(optarg); break;
+            case 'P': options.forwarder_pid = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (options.sessions < 0 || options.idle_sessions < 0 || options.duration <= 0 ||
+        options.bitmap_size < 4 || options.bitmap_interval_ms <= 0 || options.churn_threads <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // 空闲会话：先建立并保持到结束
+    int* idle_fds = calloc(options.idle_sessions + 1, sizeof(int));
+    int idle_connected = 0;
+    for (int i = 0; i < options.idle_sessions; i++) {
+        int fd = connect_forwarder();
+        if (fd < 0 || input_roundtrip(fd) < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        idle_fds[idle_connected++] = fd;
+    }
+
+    // 负载阶段
+    session_result_t* results = calloc(options.sessions + 1, sizeof(session_result_t));
+    pthread_t* threads = calloc(options.sessions + 1, sizeof(pthread_t));
+    double cpu_start = process_cpu_seconds(options.forwarder_pid);
+    uint64_t load_start = metrics_now_us();
+    phase_deadline_us = load_start + options.duration * 1000000ULL;
+
+    for (int i = 0; i < options.sessions; i++) {
+        results[i].index = i;
+        pthread_create(&threads[i], NULL, session_main, &results[i]);
+    }
+    for (int i = 0; i < options.sessions; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    uint64_t load_elapsed = metrics_now_us() - load_start;
+    double cpu_end = process_cpu_seconds(options.forwarder_pid);
+
+    session_result_t total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < options.sessions; i++) {
+        metrics_hist_merge(&total.input_latency, &results[i].input_latency);
+        metrics_hist_merge(&total.bitmap_latency, &results[i].bitmap_latency);
+        total.bytes_sent += results[i].bytes_sent;
+        total.bytes_received += results[i].bytes_received;
+        total.errors += results[i].errors;
+    }
+
+    // 连接风暴阶段（空闲会话仍然保持）
+    churn_result_t churn;
+    memset(&churn, 0, sizeof(churn));
+    uint64_t churn_elapsed = 0;
+    if (options.churn_seconds > 0) {
+        churn_result_t* churn_results = calloc(options.churn_threads, sizeof(churn_result_t));
+        pthread_t* churn_threads = calloc(options.churn_threads, sizeof(pthread_t));
+        uint64_t churn_start = metrics_now_us();
+        phase_deadline_us = churn_start + options.churn_seconds * 1000000ULL;
+        for (int i = 0; i < options.churn_threads; i++) {
+            pthread_create(&churn_threads[i], NULL, churn_main, &churn_results[i]);
+        }
+        for (int i = 0; i < options.churn_threads; i++) {
+            pthread_join(churn_threads[i], NULL);
+            metrics_hist_merge(&churn.connect_latency, &churn_results[i].connect_latency);
+            churn.connections += churn_results[i].connections;
+            churn.errors += churn_results[i].errors;
+        }
+        churn_elapsed = metrics_now_us() - churn_start;
+        free(churn_results);
+        free(churn_threads);
+    }
+
+    for (int i = 0; i < idle_connected; i++) {
+        close(idle_fds[i]);
+    }
+
+    double seconds = load_elapsed / 1e6;
+    double relayed_gib = (double)(total.bytes_sent + total.bytes_received) / (1024.0 * 1024.0 * 1024.0);
+    double cpu_seconds = (cpu_start >= 0 && cpu_end >= 0) ? cpu_end - cpu_start : -1;
+
+    printf("{\n");
+    printf("  \"config\": {\"sessions\": %d, \"idle_sessions\": %d, \"duration_s\": %d, "
+           "\"bitmap_size\": %d, \"bitmap_interval_ms\": %d, \"think_ms\": %d},\n",
+           options.sessions, options.idle_sessions, options.duration,
+           options.bitmap_size, options.bitmap_interval_ms, options.think_ms);
+    printf("  \"load\": {\n");
+    printf("    \"elapsed_s\": %.3f,\n", seconds);
+    printf("    \"bytes_client_to_target\": %llu,\n", (unsigned long long)total.bytes_sent);
+    printf("    \"bytes_target_to_client\": %llu,\n", (unsigned long long)total.bytes_received);
+    printf("    \"throughput_mbps\": %.2f,\n",
+           seconds > 0 ? (total.bytes_sent + total.bytes_received) * 8.0 / seconds / 1e6 : 0.0);
+    printf("    \"idle_sessions_connected\": %d,\n", idle_connected);
+    printf("    \"errors\": %llu,\n", (unsigned long long)total.errors);
+    if (cpu_seconds >= 0) {
+        printf("    \"forwarder_cpu_s\": %.3f,\n", cpu_seconds);
+        printf("    \"forwarder_cpu_s_per_gib\": %.3f,\n", relayed_gib > 0 ? cpu_seconds / relayed_gib : 0.0);
+    } else {
+        printf("    \"forwarder_cpu_s\": null,\n");
+        printf("    \"forwarder_cpu_s_per_gib\": null,\n");
+    }
+    print_histogram("input_latency", &total.input_latency, 0);
+    print_histogram("bitmap_latency", &total.bitmap_latency, 1);
+    printf("  },\n");
+    printf("  \"churn\": {\n");
+    printf("    \"elapsed_s\": %.3f,\n", churn_elapsed / 1e6);
+    printf("    \"connections\": %llu,\n", (unsigned long long)churn.connections);
+    printf("    \"errors\": %llu,\n", (unsigned long long)churn.errors);
+    printf("    \"accept_rate_per_s\": %.1f,\n", churn_elapsed ? churn.connections / (churn_elapsed / 1e6) : 0.0);
+    print_histogram("connect_latency", &churn.connect_latency, 1);
+    printf("  }\n");
+    printf("}\n");
+
+    free(idle_fds);
+    free(results);
+    free(threads);
+    return total.errors > 0 ? 2 : 0;
+}
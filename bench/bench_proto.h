@@ -0,0 +1,19 @@
+#ifndef BENCH_PROTO_H
+#define BENCH_PROTO_H
+
+#include <stdint.h>
+
+// 基准测试协议：负载生成器和模拟目标之间的消息头
+//   BENCH_MSG_INPUT  - 交互输入（键盘/鼠标），目标原样回显消息头
+//   BENCH_MSG_BITMAP - 请求一次位图更新，目标回复消息头和 length 字节的数据
+
+#define BENCH_MSG_INPUT 1
+#define BENCH_MSG_BITMAP 2
+
+typedef struct {
+    uint32_t type;
+    uint32_t length;        // 请求的位图大小（输入消息为0）
+    uint64_t timestamp_us;  // 发送时间，原样带回
+} bench_msg_t;
+
+#endif // BENCH_PROTO_H
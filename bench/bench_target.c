@@ -0,0 +1,132 @@
+// 基准测试用的 RDP 目标模拟：回显输入事件，按请求发送位图数据
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "bench_proto.h"
+
+#define BITMAP_CHUNK 65536
+
+static char bitmap_data[BITMAP_CHUNK];
+
+static int recv_all(int fd, void* data, size_t size) {
+    char* bytes = (char*)data;
+    size_t received = 0;
+    while (received < size) {
+        ssize_t n = recv(fd, bytes + received, size - received, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        received += n;
+    }
+    return 0;
+}
+
+static int send_all(int fd, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t n = send(fd, bytes + sent, size - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+static void* session_main(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    bench_msg_t msg;
+    int ok = 1;
+    while (ok && recv_all(fd, &msg, sizeof(msg)) == 0) {
+        if (send_all(fd, &msg, sizeof(msg)) < 0) {
+            break;
+        }
+        if (msg.type != BENCH_MSG_BITMAP) {
+            continue;
+        }
+        uint32_t remaining = msg.length;
+        while (remaining > 0) {
+            uint32_t size = remaining < BITMAP_CHUNK ? remaining : BITMAP_CHUNK;
+            if (send_all(fd, bitmap_data, size) < 0) {
+                ok = 0;
+                break;
+            }
+            remaining -= size;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    int port = argc > 1 ? atoi(argv[1]) : 15901;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // 位图数据使用伪随机内容，避免被压缩或特殊处理
+    uint32_t seed = 0x12345678;
+    for (int i = 0; i < BITMAP_CHUNK; i++) {
+        seed = seed * 1103515245 + 12345;
+        bitmap_data[i] = (char)(seed >> 16);
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 1024) < 0) {
+        perror("bind/listen");
+        return 1;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, session_main, (void*)(intptr_t)fd) != 0) {
+            close(fd);
+        }
+    }
+
+    close(listen_fd);
+    return 0;
+}
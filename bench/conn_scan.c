@@ -0,0 +1,386 @@
+// 会话数组遍历微基准：比较拆分前的会话结构（所有字段在一个结构中）和拆分后的热、冷两个数组
+// 在主循环每轮遍历时的开销
+//
+// 每轮遍历与主循环相同：快速重连检查、按 fd 和暂存状态决定监听哪些事件、超时检查。
+// 旧布局每个会话都要查看暂存缓冲区（spill_pending），新布局只读热数据中的 parked 标志。
+// 最后把 -x 指定比例的会话设为超时，按 cleanup_connection 的方式逐个移除并计时。
+// -l / -s 只运行其中一种布局，便于在 perf stat -e cache-misses 下分别比较。
+// 结构定义需与 rdp_forwarder.c 保持一致（旧布局为拆分前的 connection_pair_t）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include "spill_buffer.h"
+
+#define SCAN_SESSIONS 10000             // 默认会话数
+#define SCAN_ROUNDS 2000                // 默认遍历轮数
+#define SCAN_TIMEOUT 3600               // 超时秒数（connection_timeout）
+
+typedef struct {
+    int size;
+    int small_reads;
+    int sockbuf;
+    long sockbuf_bytes;
+} relay_dir_t;
+
+// 拆分前的布局
+typedef struct {
+    unsigned long session_id;
+    int client_fd;
+    int target_fd;
+    char target_ip[16];
+    int target_port;
+    time_t last_activity;
+    int is_active;
+    unsigned long bytes_sent;
+    unsigned long bytes_received;
+    relay_dir_t relay[2];
+    void* ht_stream;
+    int use_hybrid_transport;
+    int ht_exit_side;
+    int client_disconnected;
+    int target_ready;
+    time_t disconnect_time;
+    int reconnect_attempts;
+    spill_buffer_t park_buffer;
+    int state;
+    time_t state_change_time;
+    time_t connection_start_time;
+    char last_error[256];
+    int error_count;
+} legacy_pair_t;
+
+// 拆分后的布局
+typedef struct {
+    void* ht_stream;
+    time_t last_activity;
+    unsigned long bytes_sent;
+    unsigned long bytes_received;
+    int client_fd;
+    int target_fd;
+    int state;
+    uint8_t is_active;
+    uint8_t use_hybrid_transport;
+    uint8_t ht_exit_side;
+    uint8_t client_disconnected;
+    uint8_t target_ready;
+    uint8_t parked;
+} __attribute__((aligned(64))) hot_pair_t;
+
+typedef struct {
+    unsigned long session_id;
+    char target_ip[16];
+    int target_port;
+    relay_dir_t relay[2];
+    time_t disconnect_time;
+    int reconnect_attempts;
+    spill_buffer_t park_buffer;
+    time_t state_change_time;
+    time_t connection_start_time;
+    char last_error[256];
+    int error_count;
+} cold_info_t;
+
+typedef struct {
+    double scan_ns_per_session;
+    double timeout_us;
+    unsigned long checksum;             // 防止遍历被优化掉，两种布局应一致
+} scan_result_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 会话组成：每20个中1个混合传输会话、1个客户端已断开并有暂存数据的会话，其余为普通TCP会话
+static int session_kind(int i) {
+    return i % 20 == 0 ? 1 : (i % 20 == 1 ? 2 : 0);
+}
+
+static void evict(char* buffer, size_t size) {
+    for (size_t i = 0; i < size; i += 64) {
+        buffer[i]++;
+    }
+}
+
+static scan_result_t run_legacy(int count, int rounds, int expire_pct, char* evict_buf, size_t evict_size) {
+    legacy_pair_t* conns = calloc(count, sizeof(legacy_pair_t));
+    time_t now = time(NULL);
+    static const char parked[100];
+    for (int i = 0; i < count; i++) {
+        legacy_pair_t* conn = &conns[i];
+        spill_init(&conn->park_buffer);
+        conn->session_id = i + 1;
+        conn->client_fd = 10 + 2 * i;
+        conn->target_fd = 11 + 2 * i;
+        conn->last_activity = now;
+        conn->is_active = 1;
+        if (session_kind(i) == 1) {
+            conn->use_hybrid_transport = 1;
+            conn->ht_stream = conn;
+        } else if (session_kind(i) == 2) {
+            conn->client_fd = -1;
+            conn->client_disconnected = 1;
+            conn->target_ready = 1;
+            spill_append(&conn->park_buffer, parked, sizeof(parked));
+        }
+    }
+
+    scan_result_t result = { 0, 0, 0 };
+    uint64_t scan_ns = 0;
+    for (int r = 0; r < rounds; r++) {
+        if (evict_size) {
+            evict(evict_buf, evict_size);
+        }
+        uint64_t t0 = now_ns();
+        unsigned long sum = 0;
+        for (int i = 0; i < count; i++) {
+            if (conns[i].client_disconnected && !conns[i].target_ready &&
+                now - conns[i].disconnect_time >= 0) {
+                sum += 1;
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            if (conns[i].use_hybrid_transport && conns[i].ht_stream) {
+                int tcp_fd = conns[i].ht_exit_side ? conns[i].target_fd : conns[i].client_fd;
+                if (tcp_fd > 0) {
+                    sum += tcp_fd;
+                    if (spill_pending(&conns[i].park_buffer) > 0) {
+                        sum += 3;
+                    }
+                }
+                continue;
+            }
+            if (conns[i].client_fd > 0) {
+                sum += conns[i].client_fd;
+                if (spill_pending(&conns[i].park_buffer) > 0) {
+                    sum += 3;
+                }
+            }
+            if (conns[i].target_fd > 0 &&
+                (conns[i].client_fd > 0 || spill_space(&conns[i].park_buffer) > 0)) {
+                sum += conns[i].target_fd;
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            if (conns[i].is_active && now - conns[i].last_activity > SCAN_TIMEOUT) {
+                sum += 7;
+            }
+        }
+        scan_ns += now_ns() - t0;
+        result.checksum += sum;
+    }
+    result.scan_ns_per_session = (double)scan_ns / rounds / count;
+
+    // 超时移除
+    for (int i = 0; i < count; i++) {
+        if (i % 100 < expire_pct) {
+            conns[i].last_activity = now - SCAN_TIMEOUT - 1;
+        }
+    }
+    if (evict_size) {
+        evict(evict_buf, evict_size);
+    }
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < count; i++) {
+        if (now - conns[i].last_activity > SCAN_TIMEOUT) {
+            spill_release(&conns[i].park_buffer);
+            for (int j = i; j < count - 1; j++) {
+                conns[j] = conns[j + 1];
+            }
+            count--;
+            i--;
+        }
+    }
+    result.timeout_us = (now_ns() - t0) / 1e3;
+    result.checksum += count;
+
+    for (int i = 0; i < count; i++) {
+        spill_release(&conns[i].park_buffer);
+    }
+    free(conns);
+    return result;
+}
+
+static scan_result_t run_split(int count, int rounds, int expire_pct, char* evict_buf, size_t evict_size) {
+    hot_pair_t* conns = aligned_alloc(64, count * sizeof(hot_pair_t));
+    cold_info_t* info = calloc(count, sizeof(cold_info_t));
+    memset(conns, 0, count * sizeof(hot_pair_t));
+    time_t now = time(NULL);
+    static const char parked[100];
+    for (int i = 0; i < count; i++) {
+        hot_pair_t* conn = &conns[i];
+        spill_init(&info[i].park_buffer);
+        info[i].session_id = i + 1;
+        conn->client_fd = 10 + 2 * i;
+        conn->target_fd = 11 + 2 * i;
+        conn->last_activity = now;
+        conn->is_active = 1;
+        if (session_kind(i) == 1) {
+            conn->use_hybrid_transport = 1;
+            conn->ht_stream = conn;
+        } else if (session_kind(i) == 2) {
+            conn->client_fd = -1;
+            conn->client_disconnected = 1;
+            conn->target_ready = 1;
+            conn->parked = 1;
+            spill_append(&info[i].park_buffer, parked, sizeof(parked));
+        }
+    }
+
+    scan_result_t result = { 0, 0, 0 };
+    uint64_t scan_ns = 0;
+    for (int r = 0; r < rounds; r++) {
+        if (evict_size) {
+            evict(evict_buf, evict_size);
+        }
+        uint64_t t0 = now_ns();
+        unsigned long sum = 0;
+        for (int i = 0; i < count; i++) {
+            if (conns[i].client_disconnected && !conns[i].target_ready &&
+                now - info[i].disconnect_time >= 0) {
+                sum += 1;
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            if (conns[i].use_hybrid_transport && conns[i].ht_stream) {
+                int tcp_fd = conns[i].ht_exit_side ? conns[i].target_fd : conns[i].client_fd;
+                if (tcp_fd > 0) {
+                    sum += tcp_fd;
+                    if (conns[i].parked && spill_pending(&info[i].park_buffer) > 0) {
+                        sum += 3;
+                    }
+                }
+                continue;
+            }
+            if (conns[i].client_fd > 0) {
+                sum += conns[i].client_fd;
+                if (conns[i].parked && spill_pending(&info[i].park_buffer) > 0) {
+                    sum += 3;
+                }
+            }
+            if (conns[i].target_fd > 0 &&
+                (conns[i].client_fd > 0 || spill_space(&info[i].park_buffer) > 0)) {
+                sum += conns[i].target_fd;
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            if (conns[i].is_active && now - conns[i].last_activity > SCAN_TIMEOUT) {
+                sum += 7;
+            }
+        }
+        scan_ns += now_ns() - t0;
+        result.checksum += sum;
+    }
+    result.scan_ns_per_session = (double)scan_ns / rounds / count;
+
+    for (int i = 0; i < count; i++) {
+        if (i % 100 < expire_pct) {
+            conns[i].last_activity = now - SCAN_TIMEOUT - 1;
+        }
+    }
+    if (evict_size) {
+        evict(evict_buf, evict_size);
+    }
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < count; i++) {
+        if (now - conns[i].last_activity > SCAN_TIMEOUT) {
+            spill_release(&info[i].park_buffer);
+            for (int j = i; j < count - 1; j++) {
+                conns[j] = conns[j + 1];
+                info[j] = info[j + 1];
+            }
+            count--;
+            i--;
+        }
+    }
+    result.timeout_us = (now_ns() - t0) / 1e3;
+    result.checksum += count;
+
+    for (int i = 0; i < count; i++) {
+        spill_release(&info[i].park_buffer);
+    }
+    free(conns);
+    free(info);
+    return result;
+}
+
+static void print_result(const char* name, size_t hot_bytes, scan_result_t* r, int last) {
+    printf("  \"%s\": {\n", name);
+    printf("    \"scanned_bytes_per_session\": %zu,\n", hot_bytes);
+    printf("    \"scan_ns_per_session\": %.2f,\n", r->scan_ns_per_session);
+    printf("    \"timeout_us\": %.1f,\n", r->timeout_us);
+    printf("    \"checksum\": %lu\n", r->checksum);
+    printf("  }%s\n", last ? "" : ",");
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n sessions  number of sessions (default %d)\n"
+            "  -r rounds    scan rounds (default %d)\n"
+            "  -x percent   sessions timed out in the final pass (default 1)\n"
+            "  -e KiB       touch this much memory between rounds to evict caches (default 0)\n"
+            "  -l           legacy layout only\n"
+            "  -s           split layout only\n",
+            program, SCAN_SESSIONS, SCAN_ROUNDS);
+}
+
+int main(int argc, char* argv[]) {
+    int count = SCAN_SESSIONS;
+    int rounds = SCAN_ROUNDS;
+    int expire_pct = 1;
+    size_t evict_size = 0;
+    int run_old = 1;
+    int run_new = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:x:e:lsh")) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 'x': expire_pct = atoi(optarg); break;
+            case 'e': evict_size = (size_t)atol(optarg) * 1024; break;
+            case 'l': run_new = 0; break;
+            case 's': run_old = 0; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (count <= 0 || rounds <= 0 || expire_pct < 0 || expire_pct > 100 || (!run_old && !run_new)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    spill_set_limits(1024 * 1024, 1024L * 1024 * 1024, 0, "");
+    char* evict_buf = evict_size ? calloc(1, evict_size) : NULL;
+
+    scan_result_t legacy = { 0, 0, 0 };
+    scan_result_t split = { 0, 0, 0 };
+    if (run_old) {
+        legacy = run_legacy(count, rounds, expire_pct, evict_buf, evict_size);
+    }
+    if (run_new) {
+        split = run_split(count, rounds, expire_pct, evict_buf, evict_size);
+    }
+
+    printf("{\n");
+    printf("  \"sessions\": %d,\n", count);
+    printf("  \"rounds\": %d,\n", rounds);
+    printf("  \"expired_percent\": %d,\n", expire_pct);
+    printf("  \"evict_kib\": %zu,\n", evict_size / 1024);
+    if (run_old) {
+        print_result("legacy", sizeof(legacy_pair_t), &legacy, !run_new);
+    }
+    if (run_new) {
+        print_result("split", sizeof(hot_pair_t), &split, 1);
+    }
+    printf("}\n");
+
+    free(evict_buf);
+    return run_old && run_new && legacy.checksum != split.checksum ? 1 : 0;
+}
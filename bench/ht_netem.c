@@ -0,0 +1,623 @@
+// 混合传输链路损伤测试：在同一进程内的两个 ht_connection_t 端点之间插入 UDP 损伤代理，
+// 模拟随机丢包、突发丢包（Gilbert-Elliott）、时延、抖动、乱序和带宽限制，
+// 用于在单机上可重复地比较拥塞控制、RTO 和 ACK 策略的改动
+//
+//   发送端 A --> 代理(A->B 方向损伤) --> 接收端 B
+//   发送端 A <-- 代理(B->A 方向损伤) <-- 接收端 B  (ACK)
+//
+// 多路径（-P）时发送端的各子路径绑定 127.0.0.1、127.0.0.2……，代理按源地址区分路径，
+// 每条路径的两个方向各自施加损伤（-x 单独设置某条路径的丢包和时延）
+//
+// 结果以 JSON 输出：有效吞吐、重传比例、消息交付延迟分布
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "hybrid_transport.h"
+#include "metrics.h"
+
+#define NETEM_QUEUE_CAPACITY 65536
+#define NETEM_MSG_SIZE 1000             // 默认应用消息大小（不超过单个载荷）
+#define NETEM_MSG_MIN 16                // 消息头：发送时间和消息序号
+
+// 单个方向的损伤参数
+typedef struct {
+    double loss;                // 良好状态下的随机丢包率
+    double ge_p;                // Gilbert-Elliott：良好 -> 突发 的转移概率
+    double ge_r;                // Gilbert-Elliott：突发 -> 良好 的转移概率
+    double ge_loss;             // 突发状态下的丢包率
+    int delay_ms;               // 单向时延
+    int jitter_ms;              // 抖动（均匀分布 ±jitter）
+    double reorder;             // 乱序概率（被选中的包额外延迟 reorder_ms）
+    int reorder_ms;
+    double rate_mbps;           // 带宽上限，0表示不限
+    int queue_ms;               // 瓶颈队列长度（按排队时间），超出尾部丢弃
+    int mtu;                    // 链路MTU（UDP数据报上限），更大的包丢弃（端点设置了DF），0表示不限
+} netem_params_t;
+
+// 单个方向的链路状态
+typedef struct {
+    const netem_params_t* params;
+    int in_fd;                  // 代理接收端口
+    int out_fd;                 // 代理发出端口（使对端看到的源地址保持一致）
+    struct sockaddr_in dest;    // 转发目的地址
+    int bad_state;
+    uint64_t link_free_us;      // 瓶颈链路空闲时刻
+    uint64_t packets_in;
+    uint64_t dropped_loss;
+    uint64_t dropped_queue;
+    uint64_t dropped_mtu;
+    uint64_t reordered;
+} netem_link_t;
+
+// 待发出的包（按发出时间排序的最小堆）
+typedef struct {
+    uint64_t release_us;
+    uint64_t order;             // 同一时刻按到达顺序
+    netem_link_t* link;
+    int size;
+    char* data;
+} netem_packet_t;
+
+static netem_packet_t queue[NETEM_QUEUE_CAPACITY];
+static int queue_len = 0;
+static uint64_t queue_order = 0;
+static uint64_t rng_state = 0x853c49e6748fea9bULL;
+
+static netem_params_t params = {
+    .loss = 0.0, .ge_p = 0.0, .ge_r = 1.0, .ge_loss = 1.0,
+    .delay_ms = 20, .jitter_ms = 0, .reorder = 0.0, .reorder_ms = 10,
+    .rate_mbps = 0.0, .queue_ms = 100, .mtu = 0,
+};
+
+// 每条路径的损伤参数：默认同 params，-x 覆盖丢包和时延
+static netem_params_t path_params[HT_MAX_PATHS];
+static double path_loss[HT_MAX_PATHS];
+static int path_delay[HT_MAX_PATHS];
+
+static double random_unit(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+static int packet_before(const netem_packet_t* a, const netem_packet_t* b) {
+    return a->release_us < b->release_us || (a->release_us == b->release_us && a->order < b->order);
+}
+
+static void queue_push(netem_packet_t packet) {
+    int i = queue_len++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!packet_before(&packet, &queue[parent])) {
+            break;
+        }
+        queue[i] = queue[parent];
+        i = parent;
+    }
+    queue[i] = packet;
+}
+
+static netem_packet_t queue_pop(void) {
+    netem_packet_t top = queue[0];
+    netem_packet_t last = queue[--queue_len];
+    int i = 0;
+    for (;;) {
+        int child = i * 2 + 1;
+        if (child >= queue_len) {
+            break;
+        }
+        if (child + 1 < queue_len && packet_before(&queue[child + 1], &queue[child])) {
+            child++;
+        }
+        if (!packet_before(&queue[child], &last)) {
+            break;
+        }
+        queue[i] = queue[child];
+        i = child;
+    }
+    queue[i] = last;
+    return top;
+}
+
+// 对到达代理的包应用损伤模型
+static void netem_ingress(netem_link_t* link, const char* data, int size, uint64_t now) {
+    link->packets_in++;
+
+    const netem_params_t* p = link->params;
+
+    if (p->mtu > 0 && size > p->mtu) {
+        link->dropped_mtu++;
+        return;
+    }
+
+    // Gilbert-Elliott 状态转移
+    if (link->bad_state) {
+        if (random_unit() < p->ge_r) {
+            link->bad_state = 0;
+        }
+    } else if (p->ge_p > 0 && random_unit() < p->ge_p) {
+        link->bad_state = 1;
+    }
+
+    double loss = link->bad_state ? p->ge_loss : p->loss;
+    if (loss > 0 && random_unit() < loss) {
+        link->dropped_loss++;
+        return;
+    }
+
+    // 瓶颈链路：按速率串行发送，排队超过上限则尾部丢弃
+    uint64_t depart = now;
+    if (p->rate_mbps > 0) {
+        if (link->link_free_us > now && link->link_free_us - now > (uint64_t)p->queue_ms * 1000) {
+            link->dropped_queue++;
+            return;
+        }
+        uint64_t start = link->link_free_us > now ? link->link_free_us : now;
+        depart = start + (uint64_t)(size * 8.0 / p->rate_mbps);
+        link->link_free_us = depart;
+    }
+
+    int64_t delay_us = (int64_t)p->delay_ms * 1000;
+    if (p->jitter_ms > 0) {
+        delay_us += (int64_t)((random_unit() * 2.0 - 1.0) * p->jitter_ms * 1000);
+        if (delay_us < 0) {
+            delay_us = 0;
+        }
+    }
+    if (p->reorder > 0 && random_unit() < p->reorder) {
+        delay_us += (int64_t)p->reorder_ms * 1000;
+        link->reordered++;
+    }
+
+    if (queue_len >= NETEM_QUEUE_CAPACITY) {
+        link->dropped_queue++;
+        return;
+    }
+
+    netem_packet_t packet;
+    packet.release_us = depart + delay_us;
+    packet.order = queue_order++;
+    packet.link = link;
+    packet.size = size;
+    packet.data = malloc(size);
+    if (!packet.data) {
+        link->dropped_queue++;
+        return;
+    }
+    memcpy(packet.data, data, size);
+    queue_push(packet);
+}
+
+static int bind_loopback(int fd) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+}
+
+static int local_port(int fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr*)&addr, &len) < 0) {
+        return -1;
+    }
+    return ntohs(addr.sin_port);
+}
+
+static int create_proxy_socket(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0 || bind_loopback(fd) < 0) {
+        perror("proxy socket");
+        exit(1);
+    }
+    int size = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    return fd;
+}
+
+// 发送端连接到代理（ht_connect 发出的SYN经代理到达接收端监听器）；
+// 多路径时第 i 条子路径绑定 127.0.0.(i+1)
+static ht_connection_t* create_sender(int proxy_port, int path_count, int compact_header) {
+    ht_connection_t* conn = ht_create_connection("127.0.0.1", proxy_port, HT_MODE_UDP_ONLY);
+    if (!conn) {
+        perror("sender");
+        exit(1);
+    }
+    conn->compact_header = compact_header;
+    for (int i = 0; i < path_count && path_count > 1; i++) {
+        char local_ip[32];
+        snprintf(local_ip, sizeof(local_ip), "127.0.0.%d", i + 1);
+        ht_add_path(conn, local_ip);
+    }
+    if (ht_connect(conn) < 0 || conn->path_count != path_count) {
+        perror("sender");
+        exit(1);
+    }
+    int size = 4 * 1024 * 1024;
+    for (int i = 0; i < conn->path_count; i++) {
+        setsockopt(conn->paths[i].udp_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    return conn;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -l pct      random loss (default 0)\n"
+            "  -g pct      Gilbert-Elliott good->bad probability (default 0, disabled)\n"
+            "  -G pct      Gilbert-Elliott bad->good probability (default 100)\n"
+            "  -B pct      loss in bad state (default 100)\n"
+            "  -D ms       one-way delay (default 20)\n"
+            "  -j ms       jitter, uniform +/- (default 0)\n"
+            "  -o pct      reorder probability (default 0)\n"
+            "  -O ms       extra delay of reordered packets (default 10)\n"
+            "  -b mbit     bottleneck rate, 0 for unlimited (default 0)\n"
+            "  -q ms       bottleneck queue length (default 100)\n"
+            "  -U bytes    link MTU as max UDP datagram size, larger packets dropped (default 0, unlimited)\n"
+            "  -r mbit     offered application load (default 10)\n"
+            "  -M bytes    application message size, %d-%d (default %d)\n"
+            "  -d seconds  send duration (default 10)\n"
+            "  -w seconds  drain time after sending stops (default 5)\n"
+            "  -S seed     impairment random seed\n"
+            "  -m seconds  rebind the sender's source port at this time (NAT rebinding), 0 to disable\n"
+            "  -P paths    sender UDP subflows bound to 127.0.0.1..127.0.0.N, 1-%d (default 1)\n"
+            "  -x i:pct[:ms]  override loss (and one-way delay) of path i, repeatable\n"
+            "  -u          duplicate interactive packets on the second-best path\n"
+            "  -L          use the full (legacy) packet header instead of negotiating the compact one\n",
+            program, NETEM_MSG_MIN, HT_MAX_PAYLOAD_SIZE, NETEM_MSG_SIZE, HT_MAX_PATHS);
+}
+
+int main(int argc, char* argv[]) {
+    double offered_mbps = 10.0;
+    int duration = 10;
+    int drain = 5;
+    int migrate_after = 0;
+    int msg_size = NETEM_MSG_SIZE;
+    int path_count = 1;
+    int duplicate = 0;
+    int compact_header = 1;
+
+    for (int i = 0; i < HT_MAX_PATHS; i++) {
+        path_loss[i] = -1.0;
+        path_delay[i] = -1;
+    }
+
+    int opt;
+    while ((opt = getopt(argc, argv, "l:g:G:B:D:j:o:O:b:q:U:r:M:d:w:S:m:P:x:uLh")) != -1) {
+        switch (opt) {
+            case 'l': params.loss = atof(optarg) / 100.0; break;
+            case 'g': params.ge_p = atof(optarg) / 100.0; break;
+            case 'G': params.ge_r = atof(optarg) / 100.0; break;
+            case 'B': params.ge_loss = atof(optarg) / 100.0; break;
+            case 'D': params.delay_ms = atoi(optarg); break;
+            case 'j': params.jitter_ms = atoi(optarg); break;
+            case 'o': params.reorder = atof(optarg) / 100.0; break;
+            case 'O': params.reorder_ms = atoi(optarg); break;
+            case 'b': params.rate_mbps = atof(optarg); break;
+            case 'q': params.queue_ms = atoi(optarg); break;
+            case 'U': params.mtu = atoi(optarg); break;
+            case 'r': offered_mbps = atof(optarg); break;
+            case 'M': msg_size = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            case 'w': drain = atoi(optarg); break;
+            case 'S': rng_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'm': migrate_after = atoi(optarg); break;
+            case 'P': path_count = atoi(optarg); break;
+            case 'x': {
+                int index, delay = -1;
+                double loss;
+                if (sscanf(optarg, "%d:%lf:%d", &index, &loss, &delay) < 2 ||
+                    index < 0 || index >= HT_MAX_PATHS) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                path_loss[index] = loss / 100.0;
+                path_delay[index] = delay;
+                break;
+            }
+            case 'u': duplicate = 1; break;
+            case 'L': compact_header = 0; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (offered_mbps <= 0 || duration <= 0 || drain < 0 || path_count < 1 || path_count > HT_MAX_PATHS ||
+        msg_size < NETEM_MSG_MIN || msg_size > HT_MAX_PAYLOAD_SIZE) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ht_init();
+
+    // 代理：发送端的所有子路径发往同一个入口，按源地址区分路径；
+    // 每条路径的回程从各自的端口发出，接收端看到的是不同的对端地址
+    int entry_fd = create_proxy_socket();
+    netem_link_t forward[HT_MAX_PATHS], reverse[HT_MAX_PATHS];
+    memset(forward, 0, sizeof(forward));
+    memset(reverse, 0, sizeof(reverse));
+    for (int i = 0; i < path_count; i++) {
+        path_params[i] = params;
+        if (path_loss[i] >= 0) {
+            path_params[i].loss = path_loss[i];
+        }
+        if (path_delay[i] >= 0) {
+            path_params[i].delay_ms = path_delay[i];
+        }
+        forward[i].params = &path_params[i];
+        reverse[i].params = &path_params[i];
+        forward[i].in_fd = entry_fd;
+        reverse[i].in_fd = create_proxy_socket();
+        forward[i].out_fd = reverse[i].in_fd;
+        reverse[i].out_fd = entry_fd;
+    }
+
+    // 接收端是服务端监听器，连接在握手完成后由 ht_accept 取出
+    ht_listener_t* listener = ht_listen("127.0.0.1", 0);
+    if (!listener) {
+        fprintf(stderr, "listener failed\n");
+        return 1;
+    }
+    ht_connection_t* sender = create_sender(local_port(entry_fd), path_count, compact_header);
+    ht_connection_t* receiver = NULL;
+    sender->duplicate_interactive = duplicate;
+
+    // 回程目的地址在收到该路径的第一个包时记下
+    for (int i = 0; i < path_count; i++) {
+        forward[i].dest.sin_family = AF_INET;
+        forward[i].dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        forward[i].dest.sin_port = htons(local_port(listener->udp_fd));
+        reverse[i].dest.sin_family = AF_INET;
+    }
+
+    metrics_histogram_t latency;
+    memset(&latency, 0, sizeof(latency));
+
+    uint64_t interval_us = (uint64_t)(msg_size * 8.0 / offered_mbps);
+    if (interval_us == 0) {
+        interval_us = 1;
+    }
+
+    uint64_t start = metrics_now_us();
+    uint64_t send_deadline = start + (uint64_t)duration * 1000000ULL;
+    uint64_t drain_deadline = send_deadline + (uint64_t)drain * 1000000ULL;
+    uint64_t next_send = start;
+    uint64_t messages_sent = 0;
+    uint64_t messages_delivered = 0;
+    uint64_t out_of_order = 0;
+    uint64_t last_delivery_us = start;
+    uint64_t max_delivery_gap_us = 0;
+    uint64_t migrate_at = migrate_after > 0 ? start + (uint64_t)migrate_after * 1000000ULL : 0;
+
+    static char stream[1 << 20];
+    size_t stream_len = 0;
+    char packet[HT_MAX_PACKET_SIZE + 64];
+    char message[HT_MAX_PAYLOAD_SIZE];
+    memset(message, 0x5A, sizeof(message));
+
+    for (;;) {
+        uint64_t now = metrics_now_us();
+        if (now >= drain_deadline || (now >= send_deadline && messages_delivered == messages_sent)) {
+            break;
+        }
+
+        // 应用按固定速率写入消息：[发送时间][消息序号][填充]
+        while (now < send_deadline && next_send <= now) {
+            uint64_t stamp = metrics_now_us();
+            memcpy(message, &stamp, sizeof(stamp));
+            memcpy(message + sizeof(stamp), &messages_sent, sizeof(messages_sent));
+            if (ht_send_data(sender, message, msg_size) != msg_size) {
+                break;
+            }
+            messages_sent++;
+            next_send += interval_us;
+        }
+
+        // 模拟NAT重绑定：发送端（第一条路径）的包改从新端口发出，旧端口不再转发回程包
+        if (migrate_at && now >= migrate_at) {
+            int fresh = create_proxy_socket();
+            if (fresh >= 0) {
+                close(reverse[0].in_fd);
+                reverse[0].in_fd = fresh;
+                forward[0].out_fd = fresh;
+            }
+            migrate_at = 0;
+        }
+
+        // 代理收包并施加损伤
+        ssize_t n;
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        while ((n = recvfrom(entry_fd, packet, sizeof(packet), 0, (struct sockaddr*)&from, &from_len)) > 0) {
+            int index = path_count > 1 ? (int)(ntohl(from.sin_addr.s_addr) & 0xFF) - 1 : 0;
+            from_len = sizeof(from);
+            if (index < 0 || index >= path_count) {
+                continue;
+            }
+            reverse[index].dest = from;
+            netem_ingress(&forward[index], packet, (int)n, now);
+        }
+        for (int i = 0; i < path_count; i++) {
+            while ((n = recv(reverse[i].in_fd, packet, sizeof(packet), 0)) > 0) {
+                netem_ingress(&reverse[i], packet, (int)n, now);
+            }
+        }
+
+        // 发出到期的包
+        while (queue_len > 0 && queue[0].release_us <= now) {
+            netem_packet_t due = queue_pop();
+            sendto(due.link->out_fd, due.data, due.size, 0,
+                   (struct sockaddr*)&due.link->dest, sizeof(due.link->dest));
+            free(due.data);
+        }
+
+        // 端点协议处理
+        ht_process_events(sender);
+        ht_handle_timeout(sender);
+        ht_listener_process(listener);
+        if (!receiver) {
+            receiver = ht_accept(listener);
+        }
+        if (receiver) {
+            ht_handle_timeout(receiver);
+            int received;
+            while ((received = ht_recv_data(receiver, stream + stream_len, sizeof(stream) - stream_len)) > 0) {
+                stream_len += received;
+            }
+        }
+
+        // 解析按序交付的消息
+        size_t offset = 0;
+        uint64_t delivered_at = metrics_now_us();
+        while (stream_len - offset >= (size_t)msg_size) {
+            uint64_t stamp, index;
+            memcpy(&stamp, stream + offset, sizeof(stamp));
+            memcpy(&index, stream + offset + sizeof(stamp), sizeof(index));
+            if (index != messages_delivered) {
+                out_of_order++;
+            }
+            metrics_hist_record(&latency, delivered_at - stamp);
+            if (messages_delivered > 0 && delivered_at < send_deadline &&
+                delivered_at - last_delivery_us > max_delivery_gap_us) {
+                max_delivery_gap_us = delivered_at - last_delivery_us;
+            }
+            messages_delivered++;
+            last_delivery_us = delivered_at;
+            offset += msg_size;
+        }
+        if (offset > 0) {
+            memmove(stream, stream + offset, stream_len - offset);
+            stream_len -= offset;
+        }
+
+        // 等待下一个事件：收包、包到期或应用发送时刻
+        uint64_t wake = now + 1000;
+        if (queue_len > 0 && queue[0].release_us < wake) {
+            wake = queue[0].release_us;
+        }
+        if (now < send_deadline && next_send < wake) {
+            wake = next_send;
+        }
+        now = metrics_now_us();
+        int timeout_ms = wake > now ? (int)((wake - now + 999) / 1000) : 0;
+
+        struct pollfd fds[2 * HT_MAX_PATHS + 3];
+        int fd_count = 0;
+        int sender_fds[HT_MAX_PATHS + 1];
+        int sender_fd_count = ht_connection_fds(sender, sender_fds, HT_MAX_PATHS + 1);
+        fds[fd_count++] = (struct pollfd){ entry_fd, POLLIN, 0 };
+        fds[fd_count++] = (struct pollfd){ listener->udp_fd, POLLIN, 0 };
+        for (int i = 0; i < path_count; i++) {
+            fds[fd_count++] = (struct pollfd){ reverse[i].in_fd, POLLIN, 0 };
+        }
+        for (int i = 0; i < sender_fd_count; i++) {
+            fds[fd_count++] = (struct pollfd){ sender_fds[i], POLLIN, 0 };
+        }
+        poll(fds, fd_count, timeout_ms);
+    }
+
+    double elapsed = (last_delivery_us - start) / 1e6;
+    ht_connection_stats_t sender_stats, receiver_stats;
+    ht_get_stats(sender, &sender_stats);
+    memset(&receiver_stats, 0, sizeof(receiver_stats));
+    if (receiver) {
+        ht_get_stats(receiver, &receiver_stats);
+    }
+    uint64_t data_packets = sender_stats.packets_sent - sender_stats.packets_retransmitted;
+
+    netem_link_t forward_total, reverse_total;
+    memset(&forward_total, 0, sizeof(forward_total));
+    memset(&reverse_total, 0, sizeof(reverse_total));
+    for (int i = 0; i < path_count; i++) {
+        forward_total.packets_in += forward[i].packets_in;
+        forward_total.dropped_loss += forward[i].dropped_loss;
+        forward_total.dropped_queue += forward[i].dropped_queue;
+        forward_total.dropped_mtu += forward[i].dropped_mtu;
+        reverse_total.packets_in += reverse[i].packets_in;
+        reverse_total.dropped_loss += reverse[i].dropped_loss;
+        reverse_total.dropped_queue += reverse[i].dropped_queue;
+    }
+
+    printf("{\n");
+    printf("  \"impairment\": {\"loss\": %.4f, \"ge_p\": %.4f, \"ge_r\": %.4f, \"ge_loss\": %.4f, "
+           "\"delay_ms\": %d, \"jitter_ms\": %d, \"reorder\": %.4f, \"reorder_ms\": %d, "
+           "\"rate_mbps\": %.2f, \"queue_ms\": %d, \"mtu\": %d},\n",
+           params.loss, params.ge_p, params.ge_r, params.ge_loss, params.delay_ms, params.jitter_ms,
+           params.reorder, params.reorder_ms, params.rate_mbps, params.queue_ms, params.mtu);
+    printf("  \"offered_mbps\": %.2f,\n", offered_mbps);
+    printf("  \"message_size\": %d,\n", msg_size);
+    printf("  \"messages_sent\": %llu,\n", (unsigned long long)messages_sent);
+    printf("  \"messages_delivered\": %llu,\n", (unsigned long long)messages_delivered);
+    printf("  \"out_of_order\": %llu,\n", (unsigned long long)out_of_order);
+    printf("  \"goodput_mbps\": %.3f,\n",
+           elapsed > 0 ? messages_delivered * msg_size * 8.0 / elapsed / 1e6 : 0.0);
+    printf("  \"retransmit_ratio\": %.4f,\n",
+           data_packets ? (double)sender_stats.packets_retransmitted / data_packets : 0.0);
+    printf("  \"packets_given_up\": %llu,\n", (unsigned long long)sender_stats.packets_lost);
+    printf("  \"duplicates_received\": %llu,\n", (unsigned long long)receiver_stats.packets_duplicated);
+    printf("  \"rtt_avg_ms\": %u,\n", sender_stats.rtt_avg);
+    printf("  \"path_migrations\": %llu,\n", (unsigned long long)receiver_stats.path_migrations);
+    printf("  \"max_delivery_gap_us\": %llu,\n", (unsigned long long)max_delivery_gap_us);
+    printf("  \"link\": {\"forward_in\": %llu, \"forward_lost\": %llu, \"forward_queue_drops\": %llu, "
+           "\"forward_mtu_drops\": %llu, \"reverse_in\": %llu, \"reverse_lost\": %llu, \"reverse_queue_drops\": %llu},\n",
+           (unsigned long long)forward_total.packets_in, (unsigned long long)forward_total.dropped_loss,
+           (unsigned long long)forward_total.dropped_queue, (unsigned long long)forward_total.dropped_mtu,
+           (unsigned long long)reverse_total.packets_in,
+           (unsigned long long)reverse_total.dropped_loss, (unsigned long long)reverse_total.dropped_queue);
+    printf("  \"udp_ratio\": %.4f,\n", sender_stats.udp_ratio);
+    printf("  \"loss_rate_2s\": %.4f,\n", sender_stats.packet_loss_rate);
+    ht_path_stats_t sender_paths[HT_MAX_PATHS + 1];
+    int sender_path_count = ht_get_path_stats(sender, sender_paths, HT_MAX_PATHS + 1);
+    uint64_t sent_data_packets = 0;
+    for (int i = 0; i < sender_path_count; i++) {
+        sent_data_packets += sender_paths[i].counters.data_packets;
+    }
+    double delivered_mib = messages_delivered * (double)msg_size / (1024.0 * 1024.0);
+    printf("  \"data_packets_per_mib\": %.1f,\n", delivered_mib > 0 ? sent_data_packets / delivered_mib : 0.0);
+    printf("  \"compact_header\": %d,\n", sender->compact_tx);
+    printf("  \"wire_bytes_per_message\": %.1f,\n", messages_delivered ?
+           (double)(sender_stats.bytes_sent + receiver_stats.bytes_sent) / messages_delivered : 0.0);
+    printf("  \"paths\": [");
+    for (int i = 0; i < path_count; i++) {
+        const ht_path_stats_t* path = i + 1 < sender_path_count ? &sender_paths[i + 1] : NULL;
+        printf("%s{\"loss\": %.4f, \"delay_ms\": %d, \"forward_in\": %llu, \"forward_lost\": %llu, "
+               "\"reverse_in\": %llu, \"reverse_lost\": %llu, \"sent\": %llu, \"lost\": %llu, \"srtt_ms\": %u, \"loss_estimate\": %.4f, \"mtu\": %u}",
+               i ? ", " : "", path_params[i].loss, path_params[i].delay_ms,
+               (unsigned long long)forward[i].packets_in, (unsigned long long)forward[i].dropped_loss,
+               (unsigned long long)reverse[i].packets_in, (unsigned long long)reverse[i].dropped_loss,
+               (unsigned long long)(path ? path->counters.data_packets : 0),
+               (unsigned long long)(path ? path->counters.packets_lost : 0),
+               path ? path->srtt : 0, path ? path->loss_rate : 0.0f, path ? path->mtu : 0);
+    }
+    printf("],\n");
+    printf("  \"delivery_latency\": {\"count\": %llu, \"mean_us\": %.1f, \"p50_us\": %llu, \"p90_us\": %llu, "
+           "\"p99_us\": %llu, \"p999_us\": %llu, \"max_us\": %llu}\n",
+           (unsigned long long)latency.count, latency.count ? (double)latency.sum_us / latency.count : 0.0,
+           (unsigned long long)metrics_hist_quantile(&latency, 0.50),
+           (unsigned long long)metrics_hist_quantile(&latency, 0.90),
+           (unsigned long long)metrics_hist_quantile(&latency, 0.99),
+           (unsigned long long)metrics_hist_quantile(&latency, 0.999),
+           (unsigned long long)latency.max_us);
+    printf("}\n");
+
+    while (queue_len > 0) {
+        free(queue_pop().data);
+    }
+    ht_destroy_connection(sender);
+    ht_destroy_connection(receiver);
+    ht_listener_close(listener);
+    close(entry_fd);
+    for (int i = 0; i < path_count; i++) {
+        close(reverse[i].in_fd);
+    }
+    return messages_delivered == messages_sent ? 0 : 2;
+}
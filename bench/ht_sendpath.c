@@ -0,0 +1,184 @@
+// 混合传输发送路径微基准：同一进程内用 socketpair 连接两个 TCP_ONLY 模式的 ht_connection_t，
+// 不经过网络和握手，只测量发送端组包、发送、处理确认的CPU开销
+//
+//   发送端 A --socketpair--> 接收端 B
+//
+// 每发一条消息，接收端立即收完并确认，发送端随后处理确认，发送缓冲区不会堆积。
+// -s 时经流复用层（ht_stream_send）发送，否则直接调用 ht_send_data。
+// 结果以 JSON 输出：发送端每条消息的耗时和吞吐（只计发送端调用，不含接收端）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include "hybrid_transport.h"
+#include "ht_mux.h"
+
+#define SENDPATH_MSG_SIZE 1200          // 默认消息大小
+#define SENDPATH_COUNT 200000           // 默认消息数
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 把 socketpair 的一端装成已完成握手的连接，两端共用连接ID，序列号互相对齐
+static ht_connection_t* attach(int fd, int compact_header) {
+    ht_connection_t* conn = ht_create_connection("127.0.0.1", 9, HT_MODE_TCP_ONLY);
+    if (!conn) {
+        return NULL;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    conn->tcp_fd = fd;
+    conn->is_connected = 1;
+    conn->handshake_complete = 1;
+    conn->compact_tx = compact_header;
+    return conn;
+}
+
+static void pair_up(ht_connection_t* a, ht_connection_t* b) {
+    b->conn_id = a->conn_id;
+    a->recv_sequence = b->send_sequence;
+    b->recv_sequence = a->send_sequence;
+    a->ack_sequence = a->recv_sequence;
+    b->ack_sequence = b->recv_sequence;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -M bytes    message size, 1-%d (default %d)\n"
+            "  -n count    messages to send (default %d)\n"
+            "  -s          send through a mux stream instead of ht_send_data\n"
+            "  -L          use the full (legacy) packet header\n",
+            program, HT_MAX_PAYLOAD_SIZE, SENDPATH_MSG_SIZE, SENDPATH_COUNT);
+}
+
+int main(int argc, char* argv[]) {
+    int msg_size = SENDPATH_MSG_SIZE;
+    long count = SENDPATH_COUNT;
+    int use_stream = 0;
+    int compact_header = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "M:n:sLh")) != -1) {
+        switch (opt) {
+            case 'M': msg_size = atoi(optarg); break;
+            case 'n': count = atol(optarg); break;
+            case 's': use_stream = 1; break;
+            case 'L': compact_header = 0; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (msg_size < 1 || msg_size > HT_MAX_PAYLOAD_SIZE || count <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+    ht_connection_t* sender = attach(sv[0], compact_header);
+    ht_connection_t* receiver = attach(sv[1], compact_header);
+    if (!sender || !receiver) {
+        fprintf(stderr, "failed to create connections\n");
+        return 1;
+    }
+    pair_up(sender, receiver);
+
+    ht_mux_t* sender_mux = NULL;
+    ht_mux_t* receiver_mux = NULL;
+    ht_stream_t* tx_stream = NULL;
+    ht_stream_t* rx_stream = NULL;
+    if (use_stream) {
+        sender_mux = ht_mux_create(sender, 1);
+        receiver_mux = ht_mux_create(receiver, 0);
+        tx_stream = sender_mux ? ht_mux_open_stream(sender_mux) : NULL;
+        if (!tx_stream) {
+            fprintf(stderr, "failed to open stream\n");
+            return 1;
+        }
+    }
+
+    uint8_t* message = malloc(msg_size);
+    uint8_t* buffer = malloc(HT_MAX_PAYLOAD_SIZE);
+    for (int i = 0; i < msg_size; i++) {
+        message[i] = (uint8_t)(i * 31);
+    }
+
+    uint64_t sender_ns = 0;
+    uint64_t received = 0;
+    uint64_t start = now_ns();
+
+    for (long i = 0; i < count; i++) {
+        uint64_t t0 = now_ns();
+        int sent = use_stream ? ht_stream_send(tx_stream, message, msg_size) :
+                                ht_send_data(sender, message, msg_size);
+        sender_ns += now_ns() - t0;
+        if (sent != msg_size) {
+            fprintf(stderr, "send failed at message %ld (%d)\n", i, sent);
+            return 1;
+        }
+
+        // 接收端收完并确认
+        int n;
+        if (use_stream) {
+            ht_mux_process(receiver_mux);
+            if (!rx_stream) {
+                rx_stream = ht_mux_accept_stream(receiver_mux);
+            }
+            while (rx_stream && (n = ht_stream_recv(rx_stream, buffer, HT_MAX_PAYLOAD_SIZE)) > 0) {
+                received += n;
+            }
+        } else {
+            ht_process_events(receiver);
+            while ((n = ht_recv_data(receiver, buffer, HT_MAX_PAYLOAD_SIZE)) > 0) {
+                received += n;
+            }
+        }
+
+        // 发送端处理确认
+        t0 = now_ns();
+        if (use_stream) {
+            ht_mux_process(sender_mux);
+        } else {
+            ht_process_events(sender);
+        }
+        sender_ns += now_ns() - t0;
+    }
+
+    double elapsed = (now_ns() - start) / 1e9;
+    ht_connection_stats_t stats;
+    ht_get_stats(sender, &stats);
+
+    printf("{\n");
+    printf("  \"path\": \"%s\",\n", use_stream ? "stream" : "send_data");
+    printf("  \"message_size\": %d,\n", msg_size);
+    printf("  \"messages\": %ld,\n", count);
+    printf("  \"compact_header\": %d,\n", sender->compact_tx);
+    printf("  \"bytes_received\": %llu,\n", (unsigned long long)received);
+    printf("  \"packets_sent\": %llu,\n", (unsigned long long)stats.packets_sent);
+    printf("  \"sender_ns_per_message\": %.1f,\n", (double)sender_ns / count);
+    printf("  \"sender_mb_per_s\": %.1f,\n", sender_ns ? (double)msg_size * count * 1e3 / sender_ns : 0.0);
+    printf("  \"elapsed_s\": %.3f\n", elapsed);
+    printf("}\n");
+
+    free(message);
+    free(buffer);
+    if (use_stream) {
+        ht_mux_destroy(sender_mux);
+        ht_mux_destroy(receiver_mux);
+    } else {
+        ht_destroy_connection(sender);
+        ht_destroy_connection(receiver);
+    }
+    return received == (uint64_t)msg_size * count ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# 重连风暴基准：启动模拟目标和转发器，先建立若干会话，再让大量客户端同时重连，输出 JSON 结果
+# 参数可通过环境变量调整：
+#   CLIENTS ESTABLISHED TIMEOUT
+#   LISTEN_BACKLOG ACCEPT_BATCH DEFER_ACCEPT（写入转发器配置，便于对比，留空使用默认值）
+#   FORWARDER（被测程序，默认 ./rdp_forwarder）OUTPUT（结果文件，默认 bench_storm_output.json）
+
+cd "$(dirname "$0")/.."
+
+FORWARDER=${FORWARDER:-./rdp_forwarder}
+OUTPUT=${OUTPUT:-bench_storm_output.json}
+LISTEN_PORT=${LISTEN_PORT:-15910}
+TARGET_PORT=${TARGET_PORT:-15911}
+CLIENTS=${CLIENTS:-500}
+ESTABLISHED=${ESTABLISHED:-4}
+
+for bin in "$FORWARDER" bench/bench_target bench/accept_storm; do
+    if [ ! -x "$bin" ]; then
+        echo "错误: $bin 不存在，请先运行 make bench/accept_storm bench/bench_target" >&2
+        exit 1
+    fi
+done
+
+CONF=$(mktemp /tmp/rdp_storm.XXXXXX.conf)
+cat > "$CONF" << CONF_EOF
+target_ip=127.0.0.1
+target_port=$TARGET_PORT
+listen_port=$LISTEN_PORT
+max_clients=$((CLIENTS + ESTABLISHED + 8))
+verbose_logging=0
+enable_stats=0
+enable_fast_reconnect=0
+transport_mode=tcp
+log_file=/dev/null
+CONF_EOF
+[ -n "$LISTEN_BACKLOG" ] && echo "listen_backlog=$LISTEN_BACKLOG" >> "$CONF"
+[ -n "$ACCEPT_BATCH" ] && echo "accept_batch=$ACCEPT_BATCH" >> "$CONF"
+[ -n "$DEFER_ACCEPT" ] && echo "listen_defer_accept=$DEFER_ACCEPT" >> "$CONF"
+
+bench/bench_target $TARGET_PORT &
+TARGET_PID=$!
+"$FORWARDER" -c "$CONF" > /dev/null 2>&1 &
+FORWARDER_PID=$!
+sleep 0.5
+
+cleanup() {
+    kill $FORWARDER_PID $TARGET_PID 2>/dev/null
+    wait $FORWARDER_PID $TARGET_PID 2>/dev/null
+    rm -f "$CONF"
+}
+trap cleanup EXIT
+
+if ! kill -0 $FORWARDER_PID 2>/dev/null; then
+    echo "错误: 转发器启动失败" >&2
+    exit 1
+fi
+
+bench/accept_storm -p $LISTEN_PORT -n $CLIENTS -e $ESTABLISHED -T ${TIMEOUT:-30} > "$OUTPUT"
+STATUS=$?
+
+cat "$OUTPUT"
+exit $STATUS
@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# 回环基准测试：启动模拟目标和转发器，运行负载生成器，输出 JSON 结果
+# 参数可通过环境变量调整：
+#   SESSIONS IDLE_SESSIONS DURATION BITMAP_SIZE BITMAP_INTERVAL THINK_MS CHURN_SECONDS
+#   FORWARDER（被测程序，默认 ./rdp_forwarder）OUTPUT（结果文件，默认 bench_output.json）
+
+cd "$(dirname "$0")/.."
+
+FORWARDER=${FORWARDER:-./rdp_forwarder}
+OUTPUT=${OUTPUT:-bench_output.json}
+LISTEN_PORT=${LISTEN_PORT:-15900}
+TARGET_PORT=${TARGET_PORT:-15901}
+SESSIONS=${SESSIONS:-50}
+IDLE_SESSIONS=${IDLE_SESSIONS:-100}
+
+for bin in "$FORWARDER" bench/bench_target bench/bench_load; do
+    if [ ! -x "$bin" ]; then
+        echo "错误: $bin 不存在，请先运行 make bench" >&2
+        exit 1
+    fi
+done
+
+CONF=$(mktemp /tmp/rdp_bench.XXXXXX.conf)
+cat > "$CONF" << CONF_EOF
+target_ip=127.0.0.1
+target_port=$TARGET_PORT
+listen_port=$LISTEN_PORT
+listen_interface=127.0.0.1
+max_clients=$((SESSIONS + IDLE_SESSIONS + 64))
+verbose_logging=0
+enable_stats=0
+enable_fast_reconnect=0
+transport_mode=tcp
+CONF_EOF
+
+bench/bench_target $TARGET_PORT &
+TARGET_PID=$!
+"$FORWARDER" -c "$CONF" > /dev/null 2>&1 &
+FORWARDER_PID=$!
+sleep 0.5
+
+cleanup() {
+    kill $FORWARDER_PID $TARGET_PID 2>/dev/null
+    wait $FORWARDER_PID $TARGET_PID 2>/dev/null
+    rm -f "$CONF"
+}
+trap cleanup EXIT
+
+if ! kill -0 $FORWARDER_PID 2>/dev/null; then
+    echo "错误: 转发器启动失败" >&2
+    exit 1
+fi
+
+bench/bench_load -p $LISTEN_PORT -P $FORWARDER_PID \
+    -s $SESSIONS -i $IDLE_SESSIONS \
+    -d ${DURATION:-10} -b ${BITMAP_SIZE:-262144} -I ${BITMAP_INTERVAL:-100} \
+    -t ${THINK_MS:-5} -c ${CHURN_SECONDS:-3} > "$OUTPUT"
+STATUS=$?
+
+cat "$OUTPUT"
+exit $STATUS
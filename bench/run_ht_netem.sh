@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# 混合传输链路损伤测试：依次运行一组典型链路场景，结果汇总为 JSON 数组
+# 环境变量：DURATION（每个场景发送时长，默认5秒）RATE（应用负载 Mbit/s，默认10）
+#           SEED（随机种子）OUTPUT（结果文件，默认 bench_ht_output.json）
+
+cd "$(dirname "$0")/.."
+
+OUTPUT=${OUTPUT:-bench_ht_output.json}
+COMMON="-d ${DURATION:-5} -r ${RATE:-10} -S ${SEED:-1}"
+
+if [ ! -x bench/ht_netem ]; then
+    echo "错误: bench/ht_netem 不存在，请先运行 make bench-ht" >&2
+    exit 1
+fi
+
+# 场景名称和参数
+SCENARIOS=(
+    "clean|-D 20"
+    "random_loss_1pct|-D 20 -l 1"
+    "random_loss_5pct|-D 20 -l 5"
+    "burst_loss|-D 20 -g 1 -G 30 -B 80"
+    "jitter_reorder|-D 30 -j 10 -o 2 -O 15"
+    "bottleneck_8mbit|-D 20 -b 8 -q 50"
+    "lossy_wan|-D 60 -j 5 -l 2 -b 20 -q 100"
+    "nat_rebinding|-D 40 -m 2"
+    "multipath_stripe|-D 20 -P 2 -x 1:0:40"
+    "multipath_lossy_uplink|-D 20 -P 2 -x 1:10"
+    "multipath_interactive_dup|-D 20 -l 5 -P 2 -M 64 -r 0.2 -u"
+    "mtu_1400_large_msgs|-D 20 -M 8000 -r 40 -U 1400"
+    "mtu_jumbo_large_msgs|-D 20 -M 8000 -r 40"
+    "interactive_compact_header|-D 20 -M 16 -r 0.05 -U 1500"
+    "interactive_full_header|-D 20 -M 16 -r 0.05 -U 1500 -L"
+)
+
+STATUS=0
+echo "[" > "$OUTPUT"
+for i in "${!SCENARIOS[@]}"; do
+    NAME=${SCENARIOS[$i]%%|*}
+    ARGS=${SCENARIOS[$i]#*|}
+    echo "运行场景: $NAME ($ARGS)" >&2
+    RESULT=$(bench/ht_netem $COMMON $ARGS)
+    [ $? -ne 0 ] && STATUS=2
+    SEP=","
+    [ $i -eq $((${#SCENARIOS[@]} - 1)) ] && SEP=""
+    printf '{"scenario": "%s", "result": %s}%s\n' "$NAME" "$RESULT" "$SEP" >> "$OUTPUT"
+done
+echo "]" >> "$OUTPUT"
+
+cat "$OUTPUT"
+exit $STATUS
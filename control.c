@@ -0,0 +1,103 @@
+#include "control.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// 创建控制 socket，仅 root 可访问
+int control_create_listener(const char* path) {
+    struct sockaddr_un addr;
+    if (!path || strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("control socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // 清理上次异常退出残留的 socket 文件
+    unlink(path);
+
+    mode_t old_mask = umask(0077);
+    int result = bind(sockfd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if (result < 0) {
+        perror("control bind");
+        close(sockfd);
+        return -1;
+    }
+
+    if (listen(sockfd, 4) < 0) {
+        perror("control listen");
+        close(sockfd);
+        unlink(path);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+void control_close_listener(int listen_fd, const char* path) {
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        if (path) {
+            unlink(path);
+        }
+    }
+}
+
+int control_accept_command(int listen_fd, char* command, size_t size) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // 控制端在本机，设置较短超时避免阻塞主循环
+    struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    size_t len = 0;
+    while (len < size - 1) {
+        ssize_t n = recv(fd, command + len, 1, 0);
+        if (n <= 0 || command[len] == '\n') {
+            break;
+        }
+        len++;
+    }
+    command[len] = '\0';
+
+    // 去掉行尾空白
+    while (len > 0 && (command[len - 1] == '\r' || command[len - 1] == ' ' || command[len - 1] == '\t')) {
+        command[--len] = '\0';
+    }
+
+    return fd;
+}
+
+void control_reply(int fd, const char* format, ...) {
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (len < 0) {
+        return;
+    }
+    if (len >= (int)sizeof(message)) {
+        len = sizeof(message) - 1;
+    }
+    send(fd, message, len, MSG_NOSIGNAL);
+}
@@ -0,0 +1,19 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stddef.h>
+
+// 本机控制 socket（Unix 域），每个连接发送一行命令，例如 "reload"、"status"
+
+#define CONTROL_MAX_COMMAND 128
+
+int control_create_listener(const char* path);
+void control_close_listener(int listen_fd, const char* path);
+
+// 接受一个控制连接并读取一行命令；成功返回客户端 fd，命令写入 command
+int control_accept_command(int listen_fd, char* command, size_t size);
+
+// 向控制连接写入应答
+void control_reply(int fd, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif // CONTROL_H
@@ -0,0 +1,163 @@
+#include "handover.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int handover_send(int sock, const void* record, size_t size, const int* fds, int fd_count) {
+    struct iovec iov;
+    iov.iov_base = (void*)record;
+    iov.iov_len = size;
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd_count > 0) {
+        if (fd_count > HANDOVER_MAX_FDS) {
+            return -1;
+        }
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0 || (size_t)sent != size) {
+        return -1;
+    }
+    return 0;
+}
+
+int handover_recv(int sock, void* record, size_t size, int* fds, int max_fds) {
+    struct iovec iov;
+    iov.iov_base = record;
+    iov.iov_len = size;
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t received;
+    do {
+        received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    } while (received < 0 && errno == EINTR);
+
+    if (received < 0 || (size_t)received != size) {
+        return -1;
+    }
+
+    int fd_count = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* received_fds = (int*)CMSG_DATA(cmsg);
+        for (int i = 0; i < count; i++) {
+            if (fd_count < max_fds) {
+                fds[fd_count++] = received_fds[i];
+            } else {
+                close(received_fds[i]);
+            }
+        }
+    }
+
+    return fd_count;
+}
+
+int handover_send_all(int sock, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    size_t sent = 0;
+
+    while (sent < size) {
+        ssize_t result = send(sock, bytes + sent, size - sent, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { sock, POLLOUT, 0 };
+                poll(&pfd, 1, 1000);
+                continue;
+            }
+            return -1;
+        }
+        sent += result;
+    }
+    return 0;
+}
+
+int handover_recv_all(int sock, void* data, size_t size) {
+    char* bytes = (char*)data;
+    size_t received = 0;
+
+    while (received < size) {
+        ssize_t result = recv(sock, bytes + received, size - received, 0);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return -1;
+        }
+        received += result;
+    }
+    return 0;
+}
+
+int handover_connect(const char* control_path) {
+    struct sockaddr_un addr;
+    if (!control_path || strlen(control_path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, control_path);
+
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    const char* command = "handover\n";
+    if (handover_send_all(sock, command, strlen(command)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
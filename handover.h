@@ -0,0 +1,32 @@
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 热升级交接：旧进程通过 Unix socket（SCM_RIGHTS）把监听 socket 和会话 fd 连同状态记录交给新进程
+
+#define HANDOVER_MAGIC 0x52445048      // "RDPH"
+#define HANDOVER_VERSION 2
+#define HANDOVER_MAX_FDS 4
+
+typedef enum {
+    HANDOVER_RECORD_LISTENER = 1,   // 监听 socket 和全局统计
+    HANDOVER_RECORD_SESSION = 2,    // 单个会话（后跟 parked_bytes 字节的暂存数据）
+    HANDOVER_RECORD_END = 3         // 交接结束
+} handover_record_type_t;
+
+// 发送一条记录并附带 fd
+int handover_send(int sock, const void* record, size_t size, const int* fds, int fd_count);
+
+// 接收一条定长记录和附带的 fd；返回收到的 fd 数，出错返回 -1
+int handover_recv(int sock, void* record, size_t size, int* fds, int max_fds);
+
+// 阻塞发送/接收完整数据（用于暂存数据）
+int handover_send_all(int sock, const void* data, size_t size);
+int handover_recv_all(int sock, void* data, size_t size);
+
+// 连接旧进程的控制 socket 并发起交接
+int handover_connect(const char* control_path);
+
+#endif // HANDOVER_H
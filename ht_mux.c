@@ -0,0 +1,501 @@
+#include "ht_mux.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static uint32_t elapsed_ms(const struct timeval* start, const struct timeval* end) {
+    return (uint32_t)((end->tv_sec - start->tv_sec) * 1000 + (end->tv_usec - start->tv_usec) / 1000);
+}
+
+static ht_stream_t* find_stream(ht_mux_t* mux, uint32_t id) {
+    ht_stream_t* stream = mux->buckets[id % HT_MUX_BUCKETS];
+    while (stream && stream->id != id) {
+        stream = stream->hash_next;
+    }
+    return stream;
+}
+
+static ht_stream_t* create_stream(ht_mux_t* mux, uint32_t id) {
+    ht_stream_t* stream = calloc(1, sizeof(ht_stream_t));
+    if (!stream) {
+        return NULL;
+    }
+    stream->id = id;
+    stream->mux = mux;
+    stream->tx_limit = HT_MUX_STREAM_WINDOW;
+    stream->rx_advertised = HT_MUX_STREAM_WINDOW;
+
+    stream->hash_next = mux->buckets[id % HT_MUX_BUCKETS];
+    mux->buckets[id % HT_MUX_BUCKETS] = stream;
+    mux->stream_count++;
+    return stream;
+}
+
+static void free_stream(ht_mux_t* mux, ht_stream_t* stream) {
+    ht_stream_t** link = &mux->buckets[stream->id % HT_MUX_BUCKETS];
+    while (*link && *link != stream) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = stream->hash_next;
+    }
+
+    if (stream->in_active) {
+        ht_stream_t** active = &mux->active_head;
+        ht_stream_t* prev = NULL;
+        while (*active && *active != stream) {
+            prev = *active;
+            active = &(*active)->active_next;
+        }
+        if (*active) {
+            *active = stream->active_next;
+            if (mux->active_tail == stream) {
+                mux->active_tail = prev;
+            }
+        }
+    }
+    if (stream->blocked) {
+        mux->blocked_streams--;
+    }
+
+    while (stream->tx_head) {
+        ht_mux_chunk_t* next = stream->tx_head->next;
+        ht_slab_release(stream->tx_head->slab);
+        free(stream->tx_head);
+        stream->tx_head = next;
+    }
+    while (stream->rx_head) {
+        ht_recv_buffer_entry_t* next = stream->rx_head->next;
+        free(stream->rx_head);
+        stream->rx_head = next;
+    }
+
+    mux->stream_count--;
+    free(stream);
+}
+
+// 流有可发送的内容（数据且对端窗口未满，或待发的FIN）时放入调度队列
+static void activate(ht_mux_t* mux, ht_stream_t* stream) {
+    if (stream->in_active) {
+        return;
+    }
+    int can_send = (stream->tx_bytes > 0 && stream->tx_offset < stream->tx_limit) ||
+                   (stream->local_closed && !stream->fin_sent && stream->tx_bytes == 0);
+    if (!can_send) {
+        return;
+    }
+    stream->in_active = 1;
+    stream->active_next = NULL;
+    if (mux->active_tail) {
+        mux->active_tail->active_next = stream;
+    } else {
+        mux->active_head = stream;
+    }
+    mux->active_tail = stream;
+}
+
+static void set_blocked(ht_mux_t* mux, ht_stream_t* stream, int blocked) {
+    if (stream->blocked == blocked) {
+        return;
+    }
+    stream->blocked = blocked;
+    mux->blocked_streams += blocked ? 1 : -1;
+    if (blocked) {
+        gettimeofday(&stream->probe_time, NULL);
+    }
+}
+
+// 按赤字轮询在各流之间分配拥塞窗口：每轮每个流获得 HT_MUX_QUANTUM 的额度，额度为正即可发一个包，
+// 包的大小由路径MTU决定，超出的部分记为负额度留到后面的轮次扣除
+static void schedule(ht_mux_t* mux) {
+    int budget = ht_send_budget(mux->conn);
+
+    while (budget > 0 && mux->active_head) {
+        ht_stream_t* stream = mux->active_head;
+        mux->active_head = stream->active_next;
+        if (!mux->active_head) {
+            mux->active_tail = NULL;
+        }
+        stream->in_active = 0;
+        stream->deficit += HT_MUX_QUANTUM;
+
+        while (budget > 0) {
+            if (stream->tx_bytes == 0) {
+                if (stream->local_closed && !stream->fin_sent) {
+                    if (ht_send_stream_packet(mux->conn, stream->id, HT_DATA_FIN, NULL, 0) < 0) {
+                        return;
+                    }
+                    stream->fin_sent = 1;
+                    budget--;
+                }
+                break;
+            }
+
+            ht_mux_chunk_t* chunk = stream->tx_head;
+            size_t size = chunk->end - chunk->start;
+            uint64_t credit = stream->tx_limit - stream->tx_offset;
+            if (size > credit) {
+                size = (size_t)credit;
+            }
+            if (size == 0) {
+                set_blocked(mux, stream, 1);
+                break;
+            }
+            if (stream->deficit <= 0) {
+                break;
+            }
+
+            // 最后一块数据带上FIN，省一个包；一个包装不下时FIN随后面的包发送
+            uint16_t flags = 0;
+            if (stream->local_closed && size == stream->tx_bytes) {
+                flags = HT_DATA_FIN;
+            }
+            int sent = ht_send_stream_slab(mux->conn, stream->id, flags, chunk->slab, chunk->start, size);
+            if (sent < 0) {
+                return;
+            }
+            if (flags && (size_t)sent == size) {
+                stream->fin_sent = 1;
+            }
+            size = (size_t)sent;
+
+            chunk->start += size;
+            stream->tx_bytes -= size;
+            stream->tx_offset += size;
+            stream->deficit -= (int32_t)size;
+            budget--;
+
+            if (chunk->start == chunk->end) {
+                stream->tx_head = chunk->next;
+                if (!stream->tx_head) {
+                    stream->tx_tail = NULL;
+                }
+                ht_slab_release(chunk->slab);
+                free(chunk);
+            }
+        }
+
+        if (stream->local_closed && stream->fin_sent) {
+            free_stream(mux, stream);
+            continue;
+        }
+
+        activate(mux, stream);
+        if (!stream->in_active) {
+            stream->deficit = 0;
+        }
+    }
+}
+
+// 对端的窗口包：推进发送上限，或应答对端的阻塞探测
+static void on_window(void* ctx, uint32_t stream_id, uint16_t flags, uint64_t max_offset) {
+    ht_mux_t* mux = (ht_mux_t*)ctx;
+    ht_stream_t* stream = find_stream(mux, stream_id);
+    if (!stream) {
+        return;
+    }
+
+    if (flags & HT_WINDOW_BLOCKED) {
+        ht_send_window(mux->conn, stream->id, 0, stream->rx_advertised);
+        return;
+    }
+    if (max_offset > stream->tx_limit) {
+        stream->tx_limit = max_offset;
+        set_blocked(mux, stream, 0);
+        activate(mux, stream);
+    }
+}
+
+ht_mux_t* ht_mux_create(ht_connection_t* conn, int is_client) {
+    if (!conn) {
+        return NULL;
+    }
+    ht_mux_t* mux = calloc(1, sizeof(ht_mux_t));
+    if (!mux) {
+        return NULL;
+    }
+    mux->conn = conn;
+    mux->is_client = is_client;
+    mux->next_stream_id = 1;
+    ht_set_window_handler(conn, on_window, mux);
+    return mux;
+}
+
+void ht_mux_destroy(ht_mux_t* mux) {
+    if (!mux) {
+        return;
+    }
+    for (int i = 0; i < HT_MUX_BUCKETS; i++) {
+        while (mux->buckets[i]) {
+            free_stream(mux, mux->buckets[i]);
+        }
+    }
+    if (mux->conn) {
+        ht_disconnect(mux->conn);
+        ht_destroy_connection(mux->conn);
+    }
+    free(mux);
+}
+
+int ht_mux_alive(const ht_mux_t* mux) {
+    return mux && mux->conn && mux->conn->is_connected;
+}
+
+// 收包、把按序到达的数据分发到各流、重传超时处理和调度发送
+int ht_mux_process(ht_mux_t* mux) {
+    if (!ht_mux_alive(mux)) {
+        return -1;
+    }
+
+    ht_process_events(mux->conn);
+
+    ht_recv_buffer_entry_t* entry;
+    while ((entry = ht_take_ordered(mux->conn)) != NULL) {
+        uint32_t id = entry->packet.header.stream_id;
+        ht_stream_t* stream = find_stream(mux, id);
+
+        // 接受方在收到新的（更大的）发起方流ID时创建流；发起方先打开的流可能后发数据，
+        // 所以比它小、尚未出现过的奇数ID一并隐式打开。其他未知ID属于已关闭的流
+        if (!stream && !mux->is_client && (id & 1) && id > mux->max_peer_stream_id &&
+            id - mux->max_peer_stream_id <= 2 * HT_MUX_MAX_IMPLICIT_OPEN) {
+            uint32_t next = mux->max_peer_stream_id ? mux->max_peer_stream_id + 2 : 1;
+            for (; next <= id; next += 2) {
+                ht_stream_t* opened = create_stream(mux, next);
+                if (!opened) {
+                    break;
+                }
+                mux->max_peer_stream_id = next;
+                if (mux->accept_tail) {
+                    mux->accept_tail->accept_next = opened;
+                } else {
+                    mux->accept_head = opened;
+                }
+                mux->accept_tail = opened;
+                stream = opened;
+            }
+            if (stream && stream->id != id) {
+                stream = NULL;
+            }
+        }
+        if (!stream || stream->local_closed || stream->fin_received) {
+            free(entry);
+            continue;
+        }
+
+        if (entry->packet.header.flags & HT_DATA_FIN) {
+            stream->fin_received = 1;
+        }
+        if (entry->packet.header.payload_size == 0) {
+            free(entry);
+            continue;
+        }
+        if (stream->rx_tail) {
+            stream->rx_tail->next = entry;
+        } else {
+            stream->rx_head = entry;
+            stream->rx_head_offset = 0;
+        }
+        stream->rx_tail = entry;
+        stream->rx_bytes += entry->packet.header.payload_size;
+    }
+
+    ht_handle_timeout(mux->conn);
+    if (!ht_mux_alive(mux)) {
+        return -1;
+    }
+
+    // 受流控阻塞的流定期探测，防止窗口包丢失后永久停住
+    if (mux->blocked_streams > 0) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        for (int i = 0; i < HT_MUX_BUCKETS; i++) {
+            for (ht_stream_t* stream = mux->buckets[i]; stream; stream = stream->hash_next) {
+                if (stream->blocked &&
+                    elapsed_ms(&stream->probe_time, &now) > (uint32_t)mux->conn->retransmit_timeout) {
+                    stream->probe_time = now;
+                    ht_send_window(mux->conn, stream->id, HT_WINDOW_BLOCKED, stream->tx_limit);
+                }
+            }
+        }
+    }
+
+    schedule(mux);
+    return 0;
+}
+
+// 距下一次需要调用 ht_mux_process 的时间(ms)：隧道的定时事件和阻塞流的窗口探测中最早的一个，
+// -1表示只需等待隧道socket可读
+int ht_mux_next_timeout(ht_mux_t* mux) {
+    if (!ht_mux_alive(mux)) {
+        return -1;
+    }
+
+    int timeout = ht_next_timeout(mux->conn);
+    if (mux->blocked_streams > 0 && timeout != 0) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        uint32_t interval = (uint32_t)mux->conn->retransmit_timeout;
+        for (int i = 0; i < HT_MUX_BUCKETS; i++) {
+            for (ht_stream_t* stream = mux->buckets[i]; stream; stream = stream->hash_next) {
+                if (!stream->blocked) {
+                    continue;
+                }
+                uint32_t elapsed = elapsed_ms(&stream->probe_time, &now);
+                int remaining = elapsed > interval ? 0 : (int)(interval - elapsed + 1);
+                if (timeout < 0 || remaining < timeout) {
+                    timeout = remaining;
+                }
+            }
+        }
+    }
+    return timeout;
+}
+
+ht_stream_t* ht_mux_open_stream(ht_mux_t* mux) {
+    if (!ht_mux_alive(mux) || !mux->is_client) {
+        return NULL;
+    }
+    ht_stream_t* stream = create_stream(mux, mux->next_stream_id);
+    if (!stream) {
+        return NULL;
+    }
+    mux->next_stream_id += 2;
+    mux->open_streams++;
+    return stream;
+}
+
+ht_stream_t* ht_mux_accept_stream(ht_mux_t* mux) {
+    if (!mux || !mux->accept_head) {
+        return NULL;
+    }
+    ht_stream_t* stream = mux->accept_head;
+    mux->accept_head = stream->accept_next;
+    if (!mux->accept_head) {
+        mux->accept_tail = NULL;
+    }
+    stream->accept_next = NULL;
+    mux->open_streams++;
+    return stream;
+}
+
+size_t ht_stream_send_space(const ht_stream_t* stream) {
+    if (!stream || stream->tx_bytes >= HT_MUX_SEND_BUFFER) {
+        return 0;
+    }
+    return HT_MUX_SEND_BUFFER - stream->tx_bytes;
+}
+
+// 数据放入流的发送队列并立即调度；返回接受的字节数（队列满时可能少于 size）
+int ht_stream_send(ht_stream_t* stream, const void* data, size_t size) {
+    if (!stream || stream->local_closed || !ht_mux_alive(stream->mux)) {
+        return -1;
+    }
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    size_t space = ht_stream_send_space(stream);
+    size_t accepted = size < space ? size : space;
+    size_t copied = 0;
+
+    while (copied < accepted) {
+        ht_mux_chunk_t* tail = stream->tx_tail;
+        if (!tail || tail->end == HT_MAX_PAYLOAD_SIZE) {
+            tail = malloc(sizeof(ht_mux_chunk_t));
+            if (!tail) {
+                break;
+            }
+            tail->slab = ht_slab_alloc(HT_MAX_PAYLOAD_SIZE);
+            if (!tail->slab) {
+                free(tail);
+                break;
+            }
+            tail->next = NULL;
+            tail->start = 0;
+            tail->end = 0;
+            if (stream->tx_tail) {
+                stream->tx_tail->next = tail;
+            } else {
+                stream->tx_head = tail;
+            }
+            stream->tx_tail = tail;
+        }
+        size_t room = HT_MAX_PAYLOAD_SIZE - tail->end;
+        size_t size_now = accepted - copied < room ? accepted - copied : room;
+        memcpy(tail->slab->data + tail->end, bytes + copied, size_now);
+        tail->end += size_now;
+        copied += size_now;
+    }
+    stream->tx_bytes += copied;
+
+    activate(stream->mux, stream);
+    schedule(stream->mux);
+    return (int)copied;
+}
+
+// 有按序到达的数据可读，或 ht_stream_recv 会报告结束
+int ht_stream_readable(const ht_stream_t* stream) {
+    return stream->rx_bytes > 0 || stream->fin_received || !ht_mux_alive(stream->mux);
+}
+
+// 读取按序到达的数据；没有数据返回0，对端已结束或隧道断开返回-1
+int ht_stream_recv(ht_stream_t* stream, void* buffer, size_t size) {
+    if (!stream) {
+        return -1;
+    }
+    if (stream->rx_bytes == 0) {
+        return (stream->fin_received || !ht_mux_alive(stream->mux)) ? -1 : 0;
+    }
+
+    uint8_t* bytes = (uint8_t*)buffer;
+    size_t copied = 0;
+    while (copied < size && stream->rx_head) {
+        ht_recv_buffer_entry_t* entry = stream->rx_head;
+        size_t available = entry->packet.header.payload_size - stream->rx_head_offset;
+        size_t size_now = size - copied < available ? size - copied : available;
+        memcpy(bytes + copied, entry->packet.payload + stream->rx_head_offset, size_now);
+        copied += size_now;
+        stream->rx_head_offset += size_now;
+        if (stream->rx_head_offset == entry->packet.header.payload_size) {
+            stream->rx_head = entry->next;
+            if (!stream->rx_head) {
+                stream->rx_tail = NULL;
+            }
+            stream->rx_head_offset = 0;
+            free(entry);
+        }
+    }
+    stream->rx_bytes -= copied;
+    stream->rx_consumed += copied;
+
+    // 已读取超过半个窗口时推进窗口
+    if (stream->rx_consumed + HT_MUX_STREAM_WINDOW - stream->rx_advertised >= HT_MUX_STREAM_WINDOW / 2) {
+        stream->rx_advertised = stream->rx_consumed + HT_MUX_STREAM_WINDOW;
+        ht_send_window(stream->mux->conn, stream->id, 0, stream->rx_advertised);
+    }
+    return (int)copied;
+}
+
+// 应用释放流：剩余数据和FIN发出后由复用层释放；隧道已断开时立即释放
+void ht_stream_close(ht_stream_t* stream) {
+    if (!stream || stream->local_closed) {
+        return;
+    }
+    ht_mux_t* mux = stream->mux;
+    stream->local_closed = 1;
+    mux->open_streams--;
+
+    // 不再读取，丢弃已到达的数据
+    while (stream->rx_head) {
+        ht_recv_buffer_entry_t* next = stream->rx_head->next;
+        free(stream->rx_head);
+        stream->rx_head = next;
+    }
+    stream->rx_tail = NULL;
+    stream->rx_bytes = 0;
+
+    if (!ht_mux_alive(mux) || stream->fin_sent) {
+        free_stream(mux, stream);
+        return;
+    }
+    activate(mux, stream);
+    schedule(mux);
+}
@@ -0,0 +1,92 @@
+#ifndef HT_MUX_H
+#define HT_MUX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hybrid_transport.h"
+
+// 流复用：一个混合传输连接（隧道）承载多个会话，每个会话是一个流
+//   - 流ID放在包头，发起方使用奇数ID并递增，接受方在收到新ID的第一个数据包时创建流
+//   - 每个流按字节做流控，接收方随应用读取推进窗口
+//   - 所有流共享隧道的拥塞窗口，按赤字轮询（DRR）调度，大流不会饿死交互流
+#define HT_MUX_STREAM_WINDOW (256 * 1024)       // 每个流的接收窗口(字节)
+#define HT_MUX_SEND_BUFFER (256 * 1024)         // 每个流的发送队列上限(字节)
+#define HT_MUX_BUCKETS 256                      // 流ID哈希桶数
+#define HT_MUX_MAX_IMPLICIT_OPEN 1024           // 一次最多隐式打开的流数，超出视为非法ID
+#define HT_MUX_QUANTUM (HT_BASE_PLPMTU - HT_HEADER_SIZE)    // DRR每轮的额度(字节)
+
+// 发送队列的数据块，发送时按所选路径的MTU切成一个或多个数据包；
+// 数据放在缓冲块中，发出的数据包直接引用，不再复制
+typedef struct ht_mux_chunk {
+    struct ht_mux_chunk* next;
+    uint16_t start;
+    uint16_t end;
+    ht_slab_t* slab;
+} ht_mux_chunk_t;
+
+struct ht_mux;
+
+typedef struct ht_stream {
+    uint32_t id;
+    struct ht_mux* mux;
+    struct ht_stream* hash_next;
+    struct ht_stream* active_next;      // 调度队列
+    struct ht_stream* accept_next;      // 等待 ht_mux_accept_stream 取走
+
+    // 状态
+    uint8_t in_active;
+    uint8_t blocked;                    // 有数据但对端窗口已满
+    uint8_t local_closed;               // 应用已关闭，发完剩余数据和FIN后释放
+    uint8_t fin_sent;
+    uint8_t fin_received;
+
+    // 发送
+    ht_mux_chunk_t* tx_head;
+    ht_mux_chunk_t* tx_tail;
+    size_t tx_bytes;
+    uint64_t tx_offset;                 // 已交给隧道的字节数
+    uint64_t tx_limit;                  // 对端允许发送到的偏移
+    int32_t deficit;                    // DRR 赤字(字节)，发出大包后可以为负
+    struct timeval probe_time;          // 最后一次阻塞探测
+
+    // 接收：按序到达的数据包直接挂在流上
+    ht_recv_buffer_entry_t* rx_head;
+    ht_recv_buffer_entry_t* rx_tail;
+    size_t rx_head_offset;
+    size_t rx_bytes;
+    uint64_t rx_consumed;               // 应用已读取的字节数
+    uint64_t rx_advertised;             // 已通告给对端的窗口上限
+} ht_stream_t;
+
+typedef struct ht_mux {
+    ht_connection_t* conn;              // 隧道，由复用层持有
+    int is_client;
+    uint32_t next_stream_id;
+    uint32_t max_peer_stream_id;
+    ht_stream_t* buckets[HT_MUX_BUCKETS];
+    ht_stream_t* active_head;
+    ht_stream_t* active_tail;
+    ht_stream_t* accept_head;
+    ht_stream_t* accept_tail;
+    int stream_count;                   // 所有流（含应用已关闭、尚未发完的流）
+    int open_streams;                   // 应用持有的流
+    int blocked_streams;
+} ht_mux_t;
+
+// 隧道
+ht_mux_t* ht_mux_create(ht_connection_t* conn, int is_client);
+void ht_mux_destroy(ht_mux_t* mux);
+int ht_mux_process(ht_mux_t* mux);
+int ht_mux_alive(const ht_mux_t* mux);
+int ht_mux_next_timeout(ht_mux_t* mux);
+
+// 流
+ht_stream_t* ht_mux_open_stream(ht_mux_t* mux);
+ht_stream_t* ht_mux_accept_stream(ht_mux_t* mux);
+int ht_stream_send(ht_stream_t* stream, const void* data, size_t size);
+size_t ht_stream_send_space(const ht_stream_t* stream);
+int ht_stream_recv(ht_stream_t* stream, void* buffer, size_t size);
+int ht_stream_readable(const ht_stream_t* stream);
+void ht_stream_close(ht_stream_t* stream);
+
+#endif // HT_MUX_H
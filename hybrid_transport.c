@@ -9,18 +9,40 @@
 #include <fcntl.h>
 #include <time.h>
 #include <netinet/tcp.h>
+#include <sys/random.h>
+#include <stddef.h>
 
 // 协议魔数
 #define HT_MAGIC 0x48545250  // "HTRP" - Hybrid Transport Protocol
 
+_Static_assert(sizeof(ht_packet_header_t) == HT_HEADER_SIZE, "HT_HEADER_SIZE 与包头结构不一致");
+
+// 按载荷大小分配接收缓冲区条目（数据包是条目的最后一个成员）
+#define RECV_ENTRY_SIZE(bytes) (offsetof(ht_recv_buffer_entry_t, packet.payload) + (bytes))
+
+// 载荷缓冲块按容量分级回收：交互小包、一个基础PLPMTU的包、最大载荷；每级最多缓存 HT_SLAB_CACHE 块
+#define HT_SLAB_CLASSES 3
+#define HT_SLAB_CACHE 128
+static const uint32_t slab_class_size[HT_SLAB_CLASSES] = { 256, 2048, HT_MAX_PAYLOAD_SIZE };
+
 // 全局变量
 static int ht_initialized = 0;
+static ht_slab_t* slab_free[HT_SLAB_CLASSES];
+static int slab_free_count[HT_SLAB_CLASSES];
+
+static void listener_remove(ht_listener_t* listener, ht_connection_t* conn);
+static int transmit(ht_connection_t* conn, ht_packet_header_t* header, const uint8_t* payload,
+                    int use_tcp, int path);
 
 // 工具函数：获取当前时间戳(毫秒)
+static uint32_t timeval_ms(const struct timeval* tv) {
+    return (uint32_t)(tv->tv_sec * 1000 + tv->tv_usec / 1000);
+}
+
 static uint32_t get_timestamp_ms(void) {
     struct timeval tv;
     gettimeofday(&tv, NULL);
-    return (uint32_t)(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+    return timeval_ms(&tv);
 }
 
 // 工具函数：计算时间差(毫秒)
@@ -29,6 +51,14 @@ static uint32_t time_diff_ms(struct timeval* start, struct timeval* end) {
                       (end->tv_usec - start->tv_usec) / 1000);
 }
 
+// 从 since 起经过 timeout(ms) 的定时事件还要等多久，与 current（-1表示尚无定时事件）取较早者；
+// 到期条件与 ht_handle_timeout 中的 elapsed > timeout 一致
+static int earlier_deadline(int current, struct timeval* since, uint32_t timeout, struct timeval* now) {
+    uint32_t elapsed = time_diff_ms(since, now);
+    int remaining = elapsed > timeout ? 0 : (int)(timeout - elapsed + 1);
+    return current < 0 || remaining < current ? remaining : current;
+}
+
 // 初始化混合传输协议
 int ht_init(void) {
     if (ht_initialized) {
@@ -44,22 +74,83 @@ int ht_init(void) {
 
 // 清理混合传输协议
 void ht_cleanup(void) {
+    for (int i = 0; i < HT_SLAB_CLASSES; i++) {
+        while (slab_free[i]) {
+            ht_slab_t* next = slab_free[i]->next_free;
+            free(slab_free[i]);
+            slab_free[i] = next;
+        }
+        slab_free_count[i] = 0;
+    }
     ht_initialized = 0;
 }
 
-// 计算校验和
-uint32_t ht_calculate_checksum(const void* data, size_t size) {
+// 分配至少 size 字节的载荷缓冲块，调用方持有一个引用
+ht_slab_t* ht_slab_alloc(size_t size) {
+    int index = 0;
+    while (index < HT_SLAB_CLASSES && size > slab_class_size[index]) {
+        index++;
+    }
+    if (index == HT_SLAB_CLASSES) {
+        return NULL;
+    }
+
+    ht_slab_t* slab = slab_free[index];
+    if (slab) {
+        slab_free[index] = slab->next_free;
+        slab_free_count[index]--;
+    } else {
+        slab = malloc(offsetof(ht_slab_t, data) + slab_class_size[index]);
+        if (!slab) {
+            return NULL;
+        }
+        slab->capacity = slab_class_size[index];
+    }
+    slab->next_free = NULL;
+    slab->refs = 1;
+    return slab;
+}
+
+// 释放一个引用，最后一个引用释放时回收
+void ht_slab_release(ht_slab_t* slab) {
+    if (!slab || --slab->refs > 0) {
+        return;
+    }
+    int index = 0;
+    while (slab_class_size[index] != slab->capacity) {
+        index++;
+    }
+    if (slab_free_count[index] >= HT_SLAB_CACHE) {
+        free(slab);
+        return;
+    }
+    slab->next_free = slab_free[index];
+    slab_free[index] = slab;
+    slab_free_count[index]++;
+}
+
+static void free_send_entry(ht_send_buffer_entry_t* entry) {
+    ht_slab_release(entry->slab);
+    free(entry);
+}
+
+// 在已有校验和上继续累加一段数据
+static uint32_t checksum_update(uint32_t checksum, const void* data, size_t size) {
     const uint8_t* bytes = (const uint8_t*)data;
-    uint32_t checksum = 0;
-    
+
     for (size_t i = 0; i < size; i++) {
         checksum += bytes[i];
         checksum = (checksum << 1) | (checksum >> 31); // 循环左移
     }
-    
+
     return checksum;
 }
 
+// 计算校验和
+uint32_t ht_calculate_checksum(const void* data, size_t size) {
+    return checksum_update(0, data, size);
+}
+
 // 设置socket为非阻塞模式
 static int set_nonblocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
@@ -80,6 +171,10 @@ static int create_udp_socket(void) {
     // 设置socket选项
     int opt = 1;
     setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // 设置DF且不使用内核的路径MTU缓存：数据报不会被分片，大小由连接自己的MTU探测决定
+    int pmtudisc = IP_PMTUDISC_PROBE;
+    setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc));
     
     // 设置为非阻塞模式
     if (set_nonblocking(sockfd) < 0) {
@@ -112,8 +207,17 @@ static int create_tcp_socket(void) {
     return sockfd;
 }
 
-// 创建混合传输连接
-ht_connection_t* ht_create_connection(const char* remote_ip, int remote_port, ht_transport_mode_t mode) {
+// 生成连接ID
+static uint64_t generate_conn_id(void) {
+    uint64_t id = 0;
+    if (getrandom(&id, sizeof(id), GRND_NONBLOCK) != sizeof(id) || id == 0) {
+        id = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ (uint64_t)rand() ^ (uint64_t)time(NULL);
+    }
+    return id;
+}
+
+// 分配并初始化连接结构（客户端和服务端共用）
+static ht_connection_t* alloc_connection(ht_transport_mode_t mode) {
     if (!ht_initialized) {
         ht_init();
     }
@@ -127,29 +231,26 @@ ht_connection_t* ht_create_connection(const char* remote_ip, int remote_port, ht
     conn->mode = mode;
     conn->udp_fd = -1;
     conn->tcp_fd = -1;
-    
-    // 设置远程地址
-    memset(&conn->remote_addr, 0, sizeof(conn->remote_addr));
-    conn->remote_addr.sin_family = AF_INET;
-    conn->remote_addr.sin_port = htons(remote_port);
-    if (inet_pton(AF_INET, remote_ip, &conn->remote_addr.sin_addr) <= 0) {
-        free(conn);
-        return NULL;
-    }
+    conn->tcp_path.udp_fd = -1;
+    conn->listener = NULL;
     
     // 初始化序列号
     conn->send_sequence = rand() % HT_MAX_SEQUENCE;
+    conn->initial_sequence = conn->send_sequence;
     conn->recv_sequence = 0;
     conn->ack_sequence = 0;
     
     // 初始化窗口大小
     conn->send_window_size = HT_WINDOW_SIZE;
     conn->recv_window_size = HT_WINDOW_SIZE;
+    conn->cwnd = HT_INITIAL_CWND;
+    conn->ssthresh = HT_MAX_CWND;
     
     // 初始化配置参数
     conn->retransmit_timeout = HT_RETRANSMIT_TIMEOUT;
     conn->max_retransmit = HT_MAX_RETRANSMIT;
     conn->udp_preference = 0.8f; // 默认80%使用UDP
+    conn->compact_header = 1;
     
     // 初始化统计信息
     memset(&conn->stats, 0, sizeof(conn->stats));
@@ -162,590 +263,2455 @@ ht_connection_t* ht_create_connection(const char* remote_ip, int remote_port, ht
     return conn;
 }
 
-// 销毁混合传输连接
-void ht_destroy_connection(ht_connection_t* conn) {
+// 创建混合传输连接
+ht_connection_t* ht_create_connection(const char* remote_ip, int remote_port, ht_transport_mode_t mode) {
+    ht_connection_t* conn = alloc_connection(mode);
     if (!conn) {
-        return;
+        return NULL;
     }
     
-    // 关闭socket
-    if (conn->udp_fd >= 0) {
-        close(conn->udp_fd);
-    }
-    if (conn->tcp_fd >= 0) {
-        close(conn->tcp_fd);
+    // 设置远程地址
+    memset(&conn->remote_addr, 0, sizeof(conn->remote_addr));
+    conn->remote_addr.sin_family = AF_INET;
+    conn->remote_addr.sin_port = htons(remote_port);
+    if (inet_pton(AF_INET, remote_ip, &conn->remote_addr.sin_addr) <= 0) {
+        free(conn);
+        return NULL;
     }
     
-    // 清理发送缓冲区
-    ht_send_buffer_entry_t* send_entry = conn->send_buffer;
-    while (send_entry) {
-        ht_send_buffer_entry_t* next = send_entry->next;
-        free(send_entry);
-        send_entry = next;
+    conn->conn_id = generate_conn_id();
+    return conn;
+}
+
+// 发送控制包：TCP_ONLY 模式走TCP，其他模式优先UDP
+static int send_control(ht_connection_t* conn, uint16_t flags) {
+    ht_packet_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = HT_MAGIC;
+    header.version = 1;
+    header.type = HT_TYPE_CONTROL;
+    // 握手时协商紧凑包头：SYN 表示请求，SYN_ACK 表示同意
+    if (((flags & HT_CONTROL_SYN) && conn->compact_header) ||
+        ((flags & HT_CONTROL_SYN_ACK) && conn->compact_tx)) {
+        flags |= HT_CONTROL_COMPACT;
     }
-    
-    // 清理接收缓冲区
-    ht_recv_buffer_entry_t* recv_entry = conn->recv_buffer;
-    while (recv_entry) {
-        ht_recv_buffer_entry_t* next = recv_entry->next;
-        free(recv_entry);
-        recv_entry = next;
+    header.flags = flags;
+    // 建立连接的控制包携带初始序列号，其他控制包不占用序列号
+    header.sequence = (flags & (HT_CONTROL_SYN | HT_CONTROL_SYN_ACK)) ?
+                      conn->initial_sequence : conn->send_sequence;
+    header.timestamp = get_timestamp_ms();
+
+    int prefer_tcp = conn->mode == HT_MODE_TCP_ONLY;
+    int result = transmit(conn, &header, NULL, prefer_tcp, -1);
+    if (result < 0) {
+        result = transmit(conn, &header, NULL, !prefer_tcp, -1);
     }
-    
-    free(conn);
+    return result;
 }
 
-// 连接到远程主机
-int ht_connect(ht_connection_t* conn) {
-    if (!conn || conn->is_connected) {
+// 经UDP向指定地址发送路径验证包（挑战或应答），载荷为8字节挑战值
+static int send_path_control(ht_connection_t* conn, uint16_t flags, uint64_t token, int fd,
+                             const struct sockaddr_in* addr, uint8_t path_id) {
+    if (fd < 0) {
         return -1;
     }
-    
-    // 创建UDP socket
-    if (conn->mode != HT_MODE_TCP_ONLY) {
-        conn->udp_fd = create_udp_socket();
-        if (conn->udp_fd < 0) {
-            return -1;
+
+    ht_packet_t packet;
+    memset(&packet.header, 0, sizeof(packet.header));
+    packet.header.magic = HT_MAGIC;
+    packet.header.version = 1;
+    packet.header.type = HT_TYPE_CONTROL;
+    packet.header.flags = flags;
+    packet.header.sequence = conn->send_sequence;
+    packet.header.timestamp = get_timestamp_ms();
+    packet.header.payload_size = sizeof(token);
+    packet.header.conn_id = conn->conn_id;
+    packet.header.path_id = path_id;
+    memcpy(packet.payload, &token, sizeof(token));
+    packet.header.checksum = ht_calculate_checksum(&packet, sizeof(ht_packet_header_t) + sizeof(token));
+
+    ssize_t sent = sendto(fd, &packet, sizeof(ht_packet_header_t) + sizeof(token), 0,
+                          (const struct sockaddr*)addr, sizeof(*addr));
+    if (sent > 0) {
+        conn->stats.packets_sent++;
+        conn->stats.bytes_sent += sent;
+    }
+    return (int)sent;
+}
+
+static int same_address(const struct sockaddr_in* a, const struct sockaddr_in* b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+static int find_path(const ht_connection_t* conn, uint8_t path_id) {
+    for (int i = 0; i < conn->path_count; i++) {
+        if (conn->paths[i].id == path_id) {
+            return i;
         }
     }
-    
-    // 创建TCP socket
-    if (conn->mode != HT_MODE_UDP_ONLY) {
-        conn->tcp_fd = create_tcp_socket();
-        if (conn->tcp_fd < 0) {
-            if (conn->udp_fd >= 0) {
-                close(conn->udp_fd);
-                conn->udp_fd = -1;
-            }
-            return -1;
+    return -1;
+}
+
+static int path_usable(ht_path_t* path, struct timeval* now) {
+    return path->udp_fd >= 0 && time_diff_ms(&path->last_recv, now) < HT_PATH_TIMEOUT;
+}
+
+// 路径的有效延迟：平滑RTT加上丢包带来的期望重传等待
+static uint32_t path_latency(const ht_connection_t* conn, const ht_path_t* path) {
+    uint32_t srtt = path->srtt ? path->srtt : conn->stats.rtt_avg;
+    return srtt + (uint32_t)(path->loss * 2.0f * conn->retransmit_timeout);
+}
+
+// 有效延迟最低的可用路径，exclude 指定的路径除外；没有时返回-1
+static int lowest_latency_path(ht_connection_t* conn, int exclude, struct timeval* now) {
+    int best = -1;
+    uint32_t best_latency = UINT32_MAX;
+    for (int i = 0; i < conn->path_count; i++) {
+        if (i == exclude || !path_usable(&conn->paths[i], now)) {
+            continue;
         }
-        
-        // 尝试TCP连接
-        int result = connect(conn->tcp_fd, (struct sockaddr*)&conn->remote_addr, 
-                           sizeof(conn->remote_addr));
-        if (result < 0 && errno != EINPROGRESS) {
-            close(conn->tcp_fd);
-            conn->tcp_fd = -1;
-            if (conn->mode == HT_MODE_TCP_ONLY) {
-                if (conn->udp_fd >= 0) {
-                    close(conn->udp_fd);
-                    conn->udp_fd = -1;
-                }
-                return -1;
-            }
+        uint32_t latency = path_latency(conn, &conn->paths[i]);
+        if (latency < best_latency) {
+            best = i;
+            best_latency = latency;
         }
     }
-    
-    conn->is_connected = 1;
-    gettimeofday(&conn->last_activity, NULL);
-    
-    return 0;
+    return best;
 }
 
-// 断开连接
-int ht_disconnect(ht_connection_t* conn) {
-    if (!conn || !conn->is_connected) {
-        return -1;
+// 选择UDP发送路径：交互包走有效延迟最低的路径；批量包按 1/(RTT*(1+20*丢包率)) 估计的
+// 带宽做平滑加权轮询（按序交付时丢包的代价远大于少用一条路径）。所有路径都超时未收到包时退回最近收到过包的路径
+static int choose_path(ht_connection_t* conn, int interactive, struct timeval* now) {
+    if (conn->path_count <= 1) {
+        return conn->path_count == 1 && conn->paths[0].udp_fd >= 0 ? 0 : -1;
     }
-    
-    conn->is_closing = 1;
-    
-    // 发送关闭通知包
-    ht_packet_t close_packet;
-    memset(&close_packet, 0, sizeof(close_packet));
-    close_packet.header.magic = HT_MAGIC;
-    close_packet.header.version = 1;
-    close_packet.header.type = HT_TYPE_CONTROL;
-    close_packet.header.flags = 0x01; // 关闭标志
-    close_packet.header.sequence = conn->send_sequence++;
-    close_packet.header.timestamp = get_timestamp_ms();
-    
-    // 尝试通过两个通道发送关闭包
-    if (conn->udp_fd >= 0) {
-        ht_send_packet(conn, &close_packet, 0);
+
+    int best = -1;
+    if (interactive) {
+        best = lowest_latency_path(conn, -1, now);
+    } else {
+        int total = 0;
+        for (int i = 0; i < conn->path_count; i++) {
+            ht_path_t* path = &conn->paths[i];
+            if (!path_usable(path, now)) {
+                continue;
+            }
+            uint32_t srtt = path->srtt ? path->srtt : conn->stats.rtt_avg;
+            int weight = (int)(1000.0f / ((srtt + 1) * (1.0f + 20.0f * path->loss))) + 1;
+            path->credit += weight;
+            total += weight;
+            if (best < 0 || path->credit > conn->paths[best].credit) {
+                best = i;
+            }
+        }
+        if (best >= 0) {
+            conn->paths[best].credit -= total;
+        }
     }
-    if (conn->tcp_fd >= 0) {
-        ht_send_packet(conn, &close_packet, 1);
+
+    if (best < 0) {
+        for (int i = 0; i < conn->path_count; i++) {
+            if (conn->paths[i].udp_fd >= 0 &&
+                (best < 0 || timercmp(&conn->paths[i].last_recv, &conn->paths[best].last_recv, >))) {
+                best = i;
+            }
+        }
     }
-    
-    conn->is_connected = 0;
-    return 0;
+    return best;
 }
 
-// 获取连接统计信息
-void ht_get_stats(ht_connection_t* conn, ht_connection_stats_t* stats) {
-    if (!conn || !stats) {
-        return;
-    }
-    
-    *stats = conn->stats;
-    
-    // 计算传输比例
-    uint64_t total_packets = stats->packets_sent;
-    if (total_packets > 0) {
-        // 这里需要根据实际发送记录计算，暂时使用估算值
-        stats->udp_ratio = conn->udp_preference;
-        stats->tcp_ratio = 1.0f - conn->udp_preference;
+// 路径当前使用的数据报大小和探测上界
+static uint16_t path_mtu(const ht_path_t* path) {
+    return path->plpmtu ? path->plpmtu : HT_BASE_PLPMTU;
+}
+
+static uint16_t path_ceiling(const ht_path_t* path) {
+    return path->probe_ceiling ? path->probe_ceiling : HT_MAX_PACKET_SIZE;
+}
+
+// 经指定UDP路径发送时的最大载荷；没有UDP路径时（只走TCP）不受MTU限制
+static size_t path_payload_limit(const ht_connection_t* conn, int path) {
+    if (path < 0 || path >= conn->path_count) {
+        return HT_MAX_PAYLOAD_SIZE;
     }
-    
-    // 计算丢包率
-    if (stats->packets_sent > 0) {
-        stats->packet_loss_rate = (float)stats->packets_lost / stats->packets_sent;
+    return path_mtu(&conn->paths[path]) - HT_HEADER_SIZE;
+}
+
+// 发送缓冲区条目记录的通道：-1为TCP，否则为UDP子路径下标；路径已被替换时返回NULL
+static ht_path_t* channel_of(ht_connection_t* conn, int path) {
+    if (path < 0) {
+        return &conn->tcp_path;
     }
+    return path < conn->path_count ? &conn->paths[path] : NULL;
 }
 
-// 重置统计信息
-void ht_reset_stats(ht_connection_t* conn) {
-    if (!conn) {
+// 丢包率窗口前移到当前时间片，移出窗口的时间片从合计中减去
+static void loss_window_advance(ht_loss_window_t* window, uint32_t now_ms) {
+    uint32_t epoch = now_ms / HT_LOSS_SLOT_MS;
+    uint32_t steps = epoch - window->epoch;
+    if (steps >= HT_LOSS_WINDOW_SLOTS) {
+        memset(window, 0, sizeof(*window));
+        window->epoch = epoch;
         return;
     }
+    while (steps-- > 0) {
+        int slot = ++window->epoch % HT_LOSS_WINDOW_SLOTS;
+        window->window_sent -= window->sent[slot];
+        window->window_lost -= window->lost[slot];
+        window->sent[slot] = 0;
+        window->lost[slot] = 0;
+    }
+}
 
-    memset(&conn->stats, 0, sizeof(conn->stats));
-    conn->stats.rtt_min = UINT32_MAX;
+static void loss_window_add(ht_loss_window_t* window, uint32_t now_ms, uint32_t sent, uint32_t lost) {
+    loss_window_advance(window, now_ms);
+    int slot = window->epoch % HT_LOSS_WINDOW_SLOTS;
+    window->sent[slot] += sent;
+    window->lost[slot] += lost;
+    window->window_sent += sent;
+    window->window_lost += lost;
 }
 
-// 判断是否应该使用TCP传输
-int ht_should_use_tcp(ht_connection_t* conn) {
-    if (!conn) {
-        return 0;
+// 丢失按超时时刻计入，窗口内丢失数可能略多于发送数
+static float loss_rate(uint32_t sent, uint32_t lost) {
+    if (sent == 0) {
+        return 0.0f;
     }
+    return lost >= sent ? 1.0f : (float)lost / sent;
+}
 
-    // 如果只有TCP模式，总是使用TCP
-    if (conn->mode == HT_MODE_TCP_ONLY) {
-        return 1;
+// 确认到达时更新发送所用通道的计数、RTT和丢包估计；重传过的包无法区分是哪一次的确认，不取RTT样本
+static void path_on_ack(ht_connection_t* conn, ht_send_buffer_entry_t* entry, uint32_t rtt) {
+    ht_path_t* path = channel_of(conn, entry->path);
+    if (!path) {
+        return;
     }
-
-    // 如果只有UDP模式，总是使用UDP
-    if (conn->mode == HT_MODE_UDP_ONLY) {
-        return 0;
+    path->counters.packets_acked++;
+    if (HT_HEADER_SIZE + entry->header.payload_size > HT_BASE_PLPMTU) {
+        path->blackhole_losses = 0;
     }
-
-    // 混合模式或自动模式的决策逻辑
-    float tcp_probability = 1.0f - conn->udp_preference;
-
-    // 根据网络状况调整TCP使用概率
-    if (conn->stats.packet_loss_rate > 0.05f) { // 丢包率超过5%
-        tcp_probability += 0.3f;
+    if (entry->retransmit_count == 0) {
+        path->srtt = path->srtt ? (path->srtt * 7 + rtt) / 8 : rtt;
+        if (path->counters.rtt_min == 0 || rtt < path->counters.rtt_min) {
+            path->counters.rtt_min = rtt ? rtt : 1;
+        }
+        if (rtt > path->counters.rtt_max) {
+            path->counters.rtt_max = rtt;
+        }
     }
+    path->loss *= 0.875f;
+}
 
-    if (conn->stats.rtt_avg > 200) { // 延迟超过200ms
-        tcp_probability += 0.2f;
+// 数据包的重传超时：配置值为下限，且不低于发送通道平滑RTT的两倍，
+// 否则RTT较长的路径上每个包都会被误判为丢失
+static uint32_t entry_timeout(ht_connection_t* conn, const ht_send_buffer_entry_t* entry) {
+    uint32_t srtt = conn->stats.rtt_avg;
+    ht_path_t* path = channel_of(conn, entry->path);
+    if (path && path->srtt) {
+        srtt = path->srtt;
     }
+    uint32_t timeout = (uint32_t)conn->retransmit_timeout;
+    return srtt * 2 > timeout ? srtt * 2 : timeout;
+}
 
-    // 限制概率范围
-    if (tcp_probability > 1.0f) tcp_probability = 1.0f;
-    if (tcp_probability < 0.0f) tcp_probability = 0.0f;
+static void path_on_loss(ht_connection_t* conn, ht_send_buffer_entry_t* entry, struct timeval* now) {
+    ht_path_t* path = channel_of(conn, entry->path);
+    if (!path) {
+        return;
+    }
+    path->loss = path->loss * 0.875f + 0.125f;
+    path->counters.packets_lost++;
+    loss_window_add(&path->loss_window, timeval_ms(now), 0, 1);
+
+    // 大包连续丢失而小包正常：路径MTU变小（黑洞），退回基础大小，以丢包时的大小为上界重新探测
+    if (path->udp_fd >= 0 && HT_HEADER_SIZE + entry->header.payload_size > HT_BASE_PLPMTU &&
+        ++path->blackhole_losses >= HT_PLPMTU_BLACKHOLE) {
+        path->probe_ceiling = path_mtu(path) - 1;
+        path->plpmtu = 0;
+        path->probe_size = 0;
+        path->probe_done = 0;
+        path->blackhole_losses = 0;
+    }
+}
 
-    // 随机决策
-    return (rand() / (float)RAND_MAX) < tcp_probability;
+// 关闭TCP通道；混合模式下继续使用UDP
+static void close_tcp_channel(ht_connection_t* conn) {
+    if (conn->tcp_fd >= 0) {
+        close(conn->tcp_fd);
+        conn->tcp_fd = -1;
+    }
+    conn->tcp_rx_len = 0;
+    conn->tcp_tx_len = 0;
+    conn->tcp_tx_offset = 0;
+    if (conn->mode == HT_MODE_TCP_ONLY) {
+        conn->is_connected = 0;
+    }
 }
 
-// 发送数据包
-int ht_send_packet(ht_connection_t* conn, ht_packet_t* packet, int use_tcp) {
-    if (!conn || !packet) {
+// 校验收到的数据包：魔数、长度和校验和
+static int validate_packet(ht_packet_t* packet, size_t size) {
+    if (size < sizeof(ht_packet_header_t) || packet->header.magic != HT_MAGIC ||
+        packet->header.payload_size > HT_MAX_PAYLOAD_SIZE ||
+        sizeof(ht_packet_header_t) + packet->header.payload_size > size) {
         return -1;
     }
 
-    // 计算校验和
+    uint32_t received_checksum = packet->header.checksum;
     packet->header.checksum = 0;
-    packet->header.checksum = ht_calculate_checksum(packet,
+    uint32_t calculated_checksum = ht_calculate_checksum(packet,
         sizeof(ht_packet_header_t) + packet->header.payload_size);
+    packet->header.checksum = received_checksum;
 
-    int bytes_sent = 0;
+    return received_checksum == calculated_checksum ? 0 : -1;
+}
 
-    if (use_tcp && conn->tcp_fd >= 0) {
-        // TCP发送
-        size_t total_size = sizeof(ht_packet_header_t) + packet->header.payload_size;
-        bytes_sent = send(conn->tcp_fd, packet, total_size, MSG_NOSIGNAL);
-    } else if (!use_tcp && conn->udp_fd >= 0) {
-        // UDP发送
-        size_t total_size = sizeof(ht_packet_header_t) + packet->header.payload_size;
-        bytes_sent = sendto(conn->udp_fd, packet, total_size, 0,
-                           (struct sockaddr*)&conn->remote_addr, sizeof(conn->remote_addr));
-    } else {
-        return -1;
+// 紧凑包头解析出的字段（序列号和确认号尚未展开）
+typedef struct {
+    uint8_t type;
+    uint8_t present;
+    uint32_t conn_id;
+    uint32_t flags;
+    uint32_t stream_id;
+    uint8_t path_id;
+    uint16_t sequence;
+    uint16_t ack_sequence;
+    uint32_t payload_size;
+    uint32_t checksum;
+} ht_compact_header_t;
+
+static size_t put_varint(uint8_t* wire, size_t pos, uint32_t value) {
+    while (value >= 0x80) {
+        wire[pos++] = (uint8_t)(value | 0x80);
+        value >>= 7;
     }
+    wire[pos++] = (uint8_t)value;
+    return pos;
+}
 
-    if (bytes_sent > 0) {
-        conn->stats.packets_sent++;
-        conn->stats.bytes_sent += bytes_sent;
-        gettimeofday(&conn->last_activity, NULL);
+// 读取变长整数：返回1成功，数据不足返回0，超过 max_bytes 返回-1
+static int get_varint(const uint8_t* wire, size_t size, size_t* pos, uint32_t* value, int max_bytes) {
+    uint32_t result = 0;
+    for (int i = 0; i < max_bytes; i++) {
+        if (*pos >= size) {
+            return 0;
+        }
+        uint8_t byte = wire[(*pos)++];
+        result |= (uint32_t)(byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 1;
+        }
     }
-
-    return bytes_sent;
+    return -1;
 }
 
-// 接收数据包
-int ht_recv_packet(ht_connection_t* conn, ht_packet_t* packet, int* from_tcp) {
-    if (!conn || !packet || !from_tcp) {
-        return -1;
-    }
+static uint16_t get_u16(const uint8_t* wire) {
+    return (uint16_t)(wire[0] | wire[1] << 8);
+}
 
-    int bytes_received = 0;
-    *from_tcp = 0;
+static uint32_t get_u32(const uint8_t* wire) {
+    return (uint32_t)wire[0] | (uint32_t)wire[1] << 8 | (uint32_t)wire[2] << 16 | (uint32_t)wire[3] << 24;
+}
 
-    // 首先尝试从UDP接收
-    if (conn->udp_fd >= 0) {
-        struct sockaddr_in sender_addr;
-        socklen_t addr_len = sizeof(sender_addr);
+static size_t put_u16(uint8_t* wire, size_t pos, uint16_t value) {
+    wire[pos] = (uint8_t)value;
+    wire[pos + 1] = (uint8_t)(value >> 8);
+    return pos + 2;
+}
 
-        bytes_received = recvfrom(conn->udp_fd, packet, sizeof(ht_packet_t), 0,
-                                 (struct sockaddr*)&sender_addr, &addr_len);
+static size_t put_u32(uint8_t* wire, size_t pos, uint32_t value) {
+    pos = put_u16(wire, pos, (uint16_t)value);
+    return put_u16(wire, pos, (uint16_t)(value >> 16));
+}
 
-        if (bytes_received > 0) {
-            *from_tcp = 0;
-        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            // UDP接收错误
-            return -1;
-        }
+// 解析紧凑包头：返回包头长度，数据不足返回0，格式错误返回-1
+static int parse_compact(const uint8_t* wire, size_t size, ht_compact_header_t* header) {
+    if (size < 2) {
+        return 0;
+    }
+    memset(header, 0, sizeof(*header));
+    header->type = wire[0] & ~HT_COMPACT_MARKER;
+    header->present = wire[1];
+
+    // 定长字段的长度由存在位决定，先确认这些字节都已收到
+    size_t pos = 2;
+    size_t fixed = 2 + 4 + 4 + (header->present & HT_COMPACT_PATH ? 1 : 0) +
+                   (header->present & HT_COMPACT_SEQ ? 2 : 0) + (header->present & HT_COMPACT_ACK ? 2 : 0);
+    if (size < fixed) {
+        return 0;
     }
 
-    // 如果UDP没有数据，尝试从TCP接收
-    if (bytes_received <= 0 && conn->tcp_fd >= 0) {
-        bytes_received = recv(conn->tcp_fd, packet, sizeof(ht_packet_t), 0);
-
-        if (bytes_received > 0) {
-            *from_tcp = 1;
-        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            // TCP接收错误
+    header->conn_id = get_u32(wire + pos);
+    pos += 4;
+    int result = 1;
+    if (header->present & HT_COMPACT_FLAGS) {
+        result = get_varint(wire, size, &pos, &header->flags, 3);
+        if (result <= 0) {
+            return result;
+        }
+        if (header->flags > UINT16_MAX) {
             return -1;
         }
     }
-
-    if (bytes_received > 0) {
-        // 验证数据包
-        if (packet->header.magic != HT_MAGIC) {
-            return -1; // 无效的数据包
-        }
-
-        // 验证校验和
-        uint32_t received_checksum = packet->header.checksum;
-        packet->header.checksum = 0;
-        uint32_t calculated_checksum = ht_calculate_checksum(packet,
-            sizeof(ht_packet_header_t) + packet->header.payload_size);
-
-        if (received_checksum != calculated_checksum) {
-            return -1; // 校验和错误
+    if (header->present & HT_COMPACT_STREAM) {
+        result = get_varint(wire, size, &pos, &header->stream_id, 5);
+        if (result <= 0) {
+            return result;
         }
-
-        packet->header.checksum = received_checksum;
-
-        conn->stats.packets_received++;
-        conn->stats.bytes_received += bytes_received;
-        gettimeofday(&conn->last_activity, NULL);
     }
+    if (header->present & HT_COMPACT_PATH) {
+        header->path_id = wire[pos++];
+    }
+    if (header->present & HT_COMPACT_SEQ) {
+        header->sequence = get_u16(wire + pos);
+        pos += 2;
+    }
+    if (header->present & HT_COMPACT_ACK) {
+        header->ack_sequence = get_u16(wire + pos);
+        pos += 2;
+    }
+    result = get_varint(wire, size, &pos, &header->payload_size, 3);
+    if (result <= 0) {
+        return result;
+    }
+    if (header->payload_size > HT_MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+    if (size < pos + 4) {
+        return 0;
+    }
+    header->checksum = get_u32(wire + pos);
+    return (int)(pos + 4);
+}
 
-    return bytes_received;
+// 紧凑包头对应的完整包头：不传输的字段取0，序列号和确认号只在数据包和确认包中保留
+static void compact_canonical(ht_packet_header_t* canonical, const ht_packet_header_t* header, uint64_t conn_id) {
+    memset(canonical, 0, sizeof(*canonical));
+    canonical->magic = HT_MAGIC;
+    canonical->version = 1;
+    canonical->type = header->type;
+    canonical->flags = header->flags;
+    canonical->sequence = header->type == HT_TYPE_DATA ? header->sequence : 0;
+    canonical->ack_sequence = header->type == HT_TYPE_ACK ? header->ack_sequence : 0;
+    canonical->payload_size = header->payload_size;
+    canonical->conn_id = conn_id;
+    canonical->stream_id = header->stream_id;
+    canonical->path_id = header->path_id;
 }
 
-// 更新RTT统计
-void ht_update_rtt(ht_connection_t* conn, uint32_t rtt) {
+// 编码紧凑包头，返回包头长度（载荷另行发送）
+static size_t encode_compact(const ht_packet_header_t* header, const uint8_t* payload, uint8_t* wire) {
+    uint8_t present = 0;
+    size_t pos = put_u32(wire, 2, (uint32_t)header->conn_id);
+
+    if (header->flags) {
+        present |= HT_COMPACT_FLAGS;
+        pos = put_varint(wire, pos, header->flags);
+    }
+    if (header->stream_id) {
+        present |= HT_COMPACT_STREAM;
+        pos = put_varint(wire, pos, header->stream_id);
+    }
+    if (header->path_id) {
+        present |= HT_COMPACT_PATH;
+        wire[pos++] = header->path_id;
+    }
+    if (header->type == HT_TYPE_DATA) {
+        present |= HT_COMPACT_SEQ;
+        pos = put_u16(wire, pos, (uint16_t)header->sequence);
+    }
+    if (header->type == HT_TYPE_ACK) {
+        present |= HT_COMPACT_ACK;
+        pos = put_u16(wire, pos, (uint16_t)header->ack_sequence);
+    }
+    pos = put_varint(wire, pos, header->payload_size);
+
+    ht_packet_header_t canonical;
+    compact_canonical(&canonical, header, header->conn_id);
+    uint32_t checksum = checksum_update(0, &canonical, sizeof(canonical));
+    checksum = checksum_update(checksum, payload, header->payload_size);
+    pos = put_u32(wire, pos, checksum);
+
+    wire[0] = HT_COMPACT_MARKER | header->type;
+    wire[1] = present;
+    return pos;
+}
+
+// 16位序列号按参考位置展开为最接近的32位序列号
+static uint32_t expand_sequence(uint32_t reference, uint16_t low) {
+    return reference + (uint32_t)(int16_t)(uint16_t)(low - (uint16_t)reference);
+}
+
+// 把紧凑格式的数据包还原为完整包头格式，wire 可以与 packet 重叠（包头比完整包头短，载荷向后移动）
+// 返回还原后的包长度，格式错误或不属于该连接返回-1
+static int decode_compact(ht_connection_t* conn, const ht_compact_header_t* compact, int header_size,
+                          const uint8_t* wire, size_t size, ht_packet_t* packet) {
+    if ((size_t)header_size + compact->payload_size > size || compact->conn_id != (uint32_t)conn->conn_id) {
+        return -1;
+    }
+
+    ht_packet_header_t fields;
+    memset(&fields, 0, sizeof(fields));
+    fields.type = compact->type;
+    fields.flags = (uint16_t)compact->flags;
+    fields.sequence = expand_sequence(conn->recv_sequence, compact->sequence);
+    fields.ack_sequence = expand_sequence(conn->send_sequence, compact->ack_sequence);
+    fields.payload_size = (uint16_t)compact->payload_size;
+    fields.stream_id = compact->stream_id;
+    fields.path_id = compact->path_id;
+
+    memmove(packet->payload, wire + header_size, compact->payload_size);
+    compact_canonical(&packet->header, &fields, conn->conn_id);
+    packet->header.checksum = compact->checksum;
+    return (int)(sizeof(ht_packet_header_t) + compact->payload_size);
+}
+
+// 把收到的数据包（任一格式）还原为完整包头格式放入 packet，wire 可以就是 packet
+// 返回还原后的包长度，格式错误返回-1；完整包头的包原样返回，由 validate_packet 校验
+static int unpack_packet(ht_connection_t* conn, const uint8_t* wire, size_t size, ht_packet_t* packet) {
+    if (size > 0 && (wire[0] & HT_COMPACT_MARKER)) {
+        ht_compact_header_t compact;
+        int header_size = parse_compact(wire, size, &compact);
+        if (header_size <= 0) {
+            return -1;
+        }
+        return decode_compact(conn, &compact, header_size, wire, size, packet);
+    }
+    if ((const uint8_t*)packet != wire) {
+        memcpy(packet, wire, size);
+    }
+    return (int)size;
+}
+
+// 缓冲区开头一帧的长度：完整包头由 payload_size 决定，紧凑包头由其载荷长度字段决定
+// 返回帧长度，尚未收完返回0，帧错误返回-1
+static int tcp_frame_size(const uint8_t* buffer, size_t length) {
+    size_t need;
+    if (length == 0) {
+        return 0;
+    }
+    if (buffer[0] & HT_COMPACT_MARKER) {
+        ht_compact_header_t compact;
+        int header_size = parse_compact(buffer, length, &compact);
+        if (header_size <= 0) {
+            return header_size;
+        }
+        need = header_size + compact.payload_size;
+    } else {
+        if (length < sizeof(ht_packet_header_t)) {
+            return 0;
+        }
+        const ht_packet_header_t* header = (const ht_packet_header_t*)buffer;
+        if (header->magic != HT_MAGIC || header->payload_size > HT_MAX_PAYLOAD_SIZE) {
+            return -1;
+        }
+        need = sizeof(ht_packet_header_t) + header->payload_size;
+    }
+    return length >= need ? (int)need : 0;
+}
+
+// 从TCP读取一个完整帧。紧凑包头的长度要边解析边确定，所以按缓冲区剩余空间整块读取，
+// 可能读入下一帧的开头，处理完本帧后用 consume_tcp_frame 移走
+// 返回帧长度，尚未收完返回0，连接关闭或帧错误返回-1
+static int read_tcp_frame(int fd, uint8_t* buffer, size_t* length) {
+    for (;;) {
+        int frame_size = tcp_frame_size(buffer, *length);
+        if (frame_size != 0) {
+            return frame_size;
+        }
+
+        ssize_t n = recv(fd, buffer + *length, sizeof(ht_packet_t) - *length, 0);
+        if (n > 0) {
+            *length += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+// 移走缓冲区开头已处理的一帧
+static void consume_tcp_frame(uint8_t* buffer, size_t* length, size_t frame_size) {
+    *length -= frame_size;
+    memmove(buffer, buffer + frame_size, *length);
+}
+
+// 发送上次未发完的TCP帧，全部发完返回0
+static int flush_tcp_tx(ht_connection_t* conn) {
+    while (conn->tcp_tx_offset < conn->tcp_tx_len) {
+        ssize_t sent = send(conn->tcp_fd, conn->tcp_tx + conn->tcp_tx_offset,
+                            conn->tcp_tx_len - conn->tcp_tx_offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                close_tcp_channel(conn);
+            }
+            return -1;
+        }
+        conn->tcp_tx_offset += sent;
+    }
+    conn->tcp_tx_len = 0;
+    conn->tcp_tx_offset = 0;
+    return 0;
+}
+
+// 记录收到的数据包
+static void record_received(ht_connection_t* conn, size_t size) {
+    conn->stats.packets_received++;
+    conn->stats.bytes_received += size;
+    gettimeofday(&conn->last_activity, NULL);
+}
+
+// 销毁混合传输连接
+void ht_destroy_connection(ht_connection_t* conn) {
+    if (!conn) {
+        return;
+    }
+    
+    // 服务端连接从监听器中移除，UDP socket 属于监听器
+    if (conn->listener) {
+        listener_remove(conn->listener, conn);
+    } else {
+        for (int i = 0; i < conn->path_count; i++) {
+            if (conn->paths[i].udp_fd >= 0) {
+                close(conn->paths[i].udp_fd);
+            }
+        }
+    }
+    if (conn->tcp_fd >= 0) {
+        close(conn->tcp_fd);
+    }
+    
+    // 清理发送缓冲区
+    ht_send_buffer_entry_t* send_entry = conn->send_buffer;
+    while (send_entry) {
+        ht_send_buffer_entry_t* next = send_entry->next;
+        free_send_entry(send_entry);
+        send_entry = next;
+    }
+    
+    // 清理接收缓冲区
+    ht_recv_buffer_entry_t* recv_entry = conn->recv_buffer;
+    while (recv_entry) {
+        ht_recv_buffer_entry_t* next = recv_entry->next;
+        free(recv_entry);
+        recv_entry = next;
+    }
+    
+    free(conn);
+}
+
+// 增加一条从指定本地地址发出的UDP子路径，须在 ht_connect 之前调用
+int ht_add_path(ht_connection_t* conn, const char* local_ip) {
+    if (!conn || conn->is_connected || conn->listener || conn->path_count >= HT_MAX_PATHS) {
+        return -1;
+    }
+
+    ht_path_t* path = &conn->paths[conn->path_count];
+    memset(path, 0, sizeof(*path));
+    path->local_addr.sin_family = AF_INET;
+    if (inet_pton(AF_INET, local_ip, &path->local_addr.sin_addr) <= 0) {
+        return -1;
+    }
+    path->udp_fd = -1;
+    path->id = (uint8_t)conn->path_count;
+    conn->path_count++;
+    return 0;
+}
+
+// 为每条子路径创建并绑定UDP socket；绑定失败的路径（如该出口的地址不存在）跳过，
+// 至少要有一条可用
+static int open_paths(ht_connection_t* conn) {
+    if (conn->path_count == 0) {
+        memset(&conn->paths[0], 0, sizeof(conn->paths[0]));
+        conn->path_count = 1;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int opened = 0;
+    for (int i = 0; i < conn->path_count; i++) {
+        ht_path_t path = conn->paths[i];
+        path.udp_fd = create_udp_socket();
+        if (path.udp_fd < 0) {
+            continue;
+        }
+        if (path.local_addr.sin_addr.s_addr != 0 &&
+            bind(path.udp_fd, (struct sockaddr*)&path.local_addr, sizeof(path.local_addr)) < 0) {
+            close(path.udp_fd);
+            continue;
+        }
+        path.peer_addr = conn->remote_addr;
+        path.last_recv = now;
+        path.last_heartbeat = now;
+        conn->paths[opened++] = path;
+    }
+    conn->path_count = opened;
+    conn->udp_fd = opened > 0 ? conn->paths[0].udp_fd : -1;
+    return opened > 0 ? 0 : -1;
+}
+
+static void close_paths(ht_connection_t* conn) {
+    for (int i = 0; i < conn->path_count; i++) {
+        if (conn->paths[i].udp_fd >= 0) {
+            close(conn->paths[i].udp_fd);
+        }
+    }
+    conn->path_count = 0;
+    conn->udp_fd = -1;
+}
+
+// 连接到远程主机
+int ht_connect(ht_connection_t* conn) {
+    if (!conn || conn->is_connected) {
+        return -1;
+    }
+    
+    // 创建UDP socket（每条子路径一个）
+    if (conn->mode != HT_MODE_TCP_ONLY) {
+        if (open_paths(conn) < 0) {
+            return -1;
+        }
+    }
+    
+    // 创建TCP socket
+    if (conn->mode != HT_MODE_UDP_ONLY) {
+        conn->tcp_fd = create_tcp_socket();
+        if (conn->tcp_fd < 0) {
+            close_paths(conn);
+            return -1;
+        }
+        
+        // 尝试TCP连接
+        int result = connect(conn->tcp_fd, (struct sockaddr*)&conn->remote_addr, 
+                           sizeof(conn->remote_addr));
+        if (result < 0 && errno != EINPROGRESS) {
+            close(conn->tcp_fd);
+            conn->tcp_fd = -1;
+            if (conn->mode == HT_MODE_TCP_ONLY) {
+                close_paths(conn);
+                return -1;
+            }
+        }
+    }
+    
+    conn->is_connected = 1;
+    gettimeofday(&conn->last_activity, NULL);
+
+    // 发送SYN，对端收到后回复SYN_ACK（丢失时由 ht_handle_timeout 重发）
+    gettimeofday(&conn->syn_time, NULL);
+    send_control(conn, HT_CONTROL_SYN);
+    
+    return 0;
+}
+
+// 断开连接
+int ht_disconnect(ht_connection_t* conn) {
+    if (!conn || !conn->is_connected) {
+        return -1;
+    }
+    
+    conn->is_closing = 1;
+    
+    // 发送关闭通知包
+    ht_packet_header_t close_header;
+    memset(&close_header, 0, sizeof(close_header));
+    close_header.magic = HT_MAGIC;
+    close_header.version = 1;
+    close_header.type = HT_TYPE_CONTROL;
+    close_header.flags = HT_CONTROL_CLOSE;
+    close_header.sequence = conn->send_sequence; // 非数据包不占用序列号
+    close_header.timestamp = get_timestamp_ms();
+    
+    // 尝试通过两个通道发送关闭包
+    if (conn->udp_fd >= 0) {
+        transmit(conn, &close_header, NULL, 0, -1);
+    }
+    if (conn->tcp_fd >= 0) {
+        transmit(conn, &close_header, NULL, 1, -1);
+    }
+    
+    conn->is_connected = 0;
+    return 0;
+}
+
+// 获取连接统计信息
+void ht_get_stats(ht_connection_t* conn, ht_connection_stats_t* stats) {
+    if (!conn || !stats) {
+        return;
+    }
+    
+    *stats = conn->stats;
+    
+    // 传输比例按各通道实际发出的数据包计算，丢包率为所有通道最近2秒的合计
+    uint32_t now_ms = get_timestamp_ms();
+    uint64_t udp_packets = 0;
+    uint32_t window_sent = 0, window_lost = 0;
+    for (int i = -1; i < conn->path_count; i++) {
+        ht_path_t* path = channel_of(conn, i);
+        if (i >= 0) {
+            udp_packets += path->counters.data_packets;
+        }
+        loss_window_advance(&path->loss_window, now_ms);
+        window_sent += path->loss_window.window_sent;
+        window_lost += path->loss_window.window_lost;
+    }
+    uint64_t total_packets = udp_packets + conn->tcp_path.counters.data_packets;
+    if (total_packets > 0) {
+        stats->udp_ratio = (float)udp_packets / total_packets;
+        stats->tcp_ratio = 1.0f - stats->udp_ratio;
+    }
+    stats->packet_loss_rate = loss_rate(window_sent, window_lost);
+}
+
+// 各通道的统计快照：第一项为TCP通道，其后为各UDP子路径；返回填写的项数。
+// 只复制计数并前移丢包率窗口，可以每轮事件循环调用
+int ht_get_path_stats(ht_connection_t* conn, ht_path_stats_t* stats, int max_paths) {
+    if (!conn || !stats) {
+        return 0;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint32_t now_ms = timeval_ms(&now);
+    int count = 0;
+    for (int i = -1; i < conn->path_count && count < max_paths; i++) {
+        ht_path_t* path = channel_of(conn, i);
+        ht_path_stats_t* out = &stats[count++];
+        loss_window_advance(&path->loss_window, now_ms);
+        out->is_tcp = i < 0;
+        out->id = i < 0 ? 0 : path->id;
+        out->usable = i < 0 ? conn->tcp_fd >= 0 : path_usable(path, &now);
+        out->srtt = path->srtt;
+        out->loss_rate = loss_rate(path->loss_window.window_sent, path->loss_window.window_lost);
+        out->mtu = i < 0 ? 0 : path_mtu(path);
+        out->counters = path->counters;
+    }
+    return count;
+}
+
+// 重置统计信息
+void ht_reset_stats(ht_connection_t* conn) {
+    if (!conn) {
+        return;
+    }
+
+    memset(&conn->stats, 0, sizeof(conn->stats));
+    conn->stats.rtt_min = UINT32_MAX;
+    for (int i = -1; i < conn->path_count; i++) {
+        ht_path_t* path = channel_of(conn, i);
+        memset(&path->counters, 0, sizeof(path->counters));
+        memset(&path->loss_window, 0, sizeof(path->loss_window));
+    }
+}
+
+// 判断新数据是否应该使用TCP传输：通道由 update_channel 定期评估，这里只读结果
+int ht_should_use_tcp(ht_connection_t* conn) {
     if (!conn) {
+        return 0;
+    }
+
+    // 如果只有TCP模式，总是使用TCP
+    if (conn->mode == HT_MODE_TCP_ONLY) {
+        return 1;
+    }
+
+    // 如果只有UDP模式，总是使用UDP
+    if (conn->mode == HT_MODE_UDP_ONLY) {
+        return 0;
+    }
+
+    return conn->data_over_tcp || conn->udp_preference <= 0.0f;
+}
+
+// 评估新数据的通道。UDP丢包率取各子路径最近2秒的滑动窗口合计，样本不足 HT_CHANNEL_MIN_SAMPLES 时不作为
+// 切换依据（单次丢包不会触发切换）。丢包率超过 udp_preference*HT_UDP_LOSS_LIMIT，或最好的UDP路径RTT明显高于
+// TCP通道（UDP被限速或降级）时改用TCP；丢包率降到门限的1/4以下且RTT不再落后时才切回UDP。
+// 走TCP期间UDP没有新的数据样本，旧的丢包移出窗口后再回UDP试探，仍然丢包会很快切回TCP
+static void update_channel(ht_connection_t* conn, struct timeval* now) {
+    if (conn->mode == HT_MODE_TCP_ONLY || conn->mode == HT_MODE_UDP_ONLY ||
+        time_diff_ms(&conn->channel_time, now) < HT_CHANNEL_HOLD) {
         return;
     }
+    conn->channel_time = *now;
+
+    int best = lowest_latency_path(conn, -1, now);
+    if (conn->tcp_fd < 0 || best < 0 || conn->udp_preference <= 0.0f) {
+        conn->data_over_tcp = conn->tcp_fd >= 0;
+        return;
+    }
+
+    uint32_t now_ms = timeval_ms(now);
+    uint32_t sent = 0, lost = 0;
+    for (int i = 0; i < conn->path_count; i++) {
+        loss_window_advance(&conn->paths[i].loss_window, now_ms);
+        sent += conn->paths[i].loss_window.window_sent;
+        lost += conn->paths[i].loss_window.window_lost;
+    }
+    float udp_loss = sent >= HT_CHANNEL_MIN_SAMPLES ? loss_rate(sent, lost) : 0.0f;
+
+    float loss_limit = conn->udp_preference * HT_UDP_LOSS_LIMIT;
+    uint32_t srtt = conn->paths[best].srtt ? conn->paths[best].srtt : conn->stats.rtt_avg;
+    uint32_t tcp_srtt = conn->tcp_path.srtt;
+    if (!conn->data_over_tcp) {
+        if (udp_loss > loss_limit || (tcp_srtt && srtt > tcp_srtt * 2 + HT_CHANNEL_RTT_SLACK)) {
+            conn->data_over_tcp = 1;
+        }
+    } else if (udp_loss < loss_limit / 4 && (!tcp_srtt || srtt <= tcp_srtt + HT_CHANNEL_RTT_SLACK)) {
+        conn->data_over_tcp = 0;
+    }
+}
+
+// 发送数据包：UDP经指定子路径发出，path 为-1时按交互包选择路径。
+// 包头就地补全连接ID、路径ID和校验和，载荷不复制，与包头分两段交给 sendmsg
+static int transmit(ht_connection_t* conn, ht_packet_header_t* header, const uint8_t* payload,
+                    int use_tcp, int path) {
+    if (!use_tcp && path < 0) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        path = choose_path(conn, 1, &now);
+    }
+
+    header->conn_id = conn->conn_id;
+    header->path_id = !use_tcp && path >= 0 ? conn->paths[path].id : 0;
+
+    // 协商了紧凑包头时另行编码包头，否则计算校验和后直接发送完整包头
+    uint8_t compact[HT_COMPACT_MAX_HEADER];
+    struct iovec iov[2];
+    if (conn->compact_tx && header->type != HT_TYPE_CONTROL && header->type != HT_TYPE_PROBE) {
+        iov[0].iov_base = compact;
+        iov[0].iov_len = encode_compact(header, payload, compact);
+    } else {
+        header->checksum = 0;
+        header->checksum = checksum_update(checksum_update(0, header, sizeof(*header)),
+                                           payload, header->payload_size);
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(*header);
+    }
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = header->payload_size;
+    size_t total_size = iov[0].iov_len + iov[1].iov_len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    int bytes_sent = 0;
+
+    if (use_tcp && conn->tcp_fd >= 0) {
+        // TCP发送：先发完上一帧的剩余部分以保持帧边界
+        if (flush_tcp_tx(conn) < 0) {
+            return -1;
+        }
+        ssize_t sent = sendmsg(conn->tcp_fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            // 连接尚未建立或缓冲区满时不发送，由调用方改走UDP或稍后重传
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOTCONN && errno != EINTR) {
+                close_tcp_channel(conn);
+            }
+            return -1;
+        }
+        if ((size_t)sent < total_size) {
+            // 剩余部分暂存，下次发送前补发
+            size_t offset = sent;
+            conn->tcp_tx_len = 0;
+            conn->tcp_tx_offset = 0;
+            for (int i = 0; i < 2; i++) {
+                if (offset >= iov[i].iov_len) {
+                    offset -= iov[i].iov_len;
+                    continue;
+                }
+                memcpy(conn->tcp_tx + conn->tcp_tx_len, (uint8_t*)iov[i].iov_base + offset, iov[i].iov_len - offset);
+                conn->tcp_tx_len += iov[i].iov_len - offset;
+                offset = 0;
+            }
+        }
+        bytes_sent = total_size;
+    } else if (!use_tcp && path >= 0 && path < conn->path_count && conn->paths[path].udp_fd >= 0) {
+        // UDP发送
+        msg.msg_name = &conn->paths[path].peer_addr;
+        msg.msg_namelen = sizeof(conn->paths[path].peer_addr);
+        bytes_sent = sendmsg(conn->paths[path].udp_fd, &msg, 0);
+    } else {
+        return -1;
+    }
+
+    // 只统计发送；last_activity 只随收包更新，用于发现对端失联
+    if (bytes_sent > 0) {
+        conn->stats.packets_sent++;
+        conn->stats.bytes_sent += bytes_sent;
+        ht_path_t* channel = use_tcp ? &conn->tcp_path : &conn->paths[path];
+        channel->counters.packets_sent++;
+        channel->counters.bytes_sent += bytes_sent;
+        if (header->type == HT_TYPE_DATA) {
+            channel->counters.data_packets++;
+            loss_window_add(&channel->loss_window, get_timestamp_ms(), 1, 0);
+        }
+    }
+
+    return bytes_sent;
+}
+
+// 发送数据包
+int ht_send_packet(ht_connection_t* conn, ht_packet_t* packet, int use_tcp) {
+    if (!conn || !packet) {
+        return -1;
+    }
+    return transmit(conn, &packet->header, packet->payload, use_tcp, -1);
+}
+
+// 接收数据包；返回包长度，没有可用数据返回0。path 返回收包的子路径下标，TCP为-1
+static int recv_packet(ht_connection_t* conn, ht_packet_t* packet, int* path) {
+    *path = -1;
+
+    // 首先依次尝试各子路径的UDP（服务端连接的UDP包由监听器分发）
+    for (int i = 0; i < conn->path_count && !conn->listener; i++) {
+        ht_path_t* udp_path = &conn->paths[i];
+        while (udp_path->udp_fd >= 0) {
+            struct sockaddr_in sender_addr;
+            socklen_t addr_len = sizeof(sender_addr);
+
+            ssize_t bytes_received = recvfrom(udp_path->udp_fd, packet, sizeof(ht_packet_t), 0,
+                                              (struct sockaddr*)&sender_addr, &addr_len);
+            if (bytes_received < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    // UDP接收错误
+                    return -1;
+                }
+                break;
+            }
+
+            // 丢弃无效、不属于本连接或不是来自对端地址的数据包
+            int size = unpack_packet(conn, (const uint8_t*)packet, bytes_received, packet);
+            if (size < 0 || validate_packet(packet, size) < 0 || packet->header.conn_id != conn->conn_id ||
+                !same_address(&sender_addr, &udp_path->peer_addr)) {
+                continue;
+            }
+
+            record_received(conn, bytes_received);
+            udp_path->last_recv = conn->last_activity;
+            *path = i;
+            return bytes_received;
+        }
+    }
+
+    // 如果UDP没有数据，尝试从TCP接收一个完整帧
+    if (conn->tcp_fd >= 0) {
+        int frame_size = read_tcp_frame(conn->tcp_fd, conn->tcp_rx, &conn->tcp_rx_len);
+        if (frame_size < 0) {
+            close_tcp_channel(conn);
+            return 0;
+        }
+        if (frame_size > 0) {
+            int size = unpack_packet(conn, conn->tcp_rx, frame_size, packet);
+            consume_tcp_frame(conn->tcp_rx, &conn->tcp_rx_len, frame_size);
+
+            // TCP上的帧错误说明流已不同步，只能关闭该通道
+            if (size < 0 || validate_packet(packet, size) < 0 || packet->header.conn_id != conn->conn_id) {
+                close_tcp_channel(conn);
+                return 0;
+            }
+
+            record_received(conn, frame_size);
+            return frame_size;
+        }
+    }
+
+    return 0;
+}
+
+// 接收数据包；返回包长度，没有可用数据返回0
+int ht_recv_packet(ht_connection_t* conn, ht_packet_t* packet, int* from_tcp) {
+    if (!conn || !packet || !from_tcp) {
+        return -1;
+    }
+
+    int path;
+    int result = recv_packet(conn, packet, &path);
+    *from_tcp = result > 0 && path < 0;
+    return result;
+}
+
+// 更新RTT统计
+void ht_update_rtt(ht_connection_t* conn, uint32_t rtt) {
+    if (!conn) {
+        return;
+    }
+
+    if (rtt < conn->stats.rtt_min) {
+        conn->stats.rtt_min = rtt;
+    }
+
+    if (rtt > conn->stats.rtt_max) {
+        conn->stats.rtt_max = rtt;
+    }
+
+    // 计算平均RTT (使用指数移动平均)
+    if (conn->stats.rtt_avg == 0) {
+        conn->stats.rtt_avg = rtt;
+    } else {
+        conn->stats.rtt_avg = (conn->stats.rtt_avg * 7 + rtt) / 8;
+    }
+}
+
+// 发送应用数据：每段数据复制一次到缓冲块，切成的各个数据包都引用这块数据
+int ht_send_data(ht_connection_t* conn, const void* data, size_t size) {
+    if (!conn || !data || size == 0 || !conn->is_connected) {
+        return -1;
+    }
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    size_t bytes_sent = 0;
+
+    while (bytes_sent < size) {
+        // 计算本次复制的数据大小，实际载荷由所选路径的MTU决定
+        size_t chunk_size = size - bytes_sent;
+        if (chunk_size > HT_MAX_PAYLOAD_SIZE) {
+            chunk_size = HT_MAX_PAYLOAD_SIZE;
+        }
+
+        ht_slab_t* slab = ht_slab_alloc(chunk_size);
+        if (!slab) {
+            break;
+        }
+        memcpy(slab->data, bytes + bytes_sent, chunk_size);
+
+        size_t offset = 0;
+        while (offset < chunk_size) {
+            int result = ht_send_stream_slab(conn, 0, 0, slab, offset, chunk_size - offset);
+            if (result <= 0) {
+                break;
+            }
+            offset += result;
+        }
+        ht_slab_release(slab);
+
+        bytes_sent += offset;
+        if (offset < chunk_size) {
+            break;
+        }
+    }
+
+    return bytes_sent;
+}
+
+// 复制数据到新的缓冲块后按 ht_send_stream_slab 发送
+int ht_send_stream_packet(ht_connection_t* conn, uint32_t stream_id, uint16_t flags,
+                          const void* data, size_t size) {
+    if (size > HT_MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    ht_slab_t* slab = NULL;
+    if (size > 0) {
+        slab = ht_slab_alloc(size);
+        if (!slab) {
+            return -1;
+        }
+        memcpy(slab->data, data, size);
+    }
+    int result = ht_send_stream_slab(conn, stream_id, flags, slab, 0, size);
+    ht_slab_release(slab);
+    return result;
+}
+
+// 发送一个数据包并放入发送缓冲区，载荷为 slab 中从 offset 开始的数据，条目持有 slab 的一个引用。
+// 返回实际放入的载荷字节数：超过所选UDP路径MTU的部分留给调用方下次发送，此时不带FIN。
+// 走TCP时按延迟最低的UDP路径截断，TCP暂时发不出时可以改走UDP。
+// 两个通道暂时都发不出时也保留在缓冲区中，由重传补发
+int ht_send_stream_slab(ht_connection_t* conn, uint32_t stream_id, uint16_t flags,
+                        ht_slab_t* slab, size_t offset, size_t size) {
+    if (!conn || !conn->is_connected || size > HT_MAX_PAYLOAD_SIZE ||
+        (size > 0 && (!slab || offset + size > slab->capacity)) ||
+        (conn->udp_fd < 0 && conn->tcp_fd < 0)) {
+        return -1;
+    }
+
+    // 决定使用哪个传输通道和UDP子路径，据此确定载荷大小
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int interactive = size <= HT_INTERACTIVE_PAYLOAD;
+    update_channel(conn, &now);
+    int use_tcp = ht_should_use_tcp(conn);
+    int path = use_tcp ? -1 : choose_path(conn, interactive, &now);
+    size_t limit = path_payload_limit(conn, use_tcp ? lowest_latency_path(conn, -1, &now) : path);
+    if (size > limit) {
+        size = limit;
+        flags &= ~HT_DATA_FIN;
+    }
+
+    ht_send_buffer_entry_t* entry = malloc(sizeof(ht_send_buffer_entry_t));
+    if (!entry) {
+        return -1;
+    }
+
+    // 就地填写包头，载荷引用缓冲块
+    ht_packet_header_t* header = &entry->header;
+    memset(header, 0, sizeof(*header));
+    header->magic = HT_MAGIC;
+    header->version = 1;
+    header->type = HT_TYPE_DATA;
+    header->flags = flags;
+    header->sequence = conn->send_sequence++;
+    header->ack_sequence = conn->ack_sequence;
+    header->window_size = conn->recv_window_size;
+    header->payload_size = size;
+    header->timestamp = get_timestamp_ms();
+    header->stream_id = stream_id;
+    entry->slab = size > 0 ? slab : NULL;
+    entry->payload = size > 0 ? slab->data + offset : NULL;
+    if (entry->slab) {
+        entry->slab->refs++;
+    }
+
+    // 首选通道失败时尝试另一个
+    if (transmit(conn, header, entry->payload, use_tcp, path) < 0) {
+        use_tcp = !use_tcp;
+        path = use_tcp ? -1 : choose_path(conn, interactive, &now);
+        transmit(conn, header, entry->payload, use_tcp, path);
+    }
+
+    // 交互包可在次优路径上再发一份，任一路径送达即可，接收方按序列号去重
+    if (interactive && !use_tcp && conn->duplicate_interactive) {
+        int backup = lowest_latency_path(conn, path, &now);
+        if (backup >= 0) {
+            transmit(conn, header, entry->payload, 0, backup);
+        }
+    }
+
+    // 将数据包添加到发送缓冲区（用于重传）
+    entry->send_time = now;
+    entry->path = path;
+    entry->retransmit_count = 0;
+    entry->next = conn->send_buffer;
+    conn->send_buffer = entry;
+    conn->inflight++;
+
+    return (int)size;
+}
+
+// 拥塞窗口还允许发送的数据包数
+int ht_send_budget(ht_connection_t* conn) {
+    if (!conn || !conn->is_connected || !conn->handshake_complete) {
+        return 0;
+    }
+    return conn->inflight < conn->cwnd ? (int)(conn->cwnd - conn->inflight) : 0;
+}
+
+// 发送窗口包：不占用序列号，丢失时由发送方的阻塞探测触发重发
+int ht_send_window(ht_connection_t* conn, uint32_t stream_id, uint16_t flags, uint64_t max_offset) {
+    if (!conn || !conn->is_connected) {
+        return -1;
+    }
+
+    ht_packet_t packet;
+    memset(&packet.header, 0, sizeof(packet.header));
+    packet.header.magic = HT_MAGIC;
+    packet.header.version = 1;
+    packet.header.type = HT_TYPE_WINDOW;
+    packet.header.flags = flags;
+    packet.header.sequence = conn->send_sequence;
+    packet.header.timestamp = get_timestamp_ms();
+    packet.header.stream_id = stream_id;
+    packet.header.payload_size = sizeof(max_offset);
+    memcpy(packet.payload, &max_offset, sizeof(max_offset));
+
+    int prefer_tcp = conn->mode == HT_MODE_TCP_ONLY;
+    int result = ht_send_packet(conn, &packet, prefer_tcp);
+    if (result < 0) {
+        result = ht_send_packet(conn, &packet, !prefer_tcp);
+    }
+    return result;
+}
+
+void ht_set_window_handler(ht_connection_t* conn, ht_window_handler_t handler, void* ctx) {
+    if (!conn) {
+        return;
+    }
+    conn->window_handler = handler;
+    conn->window_ctx = ctx;
+}
+
+// 取出下一个按序到达的数据包（调用方负责释放），没有时返回NULL
+ht_recv_buffer_entry_t* ht_take_ordered(ht_connection_t* conn) {
+    if (!conn) {
+        return NULL;
+    }
+
+    ht_recv_buffer_entry_t* prev = NULL;
+    for (ht_recv_buffer_entry_t* entry = conn->recv_buffer; entry; prev = entry, entry = entry->next) {
+        if (entry->received && entry->packet.header.sequence == conn->recv_sequence) {
+            if (prev) {
+                prev->next = entry->next;
+            } else {
+                conn->recv_buffer = entry->next;
+            }
+            entry->next = NULL;
+            conn->recv_sequence++;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// 接收应用数据
+int ht_recv_data(ht_connection_t* conn, void* buffer, size_t buffer_size) {
+    if (!conn || !buffer || buffer_size == 0 || !conn->is_connected) {
+        return -1;
+    }
+
+    uint8_t* bytes = (uint8_t*)buffer;
+    size_t bytes_received = 0;
+
+    // 处理接收缓冲区中的有序数据
+    ht_recv_buffer_entry_t* entry = conn->recv_buffer;
+    ht_recv_buffer_entry_t* prev = NULL;
+
+    while (entry && bytes_received < buffer_size) {
+        if (entry->received && entry->packet.header.sequence == conn->recv_sequence) {
+            // 找到下一个期望的数据包；放不下整个包时留到下次读取，避免截断丢数据
+            size_t copy_size = entry->packet.header.payload_size;
+            if (copy_size > buffer_size - bytes_received) {
+                break;
+            }
+
+            memcpy(bytes + bytes_received, entry->packet.payload, copy_size);
+            bytes_received += copy_size;
+            conn->recv_sequence++;
+
+            // 从缓冲区中移除已处理的数据包
+            if (prev) {
+                prev->next = entry->next;
+            } else {
+                conn->recv_buffer = entry->next;
+            }
+
+            free(entry);
+
+            // 缓冲区无序，从头查找下一个序列号
+            prev = NULL;
+            entry = conn->recv_buffer;
+        } else {
+            prev = entry;
+            entry = entry->next;
+        }
+    }
+
+    return bytes_received;
+}
+
+// 拥塞控制：每个确认在慢启动阶段加一个包，拥塞避免阶段每个窗口加一个包
+static void congestion_on_ack(ht_connection_t* conn) {
+    if (conn->cwnd >= HT_MAX_CWND) {
+        return;
+    }
+    if (conn->cwnd < conn->ssthresh) {
+        conn->cwnd++;
+    } else if (++conn->cwnd_acc >= conn->cwnd) {
+        conn->cwnd_acc = 0;
+        conn->cwnd++;
+    }
+}
+
+// 拥塞控制：重传超时视为拥塞，窗口减半；同一RTT内的多次超时只减一次
+static void congestion_on_loss(ht_connection_t* conn, struct timeval* now) {
+    uint32_t interval = conn->stats.rtt_avg > (uint32_t)conn->retransmit_timeout ?
+                        conn->stats.rtt_avg : (uint32_t)conn->retransmit_timeout;
+    if (conn->recovery_start.tv_sec != 0 && time_diff_ms(&conn->recovery_start, now) < interval) {
+        return;
+    }
+    conn->ssthresh = conn->cwnd / 2 > 2 ? conn->cwnd / 2 : 2;
+    conn->cwnd = conn->ssthresh;
+    conn->cwnd_acc = 0;
+    conn->recovery_start = *now;
+}
+
+// 处理单个数据包；path 为收包的UDP子路径下标，TCP或尚未验证的路径为-1
+// 重传经MTU容得下该数据报的延迟最低的UDP路径；都容不下（MTU刚变小）时仍按延迟选择
+static int retransmit_path(ht_connection_t* conn, size_t datagram, struct timeval* now) {
+    int best = -1;
+    uint32_t best_latency = UINT32_MAX;
+    for (int i = 0; i < conn->path_count; i++) {
+        ht_path_t* path = &conn->paths[i];
+        if (!path_usable(path, now) || path_mtu(path) < datagram) {
+            continue;
+        }
+        uint32_t latency = path_latency(conn, path);
+        if (latency < best_latency) {
+            best = i;
+            best_latency = latency;
+        }
+    }
+    return best >= 0 ? best : choose_path(conn, 1, now);
+}
+
+static int send_probe(ht_connection_t* conn, int path, uint16_t flags, uint16_t size) {
+    ht_packet_t packet;
+    memset(&packet.header, 0, sizeof(packet.header));
+    packet.header.magic = HT_MAGIC;
+    packet.header.version = 1;
+    packet.header.type = HT_TYPE_PROBE;
+    packet.header.flags = flags;
+    packet.header.sequence = conn->send_sequence; // 非数据包不占用序列号
+    packet.header.timestamp = get_timestamp_ms();
+    // 探测包填充到探测大小，应答只带回大小
+    packet.header.payload_size = flags & HT_PROBE_ACK ? sizeof(size) : size - HT_HEADER_SIZE;
+    memset(packet.payload, 0, packet.header.payload_size);
+    memcpy(packet.payload, &size, sizeof(size));
+    return transmit(conn, &packet.header, packet.payload, 0, path);
+}
+
+// 探测包的应答超时：两倍平滑RTT，不短于重传超时
+static uint32_t probe_timeout(const ht_connection_t* conn, const ht_path_t* path) {
+    uint32_t srtt = path->srtt ? path->srtt : conn->stats.rtt_avg;
+    return srtt * 2 > (uint32_t)conn->retransmit_timeout ? srtt * 2 : (uint32_t)conn->retransmit_timeout;
+}
+
+// 路径MTU探测（DPLPMTUD）：每条路径同时只有一个探测在途，先探测以太网大小，之后在已确认大小和上界之间二分；
+// 同一大小连续 HT_PLPMTU_MAX_PROBES 次无应答或本机直接拒绝（EMSGSIZE）即降低上界。返回发出的探测数
+static int pmtu_probe(ht_connection_t* conn, int index, struct timeval* now) {
+    ht_path_t* path = &conn->paths[index];
+    if (!path_usable(path, now)) {
+        return 0;
+    }
+
+    uint32_t elapsed = time_diff_ms(&path->probe_time, now);
+    if (path->probe_size) {
+        if (elapsed <= probe_timeout(conn, path)) {
+            return 0;
+        }
+        if (path->probe_count >= HT_PLPMTU_MAX_PROBES) {
+            path->probe_ceiling = path->probe_size - 1;
+            path->probe_size = 0;
+        }
+    } else if (path->probe_done) {
+        if (elapsed < HT_PLPMTU_RAISE_INTERVAL) {
+            return 0;
+        }
+        path->probe_done = 0;
+        path->probe_ceiling = 0;
+    }
+
+    uint16_t mtu = path_mtu(path);
+    uint16_t ceiling = path_ceiling(path);
+    if (!path->probe_size) {
+        if (ceiling < mtu + HT_PLPMTU_SEARCH_STEP) {
+            path->probe_done = 1;
+            path->probe_time = *now;
+            return 0;
+        }
+        path->probe_size = mtu < HT_PLPMTU_FIRST_PROBE && ceiling >= HT_PLPMTU_FIRST_PROBE ?
+                           HT_PLPMTU_FIRST_PROBE : (uint16_t)((mtu + ceiling + 1) / 2);
+        path->probe_count = 0;
+    }
+
+    path->probe_time = *now;
+    path->probe_count++;
+    if (send_probe(conn, index, 0, path->probe_size) < 0 && errno == EMSGSIZE) {
+        // 超过本机出口的MTU，不必等待超时
+        path->probe_count = HT_PLPMTU_MAX_PROBES;
+        path->probe_time.tv_sec = 0;
+        path->probe_time.tv_usec = 0;
+        return 0;
+    }
+    return 1;
+}
+
+static void handle_probe(ht_connection_t* conn, ht_packet_t* packet, int path) {
+    int index = path >= 0 ? path : 0;
+    if (index >= conn->path_count) {
+        return;
+    }
+    if (!(packet->header.flags & HT_PROBE_ACK)) {
+        send_probe(conn, index, HT_PROBE_ACK, HT_HEADER_SIZE + packet->header.payload_size);
+        return;
+    }
+
+    uint16_t size;
+    ht_path_t* probed = &conn->paths[index];
+    if (packet->header.payload_size != sizeof(size)) {
+        return;
+    }
+    memcpy(&size, packet->payload, sizeof(size));
+    if (probed->probe_size && size == probed->probe_size) {
+        probed->plpmtu = size;
+        probed->probe_size = 0;
+        probed->blackhole_losses = 0;
+        probed->probe_time.tv_sec = 0;
+        probed->probe_time.tv_usec = 0;
+    }
+}
+
+static void handle_packet(ht_connection_t* conn, ht_packet_t* packet, int from_tcp, int path) {
+    switch (packet->header.type) {
+        case HT_TYPE_DATA:
+            // 处理数据包
+            {
+                // 尚未获知对端初始序列号，不确认，等待对端重传
+                if (!conn->handshake_complete) {
+                    break;
+                }
+
+                // 发送ACK
+                ht_packet_header_t ack_header;
+                memset(&ack_header, 0, sizeof(ack_header));
+                ack_header.magic = HT_MAGIC;
+                ack_header.version = 1;
+                ack_header.type = HT_TYPE_ACK;
+                ack_header.sequence = conn->send_sequence; // 非数据包不占用序列号
+                ack_header.ack_sequence = packet->header.sequence;
+                ack_header.timestamp = get_timestamp_ms();
+
+                // 确认从收包的路径返回，发送方据此估计各路径的RTT
+                if (transmit(conn, &ack_header, NULL, from_tcp, path) < 0) {
+                    transmit(conn, &ack_header, NULL, !from_tcp, -1);
+                }
+
+                // 丢弃重复的数据包（ACK丢失导致的重传）：已交付或已在接收缓冲区中
+                if ((int32_t)(packet->header.sequence - conn->recv_sequence) < 0) {
+                    conn->stats.packets_duplicated++;
+                    break;
+                }
+                ht_recv_buffer_entry_t* existing = conn->recv_buffer;
+                while (existing && existing->packet.header.sequence != packet->header.sequence) {
+                    existing = existing->next;
+                }
+                if (existing) {
+                    conn->stats.packets_duplicated++;
+                    break;
+                }
+
+                // 将数据包添加到接收缓冲区
+                ht_recv_buffer_entry_t* entry = malloc(RECV_ENTRY_SIZE(packet->header.payload_size));
+                if (entry) {
+                    memcpy(&entry->packet, packet, sizeof(packet->header) + packet->header.payload_size);
+                    gettimeofday(&entry->recv_time, NULL);
+                    entry->received = 1;
+                    entry->next = conn->recv_buffer;
+                    conn->recv_buffer = entry;
+                }
+            }
+            break;
+
+        case HT_TYPE_ACK:
+            // 处理ACK包
+            {
+                uint32_t acked_seq = packet->header.ack_sequence;
+
+                // 从发送缓冲区中移除已确认的数据包
+                ht_send_buffer_entry_t* send_entry = conn->send_buffer;
+                ht_send_buffer_entry_t* send_prev = NULL;
+
+                while (send_entry) {
+                    if (send_entry->header.sequence == acked_seq) {
+                        // 计算RTT
+                        struct timeval now;
+                        gettimeofday(&now, NULL);
+                        uint32_t rtt = time_diff_ms(&send_entry->send_time, &now);
+                        ht_update_rtt(conn, rtt);
+                        path_on_ack(conn, send_entry, rtt);
+
+                        // 移除已确认的数据包
+                        if (send_prev) {
+                            send_prev->next = send_entry->next;
+                        } else {
+                            conn->send_buffer = send_entry->next;
+                        }
+
+                        free_send_entry(send_entry);
+                        conn->inflight--;
+                        congestion_on_ack(conn);
+                        break;
+                    }
+                    send_prev = send_entry;
+                    send_entry = send_entry->next;
+                }
+            }
+            break;
+
+        case HT_TYPE_HEARTBEAT:
+            // 处理心跳包
+            gettimeofday(&conn->last_activity, NULL);
+            break;
+
+        case HT_TYPE_PROBE:
+            // MTU探测只经UDP：收到探测包从原路径应答其大小，收到应答则确认探测的大小可用
+            if (!from_tcp) {
+                handle_probe(conn, packet, path);
+            }
+            break;
+
+        case HT_TYPE_WINDOW:
+            // 流控窗口交给流复用层
+            if (conn->window_handler && packet->header.payload_size == sizeof(uint64_t)) {
+                uint64_t max_offset;
+                memcpy(&max_offset, packet->payload, sizeof(max_offset));
+                conn->window_handler(conn->window_ctx, packet->header.stream_id,
+                                     packet->header.flags, max_offset);
+            }
+            break;
+
+        case HT_TYPE_CONTROL:
+            // 处理控制包
+            if ((packet->header.flags & HT_CONTROL_SYN_ACK) && !conn->handshake_complete) {
+                // 对端确认建立，记录其初始序列号
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                conn->recv_sequence = packet->header.sequence;
+                conn->handshake_complete = 1;
+                conn->compact_tx = conn->compact_header && (packet->header.flags & HT_CONTROL_COMPACT);
+                ht_update_rtt(conn, time_diff_ms(&conn->syn_time, &now));
+            }
+            if ((packet->header.flags & HT_CONTROL_PATH_CHALLENGE) &&
+                packet->header.payload_size == sizeof(uint64_t)) {
+                // 对端在验证本端的新地址（或新的子路径），从收到挑战的路径原样带回挑战值
+                uint64_t token;
+                memcpy(&token, packet->payload, sizeof(token));
+                int reply = path >= 0 ? path : 0;
+                if (reply < conn->path_count) {
+                    send_path_control(conn, HT_CONTROL_PATH_RESPONSE, token, conn->paths[reply].udp_fd,
+                                      &conn->paths[reply].peer_addr, conn->paths[reply].id);
+                }
+            }
+            if (packet->header.flags & HT_CONTROL_CLOSE) {
+                conn->is_connected = 0;
+            }
+            break;
+    }
+}
+
+// 处理事件（接收数据包、处理ACK等）
+int ht_process_events(ht_connection_t* conn) {
+    if (!conn || !conn->is_connected) {
+        return -1;
+    }
+
+    ht_packet_t packet;
+    int path;
+    int processed = 0;
+
+    // 处理所有可用的数据包
+    conn->rx_dispatched = 0;
+    while (recv_packet(conn, &packet, &path) > 0) {
+        processed++;
+        handle_packet(conn, &packet, path < 0, path);
+    }
+
+    return processed;
+}
+
+// 处理超时事件（重传、心跳等）
+int ht_handle_timeout(ht_connection_t* conn) {
+    if (!conn || !conn->is_connected) {
+        return -1;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int actions = 0;
+
+    // 握手未完成：重发SYN；对端此前丢弃了数据包，握手完成前不计重传次数
+    if (!conn->handshake_complete) {
+        if (time_diff_ms(&conn->syn_time, &now) > (uint32_t)conn->retransmit_timeout) {
+            conn->syn_time = now;
+            if (send_control(conn, HT_CONTROL_SYN) > 0) {
+                actions++;
+            }
+        }
+    }
+
+    if (conn->handshake_complete) {
+        update_channel(conn, &now);
+    }
+
+    // 检查发送缓冲区中需要重传的数据包
+    ht_send_buffer_entry_t* entry = conn->handshake_complete ? conn->send_buffer : NULL;
+    ht_send_buffer_entry_t* prev = NULL;
+
+    while (entry) {
+        uint32_t elapsed = time_diff_ms(&entry->send_time, &now);
+
+        if (elapsed > entry_timeout(conn, entry)) {
+            if (entry->retransmit_count < conn->max_retransmit) {
+                // 重传数据包
+                path_on_loss(conn, entry, &now);
+                entry->retransmit_count++;
+                entry->send_time = now;
+
+                // 优先使用TCP重传
+                entry->path = -1;
+                int result = transmit(conn, &entry->header, entry->payload, 1, -1);
+                if (result < 0) {
+                    // TCP失败，经MTU容得下的延迟最低的UDP路径重传
+                    entry->path = retransmit_path(conn, HT_HEADER_SIZE + entry->header.payload_size, &now);
+                    result = transmit(conn, &entry->header, entry->payload, 0, entry->path);
+                }
+
+                if (result > 0) {
+                    conn->stats.packets_retransmitted++;
+                    channel_of(conn, entry->path)->counters.packets_retransmitted++;
+                    actions++;
+                }
+                congestion_on_loss(conn, &now);
+
+                entry = entry->next;
+            } else {
+                // 超过最大重传次数，丢弃数据包
+                conn->stats.packets_lost++;
+                path_on_loss(conn, entry, &now);
+
+                if (prev) {
+                    prev->next = entry->next;
+                } else {
+                    conn->send_buffer = entry->next;
+                }
+
+                ht_send_buffer_entry_t* to_free = entry;
+                entry = entry->next;
+                free_send_entry(to_free);
+                conn->inflight--;
+                actions++;
+            }
+        } else {
+            prev = entry;
+            entry = entry->next;
+        }
+    }
+
+    // 检查是否需要发送心跳
+    ht_packet_header_t heartbeat;
+    memset(&heartbeat, 0, sizeof(heartbeat));
+    heartbeat.magic = HT_MAGIC;
+    heartbeat.version = 1;
+    heartbeat.type = HT_TYPE_HEARTBEAT;
+    heartbeat.sequence = conn->send_sequence; // 非数据包不占用序列号
+    heartbeat.timestamp = get_timestamp_ms();
+
+    if (conn->path_count > 1) {
+        // 多路径时每条子路径各自发送心跳，双方据此判断每条路径是否还能用
+        for (int i = 0; i < conn->path_count; i++) {
+            ht_path_t* path = &conn->paths[i];
+            if (path->udp_fd >= 0 && time_diff_ms(&path->last_heartbeat, &now) > HT_HEARTBEAT_INTERVAL) {
+                // 发送失败也推迟到下一个间隔，不让到期的定时器反复唤醒事件循环
+                path->last_heartbeat = now;
+                conn->last_heartbeat = now;
+                if (transmit(conn, &heartbeat, NULL, 0, i) > 0) {
+                    actions++;
+                }
+            }
+        }
+    } else if (time_diff_ms(&conn->last_heartbeat, &now) > HT_HEARTBEAT_INTERVAL) {
+        // 心跳包优先使用UDP
+        int result = transmit(conn, &heartbeat, NULL, 0, -1);
+        if (result < 0) {
+            result = transmit(conn, &heartbeat, NULL, 1, -1);
+        }
+
+        conn->last_heartbeat = now;
+        if (result > 0) {
+            actions++;
+        }
+    }
+
+    // 各UDP路径的MTU探测
+    if (conn->handshake_complete) {
+        for (int i = 0; i < conn->path_count; i++) {
+            if (pmtu_probe(conn, i, &now) > 0) {
+                actions++;
+            }
+        }
+    }
+
+    // 检查连接是否超时
+    uint32_t activity_elapsed = time_diff_ms(&conn->last_activity, &now);
+    if (activity_elapsed > HT_CONNECTION_TIMEOUT) {
+        conn->is_connected = 0;
+        return -1;
+    }
+
+    return actions;
+}
+
+// 距下一次需要调用 ht_handle_timeout 的时间(ms)：握手重发、最早的重传、心跳、MTU探测和连接超时中
+// 最早的一个。监听器已分发来数据包、或TCP缓冲区中已有完整的帧时返回0；连接已断开返回-1
+int ht_next_timeout(ht_connection_t* conn) {
+    if (!conn || !conn->is_connected) {
+        return -1;
+    }
+    if (conn->rx_dispatched || tcp_frame_size(conn->tcp_rx, conn->tcp_rx_len) != 0) {
+        return 0;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int timeout = earlier_deadline(-1, &conn->last_activity, HT_CONNECTION_TIMEOUT, &now);
+
+    if (!conn->handshake_complete) {
+        timeout = earlier_deadline(timeout, &conn->syn_time, conn->retransmit_timeout, &now);
+    }
+    for (ht_send_buffer_entry_t* entry = conn->handshake_complete ? conn->send_buffer : NULL;
+         entry && timeout > 0; entry = entry->next) {
+        timeout = earlier_deadline(timeout, &entry->send_time, entry_timeout(conn, entry), &now);
+    }
+
+    if (conn->path_count > 1) {
+        for (int i = 0; i < conn->path_count; i++) {
+            if (conn->paths[i].udp_fd >= 0) {
+                timeout = earlier_deadline(timeout, &conn->paths[i].last_heartbeat, HT_HEARTBEAT_INTERVAL, &now);
+            }
+        }
+    } else {
+        timeout = earlier_deadline(timeout, &conn->last_heartbeat, HT_HEARTBEAT_INTERVAL, &now);
+    }
+
+    // MTU探测：在途探测等应答超时，搜索结束的路径等重新向上探测，其他可用路径立即开始
+    for (int i = 0; i < conn->path_count && conn->handshake_complete; i++) {
+        ht_path_t* path = &conn->paths[i];
+        if (!path_usable(path, &now)) {
+            continue;
+        }
+        if (path->probe_size) {
+            timeout = earlier_deadline(timeout, &path->probe_time, probe_timeout(conn, path), &now);
+        } else if (path->probe_done) {
+            timeout = earlier_deadline(timeout, &path->probe_time, HT_PLPMTU_RAISE_INTERVAL, &now);
+        } else {
+            timeout = 0;
+        }
+    }
+
+    return timeout;
+}
+
+// 连接ID查找表：已删除槽位的标记：查找时跳过继续探测，插入时可复用
+static ht_connection_t ht_slot_deleted;
+#define HT_SLOT_DELETED (&ht_slot_deleted)
+
+static uint64_t conn_id_hash(uint64_t conn_id, uint64_t seed) {
+    uint64_t x = conn_id ^ seed;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb3fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static ht_conn_slots_t* alloc_slots(size_t capacity) {
+    ht_conn_slots_t* slots = calloc(1, sizeof(ht_conn_slots_t) + capacity * sizeof(slots->slots[0]));
+    if (!slots) {
+        return NULL;
+    }
+    slots->mask = capacity - 1;
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&slots->slots[i], NULL);
+    }
+    return slots;
+}
+
+static size_t slot_index(const ht_conn_table_t* table, const ht_conn_slots_t* slots, uint64_t conn_id) {
+    return conn_id_hash(conn_id & table->key_mask, table->seed) & slots->mask;
+}
 
-    if (rtt < conn->stats.rtt_min) {
-        conn->stats.rtt_min = rtt;
+// 放入尚未发布或由本线程独占写入的槽位数组
+static void slots_place(const ht_conn_table_t* table, ht_conn_slots_t* slots, ht_connection_t* conn) {
+    size_t index = slot_index(table, slots, conn->conn_id);
+    for (;;) {
+        ht_connection_t* entry = atomic_load_explicit(&slots->slots[index], memory_order_relaxed);
+        if (!entry || entry == HT_SLOT_DELETED) {
+            atomic_store_explicit(&slots->slots[index], conn, memory_order_release);
+            return;
+        }
+        index = (index + 1) & slots->mask;
     }
+}
 
-    if (rtt > conn->stats.rtt_max) {
-        conn->stats.rtt_max = rtt;
+int ht_conn_table_init(ht_conn_table_t* table, size_t capacity) {
+    size_t size = 16;
+    while (size < capacity * 2) {
+        size *= 2;
+    }
+    ht_conn_slots_t* slots = alloc_slots(size);
+    if (!slots) {
+        return -1;
     }
+    atomic_init(&table->current, slots);
+    table->count = 0;
+    table->used = 0;
+    table->seed = generate_conn_id();
+    table->key_mask = UINT64_MAX;
+    return 0;
+}
 
-    // 计算平均RTT (使用指数移动平均)
-    if (conn->stats.rtt_avg == 0) {
-        conn->stats.rtt_avg = rtt;
-    } else {
-        conn->stats.rtt_avg = (conn->stats.rtt_avg * 7 + rtt) / 8;
+void ht_conn_table_destroy(ht_conn_table_t* table) {
+    ht_conn_slots_t* slots = atomic_load_explicit(&table->current, memory_order_relaxed);
+    while (slots) {
+        ht_conn_slots_t* retired = slots->retired;
+        free(slots);
+        slots = retired;
     }
+    atomic_store_explicit(&table->current, NULL, memory_order_relaxed);
+    table->count = 0;
+    table->used = 0;
 }
 
-// 发送应用数据
-int ht_send_data(ht_connection_t* conn, const void* data, size_t size) {
-    if (!conn || !data || size == 0 || !conn->is_connected) {
+int ht_conn_table_insert(ht_conn_table_t* table, ht_connection_t* conn) {
+    ht_conn_slots_t* slots = atomic_load_explicit(&table->current, memory_order_relaxed);
+    if (!slots) {
         return -1;
     }
 
-    const uint8_t* bytes = (const uint8_t*)data;
-    size_t bytes_sent = 0;
+    // 占用超过3/4时重建：有效连接多则扩容，否则只清理删除标记
+    size_t capacity = slots->mask + 1;
+    if ((table->used + 1) * 4 > capacity * 3) {
+        size_t new_capacity = (table->count + 1) * 2 > capacity ? capacity * 2 : capacity;
+        ht_conn_slots_t* rebuilt = alloc_slots(new_capacity);
+        if (!rebuilt) {
+            return -1;
+        }
+        for (size_t i = 0; i < capacity; i++) {
+            ht_connection_t* entry = atomic_load_explicit(&slots->slots[i], memory_order_relaxed);
+            if (entry && entry != HT_SLOT_DELETED) {
+                slots_place(table, rebuilt, entry);
+            }
+        }
+        // 并发查找可能仍在读旧数组，旧数组保留到查找表销毁
+        rebuilt->retired = slots;
+        atomic_store_explicit(&table->current, rebuilt, memory_order_release);
+        slots = rebuilt;
+        table->used = table->count;
+    }
 
-    while (bytes_sent < size) {
-        // 计算本次发送的数据大小
-        size_t chunk_size = size - bytes_sent;
-        if (chunk_size > HT_MAX_PAYLOAD_SIZE) {
-            chunk_size = HT_MAX_PAYLOAD_SIZE;
+    // 复用删除标记时占用数不变
+    size_t index = slot_index(table, slots, conn->conn_id);
+    for (;;) {
+        ht_connection_t* entry = atomic_load_explicit(&slots->slots[index], memory_order_relaxed);
+        if (!entry || entry == HT_SLOT_DELETED) {
+            if (!entry) {
+                table->used++;
+            }
+            atomic_store_explicit(&slots->slots[index], conn, memory_order_release);
+            table->count++;
+            return 0;
         }
+        index = (index + 1) & slots->mask;
+    }
+}
 
-        // 创建数据包
-        ht_packet_t packet;
-        memset(&packet, 0, sizeof(packet));
+void ht_conn_table_remove(ht_conn_table_t* table, ht_connection_t* conn) {
+    ht_conn_slots_t* slots = atomic_load_explicit(&table->current, memory_order_relaxed);
+    if (!slots) {
+        return;
+    }
 
-        packet.header.magic = HT_MAGIC;
-        packet.header.version = 1;
-        packet.header.type = HT_TYPE_DATA;
-        packet.header.sequence = conn->send_sequence++;
-        packet.header.ack_sequence = conn->ack_sequence;
-        packet.header.window_size = conn->recv_window_size;
-        packet.header.payload_size = chunk_size;
-        packet.header.timestamp = get_timestamp_ms();
+    size_t index = slot_index(table, slots, conn->conn_id);
+    for (size_t probes = 0; probes <= slots->mask; probes++) {
+        ht_connection_t* entry = atomic_load_explicit(&slots->slots[index], memory_order_relaxed);
+        if (!entry) {
+            return;
+        }
+        if (entry == conn) {
+            atomic_store_explicit(&slots->slots[index], HT_SLOT_DELETED, memory_order_release);
+            table->count--;
+            return;
+        }
+        index = (index + 1) & slots->mask;
+    }
+}
 
-        // 复制载荷数据
-        memcpy(packet.payload, bytes + bytes_sent, chunk_size);
+ht_connection_t* ht_conn_table_lookup(ht_conn_table_t* table, uint64_t conn_id) {
+    ht_conn_slots_t* slots = atomic_load_explicit(&table->current, memory_order_acquire);
+    if (!slots) {
+        return NULL;
+    }
 
-        // 决定使用哪个传输通道
-        int use_tcp = ht_should_use_tcp(conn);
+    size_t index = slot_index(table, slots, conn_id);
+    for (size_t probes = 0; probes <= slots->mask; probes++) {
+        ht_connection_t* entry = atomic_load_explicit(&slots->slots[index], memory_order_acquire);
+        if (!entry) {
+            return NULL;
+        }
+        if (entry != HT_SLOT_DELETED && ((entry->conn_id ^ conn_id) & table->key_mask) == 0) {
+            return entry;
+        }
+        index = (index + 1) & slots->mask;
+    }
+    return NULL;
+}
 
-        // 发送数据包
-        int result = ht_send_packet(conn, &packet, use_tcp);
-        if (result < 0) {
-            // 如果首选通道失败，尝试另一个通道
-            use_tcp = !use_tcp;
-            result = ht_send_packet(conn, &packet, use_tcp);
-            if (result < 0) {
-                break;
+static void listener_remove(ht_listener_t* listener, ht_connection_t* conn) {
+    ht_conn_table_remove(&listener->table, conn);
+    if (conn->compact_tx) {
+        ht_conn_table_remove(&listener->short_table, conn);
+    }
+    for (int i = 0; i < listener->conn_count; i++) {
+        if (listener->conns[i] == conn) {
+            listener->conns[i] = listener->conns[--listener->conn_count];
+            if (!conn->accepted) {
+                listener->accept_pending--;
             }
+            break;
         }
+    }
+    conn->listener = NULL;
+}
 
-        // 将数据包添加到发送缓冲区（用于重传）
-        if (packet.header.type == HT_TYPE_DATA) {
-            ht_send_buffer_entry_t* entry = malloc(sizeof(ht_send_buffer_entry_t));
-            if (entry) {
-                entry->packet = packet;
-                gettimeofday(&entry->send_time, NULL);
-                entry->retransmit_count = 0;
-                entry->next = conn->send_buffer;
-                conn->send_buffer = entry;
-            }
+// 收到未知连接ID的SYN，创建服务端连接并回复SYN_ACK
+static ht_connection_t* listener_create_connection(ht_listener_t* listener, const ht_packet_t* syn,
+                                                   const struct sockaddr_in* addr, int tcp_fd) {
+    if (listener->conn_count >= listener->conn_capacity) {
+        int capacity = listener->conn_capacity ? listener->conn_capacity * 2 : 16;
+        ht_connection_t** conns = realloc(listener->conns, capacity * sizeof(ht_connection_t*));
+        if (!conns) {
+            return NULL;
         }
+        listener->conns = conns;
+        listener->conn_capacity = capacity;
+    }
 
-        bytes_sent += chunk_size;
+    // 经UDP建立的连接在对端的TCP通道连上后升级为混合模式
+    ht_connection_t* conn = alloc_connection(tcp_fd >= 0 ? HT_MODE_TCP_ONLY : HT_MODE_UDP_ONLY);
+    if (!conn) {
+        return NULL;
     }
 
-    return bytes_sent;
-}
+    conn->listener = listener;
+    conn->udp_fd = listener->udp_fd;
+    conn->tcp_fd = tcp_fd;
+    conn->remote_addr = *addr;
+    if (tcp_fd < 0) {
+        // 经UDP建立的连接：SYN所在的路径即主路径，其他子路径首次出现时经路径验证加入
+        ht_path_t* path = &conn->paths[conn->path_count++];
+        path->udp_fd = listener->udp_fd;
+        path->peer_addr = *addr;
+        path->id = syn->header.path_id;
+        path->last_recv = conn->last_activity;
+        path->last_heartbeat = conn->last_activity;
+    }
+    conn->conn_id = syn->header.conn_id;
+    conn->recv_sequence = syn->header.sequence;
+    conn->handshake_complete = 1;
+    conn->is_connected = 1;
 
-// 接收应用数据
-int ht_recv_data(ht_connection_t* conn, void* buffer, size_t buffer_size) {
-    if (!conn || !buffer || buffer_size == 0 || !conn->is_connected) {
-        return -1;
+    if (ht_conn_table_insert(&listener->table, conn) < 0) {
+        free(conn);
+        return NULL;
     }
+    listener->conns[listener->conn_count++] = conn;
 
-    uint8_t* bytes = (uint8_t*)buffer;
-    size_t bytes_received = 0;
+    // 对端请求紧凑包头且短连接ID不与已有连接冲突时同意，否则双方继续使用完整包头
+    if ((syn->header.flags & HT_CONTROL_COMPACT) && conn->compact_header &&
+        !ht_conn_table_lookup(&listener->short_table, conn->conn_id) &&
+        ht_conn_table_insert(&listener->short_table, conn) == 0) {
+        conn->compact_tx = 1;
+    }
+    listener->accept_pending++;
 
-    // 处理接收缓冲区中的有序数据
-    ht_recv_buffer_entry_t* entry = conn->recv_buffer;
-    ht_recv_buffer_entry_t* prev = NULL;
+    send_control(conn, HT_CONTROL_SYN_ACK);
+    return conn;
+}
 
-    while (entry && bytes_received < buffer_size) {
-        if (entry->received && entry->packet.header.sequence == conn->recv_sequence) {
-            // 找到下一个期望的数据包
-            size_t copy_size = entry->packet.header.payload_size;
-            if (copy_size > buffer_size - bytes_received) {
-                copy_size = buffer_size - bytes_received;
-            }
+// 对端从新地址发来数据包（已有子路径换了地址，或新的子路径）：向新地址发送挑战，
+// 同一地址每个重传超时内最多一次；重发沿用同一挑战值，RTT超过重传超时时先前的应答仍然有效
+static void start_path_validation(ht_connection_t* conn, const struct sockaddr_in* addr, uint8_t path_id) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (conn->path_validating && same_address(addr, &conn->probe_addr) && conn->probe_path_id == path_id) {
+        if (time_diff_ms(&conn->challenge_time, &now) < (uint32_t)conn->retransmit_timeout) {
+            return;
+        }
+    } else {
+        conn->probe_addr = *addr;
+        conn->probe_path_id = path_id;
+        conn->path_challenge = generate_conn_id();
+    }
 
-            memcpy(bytes + bytes_received, entry->packet.payload, copy_size);
-            bytes_received += copy_size;
-            conn->recv_sequence++;
+    conn->challenge_time = now;
+    conn->path_validating = 1;
+    send_path_control(conn, HT_CONTROL_PATH_CHALLENGE, conn->path_challenge, conn->udp_fd, addr, path_id);
+}
 
-            // 从缓冲区中移除已处理的数据包
-            if (prev) {
-                prev->next = entry->next;
-            } else {
-                conn->recv_buffer = entry->next;
-            }
+// 新地址带回了挑战值：已有子路径切换到新地址，并立即经新路径重发未确认的数据包；
+// 新的子路径加入调度，路径已满时替换最久没有收到包的一条
+static void complete_path_validation(ht_connection_t* conn, const ht_packet_t* packet,
+                                     const struct sockaddr_in* addr) {
+    uint64_t token;
+    if (!conn->path_validating || !same_address(addr, &conn->probe_addr) ||
+        packet->header.path_id != conn->probe_path_id || packet->header.payload_size != sizeof(token)) {
+        return;
+    }
+    memcpy(&token, packet->payload, sizeof(token));
+    if (token != conn->path_challenge) {
+        return;
+    }
+    conn->path_validating = 0;
 
-            free(entry);
-            entry = prev ? prev->next : conn->recv_buffer;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int index = find_path(conn, conn->probe_path_id);
+    int migrated = index >= 0;
+    if (index < 0) {
+        if (conn->path_count < HT_MAX_PATHS) {
+            index = conn->path_count++;
         } else {
-            prev = entry;
-            entry = entry->next;
+            index = 0;
+            for (int i = 1; i < conn->path_count; i++) {
+                if (timercmp(&conn->paths[i].last_recv, &conn->paths[index].last_recv, <)) {
+                    index = i;
+                }
+            }
         }
+        memset(&conn->paths[index], 0, sizeof(conn->paths[index]));
+        conn->paths[index].id = conn->probe_path_id;
+        conn->paths[index].udp_fd = conn->udp_fd;
     }
 
-    return bytes_received;
+    ht_path_t* path = &conn->paths[index];
+    path->peer_addr = *addr;
+    path->last_recv = now;
+    path->srtt = 0;
+    path->loss = 0.0f;
+    // 新地址的MTU未知，从基础大小重新探测
+    path->plpmtu = 0;
+    path->probe_ceiling = 0;
+    path->probe_size = 0;
+    path->probe_done = 0;
+    path->blackhole_losses = 0;
+    if (index == 0) {
+        conn->remote_addr = *addr;
+    }
+    if (!migrated) {
+        return;
+    }
+    conn->stats.path_migrations++;
+
+    // 旧地址上的包大多已丢失，不必等重传超时；路径切换不计入重传次数
+    for (ht_send_buffer_entry_t* entry = conn->send_buffer; entry; entry = entry->next) {
+        if (entry->path == index && transmit(conn, &entry->header, entry->payload, 0, index) > 0) {
+            entry->send_time = now;
+            conn->stats.packets_retransmitted++;
+        }
+    }
 }
 
-// 处理事件（接收数据包、处理ACK等）
-int ht_process_events(ht_connection_t* conn) {
-    if (!conn || !conn->is_connected) {
+static int is_syn(const ht_packet_t* packet) {
+    return packet->header.type == HT_TYPE_CONTROL && (packet->header.flags & HT_CONTROL_SYN);
+}
+
+// 首帧之后已读入的字节属于该连接的后续帧，随TCP通道一起交给连接
+static void take_pending_rx(ht_connection_t* conn, const ht_pending_tcp_t* pending) {
+    memcpy(conn->tcp_rx, pending->rx, pending->rx_len);
+    conn->tcp_rx_len = pending->rx_len;
+}
+
+// 找到收到的数据包所属的连接并还原为完整包头格式：紧凑包头按短连接ID查找，完整包头校验后按连接ID查找
+// 返回还原后的长度，无效的包返回-1；*conn 为NULL表示未知连接（只有完整包头的SYN可以建立连接）
+static int listener_unpack(ht_listener_t* listener, const uint8_t* wire, size_t size,
+                           ht_packet_t* packet, ht_connection_t** conn) {
+    *conn = NULL;
+    if (size > 0 && (wire[0] & HT_COMPACT_MARKER)) {
+        ht_compact_header_t compact;
+        int header_size = parse_compact(wire, size, &compact);
+        if (header_size <= 0) {
+            return -1;
+        }
+        *conn = ht_conn_table_lookup(&listener->short_table, compact.conn_id);
+        if (!*conn) {
+            return -1;
+        }
+        int unpacked = decode_compact(*conn, &compact, header_size, wire, size, packet);
+        return unpacked < 0 || validate_packet(packet, unpacked) < 0 ? -1 : unpacked;
+    }
+
+    int unpacked = unpack_packet(NULL, wire, size, packet);
+    if (validate_packet(packet, unpacked) < 0) {
         return -1;
     }
+    *conn = ht_conn_table_lookup(&listener->table, packet->header.conn_id);
+    return unpacked;
+}
 
-    ht_packet_t packet;
-    int from_tcp;
-    int processed = 0;
+static void close_pending_tcp(ht_listener_t* listener, int index, int close_fd) {
+    if (close_fd) {
+        close(listener->pending_tcp[index].fd);
+    }
+    listener->pending_tcp[index] = listener->pending_tcp[--listener->pending_tcp_count];
+}
 
-    // 处理所有可用的数据包
-    while (ht_recv_packet(conn, &packet, &from_tcp) > 0) {
-        processed++;
+// 创建服务端监听器：UDP和TCP使用同一端口
+ht_listener_t* ht_listen(const char* bind_ip, int port) {
+    if (!ht_initialized) {
+        ht_init();
+    }
 
-        switch (packet.header.type) {
-            case HT_TYPE_DATA:
-                // 处理数据包
-                {
-                    // 发送ACK
-                    ht_packet_t ack_packet;
-                    memset(&ack_packet, 0, sizeof(ack_packet));
-                    ack_packet.header.magic = HT_MAGIC;
-                    ack_packet.header.version = 1;
-                    ack_packet.header.type = HT_TYPE_ACK;
-                    ack_packet.header.sequence = conn->send_sequence++;
-                    ack_packet.header.ack_sequence = packet.header.sequence;
-                    ack_packet.header.timestamp = get_timestamp_ms();
-
-                    ht_send_packet(conn, &ack_packet, from_tcp);
-
-                    // 将数据包添加到接收缓冲区
-                    ht_recv_buffer_entry_t* entry = malloc(sizeof(ht_recv_buffer_entry_t));
-                    if (entry) {
-                        entry->packet = packet;
-                        gettimeofday(&entry->recv_time, NULL);
-                        entry->received = 1;
-                        entry->next = conn->recv_buffer;
-                        conn->recv_buffer = entry;
-                    }
-                }
-                break;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (!bind_ip || !bind_ip[0]) {
+        addr.sin_addr.s_addr = INADDR_ANY;
+    } else if (inet_pton(AF_INET, bind_ip, &addr.sin_addr) <= 0) {
+        return NULL;
+    }
 
-            case HT_TYPE_ACK:
-                // 处理ACK包
-                {
-                    uint32_t acked_seq = packet.header.ack_sequence;
-
-                    // 从发送缓冲区中移除已确认的数据包
-                    ht_send_buffer_entry_t* send_entry = conn->send_buffer;
-                    ht_send_buffer_entry_t* send_prev = NULL;
-
-                    while (send_entry) {
-                        if (send_entry->packet.header.sequence == acked_seq) {
-                            // 计算RTT
-                            struct timeval now;
-                            gettimeofday(&now, NULL);
-                            uint32_t rtt = time_diff_ms(&send_entry->send_time, &now);
-                            ht_update_rtt(conn, rtt);
-
-                            // 移除已确认的数据包
-                            if (send_prev) {
-                                send_prev->next = send_entry->next;
-                            } else {
-                                conn->send_buffer = send_entry->next;
-                            }
-
-                            free(send_entry);
-                            break;
-                        }
-                        send_prev = send_entry;
-                        send_entry = send_entry->next;
-                    }
-                }
-                break;
+    ht_listener_t* listener = calloc(1, sizeof(ht_listener_t));
+    if (!listener) {
+        return NULL;
+    }
+    if (ht_conn_table_init(&listener->table, 64) < 0) {
+        free(listener);
+        return NULL;
+    }
+    if (ht_conn_table_init(&listener->short_table, 64) < 0) {
+        ht_conn_table_destroy(&listener->table);
+        free(listener);
+        return NULL;
+    }
+    listener->short_table.key_mask = UINT32_MAX;
+    listener->udp_fd = create_udp_socket();
+    listener->tcp_fd = create_tcp_socket();
+    if (listener->udp_fd < 0 || listener->tcp_fd < 0) {
+        ht_listener_close(listener);
+        return NULL;
+    }
 
-            case HT_TYPE_HEARTBEAT:
-                // 处理心跳包
-                gettimeofday(&conn->last_activity, NULL);
-                break;
+    // 多个对端共用一个UDP socket，加大接收缓冲区
+    int buffer_size = 4 * 1024 * 1024;
+    setsockopt(listener->udp_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
 
-            case HT_TYPE_CONTROL:
-                // 处理控制包
-                if (packet.header.flags & 0x01) { // 关闭标志
-                    conn->is_connected = 0;
-                }
-                break;
-        }
+    if (bind(listener->udp_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        bind(listener->tcp_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(listener->tcp_fd, 128) < 0) {
+        perror("HT listen");
+        ht_listener_close(listener);
+        return NULL;
     }
 
-    return processed;
+    return listener;
 }
 
-// 处理超时事件（重传、心跳等）
-int ht_handle_timeout(ht_connection_t* conn) {
-    if (!conn || !conn->is_connected) {
+// 处理监听socket上的数据：分发UDP包、接受TCP连接并按首帧的连接ID关联到对应连接
+int ht_listener_process(ht_listener_t* listener) {
+    if (!listener) {
         return -1;
     }
 
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    int actions = 0;
+    ht_packet_t packet;
+    int processed = 0;
 
-    // 检查发送缓冲区中需要重传的数据包
-    ht_send_buffer_entry_t* entry = conn->send_buffer;
-    ht_send_buffer_entry_t* prev = NULL;
+    // UDP：按连接ID分发
+    for (;;) {
+        struct sockaddr_in sender_addr;
+        socklen_t addr_len = sizeof(sender_addr);
+        ssize_t bytes_received = recvfrom(listener->udp_fd, &packet, sizeof(packet), 0,
+                                          (struct sockaddr*)&sender_addr, &addr_len);
+        if (bytes_received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        ht_connection_t* conn;
+        if (listener_unpack(listener, (const uint8_t*)&packet, bytes_received, &packet, &conn) < 0) {
+            continue;
+        }
 
-    while (entry) {
-        uint32_t elapsed = time_diff_ms(&entry->send_time, &now);
+        processed++;
+        if (!conn) {
+            // 未知连接只接受SYN，其他包丢弃（对端会在握手完成后重传）
+            if (is_syn(&packet)) {
+                listener_create_connection(listener, &packet, &sender_addr, -1);
+            }
+            continue;
+        }
 
-        if (elapsed > conn->retransmit_timeout) {
-            if (entry->retransmit_count < conn->max_retransmit) {
-                // 重传数据包
-                entry->retransmit_count++;
-                entry->send_time = now;
+        record_received(conn, bytes_received);
+        if (is_syn(&packet)) {
+            // 重复的SYN说明SYN_ACK丢失
+            send_control(conn, HT_CONTROL_SYN_ACK);
+            continue;
+        }
 
-                // 优先使用TCP重传
-                int result = ht_send_packet(conn, &entry->packet, 1);
-                if (result < 0) {
-                    // TCP失败，尝试UDP
-                    result = ht_send_packet(conn, &entry->packet, 0);
-                }
+        // 按路径ID找到子路径。源地址变化或新的子路径：照常处理数据包，同时验证新地址，
+        // 验证通过后再切换该路径的发送目标或把新路径加入调度
+        int path = find_path(conn, packet.header.path_id);
+        if (path >= 0 && same_address(&sender_addr, &conn->paths[path].peer_addr)) {
+            conn->paths[path].last_recv = conn->last_activity;
+        } else {
+            if (packet.header.type == HT_TYPE_CONTROL &&
+                (packet.header.flags & HT_CONTROL_PATH_RESPONSE)) {
+                complete_path_validation(conn, &packet, &sender_addr);
+                continue;
+            }
+            start_path_validation(conn, &sender_addr, packet.header.path_id);
+            path = -1;
+        }
+        handle_packet(conn, &packet, 0, path);
+        conn->rx_dispatched = 1;
+    }
 
-                if (result > 0) {
-                    conn->stats.packets_retransmitted++;
-                    actions++;
-                }
+    // 接受新的TCP连接，等待首帧确定连接ID
+    for (;;) {
+        int fd = accept(listener->tcp_fd, NULL, NULL);
+        if (fd < 0) {
+            break;
+        }
+        if (set_nonblocking(fd) < 0) {
+            close(fd);
+            continue;
+        }
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
 
-                entry = entry->next;
-            } else {
-                // 超过最大重传次数，丢弃数据包
-                conn->stats.packets_lost++;
+        if (listener->pending_tcp_count >= HT_MAX_PENDING_TCP) {
+            close_pending_tcp(listener, 0, 1);
+        }
+        ht_pending_tcp_t* pending = &listener->pending_tcp[listener->pending_tcp_count++];
+        pending->fd = fd;
+        pending->rx_len = 0;
+    }
 
-                if (prev) {
-                    prev->next = entry->next;
-                } else {
-                    conn->send_buffer = entry->next;
-                }
+    for (int i = 0; i < listener->pending_tcp_count; i++) {
+        ht_pending_tcp_t* pending = &listener->pending_tcp[i];
+        int frame_size = read_tcp_frame(pending->fd, pending->rx, &pending->rx_len);
+        if (frame_size == 0) {
+            continue;
+        }
 
-                ht_send_buffer_entry_t* to_free = entry;
-                entry = entry->next;
-                free(to_free);
-                actions++;
+        ht_connection_t* conn;
+        if (frame_size < 0 || listener_unpack(listener, pending->rx, frame_size, &packet, &conn) < 0) {
+            close_pending_tcp(listener, i--, 1);
+            continue;
+        }
+
+        processed++;
+        int fd = pending->fd;
+        consume_tcp_frame(pending->rx, &pending->rx_len, frame_size);
+        if (!conn) {
+            if (is_syn(&packet)) {
+                struct sockaddr_in peer_addr;
+                socklen_t addr_len = sizeof(peer_addr);
+                getpeername(fd, (struct sockaddr*)&peer_addr, &addr_len);
+                conn = listener_create_connection(listener, &packet, &peer_addr, fd);
+                if (conn) {
+                    take_pending_rx(conn, pending);
+                }
+                close_pending_tcp(listener, i--, !conn);
+            } else {
+                close_pending_tcp(listener, i--, 1);
             }
+            continue;
+        }
+
+        // 把TCP通道交给对应连接，后续帧由 ht_process_events 读取
+        if (conn->tcp_fd >= 0) {
+            close(conn->tcp_fd);
+        }
+        conn->tcp_fd = fd;
+        conn->tcp_tx_len = 0;
+        conn->tcp_tx_offset = 0;
+        take_pending_rx(conn, pending);
+        close_pending_tcp(listener, i--, 0);
+        if (conn->mode == HT_MODE_UDP_ONLY) {
+            conn->mode = HT_MODE_HYBRID;
+        }
+
+        record_received(conn, frame_size);
+        if (is_syn(&packet)) {
+            send_control(conn, HT_CONTROL_SYN_ACK);
         } else {
-            prev = entry;
-            entry = entry->next;
+            handle_packet(conn, &packet, 1, -1);
+            conn->rx_dispatched = 1;
         }
     }
 
-    // 检查是否需要发送心跳
-    uint32_t heartbeat_elapsed = time_diff_ms(&conn->last_heartbeat, &now);
-    if (heartbeat_elapsed > HT_HEARTBEAT_INTERVAL) {
-        ht_packet_t heartbeat;
-        memset(&heartbeat, 0, sizeof(heartbeat));
+    return processed;
+}
 
-        heartbeat.header.magic = HT_MAGIC;
-        heartbeat.header.version = 1;
-        heartbeat.header.type = HT_TYPE_HEARTBEAT;
-        heartbeat.header.sequence = conn->send_sequence++;
-        heartbeat.header.timestamp = get_timestamp_ms();
+// 取出一个新建立的连接，没有时返回NULL
+ht_connection_t* ht_accept(ht_listener_t* listener) {
+    if (!listener || listener->accept_pending == 0) {
+        return NULL;
+    }
 
-        // 心跳包优先使用UDP
-        int result = ht_send_packet(conn, &heartbeat, 0);
-        if (result < 0) {
-            result = ht_send_packet(conn, &heartbeat, 1);
+    for (int i = 0; i < listener->conn_count; i++) {
+        ht_connection_t* conn = listener->conns[i];
+        if (!conn->accepted) {
+            conn->accepted = 1;
+            listener->accept_pending--;
+            return conn;
         }
+    }
+    return NULL;
+}
 
-        if (result > 0) {
-            conn->last_heartbeat = now;
-            actions++;
+// 获取连接需要等待可读的socket：客户端各子路径的UDP和TCP通道（服务端连接的UDP属于监听器）
+int ht_connection_fds(ht_connection_t* conn, int* fds, int max_fds) {
+    int count = 0;
+    if (!conn) {
+        return 0;
+    }
+    for (int i = 0; i < conn->path_count && !conn->listener && count < max_fds; i++) {
+        if (conn->paths[i].udp_fd >= 0) {
+            fds[count++] = conn->paths[i].udp_fd;
         }
     }
+    if (conn->tcp_fd >= 0 && count < max_fds) {
+        fds[count++] = conn->tcp_fd;
+    }
+    return count;
+}
 
-    // 检查连接是否超时
-    uint32_t activity_elapsed = time_diff_ms(&conn->last_activity, &now);
-    if (activity_elapsed > 30000) { // 30秒无活动
-        conn->is_connected = 0;
-        return -1;
+// 获取需要等待可读的监听器socket
+int ht_listener_fds(ht_listener_t* listener, int* fds, int max_fds) {
+    int count = 0;
+    if (!listener) {
+        return 0;
+    }
+    if (listener->udp_fd >= 0 && count < max_fds) {
+        fds[count++] = listener->udp_fd;
+    }
+    if (listener->tcp_fd >= 0 && count < max_fds) {
+        fds[count++] = listener->tcp_fd;
+    }
+    for (int i = 0; i < listener->pending_tcp_count && count < max_fds; i++) {
+        fds[count++] = listener->pending_tcp[i].fd;
     }
+    return count;
+}
 
-    return actions;
+// 关闭监听器：未取走的连接一并销毁，已取走的连接失去UDP通道（由调用方负责销毁）
+void ht_listener_close(ht_listener_t* listener) {
+    if (!listener) {
+        return;
+    }
+
+    for (int i = listener->conn_count - 1; i >= 0; i--) {
+        ht_connection_t* conn = listener->conns[i];
+        if (!conn->accepted) {
+            ht_destroy_connection(conn);
+        } else {
+            conn->listener = NULL;
+            conn->udp_fd = -1;
+            conn->path_count = 0;
+        }
+    }
+
+    for (int i = 0; i < listener->pending_tcp_count; i++) {
+        close(listener->pending_tcp[i].fd);
+    }
+    if (listener->udp_fd >= 0) {
+        close(listener->udp_fd);
+    }
+    if (listener->tcp_fd >= 0) {
+        close(listener->tcp_fd);
+    }
+    free(listener->conns);
+    ht_conn_table_destroy(&listener->table);
+    ht_conn_table_destroy(&listener->short_table);
+    free(listener);
 }
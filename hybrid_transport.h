@@ -2,18 +2,72 @@
 #define HYBRID_TRANSPORT_H
 
 #include <stdint.h>
+#include <stdatomic.h>
 #include <sys/time.h>
 #include <netinet/in.h>
 
 // 协议常量
-#define HT_MAX_PACKET_SIZE 1400        // 最大UDP包大小（避免分片）
-#define HT_MAX_PAYLOAD_SIZE 1350       // 最大载荷大小
-#define HT_HEADER_SIZE 50               // 协议头大小
+#define HT_MAX_PACKET_SIZE 8972        // 最大数据报大小（巨帧MTU 9000减去IP和UDP头），各路径实际大小由MTU探测决定
+#define HT_HEADER_SIZE 41               // 协议头大小（sizeof(ht_packet_header_t)）
+#define HT_MAX_PAYLOAD_SIZE (HT_MAX_PACKET_SIZE - HT_HEADER_SIZE)   // 最大载荷大小
 #define HT_MAX_SEQUENCE 0xFFFFFFFF      // 最大序列号
 #define HT_RETRANSMIT_TIMEOUT 100       // 重传超时(ms)
 #define HT_MAX_RETRANSMIT 3             // 最大重传次数
 #define HT_WINDOW_SIZE 64               // 滑动窗口大小
 #define HT_HEARTBEAT_INTERVAL 1000      // 心跳间隔(ms)
+#define HT_CONNECTION_TIMEOUT 30000     // 超过该时间(ms)没有收到任何包即认为连接断开
+#define HT_MAX_PENDING_TCP 64           // 监听器上尚未识别连接ID的TCP连接数
+#define HT_INITIAL_CWND 10              // 初始拥塞窗口(包)
+#define HT_MAX_CWND 4096                // 拥塞窗口上限(包)
+#define HT_MAX_PATHS 4                  // 每个连接最多的UDP子路径数
+#define HT_PATH_TIMEOUT 3000            // 子路径超过该时间(ms)没有收到包则不再调度
+#define HT_INTERACTIVE_PAYLOAD 256      // 载荷不超过该大小的数据包按交互包调度
+#define HT_CHANNEL_HOLD 500             // 新数据的通道选择至少保持的时间(ms)
+#define HT_UDP_LOSS_LIMIT 0.125f        // udp_preference 为1时，UDP丢包率超过该值改用TCP
+#define HT_CHANNEL_RTT_SLACK 20         // 比较UDP和TCP的RTT时容许的差值(ms)
+#define HT_CHANNEL_MIN_SAMPLES 16       // 统计窗口内至少有这么多数据包，丢包率才作为切换依据
+#define HT_LOSS_WINDOW_SLOTS 8          // 丢包率滑动窗口的时间片数
+#define HT_LOSS_SLOT_MS 250             // 每个时间片的长度(ms)，窗口共2秒
+#define HT_BASE_PLPMTU 1200             // 不经探测即可使用的数据报大小（IPv6最小MTU 1280减去IP和UDP头后留有余量）
+#define HT_PLPMTU_FIRST_PROBE 1472      // 首先探测的大小：以太网MTU 1500下的最大UDP数据报
+#define HT_PLPMTU_MAX_PROBES 3          // 同一大小的探测连续丢失这么多次即认为不通
+#define HT_PLPMTU_SEARCH_STEP 16        // 上下界相差不到该值时结束搜索
+#define HT_PLPMTU_RAISE_INTERVAL 600000 // 搜索结束后隔这么久(ms)重新向上探测
+#define HT_PLPMTU_BLACKHOLE 6           // 连续丢失这么多个大于基础大小的数据包，退回基础大小重新探测
+
+// 控制包标志
+#define HT_CONTROL_CLOSE 0x01           // 关闭连接
+#define HT_CONTROL_SYN 0x02             // 建立连接（sequence 为发起方初始序列号）
+#define HT_CONTROL_SYN_ACK 0x04         // 建立确认（sequence 为接受方初始序列号）
+#define HT_CONTROL_PATH_CHALLENGE 0x08  // 路径验证：载荷为8字节随机值，发往对端的新地址
+#define HT_CONTROL_PATH_RESPONSE 0x10   // 路径验证应答：原样带回挑战值
+#define HT_CONTROL_COMPACT 0x20         // SYN：本端能发送紧凑包头；SYN_ACK：同意对端使用，本端也使用
+
+// 数据包标志
+#define HT_DATA_FIN 0x01                // 流结束（载荷可以为空，占用序列号）
+
+// 窗口包标志
+#define HT_WINDOW_BLOCKED 0x01          // 发送方受流控阻塞，请求对端重发窗口
+
+// MTU探测包标志
+#define HT_PROBE_ACK 0x01               // 探测应答（载荷为2字节的探测包大小）
+
+// 紧凑包头：握手协商后，数据、确认、心跳和窗口包使用；控制包和MTU探测包始终用完整包头
+//   字节0   0x80|类型（完整包头的首字节是魔数的 'P'，最高位为0）
+//   字节1   下列字段是否存在，存在的字段按此顺序排列
+//   连接ID  4字节，连接ID的低32位（监听器按此查找，握手时保证不冲突）
+//   flags、stream_id 为变长整数，path_id 为1字节，为0时省略
+//   序列号  数据包携带低16位，接收方按 recv_sequence 展开
+//   确认号  确认包携带低16位，接收方按 send_sequence 展开
+//   载荷长度（变长整数）和校验和（4字节）总是存在
+// 校验和按等价的完整包头（省略的字段取0）计算，序列号展开错误或短连接ID冲突都会使校验失败
+#define HT_COMPACT_MARKER 0x80
+#define HT_COMPACT_FLAGS 0x01
+#define HT_COMPACT_STREAM 0x02
+#define HT_COMPACT_PATH 0x04
+#define HT_COMPACT_SEQ 0x08
+#define HT_COMPACT_ACK 0x10
+#define HT_COMPACT_MAX_HEADER 29        // 2 + 4 + 3 + 5 + 1 + 2 + 2 + 2(载荷长度) + 4
 
 // 数据包类型
 typedef enum {
@@ -22,7 +76,9 @@ typedef enum {
     HT_TYPE_NACK = 3,           // 否定确认包
     HT_TYPE_HEARTBEAT = 4,      // 心跳包
     HT_TYPE_CONTROL = 5,        // 控制包
-    HT_TYPE_RETRANSMIT = 6      // 重传请求包
+    HT_TYPE_RETRANSMIT = 6,     // 重传请求包
+    HT_TYPE_WINDOW = 7,         // 流控窗口（stream_id 指定流，载荷为8字节允许发送到的偏移）
+    HT_TYPE_PROBE = 8           // 路径MTU探测（载荷填充到探测大小，不占用序列号，丢失不算拥塞）
 } ht_packet_type_t;
 
 // 传输模式
@@ -45,7 +101,9 @@ typedef struct {
     uint16_t payload_size;      // 载荷大小
     uint32_t timestamp;         // 时间戳
     uint32_t checksum;          // 校验和
-    uint8_t reserved[8];        // 保留字段
+    uint64_t conn_id;           // 连接ID（同一端口上区分多个对端）
+    uint32_t stream_id;         // 流ID（一个连接上复用多个会话），0表示不分流
+    uint8_t path_id;            // UDP子路径ID（客户端分配，服务端按此区分同一连接的多条路径）
 } __attribute__((packed)) ht_packet_header_t;
 
 // 数据包结构
@@ -54,20 +112,32 @@ typedef struct {
     uint8_t payload[HT_MAX_PAYLOAD_SIZE];
 } ht_packet_t;
 
-// 发送缓冲区条目
+// 载荷缓冲块（带引用计数）：流的发送队列和发送缓冲区条目共用同一块数据，
+// 一段应用数据只复制一次，切成多个数据包发送和重传时都引用这块数据；引用归零时回收到按大小分级的空闲链表
+typedef struct ht_slab {
+    struct ht_slab* next_free;
+    uint32_t refs;
+    uint32_t capacity;
+    uint8_t data[];
+} ht_slab_t;
+
+// 发送缓冲区条目：只保存包头，载荷引用缓冲块中的数据，发送时包头和载荷分两段交给 sendmsg
 typedef struct ht_send_buffer_entry {
-    ht_packet_t packet;
     struct timeval send_time;
     int retransmit_count;
+    int path;                   // 最近一次发送所用的子路径下标，-1为TCP
     struct ht_send_buffer_entry* next;
+    ht_packet_header_t header;
+    ht_slab_t* slab;            // 持有一个引用，没有载荷时为NULL
+    const uint8_t* payload;     // 指向 slab 中本包的载荷
 } ht_send_buffer_entry_t;
 
-// 接收缓冲区条目
+// 接收缓冲区条目；数据包放在最后，按实际载荷大小分配
 typedef struct ht_recv_buffer_entry {
-    ht_packet_t packet;
     struct timeval recv_time;
     int received;
     struct ht_recv_buffer_entry* next;
+    ht_packet_t packet;
 } ht_recv_buffer_entry_t;
 
 // 连接统计信息
@@ -76,6 +146,8 @@ typedef struct {
     uint64_t packets_received;
     uint64_t packets_lost;
     uint64_t packets_retransmitted;
+    uint64_t packets_duplicated;    // 收到的重复数据包
+    uint64_t path_migrations;       // 对端地址变化后完成的路径迁移次数
     uint64_t bytes_sent;
     uint64_t bytes_received;
     uint32_t rtt_avg;           // 平均往返时间(ms)
@@ -86,25 +158,107 @@ typedef struct {
     float tcp_ratio;            // TCP传输比例
 } ht_connection_stats_t;
 
-// 混合传输连接结构
+// 滑动窗口丢包率：按时间片记录发出的数据包数和超时判定丢失的数据包数，随收发持续更新
+typedef struct {
+    uint32_t sent[HT_LOSS_WINDOW_SLOTS];
+    uint32_t lost[HT_LOSS_WINDOW_SLOTS];
+    uint32_t window_sent;           // 窗口内合计
+    uint32_t window_lost;
+    uint32_t epoch;                 // 当前时间片编号（毫秒时间戳/HT_LOSS_SLOT_MS）
+} ht_loss_window_t;
+
+// 单个通道（TCP或一条UDP子路径）的计数，在发送、确认和重传时维护
+typedef struct {
+    uint64_t packets_sent;          // 所有发出的包（含确认、心跳）
+    uint64_t bytes_sent;
+    uint64_t data_packets;          // 发出的数据包（含重传）
+    uint64_t packets_acked;         // 经本通道发出并得到确认的数据包
+    uint64_t packets_lost;          // 经本通道发出后超时的数据包
+    uint64_t packets_retransmitted; // 经本通道发出的重传
+    uint32_t rtt_min;               // 首发数据包的RTT(ms)，0表示还没有样本
+    uint32_t rtt_max;
+} ht_path_counters_t;
+
+// 通道统计快照（ht_get_path_stats）
 typedef struct {
+    int is_tcp;
+    uint8_t id;                     // UDP子路径ID，TCP为0
+    int usable;                     // UDP路径最近收到过包 / TCP通道已打开
+    uint32_t srtt;                  // 平滑往返时间(ms)
+    float loss_rate;                // 最近2秒的丢包率
+    uint16_t mtu;                   // UDP路径当前使用的数据报大小
+    ht_path_counters_t counters;
+} ht_path_stats_t;
+
+struct ht_listener;
+struct ht_connection;
+
+// UDP子路径：客户端每个本地地址一条，服务端按包头的路径ID区分
+typedef struct {
+    int udp_fd;                     // 客户端为本路径的socket，服务端为监听器socket
+    struct sockaddr_in local_addr;  // 客户端绑定的本地地址，全0表示按默认路由
+    struct sockaddr_in peer_addr;   // 本路径上对端的地址
+    uint8_t id;
+    uint32_t srtt;                  // 平滑往返时间(ms)，0表示还没有样本
+    float loss;                     // 丢包率（按包的指数移动平均）
+    int credit;                     // 批量包按比例分流的加权轮询计数
+    ht_path_counters_t counters;
+    ht_loss_window_t loss_window;
+
+    // 路径MTU探测（DPLPMTUD）：从 HT_BASE_PLPMTU 起向上二分探测，各字段为0表示初始状态
+    uint16_t plpmtu;                // 已确认能通过的数据报大小（包头+载荷）
+    uint16_t probe_ceiling;         // 探测上界：已知不通的最小大小减1
+    uint16_t probe_size;            // 在途的探测大小，0表示没有
+    uint8_t probe_count;            // 当前大小已发的探测次数
+    uint8_t probe_done;             // 搜索已结束，HT_PLPMTU_RAISE_INTERVAL 后再向上探测
+    uint8_t blackhole_losses;       // 连续丢失的大包数
+    struct timeval probe_time;      // 最近一次发送探测或结束搜索的时间
+
+    struct timeval last_recv;       // 最后一次从本路径收到包的时间
+    struct timeval last_heartbeat;
+} ht_path_t;
+
+// 收到窗口包的回调（由流复用层注册）
+typedef void (*ht_window_handler_t)(void* ctx, uint32_t stream_id, uint16_t flags, uint64_t max_offset);
+
+// 混合传输连接结构
+typedef struct ht_connection {
     // 基本信息
-    int udp_fd;                 // UDP socket
+    int udp_fd;                 // UDP socket（主路径）
     int tcp_fd;                 // TCP socket
     struct sockaddr_in remote_addr; // 远程地址
     ht_transport_mode_t mode;   // 传输模式
+    uint64_t conn_id;           // 连接ID
+    struct ht_listener* listener;   // 服务端连接所属的监听器（共享其UDP socket），客户端为NULL
     
     // 序列号管理
     uint32_t send_sequence;     // 发送序列号
     uint32_t recv_sequence;     // 接收序列号
     uint32_t ack_sequence;      // 确认序列号
+    uint32_t initial_sequence;  // 本端初始序列号（SYN/SYN_ACK 中携带）
+    int handshake_complete;     // 已获知对端初始序列号
+    struct timeval syn_time;    // 最后一次发送SYN的时间
     
     // 缓冲区管理
     ht_send_buffer_entry_t* send_buffer;   // 发送缓冲区
     ht_recv_buffer_entry_t* recv_buffer;   // 接收缓冲区
     uint16_t send_window_size;  // 发送窗口大小
     uint16_t recv_window_size;  // 接收窗口大小
+
+    // 拥塞控制（AIMD，单位为包）：连接上所有流共享
+    uint32_t cwnd;              // 拥塞窗口
+    uint32_t cwnd_acc;          // 拥塞避免阶段的确认计数
+    uint32_t ssthresh;          // 慢启动阈值
+    uint32_t inflight;          // 已发送未确认的数据包数
+    struct timeval recovery_start;  // 最近一次减窗时间，一个RTT内只减一次
     
+    // TCP通道分帧：已收到尚未处理的字节（可能含下一帧的开头）和未发完的帧
+    uint8_t tcp_rx[sizeof(ht_packet_t)];
+    size_t tcp_rx_len;
+    uint8_t tcp_tx[sizeof(ht_packet_t)];
+    size_t tcp_tx_len;
+    size_t tcp_tx_offset;
+
     // 时间管理
     struct timeval last_heartbeat;  // 最后心跳时间
     struct timeval last_activity;   // 最后活动时间
@@ -115,20 +269,88 @@ typedef struct {
     // 状态标志
     int is_connected;
     int is_closing;
+    int accepted;               // 服务端连接已由 ht_accept 交给调用方
+    int compact_header;         // 握手时请求（服务端：同意）使用紧凑包头，默认开启
+    int compact_tx;             // 协商成功，本端发送紧凑包头
+    int rx_dispatched;          // 监听器已把数据包交给本连接处理，等待 ht_process_events 跟进
+
+    // 路径迁移：对端源地址变化（NAT重绑定、切换网络）后，验证新地址再切换发送目标
+    struct sockaddr_in probe_addr;  // 待验证的新地址
+    uint64_t path_challenge;        // 发往新地址的挑战值
+    struct timeval challenge_time;  // 最后一次发送挑战的时间
+    int path_validating;
+    uint8_t probe_path_id;          // 待验证地址所属的子路径
+
+    // 多路径：交互包走有效延迟最低的路径，批量包按路径估计带宽分流
+    ht_path_t paths[HT_MAX_PATHS];
+    int path_count;
+    ht_path_t tcp_path;             // TCP通道的RTT、丢包和计数（udp_fd 恒为-1，不参与UDP调度）
+    int duplicate_interactive;      // 交互包同时在次优路径上再发一份
+
+    // 新数据的通道：每 HT_CHANNEL_HOLD 按测得的UDP丢包和RTT评估一次，带滞回，
+    // 期间的连续写入都走同一个通道，不会在UDP和TCP之间交错
+    int data_over_tcp;
+    struct timeval channel_time;    // 最近一次评估的时间
     
     // 配置参数
     int retransmit_timeout;     // 重传超时时间
     int max_retransmit;         // 最大重传次数
-    float udp_preference;       // UDP偏好度(0.0-1.0)
+    float udp_preference;       // UDP偏好度(0.0-1.0)：按比例放宽切到TCP的丢包门限，0为始终用TCP
+
+    // 流复用层
+    ht_window_handler_t window_handler;
+    void* window_ctx;
 } ht_connection_t;
 
+// 监听器尚未识别连接ID的TCP连接
+typedef struct {
+    int fd;
+    size_t rx_len;
+    uint8_t rx[sizeof(ht_packet_t)];
+} ht_pending_tcp_t;
+
+// 连接ID查找表的槽位数组；扩容时整体替换，旧数组挂在 retired 上直到查找表销毁
+typedef struct ht_conn_slots {
+    size_t mask;                        // 容量-1，容量为2的幂
+    struct ht_conn_slots* retired;
+    _Atomic(ht_connection_t*) slots[];
+} ht_conn_slots_t;
+
+// 连接ID -> 连接：开放寻址、线性探测。只有事件循环线程插入和删除，
+// 查找不加锁，槽位和槽位数组都以 release 写入发布，其他线程可以并发查找
+typedef struct {
+    _Atomic(ht_conn_slots_t*) current;
+    size_t count;                       // 有效连接数
+    size_t used;                        // 已占用槽位（含已删除标记）
+    uint64_t seed;                      // 哈希种子，防止构造冲突的连接ID
+    uint64_t key_mask;                  // 参与查找的连接ID位，短连接ID表只取低32位
+} ht_conn_table_t;
+
+// 服务端监听器：一个UDP端口和同端口的TCP监听socket，按连接ID把数据包分发给各个对端连接
+typedef struct ht_listener {
+    int udp_fd;
+    int tcp_fd;
+    ht_connection_t** conns;    // 本监听器上的所有连接
+    ht_conn_table_t table;      // 按连接ID查找
+    ht_conn_table_t short_table;    // 按连接ID低32位查找使用紧凑包头的连接
+    int conn_count;
+    int conn_capacity;
+    int accept_pending;         // 已建立但尚未被 ht_accept 取走的连接数
+    ht_pending_tcp_t pending_tcp[HT_MAX_PENDING_TCP];
+    int pending_tcp_count;
+} ht_listener_t;
+
 // 函数声明
 int ht_init(void);
 void ht_cleanup(void);
 
+ht_slab_t* ht_slab_alloc(size_t size);
+void ht_slab_release(ht_slab_t* slab);
+
 ht_connection_t* ht_create_connection(const char* remote_ip, int remote_port, ht_transport_mode_t mode);
 void ht_destroy_connection(ht_connection_t* conn);
 
+int ht_add_path(ht_connection_t* conn, const char* local_ip);
 int ht_connect(ht_connection_t* conn);
 int ht_disconnect(ht_connection_t* conn);
 
@@ -136,9 +358,36 @@ int ht_send_data(ht_connection_t* conn, const void* data, size_t size);
 int ht_recv_data(ht_connection_t* conn, void* buffer, size_t buffer_size);
 
 int ht_process_events(ht_connection_t* conn);
+int ht_connection_fds(ht_connection_t* conn, int* fds, int max_fds);
 int ht_handle_timeout(ht_connection_t* conn);
+int ht_next_timeout(ht_connection_t* conn);
+
+// 服务端：监听、处理监听socket上的数据包、取出新建立的连接
+ht_listener_t* ht_listen(const char* bind_ip, int port);
+int ht_listener_process(ht_listener_t* listener);
+ht_connection_t* ht_accept(ht_listener_t* listener);
+int ht_listener_fds(ht_listener_t* listener, int* fds, int max_fds);
+void ht_listener_close(ht_listener_t* listener);
+
+// 连接ID查找表
+int ht_conn_table_init(ht_conn_table_t* table, size_t capacity);
+void ht_conn_table_destroy(ht_conn_table_t* table);
+int ht_conn_table_insert(ht_conn_table_t* table, ht_connection_t* conn);
+void ht_conn_table_remove(ht_conn_table_t* table, ht_connection_t* conn);
+ht_connection_t* ht_conn_table_lookup(ht_conn_table_t* table, uint64_t conn_id);
+
+// 流复用层使用：按流发送单个数据包、取出下一个按序到达的数据包、发送窗口包、拥塞窗口余量
+int ht_send_stream_packet(ht_connection_t* conn, uint32_t stream_id, uint16_t flags,
+                          const void* data, size_t size);
+int ht_send_stream_slab(ht_connection_t* conn, uint32_t stream_id, uint16_t flags,
+                        ht_slab_t* slab, size_t offset, size_t size);
+ht_recv_buffer_entry_t* ht_take_ordered(ht_connection_t* conn);
+int ht_send_window(ht_connection_t* conn, uint32_t stream_id, uint16_t flags, uint64_t max_offset);
+int ht_send_budget(ht_connection_t* conn);
+void ht_set_window_handler(ht_connection_t* conn, ht_window_handler_t handler, void* ctx);
 
 void ht_get_stats(ht_connection_t* conn, ht_connection_stats_t* stats);
+int ht_get_path_stats(ht_connection_t* conn, ht_path_stats_t* stats, int max_paths);
 void ht_reset_stats(ht_connection_t* conn);
 
 // 内部函数
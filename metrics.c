@@ -0,0 +1,238 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// 计算数值所在的桶
+static int hist_bucket_index(uint64_t value) {
+    if (value < METRICS_HIST_SUB_BUCKETS) {
+        return (int)value;
+    }
+
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent >= METRICS_HIST_MAX_EXPONENT + 1) {
+        return METRICS_HIST_BUCKETS - 1;
+    }
+
+    int sub = (int)((value >> (exponent - 2)) & (METRICS_HIST_SUB_BUCKETS - 1));
+    return METRICS_HIST_SUB_BUCKETS + (exponent - 2) * METRICS_HIST_SUB_BUCKETS + sub;
+}
+
+// 桶的上界（包含）
+static uint64_t hist_bucket_upper(int index) {
+    if (index < METRICS_HIST_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+
+    int exponent = (index - METRICS_HIST_SUB_BUCKETS) / METRICS_HIST_SUB_BUCKETS + 2;
+    int sub = (index - METRICS_HIST_SUB_BUCKETS) % METRICS_HIST_SUB_BUCKETS;
+    return ((uint64_t)(METRICS_HIST_SUB_BUCKETS + sub + 1) << (exponent - 2)) - 1;
+}
+
+void metrics_hist_record(metrics_histogram_t* hist, uint64_t value_us) {
+    hist->counts[hist_bucket_index(value_us)]++;
+    hist->count++;
+    hist->sum_us += value_us;
+    if (value_us > hist->max_us) {
+        hist->max_us = value_us;
+    }
+}
+
+uint64_t metrics_hist_quantile(const metrics_histogram_t* hist, double quantile) {
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(quantile * hist->count);
+    if (rank >= hist->count) {
+        rank = hist->count - 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > rank) {
+            uint64_t upper = hist_bucket_upper(i);
+            return upper < hist->max_us ? upper : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
+
+void metrics_hist_merge(metrics_histogram_t* dst, const metrics_histogram_t* src) {
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    dst->sum_us += src->sum_us;
+    if (src->max_us > dst->max_us) {
+        dst->max_us = src->max_us;
+    }
+}
+
+uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void metrics_buf_init(metrics_buf_t* buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+void metrics_buf_free(metrics_buf_t* buf) {
+    free(buf->data);
+    metrics_buf_init(buf);
+}
+
+void metrics_buf_printf(metrics_buf_t* buf, const char* format, ...) {
+    va_list args;
+
+    for (;;) {
+        size_t avail = buf->cap - buf->len;
+        va_start(args, format);
+        int needed = vsnprintf(buf->data ? buf->data + buf->len : NULL, avail, format, args);
+        va_end(args);
+
+        if (needed < 0) {
+            return;
+        }
+        if ((size_t)needed < avail) {
+            buf->len += needed;
+            return;
+        }
+
+        size_t new_cap = buf->cap ? buf->cap * 2 : 4096;
+        while (new_cap - buf->len <= (size_t)needed) {
+            new_cap *= 2;
+        }
+        char* data = realloc(buf->data, new_cap);
+        if (!data) {
+            return;
+        }
+        buf->data = data;
+        buf->cap = new_cap;
+    }
+}
+
+void metrics_write_histogram(metrics_buf_t* buf, const char* name, const char* help,
+                             const metrics_histogram_t* hist) {
+    metrics_buf_printf(buf, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+    // 找到最高的非空桶，只按2的幂边界输出累计值，避免输出过长
+    int last = -1;
+    for (int i = METRICS_HIST_BUCKETS - 1; i >= 0; i--) {
+        if (hist->counts[i]) {
+            last = i;
+            break;
+        }
+    }
+
+    uint64_t cumulative = 0;
+    for (int i = 0; i <= last; i++) {
+        cumulative += hist->counts[i];
+        if (i < METRICS_HIST_SUB_BUCKETS ||
+            (i - METRICS_HIST_SUB_BUCKETS) % METRICS_HIST_SUB_BUCKETS == METRICS_HIST_SUB_BUCKETS - 1 ||
+            i == last) {
+            metrics_buf_printf(buf, "%s_bucket{le=\"%.6f\"} %llu\n", name,
+                               hist_bucket_upper(i) / 1e6, (unsigned long long)cumulative);
+        }
+    }
+
+    metrics_buf_printf(buf, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)hist->count);
+    metrics_buf_printf(buf, "%s_sum %.6f\n", name, hist->sum_us / 1e6);
+    metrics_buf_printf(buf, "%s_count %llu\n", name, (unsigned long long)hist->count);
+}
+
+// 创建仅监听本机的指标端口
+int metrics_create_listener(int port) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("metrics socket");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("metrics bind");
+        close(sockfd);
+        return -1;
+    }
+
+    if (listen(sockfd, 8) < 0) {
+        perror("metrics listen");
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+// 处理一次抓取请求：读取请求头，返回 Prometheus 文本格式
+void metrics_handle_client(int listen_fd, metrics_render_fn render) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+
+    // 抓取端在本机，设置较短超时避免阻塞主循环
+    struct timeval tv = { 0, 200000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    char request[1024];
+    ssize_t n = recv(fd, request, sizeof(request) - 1, 0);
+    if (n <= 0) {
+        close(fd);
+        return;
+    }
+    request[n] = '\0';
+
+    metrics_buf_t body;
+    metrics_buf_init(&body);
+    const char* status = "200 OK";
+    if (strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0) {
+        render(&body);
+    } else {
+        status = "404 Not Found";
+        metrics_buf_printf(&body, "not found\n");
+    }
+
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 %s\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n",
+                              status, body.len);
+
+    send(fd, header, header_len, MSG_NOSIGNAL);
+    size_t sent = 0;
+    while (sent < body.len) {
+        ssize_t result = send(fd, body.data + sent, body.len - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            break;
+        }
+        sent += result;
+    }
+
+    metrics_buf_free(&body);
+    close(fd);
+}
@@ -0,0 +1,49 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 延迟直方图：HDR 风格的对数分桶（每个2的幂区间再分4个子桶），单位微秒，记录为 O(1)
+#define METRICS_HIST_SUB_BUCKETS 4
+#define METRICS_HIST_MAX_EXPONENT 40
+#define METRICS_HIST_BUCKETS (METRICS_HIST_SUB_BUCKETS + (METRICS_HIST_MAX_EXPONENT - 1) * METRICS_HIST_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[METRICS_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+} metrics_histogram_t;
+
+void metrics_hist_record(metrics_histogram_t* hist, uint64_t value_us);
+uint64_t metrics_hist_quantile(const metrics_histogram_t* hist, double quantile);
+
+// 合并直方图（多线程各自记录后汇总）
+void metrics_hist_merge(metrics_histogram_t* dst, const metrics_histogram_t* src);
+
+// 单调时钟（微秒）
+uint64_t metrics_now_us(void);
+
+// Prometheus 文本输出缓冲区
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} metrics_buf_t;
+
+void metrics_buf_init(metrics_buf_t* buf);
+void metrics_buf_free(metrics_buf_t* buf);
+void metrics_buf_printf(metrics_buf_t* buf, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// 输出一个 Prometheus 直方图（秒为单位）
+void metrics_write_histogram(metrics_buf_t* buf, const char* name, const char* help,
+                             const metrics_histogram_t* hist);
+
+// 本地 HTTP 指标端点
+typedef void (*metrics_render_fn)(metrics_buf_t* buf);
+
+int metrics_create_listener(int port);
+void metrics_handle_client(int listen_fd, metrics_render_fn render);
+
+#endif // METRICS_H
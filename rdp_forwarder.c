@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <errno.h>
 #include <signal.h>
 #include <time.h>
@@ -14,12 +16,35 @@
 #include <stdarg.h>
 #include <netinet/tcp.h>
 #include "hybrid_transport.h"
+#include "ht_mux.h"
+#include "spill_buffer.h"
+#include "metrics.h"
+#include "async_log.h"
+#include "control.h"
+#include "handover.h"
+#include "sockmap_relay.h"
+#include "udp_relay.h"
 
 #define DEFAULT_RDP_PORT 3389
 #define DEFAULT_BUFFER_SIZE 8192
+#define DEFAULT_RELAY_BUDGET (64 * 1024)  // 每个会话每个方向每轮循环最多转发的字节数
+#define DEFAULT_BUFFER_MIN 2048
+#define DEFAULT_BUFFER_MAX (256 * 1024)
+#define DEFAULT_BUFFER_MEMORY_LIMIT (256 * 1024 * 1024)   // 所有会话socket收发缓冲区总上限
+#define RELAY_SOCKBUF_FACTOR 4          // socket收发缓冲区为每次读取大小的倍数
+#define RELAY_SHRINK_READS 32           // 连续多少次读取不到1/4才缩小
 #define DEFAULT_MAX_CLIENTS 10
+#define DEFAULT_LISTEN_BACKLOG 512      // 监听队列长度（内核按 net.core.somaxconn 截断）
+#define DEFAULT_LISTEN_DEFER_ACCEPT 0   // 等待客户端首个数据包的秒数，默认关闭
+#define DEFAULT_LISTEN_FASTOPEN 256     // TCP Fast Open 队列长度
+#define DEFAULT_ACCEPT_BATCH 32         // 每轮循环最多接受的新连接数
 #define DEFAULT_CONNECTION_TIMEOUT 300  // 5分钟超时
 #define DEFAULT_RECONNECT_INTERVAL 5    // 重连间隔秒数
+#define DEFAULT_UDP_FLOW_TIMEOUT 30    // UDP流空闲超时秒数
+#define SOCKET_PROFILE_INPUT_IDLE 2     // 多少秒没有客户端输入后 auto 档位不再视为交互会话
+#define UDP_FLOWS_PER_SESSION 4         // 流表容量按每个会话最多几个UDP流计算
+#define DEFAULT_PARK_BUFFER_SIZE (1024 * 1024)       // 挂起会话内存暂存上限
+#define DEFAULT_PARK_MEMORY_LIMIT (64 * 1024 * 1024) // 所有挂起会话内存暂存总上限
 #define CONFIG_FILE "/etc/rdp_forwarder.conf"
 #define MAX_CONFIG_LINE 256
 
@@ -35,43 +60,116 @@ typedef enum {
     CONN_STATE_CLOSING          // 正在关闭
 } connection_state_t;
 
+// 每个方向的读取大小随最近的读取量伸缩：读满则加倍，连续多次读不到1/4则减半，
+// 读取一侧的 SO_RCVBUF 和写出一侧的 SO_SNDBUF 随之调整
 typedef struct {
-    int client_fd;
-    int target_fd;
-    char target_ip[16];
+    int size;                       // 每次读取的字节数，0表示尚未使用（取 buffer_size）
+    int small_reads;                // 连续读不到1/4的次数
+    int sockbuf;                    // 已设置的 SO_RCVBUF/SO_SNDBUF，0表示内核默认
+    long sockbuf_bytes;             // 计入 buffer_memory_limit 的字节数
+} relay_dir_t;
+
+// 会话的socket调优档位。auto 按流量在三档之间切换：最近 SOCKET_PROFILE_INPUT_IDLE 秒内收到过
+// 客户端输入的会话为 interactive（用户正在操作，画面再多也优先输入回显的延迟）；没有输入时按读取大小，
+// 超过 buffer_size 为 balanced，达到 buffer_max 的1/4（视频、向客户端拷贝文件）为 bulk；
+// 客户端到目标方向的读取达到 buffer_max 的1/4（上传文件）时为 bulk
+typedef enum {
+    SOCKET_PROFILE_INTERACTIVE = 0,
+    SOCKET_PROFILE_BALANCED,
+    SOCKET_PROFILE_BULK,
+    SOCKET_PROFILE_AUTO             // 仅用于配置
+} socket_profile_t;
+
+typedef struct {
+    const char* name;
+    int notsent_lowat;              // 客户端一侧 TCP_NOTSENT_LOWAT，0表示系统默认（不限制）
+    int backlog;                    // 客户端写不动时最多暂存的字节数，超过后停止读取目标端，0表示不限制
+    int sockbuf_max;                // 按读取大小设置的 SO_RCVBUF/SO_SNDBUF 上限，0表示不限制
+    int user_timeout_ms;            // TCP_USER_TIMEOUT：已发数据多久未被确认即断开
+    int keepidle;                   // TCP KeepAlive 空闲、探测间隔(秒)和次数
+    int keepintvl;
+    int keepcnt;
+} socket_profile_params_t;
+
+// 拥塞控制算法不在档位中固定，由 congestion_<档位> 配置（默认不改动系统设置）
+static const socket_profile_params_t socket_profiles[] = {
+    [SOCKET_PROFILE_INTERACTIVE] = { "interactive", 16 * 1024, 64 * 1024, 256 * 1024, 30000, 30, 10, 3 },
+    [SOCKET_PROFILE_BALANCED] = { "balanced", 128 * 1024, 512 * 1024, 1024 * 1024, 60000, 60, 15, 4 },
+    [SOCKET_PROFILE_BULK] = { "bulk", 0, 0, 0, 120000, 120, 30, 4 },
+};
+
+// 会话分成热、冷两部分，分别放在两个下标一致的数组中：
+// 主循环每轮遍历所有会话时只读热数据（fd、活动时间、状态标志），每个会话正好一个缓存行；
+// 目标地址、暂存缓冲区、错误信息等只在建立、断开、出错和输出指标时访问的字段放在冷数据中
+typedef struct {
+    ht_stream_t* ht_stream;         // 混合传输会话在隧道上的流
     time_t last_activity;
-    int is_active;
     unsigned long bytes_sent;
     unsigned long bytes_received;
+    int client_fd;
+    int target_fd;
+    connection_state_t state;
+    uint8_t is_active;
+    uint8_t use_hybrid_transport;
+    uint8_t ht_exit_side;           // 出口中继会话：混合传输对端相当于客户端，target_fd 为到RDP主机的TCP
+    uint8_t client_disconnected;    // 快速重连：客户端已断开，目标连接保持
+    uint8_t target_ready;
+    uint8_t parked;                 // 暂存缓冲区可能有数据，为0时不必查看冷数据
+    uint8_t kernel_relay;           // 内核直接转发（sockmap）：1 两个方向，2 只有客户端到目标
+} __attribute__((aligned(64))) connection_pair_t;
 
-    // 混合传输连接
-    ht_connection_t* ht_conn;
-    int use_hybrid_transport;
+_Static_assert(sizeof(connection_pair_t) == 64, "connection_pair_t 应正好占一个缓存行");
+
+typedef struct {
+    unsigned long session_id;       // 会话编号（数组下标会随清理移动，指标中使用此编号）
+    char target_ip[16];             // 会话建立时的目标（配置重载后已有会话保持原目标）
+    int target_port;
+    relay_dir_t relay[2];           // 0: 客户端到目标，1: 目标到客户端
+    int socket_profile;             // 两端socket当前应用的调优档位
+    time_t last_input;              // 最近一次读到客户端数据的时间（auto 档位判断用户是否在操作）
+    time_t profile_checked;         // 上次按流量选择档位的时间
+    int kernel_slot;                // sockmap 槽位，-1表示未交给内核转发
+    uint64_t kernel_bytes[2];       // 上次同步时内核已转发的字节数（方向同 relay）
+    struct sockaddr_in client_addr; // 客户端地址，RDP UDP 流按此归属到会话
+    uint64_t accept_time_us;        // 接受客户端的时间（建立后计入 accept_latency）
+    uint64_t connect_start_us;      // 开始连接目标的时间
 
     // 快速重连状态
-    int client_disconnected;
-    int target_ready;
     time_t disconnect_time;
     int reconnect_attempts;
+    spill_buffer_t park_buffer;     // 客户端断开期间目标端数据暂存
 
     // 连接状态跟踪
-    connection_state_t state;
     time_t state_change_time;
     time_t connection_start_time;
     char last_error[256];
     int error_count;
-} connection_pair_t;
+} connection_info_t;
 
 typedef struct {
     char target_ip[16];
     int target_port;
     int listen_port;
     char listen_interface[16];
+    int listen_backlog;             // 监听队列长度
+    int listen_defer_accept;        // TCP_DEFER_ACCEPT 秒数，0表示关闭
+    int listen_fastopen;            // TCP_FASTOPEN 队列长度，0表示关闭
+    int accept_batch;               // 每轮循环最多接受的新连接数，其余留到下一轮
     int max_clients;
     int connection_timeout;
     int reconnect_interval;
     int verbose_logging;
+    int log_rate_limit;             // 每个日志调用点每秒最多输出条数，0表示不限速
     int buffer_size;
+    int relay_budget;               // 每个会话每个方向每轮循环最多转发的字节数
+    int buffer_min;                 // 自适应读取大小的下限
+    int buffer_max;                 // 自适应读取大小的上限
+    int buffer_memory_limit;        // 所有会话按读取大小设置的socket缓冲区总上限(字节)
+    int kernel_relay;               // 已建立的TCP会话交给内核转发（eBPF sockmap），不可用时用户态转发
+    int udp_relay;                  // 在 listen_port 上转发 RDP 的UDP传输，流归属到同一客户端的TCP会话
+    int udp_flow_timeout;           // UDP流空闲超时(秒)
+    int socket_profile;             // 会话的socket调优档位，SOCKET_PROFILE_AUTO 按流量自动切换
+    char socket_congestion[SOCKET_PROFILE_AUTO][16];  // 各档位的 TCP_CONGESTION，为空表示系统默认
     int socket_timeout;
     int enable_stats;
     int stats_interval;
@@ -83,6 +181,11 @@ typedef struct {
     int retransmit_timeout;
     int max_retransmit;
     int heartbeat_interval;
+    char ht_exit_ip[16];            // 出口中继地址：配置后新会话经混合传输发往出口中继
+    int ht_exit_port;
+    int ht_listen_port;             // 作为出口中继接受混合传输对端的端口，0表示关闭
+    char ht_local_addrs[128];       // 多路径：逗号分隔的本地地址，每个地址一条UDP子路径
+    int ht_duplicate_interactive;   // 多路径时交互包在两条路径上各发一份
 
     // 快速重连配置
     int enable_fast_reconnect;
@@ -90,22 +193,77 @@ typedef struct {
     int reconnect_delay;
     int max_reconnect_attempts;
     int connection_pool_size;
+    int park_buffer_size;           // 每会话暂存内存上限(字节)
+    int park_memory_limit;          // 全局暂存内存上限(字节)
+    int park_spill_size;            // 每会话溢出文件上限(字节)，0表示不使用文件
+    char park_spill_dir[256];       // 溢出文件目录
+
+    // 监控配置
+    int metrics_port;               // 本机指标端口(Prometheus文本格式)，0表示关闭
+    char control_socket[108];       // 本机控制socket路径，为空表示关闭
 } config_t;
 
 // 全局配置和状态
 config_t config;
 connection_pair_t* connections;
+connection_info_t* connection_info;    // 与 connections 下标一致的冷数据
 int connection_count = 0;
 volatile int running = 1;
+volatile sig_atomic_t shutdown_signal = 0;
+volatile sig_atomic_t reload_requested = 0;
 
-// 统计信息
+// 配置文件路径和命令行指定的目标（重载时保持）
+const char* config_path = CONFIG_FILE;
+const char* cmdline_target_ip = NULL;
+
+// 监听、指标和控制 socket（交接时需要在处理函数中关闭）
+int listen_fd = -1;
+int metrics_fd = -1;
+int control_fd = -1;
+
+// 已把会话交给新进程，剩余（混合传输）会话结束后退出
+int handover_draining = 0;
+
+// 转发共用的读缓冲区（主循环单线程），按 buffer_max 分配；所有会话按读取大小设置的socket缓冲区总量
+char* relay_buffer = NULL;
+int relay_buffer_capacity = 0;
+long relay_sockbuf_total = 0;
+
+// 内核转发：0 尚未初始化，1 可用，-1 不可用（只尝试一次）
+int kernel_relay_state = 0;
+time_t kernel_relay_synced = 0;
+
+// 启动时读到的系统默认拥塞控制算法
+char default_congestion[16];
+
+// RDP UDP 传输转发，未开启时为 NULL
+udp_relay_t* udp_relay = NULL;
+
+// 出口中继的混合传输监听器
+ht_listener_t* ht_listener = NULL;
+
+// 混合传输隧道：入口到出口中继一条，出口中继上每个入口一条，会话是隧道上的流
+ht_mux_t** ht_tunnels = NULL;
+int ht_tunnel_count = 0;
+int ht_tunnel_capacity = 0;
+ht_mux_t* ht_exit_tunnel = NULL;    // 入口新会话使用的隧道
+
+// 统计信息（在转发路径上增量维护，读取时无需遍历连接）
 typedef struct {
     unsigned long total_connections;
     unsigned long active_connections;
     unsigned long total_bytes_sent;
     unsigned long total_bytes_received;
+    unsigned long failed_connections;
+    unsigned long socket_profile_switches;  // 会话按流量切换调优档位的次数
     time_t start_time;
     time_t last_stats_time;
+
+    // 延迟直方图
+    metrics_histogram_t accept_latency;     // 接受客户端到会话建立
+    metrics_histogram_t connect_latency;    // 连接目标端耗时
+    metrics_histogram_t relay_latency;      // 单次读取到转发写完的耗时
+    metrics_histogram_t loop_lag;           // 每轮事件循环的处理耗时
 } stats_t;
 
 stats_t stats;
@@ -120,14 +278,26 @@ int forward_data(int from_fd, int to_fd, connection_pair_t* conn, int is_client_
 int create_listen_socket(int port);
 int connect_to_target(const char* target_ip, int port);
 void signal_handler(int sig);
-void init_config(void);
-int load_config(const char* config_file);
+void init_config(config_t* cfg);
+int load_config(const char* config_file, config_t* cfg);
+int validate_config(const config_t* cfg, char* error, size_t error_size);
+int parse_local_addrs(const char* list, char addrs[][16]);
+int reload_config(char* result, size_t result_size);
+void handle_control_command(int control_listen_fd);
+int perform_handover(int sock);
+int receive_handover(const char* control_path);
 void init_stats(void);
 void print_stats(void);
-void update_stats(void);
+void render_metrics(metrics_buf_t* buf);
 // 健康检查函数已移除
-int create_hybrid_connection(connection_pair_t* conn, const char* target_ip, int port);
-int forward_data_hybrid(connection_pair_t* conn, int from_client);
+int create_hybrid_connection(connection_pair_t* conn, const char* exit_ip, int port);
+int forward_data_hybrid(connection_pair_t* conn, int from_tcp);
+void accept_hybrid_sessions(void);
+void accept_client(int client_fd, const struct sockaddr_in* client_addr);
+int add_tunnel(ht_mux_t* tunnel);
+ht_mux_t* get_exit_tunnel(const char* exit_ip, int port);
+void reap_tunnels(void);
+int tunnel_ready(ht_mux_t* tunnel, fd_set* readfds);
 void handle_client_disconnect(connection_pair_t* conn);
 void log_connection_error(connection_pair_t* conn, int error_code, const char* context, int is_client_side);
 int try_reconnect_target(connection_pair_t* conn);
@@ -138,43 +308,119 @@ const char* get_connection_state_name(connection_state_t state);
 void log_connection_state_change(connection_pair_t* conn, int conn_index);
 
 // TCP socket 参数调优（在客户端和目标端两侧保持一致行为，提升 RDP 兼容性）
-static void configure_tcp_socket(int fd);
+static void configure_tcp_socket(int fd, int client_side, int profile);
+
+// socket调优档位
+static void socket_profile_set(int fd, int profile, int client_side);
+static int socket_profile_initial(void);
+static void socket_profile_switch(connection_pair_t* conn, int profile);
+static void socket_profile_update(connection_pair_t* conn);
+static void socket_profile_observe(connection_pair_t* conn, int dir, int resized);
+static int socket_profile_backlogged(connection_pair_t* conn);
+static int congestion_available(const char* name);
+static void read_default_congestion(void);
+
+// 按读取量自适应的转发缓冲区
+static char* get_relay_buffer(void);
+static size_t relay_read_size(connection_pair_t* conn, int dir);
+static void relay_adapt(connection_pair_t* conn, int dir, int rcv_fd, int snd_fd,
+                        size_t bytes, size_t read_size);
+static void relay_release(connection_pair_t* conn);
+
+// 会话的热、冷两部分
+static int grow_connections(int capacity);
+static connection_pair_t* reset_connection_slot(int index);
+static size_t park_append(connection_pair_t* conn, const void* data, size_t size);
+static size_t park_pending_size(connection_pair_t* conn);
+
+// 内核转发（sockmap）
+static void kernel_relay_attach(connection_pair_t* conn);
+static void kernel_relay_sync(connection_pair_t* conn);
+static int kernel_relay_sync_all(int force);
+static int kernel_relay_readable(int fd);
+static void kernel_relay_stop(connection_pair_t* conn);
+static void kernel_relay_release(connection_pair_t* conn);
+static int kernel_relay_sessions(void);
+
+static int udp_flow_owner(const struct sockaddr_in* client, unsigned long* owner, struct sockaddr_in* target);
+static void udp_flow_account(unsigned long owner, size_t to_target, size_t to_client);
+static void udp_relay_open(void);
+
+static int configure_listen_socket(int fd);
+static int start_target_connect(const char* target_ip, int port, int* in_progress);
+static int finish_target_connect(connection_pair_t* conn);
+static void session_established(connection_pair_t* conn);
+
+static inline connection_info_t* conn_info(connection_pair_t* conn) {
+    return &connection_info[conn - connections];
+}
 
-// 信号处理函数
+// 信号处理函数（只设置标志，日志在主循环中输出）
 void signal_handler(int sig) {
-    log_message(LOG_INFO, "Received signal %d, shutting down gracefully...", sig);
+    shutdown_signal = sig;
     running = 0;
 }
 
+// SIGHUP：请求在主循环的迭代边界重载配置
+void reload_signal_handler(int sig) {
+    (void)sig;
+    reload_requested = 1;
+}
+
 // 初始化默认配置
-void init_config(void) {
-    strcpy(config.target_ip, "192.168.192.100");
-    config.target_port = DEFAULT_RDP_PORT;
-    config.listen_port = DEFAULT_RDP_PORT;
-    strcpy(config.listen_interface, "0.0.0.0");
-    config.max_clients = DEFAULT_MAX_CLIENTS;
-    config.connection_timeout = DEFAULT_CONNECTION_TIMEOUT;
-    config.reconnect_interval = DEFAULT_RECONNECT_INTERVAL;
-    config.verbose_logging = 1;
-    config.buffer_size = DEFAULT_BUFFER_SIZE;
-    config.socket_timeout = 30;
-    config.enable_stats = 1;
-    config.stats_interval = 60;
-    strcpy(config.log_file, "/var/log/rdp_forwarder.log");
+void init_config(config_t* cfg) {
+    strcpy(cfg->target_ip, "192.168.192.100");
+    cfg->target_port = DEFAULT_RDP_PORT;
+    cfg->listen_port = DEFAULT_RDP_PORT;
+    strcpy(cfg->listen_interface, "0.0.0.0");
+    cfg->listen_backlog = DEFAULT_LISTEN_BACKLOG;
+    cfg->listen_defer_accept = DEFAULT_LISTEN_DEFER_ACCEPT;
+    cfg->listen_fastopen = DEFAULT_LISTEN_FASTOPEN;
+    cfg->accept_batch = DEFAULT_ACCEPT_BATCH;
+    cfg->max_clients = DEFAULT_MAX_CLIENTS;
+    cfg->connection_timeout = DEFAULT_CONNECTION_TIMEOUT;
+    cfg->reconnect_interval = DEFAULT_RECONNECT_INTERVAL;
+    cfg->verbose_logging = 1;
+    cfg->log_rate_limit = 100;
+    cfg->buffer_size = DEFAULT_BUFFER_SIZE;
+    cfg->relay_budget = DEFAULT_RELAY_BUDGET;
+    cfg->buffer_min = DEFAULT_BUFFER_MIN;
+    cfg->buffer_max = DEFAULT_BUFFER_MAX;
+    cfg->buffer_memory_limit = DEFAULT_BUFFER_MEMORY_LIMIT;
+    cfg->kernel_relay = 0;
+    cfg->udp_relay = 0;
+    cfg->udp_flow_timeout = DEFAULT_UDP_FLOW_TIMEOUT;
+    cfg->socket_profile = SOCKET_PROFILE_AUTO;
+    cfg->socket_timeout = 30;
+    cfg->enable_stats = 1;
+    cfg->stats_interval = 60;
+    strcpy(cfg->log_file, "/var/log/rdp_forwarder.log");
 
     // 混合传输默认配置（暂时使用TCP模式确保兼容性）
-    config.transport_mode = HT_MODE_TCP_ONLY;
-    config.udp_preference = 0.0f;
-    config.retransmit_timeout = 100;
-    config.max_retransmit = 3;
-    config.heartbeat_interval = 1000;
+    cfg->transport_mode = HT_MODE_TCP_ONLY;
+    cfg->udp_preference = 0.0f;
+    cfg->retransmit_timeout = 100;
+    cfg->max_retransmit = 3;
+    cfg->heartbeat_interval = 1000;
+    cfg->ht_exit_ip[0] = '\0';
+    cfg->ht_exit_port = 0;
+    cfg->ht_listen_port = 0;
+    cfg->ht_local_addrs[0] = '\0';
+    cfg->ht_duplicate_interactive = 0;
 
     // 快速重连默认配置（暂时禁用以确保基本功能正常）
-    config.enable_fast_reconnect = 0;
-    config.keep_target_alive = 1;
-    config.reconnect_delay = 100;
-    config.max_reconnect_attempts = 5;
-    config.connection_pool_size = 2;
+    cfg->enable_fast_reconnect = 0;
+    cfg->keep_target_alive = 1;
+    cfg->reconnect_delay = 100;
+    cfg->max_reconnect_attempts = 5;
+    cfg->connection_pool_size = 2;
+    cfg->park_buffer_size = DEFAULT_PARK_BUFFER_SIZE;
+    cfg->park_memory_limit = DEFAULT_PARK_MEMORY_LIMIT;
+    cfg->park_spill_size = 0;
+    strcpy(cfg->park_spill_dir, "/var/tmp");
+
+    cfg->metrics_port = 0;
+    cfg->control_socket[0] = '\0';
 }
 
 // 去除字符串首尾空白字符
@@ -189,7 +435,7 @@ char* trim(char* str) {
 }
 
 // 加载配置文件
-int load_config(const char* config_file) {
+int load_config(const char* config_file, config_t* cfg) {
     FILE* fp = fopen(config_file, "r");
     if (!fp) {
         log_message(LOG_WARNING, "Cannot open config file %s, using defaults", config_file);
@@ -226,61 +472,123 @@ int load_config(const char* config_file) {
 
         // 解析配置项
         if (strcmp(key, "target_ip") == 0) {
-            strncpy(config.target_ip, value, sizeof(config.target_ip) - 1);
+            strncpy(cfg->target_ip, value, sizeof(cfg->target_ip) - 1);
         } else if (strcmp(key, "target_port") == 0) {
-            config.target_port = atoi(value);
+            cfg->target_port = atoi(value);
         } else if (strcmp(key, "listen_port") == 0) {
-            config.listen_port = atoi(value);
+            cfg->listen_port = atoi(value);
         } else if (strcmp(key, "listen_interface") == 0) {
-            strncpy(config.listen_interface, value, sizeof(config.listen_interface) - 1);
+            strncpy(cfg->listen_interface, value, sizeof(cfg->listen_interface) - 1);
+        } else if (strcmp(key, "listen_backlog") == 0) {
+            cfg->listen_backlog = atoi(value);
+        } else if (strcmp(key, "listen_defer_accept") == 0) {
+            cfg->listen_defer_accept = atoi(value);
+        } else if (strcmp(key, "listen_fastopen") == 0) {
+            cfg->listen_fastopen = atoi(value);
+        } else if (strcmp(key, "accept_batch") == 0) {
+            cfg->accept_batch = atoi(value);
         } else if (strcmp(key, "max_clients") == 0) {
-            config.max_clients = atoi(value);
+            cfg->max_clients = atoi(value);
         } else if (strcmp(key, "connection_timeout") == 0) {
-            config.connection_timeout = atoi(value);
+            cfg->connection_timeout = atoi(value);
         } else if (strcmp(key, "reconnect_interval") == 0) {
-            config.reconnect_interval = atoi(value);
+            cfg->reconnect_interval = atoi(value);
         } else if (strcmp(key, "verbose_logging") == 0) {
-            config.verbose_logging = atoi(value);
+            cfg->verbose_logging = atoi(value);
+        } else if (strcmp(key, "log_rate_limit") == 0) {
+            cfg->log_rate_limit = atoi(value);
         } else if (strcmp(key, "buffer_size") == 0) {
-            config.buffer_size = atoi(value);
+            cfg->buffer_size = atoi(value);
+        } else if (strcmp(key, "relay_budget") == 0) {
+            cfg->relay_budget = atoi(value);
+        } else if (strcmp(key, "buffer_min") == 0) {
+            cfg->buffer_min = atoi(value);
+        } else if (strcmp(key, "buffer_max") == 0) {
+            cfg->buffer_max = atoi(value);
+        } else if (strcmp(key, "buffer_memory_limit") == 0) {
+            cfg->buffer_memory_limit = atoi(value);
+        } else if (strcmp(key, "kernel_relay") == 0) {
+            cfg->kernel_relay = atoi(value);
+        } else if (strcmp(key, "udp_relay") == 0) {
+            cfg->udp_relay = atoi(value);
+        } else if (strcmp(key, "udp_flow_timeout") == 0) {
+            cfg->udp_flow_timeout = atoi(value);
+        } else if (strcmp(key, "socket_profile") == 0) {
+            cfg->socket_profile = -1;
+            for (int i = 0; i <= SOCKET_PROFILE_BULK; i++) {
+                if (strcmp(value, socket_profiles[i].name) == 0) {
+                    cfg->socket_profile = i;
+                }
+            }
+            if (strcmp(value, "auto") == 0) {
+                cfg->socket_profile = SOCKET_PROFILE_AUTO;
+            }
+        } else if (strncmp(key, "congestion_", 11) == 0) {
+            for (int i = 0; i < SOCKET_PROFILE_AUTO; i++) {
+                if (strcmp(key + 11, socket_profiles[i].name) == 0) {
+                    strncpy(cfg->socket_congestion[i], value, sizeof(cfg->socket_congestion[i]) - 1);
+                }
+            }
         } else if (strcmp(key, "socket_timeout") == 0) {
-            config.socket_timeout = atoi(value);
+            cfg->socket_timeout = atoi(value);
         } else if (strcmp(key, "enable_stats") == 0) {
-            config.enable_stats = atoi(value);
+            cfg->enable_stats = atoi(value);
         } else if (strcmp(key, "stats_interval") == 0) {
-            config.stats_interval = atoi(value);
+            cfg->stats_interval = atoi(value);
         } else if (strcmp(key, "log_file") == 0) {
-            strncpy(config.log_file, value, sizeof(config.log_file) - 1);
+            strncpy(cfg->log_file, value, sizeof(cfg->log_file) - 1);
         } else if (strcmp(key, "transport_mode") == 0) {
             if (strcmp(value, "udp") == 0) {
-                config.transport_mode = HT_MODE_UDP_ONLY;
+                cfg->transport_mode = HT_MODE_UDP_ONLY;
             } else if (strcmp(value, "tcp") == 0) {
-                config.transport_mode = HT_MODE_TCP_ONLY;
+                cfg->transport_mode = HT_MODE_TCP_ONLY;
             } else if (strcmp(value, "hybrid") == 0) {
-                config.transport_mode = HT_MODE_HYBRID;
+                cfg->transport_mode = HT_MODE_HYBRID;
             } else if (strcmp(value, "auto") == 0) {
-                config.transport_mode = HT_MODE_AUTO;
+                cfg->transport_mode = HT_MODE_AUTO;
             }
         } else if (strcmp(key, "udp_preference") == 0) {
-            config.udp_preference = atof(value);
-            if (config.udp_preference < 0.0f) config.udp_preference = 0.0f;
-            if (config.udp_preference > 1.0f) config.udp_preference = 1.0f;
+            cfg->udp_preference = atof(value);
+            if (cfg->udp_preference < 0.0f) cfg->udp_preference = 0.0f;
+            if (cfg->udp_preference > 1.0f) cfg->udp_preference = 1.0f;
         } else if (strcmp(key, "retransmit_timeout") == 0) {
-            config.retransmit_timeout = atoi(value);
+            cfg->retransmit_timeout = atoi(value);
         } else if (strcmp(key, "max_retransmit") == 0) {
-            config.max_retransmit = atoi(value);
+            cfg->max_retransmit = atoi(value);
         } else if (strcmp(key, "heartbeat_interval") == 0) {
-            config.heartbeat_interval = atoi(value);
+            cfg->heartbeat_interval = atoi(value);
+        } else if (strcmp(key, "ht_exit_ip") == 0) {
+            strncpy(cfg->ht_exit_ip, value, sizeof(cfg->ht_exit_ip) - 1);
+        } else if (strcmp(key, "ht_exit_port") == 0) {
+            cfg->ht_exit_port = atoi(value);
+        } else if (strcmp(key, "ht_listen_port") == 0) {
+            cfg->ht_listen_port = atoi(value);
+        } else if (strcmp(key, "ht_local_addrs") == 0) {
+            strncpy(cfg->ht_local_addrs, value, sizeof(cfg->ht_local_addrs) - 1);
+        } else if (strcmp(key, "ht_duplicate_interactive") == 0) {
+            cfg->ht_duplicate_interactive = atoi(value);
         } else if (strcmp(key, "enable_fast_reconnect") == 0) {
-            config.enable_fast_reconnect = atoi(value);
+            cfg->enable_fast_reconnect = atoi(value);
         } else if (strcmp(key, "keep_target_alive") == 0) {
-            config.keep_target_alive = atoi(value);
+            cfg->keep_target_alive = atoi(value);
         } else if (strcmp(key, "reconnect_delay") == 0) {
-            config.reconnect_delay = atoi(value);
+            cfg->reconnect_delay = atoi(value);
         } else if (strcmp(key, "max_reconnect_attempts") == 0) {
-            config.max_reconnect_attempts = atoi(value);
+            cfg->max_reconnect_attempts = atoi(value);
         } else if (strcmp(key, "connection_pool_size") == 0) {
-            config.connection_pool_size = atoi(value);
+            cfg->connection_pool_size = atoi(value);
+        } else if (strcmp(key, "park_buffer_size") == 0) {
+            cfg->park_buffer_size = atoi(value);
+        } else if (strcmp(key, "park_memory_limit") == 0) {
+            cfg->park_memory_limit = atoi(value);
+        } else if (strcmp(key, "park_spill_size") == 0) {
+            cfg->park_spill_size = atoi(value);
+        } else if (strcmp(key, "park_spill_dir") == 0) {
+            strncpy(cfg->park_spill_dir, value, sizeof(cfg->park_spill_dir) - 1);
+        } else if (strcmp(key, "metrics_port") == 0) {
+            cfg->metrics_port = atoi(value);
+        } else if (strcmp(key, "control_socket") == 0) {
+            strncpy(cfg->control_socket, value, sizeof(cfg->control_socket) - 1);
         } else {
             // 安全地记录未知配置键，避免格式字符串攻击
             if (key && strlen(key) > 0) {
@@ -296,35 +604,547 @@ int load_config(const char* config_file) {
     return 1;
 }
 
-// 初始化统计信息
-void init_stats(void) {
-    memset(&stats, 0, sizeof(stats));
-    stats.start_time = time(NULL);
-    stats.last_stats_time = stats.start_time;
+// 解析逗号分隔的本地地址列表，返回地址数；格式错误或超过 HT_MAX_PATHS 个时返回-1
+int parse_local_addrs(const char* list, char addrs[][16]) {
+    int count = 0;
+    const char* p = list;
+    while (*p) {
+        while (*p == ' ' || *p == ',') {
+            p++;
+        }
+        size_t len = 0;
+        while (p[len] && p[len] != ',' && p[len] != ' ') {
+            len++;
+        }
+        if (len == 0) {
+            break;
+        }
+        struct in_addr addr;
+        if (count >= HT_MAX_PATHS || len >= 16) {
+            return -1;
+        }
+        memcpy(addrs[count], p, len);
+        addrs[count][len] = '\0';
+        if (inet_pton(AF_INET, addrs[count], &addr) != 1) {
+            return -1;
+        }
+        count++;
+        p += len;
+    }
+    return count;
+}
+
+// 校验配置，失败时返回 0 并写入原因
+int validate_config(const config_t* cfg, char* error, size_t error_size) {
+    struct in_addr addr;
+
+    if (inet_pton(AF_INET, cfg->target_ip, &addr) <= 0) {
+        snprintf(error, error_size, "invalid target_ip '%s'", cfg->target_ip);
+        return 0;
+    }
+    if (cfg->target_port <= 0 || cfg->target_port > 65535) {
+        snprintf(error, error_size, "invalid target_port %d", cfg->target_port);
+        return 0;
+    }
+    if (cfg->listen_port <= 0 || cfg->listen_port > 65535) {
+        snprintf(error, error_size, "invalid listen_port %d", cfg->listen_port);
+        return 0;
+    }
+    if (cfg->max_clients <= 0) {
+        snprintf(error, error_size, "invalid max_clients %d", cfg->max_clients);
+        return 0;
+    }
+    if (cfg->listen_backlog <= 0 || cfg->listen_defer_accept < 0 || cfg->listen_fastopen < 0) {
+        snprintf(error, error_size, "invalid listen_backlog/listen_defer_accept/listen_fastopen");
+        return 0;
+    }
+    if (cfg->accept_batch <= 0) {
+        snprintf(error, error_size, "invalid accept_batch %d", cfg->accept_batch);
+        return 0;
+    }
+    if (cfg->connection_timeout <= 0) {
+        snprintf(error, error_size, "invalid connection_timeout %d", cfg->connection_timeout);
+        return 0;
+    }
+    if (cfg->buffer_size < 512 || cfg->buffer_size > 16 * 1024 * 1024) {
+        snprintf(error, error_size, "buffer_size %d out of range (512-16777216)", cfg->buffer_size);
+        return 0;
+    }
+    if (cfg->buffer_min < 512 || cfg->buffer_max > 16 * 1024 * 1024 ||
+        cfg->buffer_min > cfg->buffer_size || cfg->buffer_size > cfg->buffer_max) {
+        snprintf(error, error_size, "buffer sizes must satisfy 512 <= buffer_min (%d) <= buffer_size (%d) "
+                 "<= buffer_max (%d) <= 16777216", cfg->buffer_min, cfg->buffer_size, cfg->buffer_max);
+        return 0;
+    }
+    if (cfg->buffer_memory_limit < 0) {
+        snprintf(error, error_size, "invalid buffer_memory_limit %d", cfg->buffer_memory_limit);
+        return 0;
+    }
+    if (cfg->relay_budget <= 0) {
+        snprintf(error, error_size, "invalid relay_budget %d", cfg->relay_budget);
+        return 0;
+    }
+    if (cfg->udp_flow_timeout <= 0) {
+        snprintf(error, error_size, "invalid udp_flow_timeout %d", cfg->udp_flow_timeout);
+        return 0;
+    }
+    if (cfg->socket_profile < 0) {
+        snprintf(error, error_size, "invalid socket_profile (auto, interactive, balanced or bulk)");
+        return 0;
+    }
+    for (int i = 0; i < SOCKET_PROFILE_AUTO; i++) {
+        if (cfg->socket_congestion[i][0] && !congestion_available(cfg->socket_congestion[i])) {
+            snprintf(error, error_size, "congestion_%s: %s is not available (%s)", socket_profiles[i].name,
+                     cfg->socket_congestion[i], strerror(errno));
+            return 0;
+        }
+    }
+    if (cfg->socket_timeout < 0 || cfg->stats_interval <= 0) {
+        snprintf(error, error_size, "invalid socket_timeout/stats_interval");
+        return 0;
+    }
+    if (cfg->retransmit_timeout <= 0 || cfg->max_retransmit < 0 || cfg->heartbeat_interval <= 0) {
+        snprintf(error, error_size, "invalid hybrid transport timing parameters");
+        return 0;
+    }
+    if (cfg->ht_exit_ip[0]) {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, cfg->ht_exit_ip, &addr) != 1) {
+            snprintf(error, error_size, "invalid ht_exit_ip '%s'", cfg->ht_exit_ip);
+            return 0;
+        }
+        if (cfg->ht_exit_port <= 0 || cfg->ht_exit_port > 65535) {
+            snprintf(error, error_size, "invalid ht_exit_port %d", cfg->ht_exit_port);
+            return 0;
+        }
+    }
+    if (cfg->ht_listen_port < 0 || cfg->ht_listen_port > 65535) {
+        snprintf(error, error_size, "invalid ht_listen_port %d", cfg->ht_listen_port);
+        return 0;
+    }
+    char local_addrs[HT_MAX_PATHS][16];
+    if (parse_local_addrs(cfg->ht_local_addrs, local_addrs) < 0) {
+        snprintf(error, error_size, "invalid ht_local_addrs '%s' (at most %d IPv4 addresses)",
+                 cfg->ht_local_addrs, HT_MAX_PATHS);
+        return 0;
+    }
+    if (cfg->park_buffer_size < 0 || cfg->park_memory_limit < 0 || cfg->park_spill_size < 0) {
+        snprintf(error, error_size, "invalid park buffer limits");
+        return 0;
+    }
+    return 1;
+}
+
+// 重载配置：解析并校验新配置，通过后在迭代边界整体替换。
+// 主循环是唯一读取配置的线程，迭代边界即为安全点；已有会话保持自己的目标，
+// 超时、缓冲区、暂存上限和混合传输参数对已有会话立即生效
+int reload_config(char* result, size_t result_size) {
+    config_t* new_config = malloc(sizeof(config_t));
+    if (!new_config) {
+        snprintf(result, result_size, "out of memory");
+        return -1;
+    }
+
+    init_config(new_config);
+    if (cmdline_target_ip) {
+        strncpy(new_config->target_ip, cmdline_target_ip, sizeof(new_config->target_ip) - 1);
+    }
+    if (!load_config(config_path, new_config)) {
+        snprintf(result, result_size, "cannot read %s", config_path);
+        free(new_config);
+        return -1;
+    }
+
+    char error[256];
+    if (!validate_config(new_config, error, sizeof(error))) {
+        snprintf(result, result_size, "validation failed: %s", error);
+        free(new_config);
+        return -1;
+    }
+
+    // 需要重新绑定或重新分配的参数保持原值
+    if (new_config->listen_port != config.listen_port ||
+        strcmp(new_config->listen_interface, config.listen_interface) != 0 ||
+        new_config->metrics_port != config.metrics_port ||
+        new_config->ht_listen_port != config.ht_listen_port ||
+        new_config->udp_relay != config.udp_relay ||
+        strcmp(new_config->control_socket, config.control_socket) != 0) {
+        log_message(LOG_WARNING, "listen/metrics/control socket changes require a restart, keeping current values");
+        new_config->listen_port = config.listen_port;
+        new_config->udp_relay = config.udp_relay;
+        strcpy(new_config->listen_interface, config.listen_interface);
+        new_config->metrics_port = config.metrics_port;
+        new_config->ht_listen_port = config.ht_listen_port;
+        strcpy(new_config->control_socket, config.control_socket);
+    }
+
+    // 连接数组只扩不缩，已有会话不受影响
+    if (new_config->max_clients > config.max_clients) {
+        if (grow_connections(new_config->max_clients) < 0) {
+            new_config->max_clients = config.max_clients;
+        }
+    } else if (new_config->max_clients < connection_count) {
+        new_config->max_clients = connection_count;
+    }
+
+    config = *new_config;
+    free(new_config);
+
+    spill_set_limits(config.park_buffer_size, config.park_memory_limit,
+                     config.park_spill_size, config.park_spill_dir);
+    async_log_set_rate_limit(config.log_rate_limit);
+    if (listen_fd >= 0 && configure_listen_socket(listen_fd) < 0) {
+        log_message(LOG_WARNING, "Failed to apply listen parameters: %s", strerror(errno));
+    }
+    if (udp_relay) {
+        udp_relay->idle_timeout = config.udp_flow_timeout;
+    }
+
+    // 已有TCP会话按新的 socket_profile 重新选择档位
+    for (int i = 0; i < connection_count; i++) {
+        if (connections[i].is_active && connections[i].state != CONN_STATE_CONNECTING) {
+            socket_profile_update(&connections[i]);
+        }
+    }
+
+    // 已有混合传输隧道迁移到新的调优参数
+    for (int i = 0; i < ht_tunnel_count; i++) {
+        ht_tunnels[i]->conn->udp_preference = config.udp_preference;
+        ht_tunnels[i]->conn->retransmit_timeout = config.retransmit_timeout;
+        ht_tunnels[i]->conn->max_retransmit = config.max_retransmit;
+        ht_tunnels[i]->conn->duplicate_interactive = config.ht_duplicate_interactive;
+    }
+
+    snprintf(result, result_size, "configuration reloaded, new sessions use %s:%d",
+             config.target_ip, config.target_port);
+    return 0;
 }
 
-// 更新统计信息
-void update_stats(void) {
-    stats.active_connections = 0;
-    stats.total_bytes_sent = 0;
-    stats.total_bytes_received = 0;
+// 交接记录：会话状态随 fd 一起发送给新进程
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t type;
+    int has_client_fd;
+    int has_target_fd;
+
+    // 会话状态
+    unsigned long session_id;
+    char target_ip[16];
+    int target_port;
+    time_t last_activity;
+    time_t state_change_time;
+    time_t connection_start_time;
+    time_t disconnect_time;
+    int state;
+    int client_disconnected;
+    int target_ready;
+    int reconnect_attempts;
+    int error_count;
+    int socket_profile;             // 两端socket当前的调优档位（socket 参数随 fd 一起保留）
+    unsigned long bytes_sent;
+    unsigned long bytes_received;
+    uint64_t parked_bytes;
+    char last_error[256];
+
+    // 全局统计（监听记录使用）
+    unsigned long total_connections;
+    unsigned long failed_connections;
+    unsigned long total_bytes_sent;
+    unsigned long total_bytes_received;
+    time_t start_time;
+} handover_record_t;
+
+// 旧进程：把监听 socket 和所有TCP会话交给新进程，混合传输会话留在本进程直到结束
+int perform_handover(int sock) {
+    handover_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = HANDOVER_MAGIC;
+    record.version = HANDOVER_VERSION;
+    record.type = HANDOVER_RECORD_LISTENER;
+    record.total_connections = stats.total_connections;
+    record.failed_connections = stats.failed_connections;
+    record.total_bytes_sent = stats.total_bytes_sent;
+    record.total_bytes_received = stats.total_bytes_received;
+    record.start_time = stats.start_time;
+
+    // 交接期间允许新进程稍慢地读取
+    struct timeval tv = { 5, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (handover_send(sock, &record, sizeof(record), &listen_fd, 1) < 0) {
+        log_message(LOG_ERR, "Handover failed while sending listener: %s", strerror(errno));
+        return -1;
+    }
+
+    // 从这里开始新进程已经在接受新连接
+    close(listen_fd);
+    listen_fd = -1;
+
+    int handed_over = 0;
+    for (int i = 0; i < connection_count; i++) {
+        connection_pair_t* conn = &connections[i];
+        connection_info_t* info = conn_info(conn);
+        if (conn->use_hybrid_transport || conn->target_fd <= 0 || info->kernel_slot >= 0 ||
+            conn->state == CONN_STATE_CONNECTING) {
+            continue;
+        }
+
+        memset(&record, 0, sizeof(record));
+        record.magic = HANDOVER_MAGIC;
+        record.version = HANDOVER_VERSION;
+        record.type = HANDOVER_RECORD_SESSION;
+        record.session_id = info->session_id;
+        strcpy(record.target_ip, info->target_ip);
+        record.target_port = info->target_port;
+        record.last_activity = conn->last_activity;
+        record.state_change_time = info->state_change_time;
+        record.connection_start_time = info->connection_start_time;
+        record.disconnect_time = info->disconnect_time;
+        record.state = conn->state;
+        record.client_disconnected = conn->client_disconnected;
+        record.target_ready = conn->target_ready;
+        record.reconnect_attempts = info->reconnect_attempts;
+        record.error_count = info->error_count;
+        record.socket_profile = info->socket_profile;
+        record.bytes_sent = conn->bytes_sent;
+        record.bytes_received = conn->bytes_received;
+        record.parked_bytes = park_pending_size(conn);
+        memcpy(record.last_error, info->last_error, sizeof(record.last_error));
+
+        int fds[2];
+        int fd_count = 0;
+        fds[fd_count++] = conn->target_fd;
+        record.has_target_fd = 1;
+        if (conn->client_fd > 0) {
+            fds[fd_count++] = conn->client_fd;
+            record.has_client_fd = 1;
+        }
+
+        if (handover_send(sock, &record, sizeof(record), fds, fd_count) < 0) {
+            log_message(LOG_ERR, "Handover failed while sending session %lu: %s",
+                       info->session_id, strerror(errno));
+            break;
+        }
+
+        // 暂存数据紧跟在记录之后发送
+        while (park_pending_size(conn) > 0) {
+            ssize_t flushed = spill_flush(&info->park_buffer, sock);
+            if (flushed == 0) {
+                struct pollfd pfd = { sock, POLLOUT, 0 };
+                flushed = poll(&pfd, 1, 5000) > 0 ? 0 : -1;
+            }
+            if (flushed < 0) {
+                log_message(LOG_ERR, "Handover failed while sending parked data: %s", strerror(errno));
+                return -1;
+            }
+        }
+
+        // 只关闭本进程的 fd 副本，socket 本身由新进程继续持有
+        close(conn->target_fd);
+        if (conn->client_fd > 0) {
+            close(conn->client_fd);
+        }
+        spill_release(&info->park_buffer);
+        conn->client_fd = -1;
+        conn->target_fd = -1;
+        conn->is_active = 0;
+        stats.active_connections--;
+        handed_over++;
+    }
 
+    // 移除已交接的会话
+    int kept = 0;
     for (int i = 0; i < connection_count; i++) {
         if (connections[i].is_active) {
-            stats.active_connections++;
-            stats.total_bytes_sent += connections[i].bytes_sent;
-            stats.total_bytes_received += connections[i].bytes_received;
+            connection_info[kept] = connection_info[i];
+            connections[kept++] = connections[i];
+        }
+    }
+    connection_count = kept;
+
+    memset(&record, 0, sizeof(record));
+    record.magic = HANDOVER_MAGIC;
+    record.version = HANDOVER_VERSION;
+    record.type = HANDOVER_RECORD_END;
+
+    // 先释放指标端口和控制 socket 路径，新进程收到结束记录后重新创建
+    if (metrics_fd >= 0) {
+        close(metrics_fd);
+        metrics_fd = -1;
+    }
+    control_close_listener(control_fd, NULL);
+    control_fd = -1;
+
+    // UDP流无法随会话交接，关闭后由新进程重新监听，客户端的后续数据报在新进程中建立新的流
+    udp_relay_destroy(udp_relay);
+    udp_relay = NULL;
+
+    if (handover_send(sock, &record, sizeof(record), NULL, 0) < 0) {
+        log_message(LOG_ERR, "Handover failed while sending end marker: %s", strerror(errno));
+    }
+
+    handover_draining = 1;
+    log_message(LOG_INFO, "Handed over listener and %d sessions, %d sessions left to drain",
+               handed_over, connection_count);
+    return handed_over;
+}
+
+// 新进程：从旧进程接收监听 socket 和会话，返回 0 表示成功
+int receive_handover(const char* control_path) {
+    int sock = handover_connect(control_path);
+    if (sock < 0) {
+        fprintf(stderr, "Cannot connect to running instance at %s: %s\n", control_path, strerror(errno));
+        return -1;
+    }
+
+    handover_record_t record;
+    int fds[HANDOVER_MAX_FDS];
+    int fd_count = handover_recv(sock, &record, sizeof(record), fds, HANDOVER_MAX_FDS);
+    if (fd_count != 1 || record.magic != HANDOVER_MAGIC || record.version != HANDOVER_VERSION ||
+        record.type != HANDOVER_RECORD_LISTENER) {
+        fprintf(stderr, "Invalid handover response from running instance\n");
+        close(sock);
+        return -1;
+    }
+
+    listen_fd = fds[0];
+    if (configure_listen_socket(listen_fd) < 0) {
+        log_message(LOG_WARNING, "Failed to apply listen parameters: %s", strerror(errno));
+    }
+    stats.total_connections = record.total_connections;
+    stats.failed_connections = record.failed_connections;
+    stats.total_bytes_sent = record.total_bytes_sent;
+    stats.total_bytes_received = record.total_bytes_received;
+    stats.start_time = record.start_time;
+
+    int received = 0;
+    for (;;) {
+        fd_count = handover_recv(sock, &record, sizeof(record), fds, HANDOVER_MAX_FDS);
+        if (fd_count < 0 || record.magic != HANDOVER_MAGIC) {
+            log_message(LOG_ERR, "Handover stream ended unexpectedly after %d sessions", received);
+            break;
+        }
+        if (record.type == HANDOVER_RECORD_END) {
+            break;
+        }
+        if (record.type != HANDOVER_RECORD_SESSION || fd_count != record.has_target_fd + record.has_client_fd) {
+            for (int i = 0; i < fd_count; i++) {
+                close(fds[i]);
+            }
+            continue;
+        }
+
+        if (connection_count >= config.max_clients) {
+            if (grow_connections(connection_count + 1) < 0) {
+                for (int i = 0; i < fd_count; i++) {
+                    close(fds[i]);
+                }
+                continue;
+            }
+            config.max_clients = connection_count + 1;
         }
+
+        connection_pair_t* conn = reset_connection_slot(connection_count);
+        connection_info_t* info = conn_info(conn);
+        info->session_id = record.session_id;
+        conn->target_fd = fds[0];
+        conn->client_fd = record.has_client_fd ? fds[1] : -1;
+        strcpy(info->target_ip, record.target_ip);
+        info->target_port = record.target_port;
+        conn->last_activity = record.last_activity;
+        info->state_change_time = record.state_change_time;
+        info->connection_start_time = record.connection_start_time;
+        info->disconnect_time = record.disconnect_time;
+        conn->state = record.state;
+        conn->client_disconnected = record.client_disconnected;
+        conn->target_ready = record.target_ready;
+        info->reconnect_attempts = record.reconnect_attempts;
+        info->error_count = record.error_count;
+        if (record.socket_profile >= 0 && record.socket_profile < SOCKET_PROFILE_AUTO) {
+            info->socket_profile = record.socket_profile;
+        }
+        conn->bytes_sent = record.bytes_sent;
+        conn->bytes_received = record.bytes_received;
+        memcpy(info->last_error, record.last_error, sizeof(info->last_error));
+        info->last_error[sizeof(info->last_error) - 1] = '\0';
+        conn->is_active = 1;
+        if (conn->client_fd > 0) {
+            struct sockaddr_in peer;
+            socklen_t peer_len = sizeof(peer);
+            if (getpeername(conn->client_fd, (struct sockaddr*)&peer, &peer_len) == 0) {
+                info->client_addr = peer;
+            }
+        }
+
+        // 接收暂存数据
+        uint64_t remaining = record.parked_bytes;
+        char chunk[SPILL_CHUNK_SIZE];
+        while (remaining > 0) {
+            size_t size = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+            if (handover_recv_all(sock, chunk, size) < 0) {
+                break;
+            }
+            if (park_append(conn, chunk, size) < size) {
+                log_message(LOG_WARNING, "Parked data of session %lu exceeds local limits, truncated",
+                           info->session_id);
+            }
+            remaining -= size;
+        }
+
+        connection_count++;
+        stats.active_connections++;
+        received++;
+    }
+
+    close(sock);
+    log_message(LOG_INFO, "Took over listener and %d sessions from running instance", received);
+    return 0;
+}
+
+// 处理一条控制命令
+void handle_control_command(int control_listen_fd) {
+    char command[CONTROL_MAX_COMMAND];
+    int fd = control_accept_command(control_listen_fd, command, sizeof(command));
+    if (fd < 0) {
+        return;
+    }
+
+    if (strcmp(command, "reload") == 0) {
+        char result[512];
+        int status = reload_config(result, sizeof(result));
+        log_message(status == 0 ? LOG_INFO : LOG_ERR, "Config reload via control socket: %s", result);
+        control_reply(fd, "%s %s\n", status == 0 ? "OK" : "ERROR", result);
+    } else if (strcmp(command, "handover") == 0) {
+        // 新进程请求交接，应答即为交接数据流
+        if (perform_handover(fd) >= 0 && connection_count == 0) {
+            running = 0;
+        }
+    } else if (strcmp(command, "status") == 0) {
+        control_reply(fd, "OK connections=%d active=%lu total=%lu sent=%lu received=%lu target=%s:%d\n",
+                      connection_count, stats.active_connections, stats.total_connections,
+                      stats.total_bytes_sent, stats.total_bytes_received,
+                      config.target_ip, config.target_port);
+    } else {
+        control_reply(fd, "ERROR unknown command\n");
     }
+
+    close(fd);
+}
+
+// 初始化统计信息
+void init_stats(void) {
+    memset(&stats, 0, sizeof(stats));
+    stats.start_time = time(NULL);
+    stats.last_stats_time = stats.start_time;
 }
 
 // 打印统计信息
 void print_stats(void) {
+    kernel_relay_sync_all(1);
     time_t now = time(NULL);
     time_t uptime = now - stats.start_time;
 
-    update_stats();
-
     log_message(LOG_INFO, "=== RDP Forwarder Statistics ===");
     log_message(LOG_INFO, "Uptime: %ld seconds", uptime);
     log_message(LOG_INFO, "Total connections: %lu", stats.total_connections);
@@ -333,10 +1153,167 @@ void print_stats(void) {
     log_message(LOG_INFO, "Total bytes received: %lu", stats.total_bytes_received);
     log_message(LOG_INFO, "Average throughput: %.2f KB/s",
                uptime > 0 ? (stats.total_bytes_sent + stats.total_bytes_received) / 1024.0 / uptime : 0);
+    log_message(LOG_INFO, "Parked buffer memory: %zu bytes", spill_memory_in_use());
+    if (kernel_relay_state > 0) {
+        log_message(LOG_INFO, "Kernel relay sessions: %d", kernel_relay_sessions());
+    }
+    if (udp_relay) {
+        log_message(LOG_INFO, "UDP flows: %d, datagrams to target: %llu, to client: %llu, dropped: %llu",
+                   udp_relay->flow_count, (unsigned long long)udp_relay->datagrams[0],
+                   (unsigned long long)udp_relay->datagrams[1], (unsigned long long)udp_relay->dropped);
+    }
+    log_message(LOG_INFO, "Log records dropped: %llu, rate-limited: %llu",
+               (unsigned long long)async_log_dropped(), (unsigned long long)async_log_suppressed());
+    log_message(LOG_INFO, "Relay latency: p50=%lluus p99=%lluus max=%lluus",
+               (unsigned long long)metrics_hist_quantile(&stats.relay_latency, 0.50),
+               (unsigned long long)metrics_hist_quantile(&stats.relay_latency, 0.99),
+               (unsigned long long)stats.relay_latency.max_us);
 
     stats.last_stats_time = now;
 }
 
+// 输出 Prometheus 文本格式指标（由本机指标端口调用）
+void render_metrics(metrics_buf_t* buf) {
+    kernel_relay_sync_all(1);
+    time_t now = time(NULL);
+
+    metrics_buf_printf(buf, "# TYPE rdp_uptime_seconds gauge\nrdp_uptime_seconds %ld\n",
+                       (long)(now - stats.start_time));
+    metrics_buf_printf(buf, "# TYPE rdp_connections_total counter\nrdp_connections_total %lu\n",
+                       stats.total_connections);
+    metrics_buf_printf(buf, "# TYPE rdp_connections_failed_total counter\nrdp_connections_failed_total %lu\n",
+                       stats.failed_connections);
+    metrics_buf_printf(buf, "# TYPE rdp_connections_active gauge\nrdp_connections_active %lu\n",
+                       stats.active_connections);
+    metrics_buf_printf(buf, "# TYPE rdp_bytes_sent_total counter\nrdp_bytes_sent_total %lu\n",
+                       stats.total_bytes_sent);
+    metrics_buf_printf(buf, "# TYPE rdp_bytes_received_total counter\nrdp_bytes_received_total %lu\n",
+                       stats.total_bytes_received);
+    metrics_buf_printf(buf, "# TYPE rdp_park_buffer_memory_bytes gauge\nrdp_park_buffer_memory_bytes %zu\n",
+                       spill_memory_in_use());
+    metrics_buf_printf(buf, "# TYPE rdp_socket_buffer_bytes gauge\nrdp_socket_buffer_bytes %ld\n",
+                       relay_sockbuf_total);
+    metrics_buf_printf(buf, "# TYPE rdp_kernel_relay_sessions gauge\nrdp_kernel_relay_sessions %d\n",
+                       kernel_relay_sessions());
+    int profile_sessions[SOCKET_PROFILE_AUTO] = { 0 };
+    for (int i = 0; i < connection_count; i++) {
+        profile_sessions[connection_info[i].socket_profile]++;
+    }
+    metrics_buf_printf(buf, "# TYPE rdp_socket_profile_sessions gauge\n");
+    for (int i = 0; i < SOCKET_PROFILE_AUTO; i++) {
+        metrics_buf_printf(buf, "rdp_socket_profile_sessions{profile=\"%s\"} %d\n",
+                           socket_profiles[i].name, profile_sessions[i]);
+    }
+    metrics_buf_printf(buf, "# TYPE rdp_socket_profile_switches_total counter\nrdp_socket_profile_switches_total %lu\n",
+                       stats.socket_profile_switches);
+    if (udp_relay) {
+        metrics_buf_printf(buf, "# TYPE rdp_udp_flows gauge\nrdp_udp_flows %d\n", udp_relay->flow_count);
+        metrics_buf_printf(buf, "# TYPE rdp_udp_datagrams_total counter\n"
+                                "rdp_udp_datagrams_total{direction=\"to_target\"} %llu\n"
+                                "rdp_udp_datagrams_total{direction=\"to_client\"} %llu\n",
+                           (unsigned long long)udp_relay->datagrams[0],
+                           (unsigned long long)udp_relay->datagrams[1]);
+        metrics_buf_printf(buf, "# TYPE rdp_udp_datagrams_dropped_total counter\nrdp_udp_datagrams_dropped_total %llu\n",
+                           (unsigned long long)udp_relay->dropped);
+    }
+    metrics_buf_printf(buf, "# TYPE rdp_log_dropped_total counter\nrdp_log_dropped_total %llu\n",
+                       (unsigned long long)async_log_dropped());
+    metrics_buf_printf(buf, "# TYPE rdp_log_suppressed_total counter\nrdp_log_suppressed_total %llu\n",
+                       (unsigned long long)async_log_suppressed());
+
+    metrics_write_histogram(buf, "rdp_accept_latency_seconds",
+                            "Time from accept() to session established", &stats.accept_latency);
+    metrics_write_histogram(buf, "rdp_connect_latency_seconds",
+                            "Time to connect to the target", &stats.connect_latency);
+    metrics_write_histogram(buf, "rdp_relay_latency_seconds",
+                            "Time from recv() to the forwarded write completing", &stats.relay_latency);
+    metrics_write_histogram(buf, "rdp_event_loop_lag_seconds",
+                            "Processing time of one event loop iteration", &stats.loop_lag);
+
+    // 每会话指标
+    metrics_buf_printf(buf, "# TYPE rdp_session_bytes_sent counter\n");
+    for (int i = 0; i < connection_count; i++) {
+        metrics_buf_printf(buf, "rdp_session_bytes_sent{session=\"%lu\"} %lu\n",
+                           connection_info[i].session_id, connections[i].bytes_sent);
+    }
+    metrics_buf_printf(buf, "# TYPE rdp_session_bytes_received counter\n");
+    for (int i = 0; i < connection_count; i++) {
+        metrics_buf_printf(buf, "rdp_session_bytes_received{session=\"%lu\"} %lu\n",
+                           connection_info[i].session_id, connections[i].bytes_received);
+    }
+    metrics_buf_printf(buf, "# TYPE rdp_session_state gauge\n");
+    for (int i = 0; i < connection_count; i++) {
+        metrics_buf_printf(buf, "rdp_session_state{session=\"%lu\",state=\"%s\"} 1\n",
+                           connection_info[i].session_id, get_connection_state_name(connections[i].state));
+    }
+    metrics_buf_printf(buf, "# TYPE rdp_session_parked_bytes gauge\n");
+    for (int i = 0; i < connection_count; i++) {
+        metrics_buf_printf(buf, "rdp_session_parked_bytes{session=\"%lu\"} %zu\n",
+                           connection_info[i].session_id, park_pending_size(&connections[i]));
+    }
+
+    // 混合传输隧道统计（按隧道连接ID）
+    metrics_buf_printf(buf, "# TYPE rdp_ht_rtt_milliseconds gauge\n"
+                            "# TYPE rdp_ht_packet_loss_ratio gauge\n"
+                            "# TYPE rdp_ht_packets_retransmitted_total counter\n"
+                            "# TYPE rdp_ht_path_migrations_total counter\n"
+                            "# TYPE rdp_ht_streams gauge\n"
+                            "# TYPE rdp_ht_cwnd_packets gauge\n"
+                            "# TYPE rdp_ht_path_rtt_milliseconds gauge\n"
+                            "# TYPE rdp_ht_path_loss_ratio gauge\n"
+                            "# TYPE rdp_ht_path_packets_sent_total counter\n"
+                            "# TYPE rdp_ht_path_bytes_sent_total counter\n"
+                            "# TYPE rdp_ht_path_packets_retransmitted_total counter\n"
+                            "# TYPE rdp_ht_path_mtu_bytes gauge\n");
+    for (int i = 0; i < ht_tunnel_count; i++) {
+        ht_connection_t* ht = ht_tunnels[i]->conn;
+        unsigned long long tunnel = (unsigned long long)ht->conn_id;
+        ht_connection_stats_t ht_stats;
+        ht_get_stats(ht, &ht_stats);
+        metrics_buf_printf(buf, "rdp_ht_rtt_milliseconds{tunnel=\"%016llx\",kind=\"avg\"} %u\n"
+                                "rdp_ht_rtt_milliseconds{tunnel=\"%016llx\",kind=\"min\"} %u\n"
+                                "rdp_ht_rtt_milliseconds{tunnel=\"%016llx\",kind=\"max\"} %u\n",
+                           tunnel, ht_stats.rtt_avg,
+                           tunnel, ht_stats.rtt_min == UINT32_MAX ? 0 : ht_stats.rtt_min,
+                           tunnel, ht_stats.rtt_max);
+        metrics_buf_printf(buf, "rdp_ht_packet_loss_ratio{tunnel=\"%016llx\"} %.4f\n",
+                           tunnel, ht_stats.packet_loss_rate);
+        metrics_buf_printf(buf, "rdp_ht_packets_retransmitted_total{tunnel=\"%016llx\"} %llu\n",
+                           tunnel, (unsigned long long)ht_stats.packets_retransmitted);
+        metrics_buf_printf(buf, "rdp_ht_path_migrations_total{tunnel=\"%016llx\"} %llu\n",
+                           tunnel, (unsigned long long)ht_stats.path_migrations);
+        metrics_buf_printf(buf, "rdp_ht_streams{tunnel=\"%016llx\"} %d\n",
+                           tunnel, ht_tunnels[i]->open_streams);
+        metrics_buf_printf(buf, "rdp_ht_cwnd_packets{tunnel=\"%016llx\"} %u\n", tunnel, ht->cwnd);
+
+        // 各通道：TCP和每条UDP子路径
+        ht_path_stats_t paths[HT_MAX_PATHS + 1];
+        int path_count = ht_get_path_stats(ht, paths, HT_MAX_PATHS + 1);
+        for (int p = 0; p < path_count; p++) {
+            char path_name[16];
+            if (paths[p].is_tcp) {
+                snprintf(path_name, sizeof(path_name), "tcp");
+            } else {
+                snprintf(path_name, sizeof(path_name), "udp%u", paths[p].id);
+            }
+            metrics_buf_printf(buf, "rdp_ht_path_rtt_milliseconds{tunnel=\"%016llx\",path=\"%s\"} %u\n",
+                               tunnel, path_name, paths[p].srtt);
+            metrics_buf_printf(buf, "rdp_ht_path_loss_ratio{tunnel=\"%016llx\",path=\"%s\"} %.4f\n",
+                               tunnel, path_name, paths[p].loss_rate);
+            metrics_buf_printf(buf, "rdp_ht_path_packets_sent_total{tunnel=\"%016llx\",path=\"%s\"} %llu\n",
+                               tunnel, path_name, (unsigned long long)paths[p].counters.packets_sent);
+            metrics_buf_printf(buf, "rdp_ht_path_bytes_sent_total{tunnel=\"%016llx\",path=\"%s\"} %llu\n",
+                               tunnel, path_name, (unsigned long long)paths[p].counters.bytes_sent);
+            metrics_buf_printf(buf, "rdp_ht_path_packets_retransmitted_total{tunnel=\"%016llx\",path=\"%s\"} %llu\n",
+                               tunnel, path_name, (unsigned long long)paths[p].counters.packets_retransmitted);
+            if (!paths[p].is_tcp) {
+                metrics_buf_printf(buf, "rdp_ht_path_mtu_bytes{tunnel=\"%016llx\",path=\"%s\"} %u\n",
+                                   tunnel, path_name, paths[p].mtu);
+            }
+        }
+    }
+}
+
 // 健康检查函数已移除 - 强制连接目标服务器
 
 // 获取连接状态名称
@@ -359,10 +1336,11 @@ const char* get_connection_state_name(connection_state_t state) {
 void set_connection_state(connection_pair_t* conn, connection_state_t new_state, const char* reason) {
     if (!conn) return;
 
+    connection_info_t* info = conn_info(conn);
     connection_state_t old_state = conn->state;
     if (old_state != new_state) {
         conn->state = new_state;
-        conn->state_change_time = time(NULL);
+        info->state_change_time = time(NULL);
 
         if (config.verbose_logging) {
             log_message(LOG_INFO, "Connection state changed: %s -> %s (%s)",
@@ -373,9 +1351,9 @@ void set_connection_state(connection_pair_t* conn, connection_state_t new_state,
 
         // 记录错误状态的原因
         if (new_state == CONN_STATE_ERROR && reason) {
-            strncpy(conn->last_error, reason, sizeof(conn->last_error) - 1);
-            conn->last_error[sizeof(conn->last_error) - 1] = '\0';
-            conn->error_count++;
+            strncpy(info->last_error, reason, sizeof(info->last_error) - 1);
+            info->last_error[sizeof(info->last_error) - 1] = '\0';
+            info->error_count++;
         }
     }
 }
@@ -384,16 +1362,17 @@ void set_connection_state(connection_pair_t* conn, connection_state_t new_state,
 void log_connection_state_change(connection_pair_t* conn, int conn_index) {
     if (!conn) return;
 
+    connection_info_t* info = conn_info(conn);
     time_t now = time(NULL);
-    time_t duration = now - conn->connection_start_time;
-    time_t state_duration = now - conn->state_change_time;
+    time_t duration = now - info->connection_start_time;
+    time_t state_duration = now - info->state_change_time;
 
     log_message(LOG_INFO, "Connection %d status: state=%s, duration=%lds, state_duration=%lds, errors=%d, sent=%lu, received=%lu",
                conn_index, get_connection_state_name(conn->state), duration, state_duration,
-               conn->error_count, conn->bytes_sent, conn->bytes_received);
+               info->error_count, conn->bytes_sent, conn->bytes_received);
 
-    if (conn->error_count > 0 && strlen(conn->last_error) > 0) {
-        log_message(LOG_INFO, "Connection %d last error: %s", conn_index, conn->last_error);
+    if (info->error_count > 0 && strlen(info->last_error) > 0) {
+        log_message(LOG_INFO, "Connection %d last error: %s", conn_index, info->last_error);
     }
 }
 
@@ -403,7 +1382,7 @@ void log_connection_error(connection_pair_t* conn, int error_code, const char* c
     const char* error_desc = strerror(error_code);
 
     if (conn) {
-        time_t connection_duration = time(NULL) - conn->connection_start_time;
+        time_t connection_duration = time(NULL) - conn_info(conn)->connection_start_time;
         const char* transport_type = conn->use_hybrid_transport ? "hybrid" : "tcp";
 
         // 分析可能的断开原因
@@ -437,11 +1416,18 @@ void log_connection_error(connection_pair_t* conn, int error_code, const char* c
     }
 }
 
-// 日志记录函数
+// 日志记录函数：写线程启动后进入异步队列，否则同步输出
 void log_message(int priority, const char* format, ...) {
     va_list args;
     va_start(args, format);
 
+    if (async_log_vwrite(priority, config.verbose_logging, format, args)) {
+        va_end(args);
+        return;
+    }
+    va_end(args);
+    va_start(args, format);
+
     if (config.verbose_logging) {
         char timestamp[64];
         char message[1024];
@@ -473,8 +1459,9 @@ int set_nonblocking(int fd) {
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-// 为客户端和目标端 TCP socket 设置通用参数，尽量减少因为 TCP 行为差异导致的 RDP 断连
-static void configure_tcp_socket(int fd) {
+// 为客户端和目标端 TCP socket 设置通用参数，尽量减少因为 TCP 行为差异导致的 RDP 断连；
+// client_side 表示面向 RDP 客户端的一端，profile 为会话的调优档位
+static void configure_tcp_socket(int fd, int client_side, int profile) {
     if (fd <= 0) {
         return;
     }
@@ -504,20 +1491,163 @@ static void configure_tcp_socket(int fd) {
             log_message(LOG_WARNING, "Failed to set SO_SNDTIMEO on socket %d: %s", fd, strerror(errno));
         }
     }
+
+    socket_profile_set(fd, profile, client_side);
 }
 
-// 清理连接
-void cleanup_connection(int index) {
-    if (index < 0 || index >= connection_count) {
+// 按档位设置一个socket：KeepAlive 探测、TCP_USER_TIMEOUT、拥塞控制算法，客户端一侧另设
+// TCP_NOTSENT_LOWAT，让未发出的数据只在内核中积压一小段，写不动时转入暂存缓冲区并按档位停止读取目标端。
+// 目标端一侧只承载键鼠输入，不设 TCP_NOTSENT_LOWAT。
+// SO_RCVLOWAT 保持1：RDP 报文长度不定，水位大于1时最后一段不足水位的数据不会唤醒主循环，会话会停住
+static void socket_profile_set(int fd, int profile, int client_side) {
+    const socket_profile_params_t* params = &socket_profiles[profile];
+    if (fd <= 0) {
         return;
     }
 
-    connection_pair_t* conn = &connections[index];
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &params->keepidle, sizeof(params->keepidle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &params->keepintvl, sizeof(params->keepintvl));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &params->keepcnt, sizeof(params->keepcnt));
+    if (setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &params->user_timeout_ms,
+                   sizeof(params->user_timeout_ms)) < 0) {
+        log_message(LOG_WARNING, "Failed to set TCP_USER_TIMEOUT on socket %d: %s", fd, strerror(errno));
+    }
+    if (client_side && setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &params->notsent_lowat,
+                                  sizeof(params->notsent_lowat)) < 0) {
+        log_message(LOG_WARNING, "Failed to set TCP_NOTSENT_LOWAT on socket %d: %s", fd, strerror(errno));
+    }
+
+    // 没有档位配置拥塞控制算法时不改动；配置了的话，未配置的档位切回启动时读到的系统默认算法
+    int congestion_configured = 0;
+    for (int i = 0; i < SOCKET_PROFILE_AUTO; i++) {
+        congestion_configured |= config.socket_congestion[i][0] != '\0';
+    }
+    if (!congestion_configured) {
+        return;
+    }
+    const char* congestion = config.socket_congestion[profile][0] ? config.socket_congestion[profile]
+                                                                   : default_congestion;
+    if (congestion[0] && setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, congestion, strlen(congestion)) < 0) {
+        log_message(LOG_WARNING, "Failed to set congestion control %s (profile %s) on socket %d: %s",
+                   congestion, params->name, fd, strerror(errno));
+    }
+}
+
+// 启动时读取系统默认的拥塞控制算法（net.ipv4.tcp_congestion_control），切回未配置算法的档位时使用
+static void read_default_congestion(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    socklen_t len = sizeof(default_congestion) - 1;
+    if (fd < 0 || getsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, default_congestion, &len) < 0) {
+        log_message(LOG_WARNING, "Cannot read default congestion control: %s", strerror(errno));
+        default_congestion[0] = '\0';
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// 算法已加载且允许非特权进程使用（net.ipv4.tcp_allowed_congestion_control）时返回1，否则返回0（errno）
+static int congestion_available(const char* name) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name, strlen(name)) == 0;
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return ok;
+}
+
+// 新会话的档位：auto 从 interactive 开始
+static int socket_profile_initial(void) {
+    return config.socket_profile == SOCKET_PROFILE_AUTO ? SOCKET_PROFILE_INTERACTIVE : config.socket_profile;
+}
+
+// 会话两端切换到指定档位（混合传输会话只有一端是TCP）
+static void socket_profile_switch(connection_pair_t* conn, int profile) {
+    connection_info_t* info = conn_info(conn);
+    if (info->socket_profile != profile) {
+        log_message(LOG_DEBUG, "Session %lu socket profile %s -> %s", info->session_id,
+                   socket_profiles[info->socket_profile].name, socket_profiles[profile].name);
+        stats.socket_profile_switches++;
+    }
+    info->socket_profile = profile;
+    socket_profile_set(conn->client_fd, profile, 1);
+    socket_profile_set(conn->target_fd, profile, 0);
+}
+
+// 按配置或当前流量选择档位，与已应用的不同时切换
+static void socket_profile_update(connection_pair_t* conn) {
+    connection_info_t* info = conn_info(conn);
+    int profile = config.socket_profile;
+    if (profile == SOCKET_PROFILE_AUTO) {
+        int bulk_size = config.buffer_max / 4;
+        int up = info->relay[0].size;
+        int down = info->relay[1].size;
+        int size = up > down ? up : down;
+        if (up > config.buffer_size && up >= bulk_size) {
+            profile = SOCKET_PROFILE_BULK;
+        } else if (time(NULL) - info->last_input < SOCKET_PROFILE_INPUT_IDLE) {
+            profile = SOCKET_PROFILE_INTERACTIVE;
+        } else if (size > config.buffer_size && size >= bulk_size) {
+            profile = SOCKET_PROFILE_BULK;
+        } else if (size > config.buffer_size) {
+            profile = SOCKET_PROFILE_BALANCED;
+        } else {
+            profile = SOCKET_PROFILE_INTERACTIVE;
+        }
+    }
+    if (profile != info->socket_profile) {
+        socket_profile_switch(conn, profile);
+    }
+}
+
+// 每次转发读取后调用（auto 档位）：读取大小变化时重新选择；输入停止后画面流量持续也不会改变读取大小，
+// 所以每秒最多再检查一次；bulk 会话收到客户端输入时立即检查，尽快回到 interactive
+static void socket_profile_observe(connection_pair_t* conn, int dir, int resized) {
+    if (config.socket_profile != SOCKET_PROFILE_AUTO) {
+        return;
+    }
+    connection_info_t* info = conn_info(conn);
+    time_t now = time(NULL);
+    if (dir == 0) {
+        info->last_input = now;
+    }
+    if (resized || now != info->profile_checked ||
+        (dir == 0 && info->socket_profile == SOCKET_PROFILE_BULK)) {
+        info->profile_checked = now;
+        socket_profile_update(conn);
+    }
+}
+
+// 客户端已连接但写不动，暂存的数据达到档位上限：停止读取目标端，让目标端按 TCP 流控降低发送速度，
+// 避免新画面排在大段旧数据之后
+static int socket_profile_backlogged(connection_pair_t* conn) {
+    size_t pending = park_pending_size(conn);
+    if (pending == 0 || conn->client_fd <= 0) {
+        return 0;
+    }
+    int backlog = socket_profiles[conn_info(conn)->socket_profile].backlog;
+    return backlog > 0 && pending >= (size_t)backlog;
+}
+
+// 清理连接
+void cleanup_connection(int index) {
+    if (index < 0 || index >= connection_count) {
+        return;
+    }
+
+    connection_pair_t* conn = &connections[index];
 
     // 记录连接状态和统计信息
     set_connection_state(conn, CONN_STATE_CLOSING, "connection cleanup");
     log_connection_state_change(conn, index);
 
+    kernel_relay_release(conn);
+    if (udp_relay) {
+        udp_relay_close_owner(udp_relay, conn_info(conn)->session_id);
+    }
     log_message(LOG_INFO, "Cleaning up connection %d (sent: %lu bytes, received: %lu bytes)",
                 index, conn->bytes_sent, conn->bytes_received);
 
@@ -531,13 +1661,19 @@ void cleanup_connection(int index) {
         conn->target_fd = -1;
     }
 
-    // 清理混合传输连接
-    if (conn->ht_conn) {
-        ht_disconnect(conn->ht_conn);
-        ht_destroy_connection(conn->ht_conn);
-        conn->ht_conn = NULL;
+    // 关闭混合传输流，隧道由其他会话继续使用
+    if (conn->ht_stream) {
+        ht_stream_close(conn->ht_stream);
+        conn->ht_stream = NULL;
     }
 
+    // 释放挂起期间的暂存数据
+    spill_release(&conn_info(conn)->park_buffer);
+    relay_release(conn);
+
+    if (conn->is_active) {
+        stats.active_connections--;
+    }
     conn->is_active = 0;
     conn->use_hybrid_transport = 0;
 
@@ -546,6 +1682,7 @@ void cleanup_connection(int index) {
     // 移动后面的连接向前填补空隙
     for (int i = index; i < connection_count - 1; i++) {
         connections[i] = connections[i + 1];
+        connection_info[i] = connection_info[i + 1];
     }
     connection_count--;
 }
@@ -573,7 +1710,7 @@ int create_listen_socket(int port) {
         return -1;
     }
     
-    if (listen(sockfd, 5) < 0) {
+    if (configure_listen_socket(sockfd) < 0) {
         perror("listen");
         close(sockfd);
         return -1;
@@ -582,6 +1719,29 @@ int create_listen_socket(int port) {
     return sockfd;
 }
 
+// 监听参数：非阻塞（每次唤醒循环接受到队列为空）、backlog、TCP_DEFER_ACCEPT、TCP_FASTOPEN。
+// 对已在监听的 socket 再次调用会更新这些参数，重载配置和接管监听 socket 后重新应用
+static int configure_listen_socket(int fd) {
+    if (set_nonblocking(fd) < 0) {
+        return -1;
+    }
+
+    // 客户端发来首个数据包（RDP 的 X.224 连接请求）后才唤醒 accept，只握手不发数据的连接不占用会话。
+    // 默认关闭：重连后等待转发器先补发暂存数据的客户端会被一直挂在队列里
+    int defer = config.listen_defer_accept;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer)) < 0) {
+        log_message(LOG_WARNING, "Failed to set TCP_DEFER_ACCEPT: %s", strerror(errno));
+    }
+
+    // 重连的客户端可在 SYN 中携带首个数据包，省去一个往返（需要 net.ipv4.tcp_fastopen 开启服务端）
+    int qlen = config.listen_fastopen;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) < 0) {
+        log_message(LOG_WARNING, "Failed to set TCP_FASTOPEN: %s", strerror(errno));
+    }
+
+    return listen(fd, config.listen_backlog);
+}
+
 // 连接到目标主机
 int connect_to_target(const char* target_ip, int port) {
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -610,77 +1770,496 @@ int connect_to_target(const char* target_ip, int port) {
     return sockfd;
 }
 
-// 改进的数据转发函数
-int forward_data(int from_fd, int to_fd, connection_pair_t* conn, int is_client_to_target) {
-    char* buffer = malloc(config.buffer_size);
-    if (!buffer) {
-        log_message(LOG_ERR, "Failed to allocate buffer");
+// 非阻塞地发起到目标的连接：立即完成时 *in_progress 为0，否则等待 socket 可写后由
+// finish_target_connect 取得结果
+static int start_target_connect(const char* target_ip, int port, int* in_progress) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, target_ip, &addr.sin_addr) <= 0) {
+        errno = EINVAL;
         return -1;
     }
-    ssize_t bytes_read = recv(from_fd, buffer, config.buffer_size, 0);
 
-    if (bytes_read < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            free(buffer);
-            return 0; // 非阻塞模式下没有数据可读
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        return -1;
+    }
+
+    *in_progress = 0;
+    if (connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        if (errno != EINPROGRESS) {
+            int saved = errno;
+            close(sockfd);
+            errno = saved;
+            return -1;
         }
-        log_connection_error(conn, errno, "recv", is_client_to_target);
-        free(buffer);
-        return -1; // 连接错误
+        *in_progress = 1;
+    }
+    return sockfd;
+}
+
+// 目标端连接结果（socket 已可写）：成功则会话建立，失败返回 -1 由调用方清理会话
+static int finish_target_connect(connection_pair_t* conn) {
+    connection_info_t* info = conn_info(conn);
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(conn->target_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+        error = errno;
     }
+    metrics_hist_record(&stats.connect_latency, metrics_now_us() - info->connect_start_us);
+
+    if (error) {
+        log_message(LOG_ERR, "Failed to connect to target %s:%d: %s",
+                   info->target_ip, info->target_port, strerror(error));
+        stats.failed_connections++;
+        return -1;
+    }
+    session_established(conn);
+    return 0;
+}
+
+// 会话建立：到目标的连接（或混合传输的流）已就绪
+static void session_established(connection_pair_t* conn) {
+    connection_info_t* info = conn_info(conn);
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &info->client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+
+    log_message(LOG_INFO, "New connection %d established (%s): %s:%d -> %s:%d",
+               (int)(conn - connections), conn->use_hybrid_transport ? "hybrid" : "tcp",
+               client_ip, ntohs(info->client_addr.sin_port), info->target_ip, info->target_port);
 
-    if (bytes_read == 0) {
-        log_message(LOG_INFO, "Connection closed by %s",
-                   is_client_to_target ? "client" : "target");
-        free(buffer);
+    // 更新连接状态为已连接
+    set_connection_state(conn, CONN_STATE_CONNECTED, "target connection established");
+    kernel_relay_attach(conn);
 
-        // 如果是客户端断开且启用了快速重连，特殊处理
-        // 但要确保连接已经建立一段时间，避免在RDP握手阶段误判
-        if (is_client_to_target && config.enable_fast_reconnect &&
-            conn && (time(NULL) - conn->last_activity > 5)) {
-            return -2; // 特殊返回值表示客户端断开
+    info->session_id = ++stats.total_connections;
+    metrics_hist_record(&stats.accept_latency, metrics_now_us() - info->accept_time_us);
+}
+
+// 把两个会话数组扩到 capacity 个，已有会话原样保留。热数据按缓存行对齐分配，
+// aligned_alloc 没有对应的 realloc，只能分配新数组后复制
+static int grow_connections(int capacity) {
+    connection_pair_t* hot = aligned_alloc(64, capacity * sizeof(connection_pair_t));
+    connection_info_t* cold = realloc(connection_info, capacity * sizeof(connection_info_t));
+    if (!hot || !cold) {
+        free(hot);
+        if (cold) {
+            connection_info = cold;
         }
+        return -1;
+    }
+    if (connections) {
+        memcpy(hot, connections, connection_count * sizeof(connection_pair_t));
+        free(connections);
+    }
+    connections = hot;
+    connection_info = cold;
+    return 0;
+}
 
-        return -1; // 连接关闭
+// 清零下标处的会话（热、冷两部分），返回热数据
+static connection_pair_t* reset_connection_slot(int index) {
+    memset(&connections[index], 0, sizeof(connection_pair_t));
+    memset(&connection_info[index], 0, sizeof(connection_info_t));
+    spill_init(&connection_info[index].park_buffer);
+    connection_info[index].kernel_slot = -1;
+    connection_info[index].socket_profile = socket_profile_initial();
+    return &connections[index];
+}
+
+// 数据转入暂存缓冲区，同时在热数据中标记
+static size_t park_append(connection_pair_t* conn, const void* data, size_t size) {
+    conn->parked = 1;
+    return spill_append(&conn_info(conn)->park_buffer, data, size);
+}
+
+// 暂存的字节数；标记为0时直接返回，回放完后清除标记
+static size_t park_pending_size(connection_pair_t* conn) {
+    if (!conn->parked) {
+        return 0;
+    }
+    size_t pending = spill_pending(&conn_info(conn)->park_buffer);
+    if (pending == 0) {
+        conn->parked = 0;
     }
+    return pending;
+}
 
-    ssize_t bytes_sent = 0;
-    while (bytes_sent < bytes_read) {
-        ssize_t sent = send(to_fd, buffer + bytes_sent, bytes_read - bytes_sent, MSG_NOSIGNAL);
-        if (sent < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // 目标socket缓冲区满，稍后重试
-                usleep(1000); // 等待1ms
-                continue;
-            }
-            log_connection_error(conn, errno, "send", !is_client_to_target);
-            free(buffer);
-            return -1;
+// 刚建立的TCP会话交给内核转发；第一次使用时加载程序，不可用时记录一次并一直使用用户态转发
+static void kernel_relay_attach(connection_pair_t* conn) {
+    if (!config.kernel_relay || kernel_relay_state < 0 ||
+        conn->use_hybrid_transport || conn->client_fd <= 0 || conn->target_fd <= 0) {
+        return;
+    }
+    if (kernel_relay_state == 0) {
+        if (sockmap_relay_init(config.max_clients) < 0) {
+            log_message(LOG_WARNING, "Kernel relay unavailable (%s), using user-space relay", strerror(errno));
+            kernel_relay_state = -1;
+            return;
+        }
+        log_message(LOG_INFO, "Kernel relay enabled (eBPF sockmap, %d sessions)", config.max_clients);
+        kernel_relay_state = 1;
+    }
+
+    connection_info_t* info = conn_info(conn);
+    int target_in_user;
+    int slot = sockmap_relay_attach(conn->client_fd, conn->target_fd, &target_in_user);
+    if (slot < 0) {
+        log_message(LOG_WARNING, "Session %lu stays in user-space relay: %s", info->session_id, strerror(errno));
+        return;
+    }
+    info->kernel_slot = slot;
+    info->kernel_bytes[0] = 0;
+    info->kernel_bytes[1] = 0;
+    conn->kernel_relay = target_in_user ? 2 : 1;
+    if (target_in_user) {
+        log_message(LOG_INFO, "Target of session %lu sent data before kernel relay took over, "
+                   "target-to-client stays in user space", info->session_id);
+    } else {
+        // 内核重定向写不进客户端时只能稍后重试，TCP_NOTSENT_LOWAT 只会降低吞吐，恢复系统默认
+        int lowat = 0;
+        setsockopt(conn->client_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+    }
+}
+
+// 把内核中转发的字节数计入会话和全局统计；有新数据时刷新活动时间
+static void kernel_relay_sync(connection_pair_t* conn) {
+    connection_info_t* info = conn_info(conn);
+    uint64_t bytes[2];
+    if (sockmap_relay_bytes(info->kernel_slot, &bytes[0], &bytes[1]) < 0) {
+        return;
+    }
+    uint64_t sent = bytes[0] > info->kernel_bytes[0] ? bytes[0] - info->kernel_bytes[0] : 0;
+    uint64_t received = bytes[1] > info->kernel_bytes[1] ? bytes[1] - info->kernel_bytes[1] : 0;
+    if (sent == 0 && received == 0) {
+        return;
+    }
+    info->kernel_bytes[0] += sent;
+    info->kernel_bytes[1] += received;
+    conn->bytes_sent += sent;
+    conn->bytes_received += received;
+    stats.total_bytes_sent += sent;
+    stats.total_bytes_received += received;
+    conn->last_activity = time(NULL);
+}
+
+// 同步所有内核转发会话；主循环中每秒最多一次（返回1表示本轮已同步），输出统计和指标前强制同步
+static int kernel_relay_sync_all(int force) {
+    time_t now = time(NULL);
+    if (kernel_relay_state <= 0 || (!force && now == kernel_relay_synced)) {
+        return 0;
+    }
+    if (!force) {
+        kernel_relay_synced = now;
+    }
+    for (int i = 0; i < connection_count; i++) {
+        if (connections[i].kernel_relay) {
+            kernel_relay_sync(&connections[i]);
+        }
+    }
+    return 1;
+}
+
+// 内核转发的 socket 上是否有用户态需要处理的事件：可读数据、对端关闭或错误
+static int kernel_relay_readable(int fd) {
+    char byte;
+    if (fd <= 0) {
+        return 0;
+    }
+    return recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+// 客户端断开：停止内核转发，目标端之后的数据回到用户态进入暂存缓冲区。
+// 重连后的会话留在用户态转发（目标端接收队列中可能还有未读数据，再交给内核会乱序）
+static void kernel_relay_stop(connection_pair_t* conn) {
+    if (!conn->kernel_relay) {
+        return;
+    }
+    kernel_relay_sync(conn);
+    sockmap_relay_stop(conn_info(conn)->kernel_slot);
+    conn->kernel_relay = 0;
+}
+
+// 当前由内核转发的会话数
+static int kernel_relay_sessions(void) {
+    int count = 0;
+    for (int i = 0; i < connection_count; i++) {
+        count += connections[i].kernel_relay != 0;
+    }
+    return count;
+}
+
+// 会话结束，回收 sockmap 槽位
+static void kernel_relay_release(connection_pair_t* conn) {
+    connection_info_t* info = conn_info(conn);
+    if (info->kernel_slot < 0) {
+        return;
+    }
+    kernel_relay_stop(conn);
+    sockmap_relay_release(info->kernel_slot);
+    info->kernel_slot = -1;
+}
+
+// RDP UDP 流归属到同一客户端地址的TCP会话（有多个时取最新的），目标与该会话相同。
+// 混合传输会话的目标在出口中继一侧，本机不转发其UDP流
+static int udp_flow_owner(const struct sockaddr_in* client, unsigned long* owner, struct sockaddr_in* target) {
+    for (int i = connection_count - 1; i >= 0; i--) {
+        connection_pair_t* conn = &connections[i];
+        connection_info_t* info = conn_info(conn);
+        if (!conn->is_active || conn->use_hybrid_transport || conn->client_fd <= 0 ||
+            conn->state == CONN_STATE_CONNECTING ||
+            info->client_addr.sin_addr.s_addr != client->sin_addr.s_addr) {
+            continue;
         }
-        if (sent == 0) {
-            log_message(LOG_WARNING, "send returned 0, connection may be closed");
-            free(buffer);
+        memset(target, 0, sizeof(*target));
+        target->sin_family = AF_INET;
+        target->sin_port = htons(info->target_port);
+        if (inet_pton(AF_INET, info->target_ip, &target->sin_addr) != 1) {
             return -1;
         }
-        bytes_sent += sent;
+        *owner = info->session_id;
+        if (config.verbose_logging) {
+            char client_ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client->sin_addr, client_ip, sizeof(client_ip));
+            log_message(LOG_INFO, "UDP flow %s:%d -> %s:%d joined session %lu", client_ip,
+                       ntohs(client->sin_port), info->target_ip, info->target_port, info->session_id);
+        }
+        return 0;
+    }
+    return -1;
+}
+
+// UDP流的转发量计入所属会话和全局统计；UDP传输期间TCP连接可能长时间空闲，同时刷新活动时间
+static void udp_flow_account(unsigned long owner, size_t to_target, size_t to_client) {
+    stats.total_bytes_sent += to_target;
+    stats.total_bytes_received += to_client;
+    for (int i = 0; i < connection_count; i++) {
+        if (connection_info[i].session_id == owner) {
+            connections[i].bytes_sent += to_target;
+            connections[i].bytes_received += to_client;
+            connections[i].last_activity = time(NULL);
+            return;
+        }
     }
+}
 
-    // 更新统计信息
-    if (is_client_to_target) {
-        conn->bytes_sent += bytes_read;
+static void udp_relay_open(void) {
+    udp_relay = udp_relay_create(config.listen_port, config.max_clients * UDP_FLOWS_PER_SESSION,
+                                 config.udp_flow_timeout, udp_flow_owner, udp_flow_account);
+    if (udp_relay) {
+        log_message(LOG_INFO, "Relaying RDP UDP transport on port %d", config.listen_port);
     } else {
-        conn->bytes_received += bytes_read;
+        log_message(LOG_WARNING, "Failed to open UDP port %d: %s", config.listen_port, strerror(errno));
     }
+}
 
-    conn->last_activity = time(NULL);
+// 转发共用的读缓冲区，配置重载调大 buffer_max 后重新分配
+static char* get_relay_buffer(void) {
+    if (relay_buffer_capacity < config.buffer_max) {
+        char* buffer = realloc(relay_buffer, config.buffer_max);
+        if (!buffer) {
+            return NULL;
+        }
+        relay_buffer = buffer;
+        relay_buffer_capacity = config.buffer_max;
+    }
+    return relay_buffer;
+}
+
+// 本方向当前的读取大小
+static size_t relay_read_size(connection_pair_t* conn, int dir) {
+    relay_dir_t* relay = &conn_info(conn)->relay[dir];
+    if (relay->size == 0) {
+        relay->size = config.buffer_size;
+    }
+    // 配置重载可能改变上下限
+    if (relay->size < config.buffer_min) {
+        relay->size = config.buffer_min;
+    } else if (relay->size > config.buffer_max) {
+        relay->size = config.buffer_max;
+    }
+    return relay->size;
+}
+
+// 按本次读取量调整读取大小，并同步调整读取一侧的 SO_RCVBUF 和写出一侧的 SO_SNDBUF（fd<=0 的一侧跳过）。
+// 所有会话的socket缓冲区总量超过 buffer_memory_limit 时只放大读取大小，socket缓冲区保持不变
+static void relay_adapt(connection_pair_t* conn, int dir, int rcv_fd, int snd_fd,
+                        size_t bytes, size_t read_size) {
+    relay_dir_t* relay = &conn_info(conn)->relay[dir];
+    int size = relay->size;
+    if (bytes == read_size && read_size == (size_t)relay->size) {
+        size = relay->size * 2 < config.buffer_max ? relay->size * 2 : config.buffer_max;
+        relay->small_reads = 0;
+    } else if (bytes < (size_t)relay->size / 4) {
+        if (++relay->small_reads >= RELAY_SHRINK_READS) {
+            size = relay->size / 2 > config.buffer_min ? relay->size / 2 : config.buffer_min;
+            relay->small_reads = 0;
+        }
+    } else {
+        relay->small_reads = 0;
+    }
+    int resized = size != relay->size;
+    relay->size = size;
+    socket_profile_observe(conn, dir, resized);
+    if (!resized) {
+        return;
+    }
+
+    int sockbuf = size * RELAY_SOCKBUF_FACTOR;
+    int sockbuf_max = socket_profiles[conn_info(conn)->socket_profile].sockbuf_max;
+    if (sockbuf_max > 0 && sockbuf > sockbuf_max) {
+        sockbuf = sockbuf_max;
+    }
+    if (sockbuf == relay->sockbuf) {
+        return;
+    }
+    long sockbuf_bytes = (long)sockbuf * ((rcv_fd > 0) + (snd_fd > 0));
+    if (sockbuf > relay->sockbuf &&
+        relay_sockbuf_total - relay->sockbuf_bytes + sockbuf_bytes > config.buffer_memory_limit) {
+        return;
+    }
+    if (rcv_fd > 0) {
+        setsockopt(rcv_fd, SOL_SOCKET, SO_RCVBUF, &sockbuf, sizeof(sockbuf));
+    }
+    if (snd_fd > 0) {
+        setsockopt(snd_fd, SOL_SOCKET, SO_SNDBUF, &sockbuf, sizeof(sockbuf));
+    }
+    relay_sockbuf_total += sockbuf_bytes - relay->sockbuf_bytes;
+    relay->sockbuf = sockbuf;
+    relay->sockbuf_bytes = sockbuf_bytes;
+}
+
+// 会话结束时归还计入总量的socket缓冲区
+static void relay_release(connection_pair_t* conn) {
+    for (int dir = 0; dir < 2; dir++) {
+        relay_sockbuf_total -= conn_info(conn)->relay[dir].sockbuf_bytes;
+        conn_info(conn)->relay[dir].sockbuf_bytes = 0;
+    }
+}
+
+// 改进的数据转发函数：反复读取并转发，直到socket读空、对端写满或用完本轮的 relay_budget，
+// 额度保证一个大流量会话不会占满一轮循环而拖慢其他会话；没读完的数据留在socket中，下一轮select立即返回
+int forward_data(int from_fd, int to_fd, connection_pair_t* conn, int is_client_to_target) {
+    char* buffer = get_relay_buffer();
+    if (!buffer) {
+        log_message(LOG_ERR, "Failed to allocate buffer");
+        return -1;
+    }
+
+    int dir = is_client_to_target ? 0 : 1;
+    int total = 0;
+    int blocked = 0;
+    while (!blocked && total < config.relay_budget) {
+        // 客户端已断开（挂起）或仍有未回放的暂存数据时，目标端数据先进入暂存缓冲区以保证顺序
+        int use_park_buffer = !is_client_to_target &&
+                              (to_fd <= 0 || park_pending_size(conn) > 0);
+        if (use_park_buffer && socket_profile_backlogged(conn)) {
+            break; // 等客户端可写回放暂存数据后再读取
+        }
+        size_t read_size = relay_read_size(conn, dir);
+        if (use_park_buffer) {
+            size_t space = spill_space(&conn_info(conn)->park_buffer);
+            if (space == 0) {
+                break; // 暂存缓冲区已满，等待客户端恢复后再读取
+            }
+            if (read_size > space) {
+                read_size = space;
+            }
+        }
+
+        ssize_t bytes_read = recv(from_fd, buffer, read_size, 0);
+        uint64_t relay_start = metrics_now_us();
+
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break; // 非阻塞模式下没有数据可读
+            }
+            log_connection_error(conn, errno, "recv", is_client_to_target);
+            return -1; // 连接错误
+        }
+
+        if (bytes_read == 0) {
+            log_message(LOG_INFO, "Connection closed by %s",
+                       is_client_to_target ? "client" : "target");
+
+            // 如果是客户端断开且启用了快速重连，特殊处理
+            // 但要确保连接已经建立一段时间，避免在RDP握手阶段误判
+            if (is_client_to_target && config.enable_fast_reconnect &&
+                conn && (time(NULL) - conn_info(conn)->connection_start_time > 5)) {
+                return -2; // 特殊返回值表示客户端断开
+            }
+
+            return -1; // 连接关闭
+        }
+
+        ssize_t bytes_sent = 0;
+        if (use_park_buffer) {
+            park_append(conn, buffer, bytes_read);
+            bytes_sent = bytes_read;
+
+            // 客户端已恢复时立即尝试回放
+            if (to_fd > 0 && spill_flush(&conn_info(conn)->park_buffer, to_fd) < 0) {
+                log_connection_error(conn, errno, "send", 1);
+                return -1;
+            }
+            blocked = park_pending_size(conn) > 0;
+        }
+        while (bytes_sent < bytes_read) {
+            ssize_t sent = send(to_fd, buffer + bytes_sent, bytes_read - bytes_sent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // 对端写满后本轮不再继续读取
+                    blocked = 1;
+                    // 客户端socket缓冲区满，剩余数据转入暂存缓冲区，等待可写时回放
+                    if (!is_client_to_target &&
+                        spill_space(&conn_info(conn)->park_buffer) >= (size_t)(bytes_read - bytes_sent)) {
+                        park_append(conn, buffer + bytes_sent, bytes_read - bytes_sent);
+                        break;
+                    }
+                    // 目标socket缓冲区满，稍后重试
+                    usleep(1000); // 等待1ms
+                    continue;
+                }
+                log_connection_error(conn, errno, "send", !is_client_to_target);
+                return -1;
+            }
+            if (sent == 0) {
+                log_message(LOG_WARNING, "send returned 0, connection may be closed");
+                return -1;
+            }
+            bytes_sent += sent;
+        }
+
+        // 更新统计信息
+        if (is_client_to_target) {
+            conn->bytes_sent += bytes_read;
+            stats.total_bytes_sent += bytes_read;
+        } else {
+            conn->bytes_received += bytes_read;
+            stats.total_bytes_received += bytes_read;
+        }
+        metrics_hist_record(&stats.relay_latency, metrics_now_us() - relay_start);
+        total += bytes_read;
+        relay_adapt(conn, dir, from_fd, to_fd, bytes_read, read_size);
+
+        // 没读满缓冲区说明socket已读空，省去一次返回EAGAIN的recv
+        if ((size_t)bytes_read < read_size) {
+            break;
+        }
+    }
+
+    if (total > 0) {
+        conn->last_activity = time(NULL);
 
-    // 如果这是第一次数据传输，更新状态为活跃
-    if (conn->state == CONN_STATE_CONNECTED) {
-        set_connection_state(conn, CONN_STATE_ACTIVE, "data transfer started");
+        // 如果这是第一次数据传输，更新状态为活跃
+        if (conn->state == CONN_STATE_CONNECTED) {
+            set_connection_state(conn, CONN_STATE_ACTIVE, "data transfer started");
+        }
     }
 
-    free(buffer);
-    return bytes_read;
+    return total;
 }
 
 // 检查客户端socket是否还活着
@@ -717,6 +2296,7 @@ void handle_client_disconnect(connection_pair_t* conn) {
     }
 
     log_message(LOG_INFO, "Client disconnected, preparing for fast reconnect");
+    kernel_relay_stop(conn);
 
     // 关闭客户端socket
     if (conn->client_fd > 0) {
@@ -726,8 +2306,8 @@ void handle_client_disconnect(connection_pair_t* conn) {
 
     // 标记客户端已断开
     conn->client_disconnected = 1;
-    conn->disconnect_time = time(NULL);
-    conn->reconnect_attempts = 0;
+    conn_info(conn)->disconnect_time = time(NULL);
+    conn_info(conn)->reconnect_attempts = 0;
 
     // 如果启用了保持目标连接活跃，则不关闭目标连接
     if (config.keep_target_alive) {
@@ -740,14 +2320,14 @@ void handle_client_disconnect(connection_pair_t* conn) {
             conn->target_fd = -1;
         }
 
-        if (conn->ht_conn) {
-            ht_disconnect(conn->ht_conn);
-            ht_destroy_connection(conn->ht_conn);
-            conn->ht_conn = NULL;
+        if (conn->ht_stream) {
+            ht_stream_close(conn->ht_stream);
+            conn->ht_stream = NULL;
         }
 
         conn->target_ready = 0;
         conn->use_hybrid_transport = 0;
+        spill_release(&conn_info(conn)->park_buffer);
     }
 }
 
@@ -759,83 +2339,224 @@ void reset_connection_for_reuse(connection_pair_t* conn) {
 
     conn->client_disconnected = 0;
     conn->target_ready = 0;
-    conn->disconnect_time = 0;
-    conn->reconnect_attempts = 0;
+    conn_info(conn)->disconnect_time = 0;
+    conn_info(conn)->reconnect_attempts = 0;
     conn->last_activity = time(NULL);
     conn->bytes_sent = 0;
     conn->bytes_received = 0;
 }
 
-// 创建混合传输连接
-int create_hybrid_connection(connection_pair_t* conn, const char* target_ip, int port) {
-    if (!conn) {
-        return -1;
+// 登记隧道
+int add_tunnel(ht_mux_t* tunnel) {
+    if (ht_tunnel_count >= ht_tunnel_capacity) {
+        int capacity = ht_tunnel_capacity ? ht_tunnel_capacity * 2 : 8;
+        ht_mux_t** tunnels = realloc(ht_tunnels, capacity * sizeof(ht_mux_t*));
+        if (!tunnels) {
+            return -1;
+        }
+        ht_tunnels = tunnels;
+        ht_tunnel_capacity = capacity;
+    }
+    ht_tunnels[ht_tunnel_count++] = tunnel;
+    return 0;
+}
+
+// 入口到出口中继的隧道：不存在、已断开或出口地址已变更时新建，旧隧道上的会话继续使用旧隧道
+ht_mux_t* get_exit_tunnel(const char* exit_ip, int port) {
+    if (ht_exit_tunnel && ht_mux_alive(ht_exit_tunnel)) {
+        struct sockaddr_in* addr = &ht_exit_tunnel->conn->remote_addr;
+        struct in_addr exit_addr;
+        if (inet_pton(AF_INET, exit_ip, &exit_addr) == 1 &&
+            addr->sin_addr.s_addr == exit_addr.s_addr && ntohs(addr->sin_port) == port) {
+            return ht_exit_tunnel;
+        }
     }
+    ht_exit_tunnel = NULL;
 
-    // 创建混合传输连接
-    conn->ht_conn = ht_create_connection(target_ip, port, config.transport_mode);
-    if (!conn->ht_conn) {
+    ht_connection_t* ht = ht_create_connection(exit_ip, port, config.transport_mode);
+    if (!ht) {
         log_message(LOG_ERR, "Failed to create hybrid transport connection");
-        return -1;
+        return NULL;
     }
 
     // 配置混合传输参数
-    conn->ht_conn->udp_preference = config.udp_preference;
-    conn->ht_conn->retransmit_timeout = config.retransmit_timeout;
-    conn->ht_conn->max_retransmit = config.max_retransmit;
+    ht->udp_preference = config.udp_preference;
+    ht->retransmit_timeout = config.retransmit_timeout;
+    ht->max_retransmit = config.max_retransmit;
+    ht->duplicate_interactive = config.ht_duplicate_interactive;
+
+    // 多路径：每个本地地址一条子路径
+    char local_addrs[HT_MAX_PATHS][16];
+    int local_count = parse_local_addrs(config.ht_local_addrs, local_addrs);
+    for (int i = 0; i < local_count; i++) {
+        ht_add_path(ht, local_addrs[i]);
+    }
 
     // 建立连接
-    if (ht_connect(conn->ht_conn) < 0) {
+    if (ht_connect(ht) < 0) {
         log_message(LOG_ERR, "Failed to connect via hybrid transport");
-        ht_destroy_connection(conn->ht_conn);
-        conn->ht_conn = NULL;
+        ht_destroy_connection(ht);
+        return NULL;
+    }
+
+    ht_mux_t* tunnel = ht_mux_create(ht, 1);
+    if (!tunnel || add_tunnel(tunnel) < 0) {
+        if (tunnel) {
+            ht_mux_destroy(tunnel);
+        } else {
+            ht_destroy_connection(ht);
+        }
+        return NULL;
+    }
+
+    log_message(LOG_INFO, "Hybrid transport tunnel %016llx opened to %s:%d",
+               (unsigned long long)ht->conn_id, exit_ip, port);
+    ht_exit_tunnel = tunnel;
+    return tunnel;
+}
+
+// 释放不再使用的隧道：已断开且没有会话，或入口已换用新隧道的空闲旧隧道
+void reap_tunnels(void) {
+    for (int i = 0; i < ht_tunnel_count; i++) {
+        ht_mux_t* tunnel = ht_tunnels[i];
+        int unused = tunnel->open_streams == 0 && tunnel->stream_count == 0 && tunnel != ht_exit_tunnel &&
+                     tunnel->is_client;
+        if (tunnel->open_streams > 0 || (ht_mux_alive(tunnel) && !unused)) {
+            continue;
+        }
+
+        log_message(LOG_INFO, "Hybrid transport tunnel %016llx closed",
+                   (unsigned long long)tunnel->conn->conn_id);
+        if (tunnel == ht_exit_tunnel) {
+            ht_exit_tunnel = NULL;
+        }
+        ht_mux_destroy(tunnel);
+        ht_tunnels[i--] = ht_tunnels[--ht_tunnel_count];
+    }
+}
+
+// 隧道需要处理：某个socket可读（收包），或重传、心跳等定时事件已到期
+int tunnel_ready(ht_mux_t* tunnel, fd_set* readfds) {
+    int ht_fds[HT_MAX_PATHS + 1];
+    int ht_fd_count = ht_connection_fds(tunnel->conn, ht_fds, HT_MAX_PATHS + 1);
+    for (int j = 0; j < ht_fd_count; j++) {
+        if (FD_ISSET(ht_fds[j], readfds)) {
+            return 1;
+        }
+    }
+    return ht_mux_next_timeout(tunnel) == 0;
+}
+
+// 创建混合传输会话：在到出口中继的隧道上打开一个流
+int create_hybrid_connection(connection_pair_t* conn, const char* exit_ip, int port) {
+    if (!conn) {
+        return -1;
+    }
+
+    ht_mux_t* tunnel = get_exit_tunnel(exit_ip, port);
+    if (!tunnel) {
+        return -1;
+    }
+
+    conn->ht_stream = ht_mux_open_stream(tunnel);
+    if (!conn->ht_stream) {
+        log_message(LOG_ERR, "Failed to open stream on hybrid transport tunnel");
         return -1;
     }
 
     conn->use_hybrid_transport = 1;
-    log_message(LOG_INFO, "Hybrid transport connection established to %s:%d", target_ip, port);
+    log_message(LOG_INFO, "Hybrid transport stream %u opened to %s:%d", conn->ht_stream->id, exit_ip, port);
 
     return 0;
 }
 
-// 混合传输数据转发
-int forward_data_hybrid(connection_pair_t* conn, int from_client) {
-    if (!conn || !conn->ht_conn || !conn->use_hybrid_transport) {
+// 混合传输数据转发：TCP一侧（入口会话为客户端，出口中继会话为RDP主机）与隧道上的流之间双向搬运
+int forward_data_hybrid(connection_pair_t* conn, int from_tcp) {
+    if (!conn || !conn->ht_stream || !conn->use_hybrid_transport) {
         return -1;
     }
 
-    char buffer[8192];
+    int tcp_fd = conn->ht_exit_side ? conn->target_fd : conn->client_fd;
+    char* buffer = get_relay_buffer();
+    if (!buffer) {
+        log_message(LOG_ERR, "Failed to allocate buffer");
+        return -1;
+    }
+    // 出口中继会话的TCP一侧是RDP主机，方向与入口会话相反
+    int dir = (from_tcp != 0) == (conn->ht_exit_side != 0) ? 1 : 0;
     int bytes_transferred = 0;
 
-    if (from_client) {
-        // 从客户端读取数据，通过混合传输发送到目标
-        ssize_t bytes_read = recv(conn->client_fd, buffer, sizeof(buffer), 0);
-        if (bytes_read <= 0) {
-            if (bytes_read == 0) {
-                log_message(LOG_INFO, "Client connection closed");
-            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                log_connection_error(conn, errno, "recv", 1);
+    if (from_tcp) {
+        // 从TCP一侧读取数据放入流的发送队列，直到读空、队列满或用完本轮额度；队列满时不读，由TCP流控反压
+        while (bytes_transferred < config.relay_budget) {
+            size_t space = ht_stream_send_space(conn->ht_stream);
+            if (space == 0) {
+                break;
+            }
+            size_t read_size = relay_read_size(conn, dir);
+            if (read_size > space) {
+                read_size = space;
+            }
+            ssize_t bytes_read = recv(tcp_fd, buffer, read_size, 0);
+            if (bytes_read <= 0) {
+                if (bytes_read == 0) {
+                    log_message(LOG_INFO, "%s connection closed", conn->ht_exit_side ? "Target" : "Client");
+                    return -1;
+                } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    log_connection_error(conn, errno, "recv", !conn->ht_exit_side);
+                    return -1;
+                }
+                break;
             }
-            return bytes_read;
-        }
 
-        // 通过混合传输发送数据
-        int sent = ht_send_data(conn->ht_conn, buffer, bytes_read);
-        if (sent > 0) {
-            conn->bytes_sent += sent;
-            bytes_transferred = sent;
+            int sent = ht_stream_send(conn->ht_stream, buffer, bytes_read);
+            if (sent < 0) {
+                log_message(LOG_INFO, "Hybrid transport tunnel of session %lu closed", conn_info(conn)->session_id);
+                return -1;
+            }
+            if (conn->ht_exit_side) {
+                conn->bytes_received += sent;
+                stats.total_bytes_received += sent;
+            } else {
+                conn->bytes_sent += sent;
+                stats.total_bytes_sent += sent;
+            }
+            bytes_transferred += sent;
+            relay_adapt(conn, dir, tcp_fd, -1, bytes_read, read_size);
+            if ((size_t)bytes_read < read_size) {
+                break;
+            }
         }
     } else {
-        // 从混合传输接收数据，发送到客户端
-        ssize_t bytes_read = ht_recv_data(conn->ht_conn, buffer, sizeof(buffer));
-        if (bytes_read > 0) {
+        // 上次写不完暂存的数据先发出；仍有积压时不再从流中取数据，由流控窗口反压对端
+        if (park_pending_size(conn) > 0 && spill_flush(&conn_info(conn)->park_buffer, tcp_fd) < 0) {
+            log_connection_error(conn, errno, "send", !conn->ht_exit_side);
+            return -1;
+        }
+
+        // 从流中读取已按序到达的数据，写入TCP一侧；写不完的部分暂存
+        while (park_pending_size(conn) == 0) {
+            size_t read_size = relay_read_size(conn, dir);
+            ssize_t bytes_read = ht_stream_recv(conn->ht_stream, buffer, read_size);
+            if (bytes_read == 0) {
+                break;
+            }
+            if (bytes_read < 0) {
+                log_message(LOG_INFO, "Hybrid transport peer of session %lu closed", conn_info(conn)->session_id);
+                return -1;
+            }
+
             ssize_t bytes_sent = 0;
             while (bytes_sent < bytes_read) {
-                ssize_t sent = send(conn->client_fd, buffer + bytes_sent,
-                                  bytes_read - bytes_sent, MSG_NOSIGNAL);
+                ssize_t sent = send(tcp_fd, buffer + bytes_sent, bytes_read - bytes_sent, MSG_NOSIGNAL);
                 if (sent <= 0) {
                     if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                        log_connection_error(conn, errno, "send", 1);
+                        log_connection_error(conn, errno, "send", !conn->ht_exit_side);
+                        return -1;
+                    }
+                    size_t remaining = bytes_read - bytes_sent;
+                    if (park_append(conn, buffer + bytes_sent, remaining) < remaining) {
+                        log_message(LOG_ERR, "Hybrid session %lu output buffer full", conn_info(conn)->session_id);
                         return -1;
                     }
                     break;
@@ -843,10 +2564,15 @@ int forward_data_hybrid(connection_pair_t* conn, int from_client) {
                 bytes_sent += sent;
             }
 
-            if (bytes_sent > 0) {
-                conn->bytes_received += bytes_sent;
-                bytes_transferred = bytes_sent;
+            if (conn->ht_exit_side) {
+                conn->bytes_sent += bytes_read;
+                stats.total_bytes_sent += bytes_read;
+            } else {
+                conn->bytes_received += bytes_read;
+                stats.total_bytes_received += bytes_read;
             }
+            bytes_transferred += bytes_read;
+            relay_adapt(conn, dir, -1, tcp_fd, bytes_read, read_size);
         }
     }
 
@@ -854,13 +2580,197 @@ int forward_data_hybrid(connection_pair_t* conn, int from_client) {
         conn->last_activity = time(NULL);
     }
 
-    // 处理混合传输事件
-    ht_process_events(conn->ht_conn);
-    ht_handle_timeout(conn->ht_conn);
-
     return bytes_transferred;
 }
 
+// 出口中继：接受新的隧道，并为隧道上每个新的流建立到RDP主机的TCP连接
+void accept_hybrid_sessions(void) {
+    ht_connection_t* peer;
+    while ((peer = ht_accept(ht_listener)) != NULL) {
+        peer->udp_preference = config.udp_preference;
+        peer->retransmit_timeout = config.retransmit_timeout;
+        peer->max_retransmit = config.max_retransmit;
+        peer->duplicate_interactive = config.ht_duplicate_interactive;
+
+        ht_mux_t* tunnel = ht_mux_create(peer, 0);
+        if (!tunnel || add_tunnel(tunnel) < 0) {
+            if (tunnel) {
+                ht_mux_destroy(tunnel);
+            } else {
+                ht_disconnect(peer);
+                ht_destroy_connection(peer);
+            }
+            continue;
+        }
+
+        char peer_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &peer->remote_addr.sin_addr, peer_ip, INET_ADDRSTRLEN);
+        log_message(LOG_INFO, "Hybrid transport tunnel %016llx accepted from %s:%d",
+                   (unsigned long long)peer->conn_id, peer_ip, ntohs(peer->remote_addr.sin_port));
+
+        // 握手之后已到达的数据包立即分流，新的流在下面接受
+        ht_mux_process(tunnel);
+    }
+
+    for (int i = 0; i < ht_tunnel_count; i++) {
+        ht_mux_t* tunnel = ht_tunnels[i];
+        ht_stream_t* stream;
+        while (!tunnel->is_client && (stream = ht_mux_accept_stream(tunnel)) != NULL) {
+            if (connection_count >= config.max_clients) {
+                log_message(LOG_WARNING, "Maximum connections reached, rejecting hybrid stream %u", stream->id);
+                ht_stream_close(stream);
+                continue;
+            }
+
+            uint64_t connect_start = metrics_now_us();
+            int target_fd = connect_to_target(config.target_ip, config.target_port);
+            metrics_hist_record(&stats.connect_latency, metrics_now_us() - connect_start);
+            if (target_fd < 0) {
+                log_message(LOG_ERR, "Failed to connect to target %s:%d for hybrid stream %u",
+                           config.target_ip, config.target_port, stream->id);
+                stats.failed_connections++;
+                ht_stream_close(stream);
+                continue;
+            }
+            if (set_nonblocking(target_fd) < 0) {
+                log_message(LOG_WARNING, "Failed to set target socket non-blocking");
+            }
+            configure_tcp_socket(target_fd, 0, socket_profile_initial());
+
+            connection_pair_t* conn = reset_connection_slot(connection_count);
+            connection_info_t* info = conn_info(conn);
+            conn->client_fd = -1;
+            conn->target_fd = target_fd;
+            strcpy(info->target_ip, config.target_ip);
+            info->target_port = config.target_port;
+            conn->last_activity = time(NULL);
+            info->connection_start_time = time(NULL);
+            conn->is_active = 1;
+            conn->ht_stream = stream;
+            conn->use_hybrid_transport = 1;
+            conn->ht_exit_side = 1;
+            set_connection_state(conn, CONN_STATE_CONNECTED, "hybrid stream accepted");
+
+            info->session_id = ++stats.total_connections;
+            connection_count++;
+            stats.active_connections++;
+
+            log_message(LOG_INFO, "New relay session %lu (hybrid): tunnel %016llx stream %u -> %s:%d",
+                       info->session_id, (unsigned long long)tunnel->conn->conn_id, stream->id,
+                       config.target_ip, config.target_port);
+        }
+    }
+}
+
+// 处理一个新接受的客户端：快速重连时接回等待中的会话，否则建立新会话。
+// 传统TCP模式下到目标的连接非阻塞发起，完成前会话处于 CONNECTING 状态，由主循环等待可写后完成
+void accept_client(int client_fd, const struct sockaddr_in* client_addr) {
+    uint64_t accept_time = metrics_now_us();
+
+    // 首先检查是否有可重用的连接（快速重连）
+    int reused_connection = -1;
+    if (config.enable_fast_reconnect) {
+        for (int i = 0; i < connection_count; i++) {
+            if (connections[i].client_disconnected && connections[i].target_ready) {
+                reused_connection = i;
+                break;
+            }
+        }
+    }
+
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_addr->sin_addr, client_ip, INET_ADDRSTRLEN);
+
+    if (reused_connection >= 0) {
+        // 重用现有连接（accept4 已设为非阻塞，这里只调整TCP参数）
+        log_message(LOG_INFO, "Reusing connection %d for fast reconnect", reused_connection);
+        // 恢复的客户端沿用会话当前的档位
+        configure_tcp_socket(client_fd, 1, connection_info[reused_connection].socket_profile);
+
+        connections[reused_connection].client_fd = client_fd;
+        connection_info[reused_connection].client_addr = *client_addr;
+        reset_connection_for_reuse(&connections[reused_connection]);
+
+        size_t parked_bytes = park_pending_size(&connections[reused_connection]);
+        if (parked_bytes > 0) {
+            log_message(LOG_INFO, "Replaying %zu bytes buffered while client was disconnected",
+                       parked_bytes);
+        }
+
+        log_message(LOG_INFO, "Fast reconnect successful: %s:%d -> %s:%d",
+                   client_ip, ntohs(client_addr->sin_port),
+                   connection_info[reused_connection].target_ip,
+                   connection_info[reused_connection].target_port);
+        return;
+    }
+
+    if (connection_count >= config.max_clients) {
+        log_message(LOG_WARNING, "Maximum connections reached, rejecting new connection");
+        close(client_fd);
+        return;
+    }
+
+    // 健康检查已移除 - 强制连接目标服务器
+    log_message(LOG_INFO, "Accepting new connection - will attempt to connect to target");
+    configure_tcp_socket(client_fd, 1, socket_profile_initial());
+
+    // 初始化连接结构
+    connection_pair_t* conn = reset_connection_slot(connection_count);
+    connection_info_t* info = conn_info(conn);
+    conn->client_fd = client_fd;
+    conn->target_fd = -1;
+    strcpy(info->target_ip, config.target_ip);
+    info->target_port = config.target_port;
+    info->client_addr = *client_addr;
+    info->accept_time_us = accept_time;
+    conn->last_activity = time(NULL);
+    info->connection_start_time = time(NULL);
+    conn->is_active = 1;
+
+    // 设置初始状态
+    set_connection_state(conn, CONN_STATE_CONNECTING, "new client connection");
+
+    int connection_success = 0;
+    int in_progress = 0;
+
+    // 根据配置选择传输模式：混合传输只在两个转发器之间使用，
+    // 必须配置出口中继，由出口中继还原为TCP连接RDP主机
+    if (config.transport_mode != HT_MODE_TCP_ONLY && config.ht_exit_ip[0]) {
+        // 尝试创建混合传输连接
+        if (create_hybrid_connection(conn, config.ht_exit_ip, config.ht_exit_port) == 0) {
+            connection_success = 1;
+        }
+    }
+
+    // 如果混合传输失败，回退到传统TCP；不等待连接完成，连接风暴时多个目标连接并行握手
+    if (!connection_success) {
+        info->connect_start_us = metrics_now_us();
+        int target_fd = start_target_connect(config.target_ip, config.target_port, &in_progress);
+        if (target_fd >= 0) {
+            configure_tcp_socket(target_fd, 0, socket_profile_initial());
+            conn->target_fd = target_fd;
+            connection_success = 1;
+            log_message(LOG_INFO, "Using traditional TCP transport");
+        }
+    }
+
+    if (!connection_success) {
+        log_message(LOG_ERR, "Failed to connect to target %s:%d", config.target_ip, config.target_port);
+        stats.failed_connections++;
+        close(client_fd);
+        return;
+    }
+
+    connection_count++;
+    stats.active_connections++;
+    if (!in_progress) {
+        if (!conn->use_hybrid_transport) {
+            metrics_hist_record(&stats.connect_latency, metrics_now_us() - info->connect_start_us);
+        }
+        session_established(conn);
+    }
+}
+
 // 尝试重连目标
 int try_reconnect_target(connection_pair_t* conn) {
     if (!conn || !conn->client_disconnected) {
@@ -868,30 +2778,30 @@ int try_reconnect_target(connection_pair_t* conn) {
     }
 
     // 检查是否超过最大重试次数
-    if (conn->reconnect_attempts >= config.max_reconnect_attempts) {
+    if (conn_info(conn)->reconnect_attempts >= config.max_reconnect_attempts) {
         log_message(LOG_WARNING, "Max reconnect attempts reached, giving up");
         return -1;
     }
 
-    conn->reconnect_attempts++;
+    conn_info(conn)->reconnect_attempts++;
 
     // 如果目标连接还活着，直接返回成功
     if (conn->target_ready &&
-        ((conn->target_fd > 0) || (conn->ht_conn && conn->use_hybrid_transport))) {
+        ((conn->target_fd > 0) || (conn->ht_stream && conn->use_hybrid_transport))) {
         log_message(LOG_INFO, "Target connection still alive, ready for new client");
         return 0;
     }
 
     // 重新建立目标连接
     log_message(LOG_INFO, "Reconnecting to target (attempt %d/%d)",
-               conn->reconnect_attempts, config.max_reconnect_attempts);
+               conn_info(conn)->reconnect_attempts, config.max_reconnect_attempts);
 
     int connection_success = 0;
 
     // 根据配置选择传输模式
-    if (config.transport_mode != HT_MODE_TCP_ONLY) {
-        // 尝试创建混合传输连接
-        if (create_hybrid_connection(conn, config.target_ip, config.target_port) == 0) {
+    if (config.transport_mode != HT_MODE_TCP_ONLY && config.ht_exit_ip[0]) {
+        // 尝试经出口中继创建混合传输连接
+        if (create_hybrid_connection(conn, config.ht_exit_ip, config.ht_exit_port) == 0) {
             connection_success = 1;
             conn->target_ready = 1;
         }
@@ -899,13 +2809,13 @@ int try_reconnect_target(connection_pair_t* conn) {
 
     // 如果混合传输失败，回退到传统TCP
 	    if (!connection_success) {
-	        int target_fd = connect_to_target(config.target_ip, config.target_port);
+	        int target_fd = connect_to_target(conn_info(conn)->target_ip, conn_info(conn)->target_port);
 	        if (target_fd >= 0) {
 	            // 设置目标socket为非阻塞模式并调整TCP参数
 	            if (set_nonblocking(target_fd) < 0) {
 	                log_message(LOG_WARNING, "Failed to set target socket non-blocking");
 	            }
-	            configure_tcp_socket(target_fd);
+	            configure_tcp_socket(target_fd, 0, conn_info(conn)->socket_profile);
 
 	            conn->target_fd = target_fd;
 	            conn->target_ready = 1;
@@ -925,7 +2835,7 @@ int try_reconnect_target(connection_pair_t* conn) {
 
 int main(int argc, char *argv[]) {
     // 初始化默认配置
-    init_config();
+    init_config(&config);
 
     // 早期初始化syslog，以便在配置加载时使用
     openlog("rdp_forwarder", LOG_PID | LOG_CONS, LOG_DAEMON);
@@ -937,19 +2847,37 @@ int main(int argc, char *argv[]) {
     }
 
     // 加载配置文件
-    const char* config_file = CONFIG_FILE;
-    if (argc > 1 && strcmp(argv[1], "-c") == 0 && argc > 2) {
-        config_file = argv[2];
-    } else if (argc == 2) {
-        // 兼容旧版本：直接指定目标IP
-        strcpy(config.target_ip, argv[1]);
+    int takeover = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            config_path = argv[++i];
+        } else if (strcmp(argv[i], "--takeover") == 0) {
+            // 热升级：从正在运行的实例接管监听socket和会话
+            takeover = 1;
+        } else if (argc == 2) {
+            // 兼容旧版本：直接指定目标IP
+            cmdline_target_ip = argv[1];
+            strncpy(config.target_ip, argv[1], sizeof(config.target_ip) - 1);
+        }
+    }
+
+    load_config(config_path, &config);
+
+    char config_error[256];
+    if (!validate_config(&config, config_error, sizeof(config_error))) {
+        fprintf(stderr, "Invalid configuration: %s\n", config_error);
+        exit(1);
     }
+    spill_set_limits(config.park_buffer_size, config.park_memory_limit,
+                     config.park_spill_size, config.park_spill_dir);
 
-    load_config(config_file);
+    // 配置加载完成后启动异步日志写线程
+    if (async_log_start(config.log_rate_limit) < 0) {
+        log_message(LOG_WARNING, "Failed to start async log writer, logging synchronously");
+    }
 
     // 分配连接数组
-    connections = malloc(config.max_clients * sizeof(connection_pair_t));
-    if (!connections) {
+    if (grow_connections(config.max_clients) < 0) {
         fprintf(stderr, "Failed to allocate memory for connections\n");
         exit(1);
     }
@@ -958,19 +2886,79 @@ int main(int argc, char *argv[]) {
     signal(SIGPIPE, SIG_IGN);
     signal(SIGTERM, signal_handler);
     signal(SIGINT, signal_handler);
+    signal(SIGHUP, reload_signal_handler);
 
     // 初始化统计
     init_stats();
+    read_default_congestion();
 
-    int listen_fd = create_listen_socket(config.listen_port);
-    if (listen_fd < 0) {
-        exit(1);
+    if (takeover) {
+        if (!config.control_socket[0] || receive_handover(config.control_socket) < 0) {
+            fprintf(stderr, "Takeover requires control_socket of the running instance\n");
+            exit(1);
+        }
+    } else {
+        listen_fd = create_listen_socket(config.listen_port);
+        if (listen_fd < 0) {
+            exit(1);
+        }
+    }
+
+    // 本机指标端口
+    if (config.metrics_port > 0) {
+        metrics_fd = metrics_create_listener(config.metrics_port);
+        if (metrics_fd < 0) {
+            log_message(LOG_WARNING, "Failed to open metrics port %d, metrics disabled", config.metrics_port);
+        } else {
+            log_message(LOG_INFO, "Metrics available at http://127.0.0.1:%d/metrics", config.metrics_port);
+        }
+    }
+
+    // 本机控制socket
+    if (config.control_socket[0]) {
+        control_fd = control_create_listener(config.control_socket);
+        if (control_fd < 0) {
+            log_message(LOG_WARNING, "Failed to open control socket %s", config.control_socket);
+        }
+    }
+
+    // RDP UDP 传输与TCP共用监听端口
+    if (config.udp_relay) {
+        udp_relay_open();
+    }
+
+    // 出口中继的混合传输监听；交接后旧进程仍占用端口，之后每秒重试
+    time_t ht_listen_retry = 0;
+    if (config.ht_listen_port > 0) {
+        ht_listener = ht_listen(config.listen_interface, config.ht_listen_port);
+        if (ht_listener) {
+            log_message(LOG_INFO, "Accepting hybrid transport peers on port %d", config.ht_listen_port);
+        } else {
+            log_message(LOG_WARNING, "Failed to open hybrid transport port %d, retrying", config.ht_listen_port);
+            ht_listen_retry = time(NULL);
+        }
     }
 
     log_message(LOG_INFO, "RDP Forwarder started, listening on port %d, forwarding to %s:%d",
                config.listen_port, config.target_ip, config.target_port);
 
     while (running) {
+        if (config.ht_listen_port > 0 && !ht_listener && !handover_draining && time(NULL) > ht_listen_retry) {
+            ht_listener = ht_listen(config.listen_interface, config.ht_listen_port);
+            if (ht_listener) {
+                log_message(LOG_INFO, "Accepting hybrid transport peers on port %d", config.ht_listen_port);
+            }
+            ht_listen_retry = time(NULL);
+        }
+
+        // SIGHUP 触发的配置重载
+        if (reload_requested) {
+            reload_requested = 0;
+            char result[512];
+            int status = reload_config(result, sizeof(result));
+            log_message(status == 0 ? LOG_INFO : LOG_ERR, "Config reload via SIGHUP: %s", result);
+        }
+
         // 定期打印统计信息和连接状态
         if (config.enable_stats) {
             time_t now = time(NULL);
@@ -995,159 +2983,193 @@ int main(int argc, char *argv[]) {
                 if (connections[i].client_disconnected && !connections[i].target_ready) {
                     // 尝试重连目标
                     time_t now = time(NULL);
-                    if (now - connections[i].disconnect_time >= config.reconnect_delay / 1000) {
+                    if (now - connection_info[i].disconnect_time >= config.reconnect_delay / 1000) {
                         try_reconnect_target(&connections[i]);
                     }
                 }
             }
         }
 
+        // 交接完成且剩余会话已结束，旧进程退出
+        if (handover_draining && connection_count == 0) {
+            log_message(LOG_INFO, "All remaining sessions drained after handover, exiting");
+            break;
+        }
+
         fd_set readfds;
+        fd_set writefds;
         int max_fd = listen_fd;
         
         FD_ZERO(&readfds);
-        FD_SET(listen_fd, &readfds);
+        FD_ZERO(&writefds);
+        if (listen_fd >= 0) {
+            FD_SET(listen_fd, &readfds);
+        }
+        if (metrics_fd >= 0) {
+            FD_SET(metrics_fd, &readfds);
+            max_fd = (metrics_fd > max_fd) ? metrics_fd : max_fd;
+        }
+        if (control_fd >= 0) {
+            FD_SET(control_fd, &readfds);
+            max_fd = (control_fd > max_fd) ? control_fd : max_fd;
+        }
         
+        // 出口中继监听的UDP/TCP套接字和等待首帧的TCP连接；监听端口被占用时每秒重试
+        int ht_timeout = config.ht_listen_port > 0 && !ht_listener ? 1000 : -1;
+        if (ht_listener) {
+            int ht_fds[HT_MAX_PENDING_TCP + 2];
+            int ht_fd_count = ht_listener_fds(ht_listener, ht_fds, HT_MAX_PENDING_TCP + 2);
+            for (int j = 0; j < ht_fd_count; j++) {
+                FD_SET(ht_fds[j], &readfds);
+                max_fd = (ht_fds[j] > max_fd) ? ht_fds[j] : max_fd;
+            }
+        }
+
+        // 隧道socket（各子路径的UDP和TCP通道）；出口中继上的隧道的UDP由监听器统一接收。
+        // select 的超时取各隧道最早的定时事件（重传、心跳、MTU探测），空闲隧道不会被轮询
+        for (int i = 0; i < ht_tunnel_count; i++) {
+            int ht_fds[HT_MAX_PATHS + 1];
+            int ht_fd_count = ht_connection_fds(ht_tunnels[i]->conn, ht_fds, HT_MAX_PATHS + 1);
+            for (int j = 0; j < ht_fd_count; j++) {
+                FD_SET(ht_fds[j], &readfds);
+                max_fd = (ht_fds[j] > max_fd) ? ht_fds[j] : max_fd;
+            }
+            int tunnel_timeout = ht_mux_next_timeout(ht_tunnels[i]);
+            if (tunnel_timeout >= 0 && (ht_timeout < 0 || tunnel_timeout < ht_timeout)) {
+                ht_timeout = tunnel_timeout;
+            }
+        }
+
+        // RDP UDP 传输的监听socket和各流的socket；超时取最早一个流的空闲到期时间
+        if (udp_relay) {
+            int udp_max_fd = udp_relay_fd_set(udp_relay, &readfds);
+            max_fd = (udp_max_fd > max_fd) ? udp_max_fd : max_fd;
+            int udp_timeout = udp_relay_next_timeout(udp_relay, time(NULL));
+            if (udp_timeout >= 0 && (ht_timeout < 0 || udp_timeout < ht_timeout)) {
+                ht_timeout = udp_timeout;
+            }
+        }
+
         // 添加所有活跃连接到select
+        int kernel_sessions = 0;
+        int connecting_sessions = 0;
         for (int i = 0; i < connection_count; i++) {
-            if (connections[i].client_fd > 0) {
+            if (connections[i].use_hybrid_transport && connections[i].ht_stream) {
+                int tcp_fd = connections[i].ht_exit_side ? connections[i].target_fd : connections[i].client_fd;
+                if (tcp_fd > 0) {
+                    // 流的发送队列有空间时读取TCP一侧，暂存未写完的数据时等待可写
+                    if (ht_stream_send_space(connections[i].ht_stream) > 0) {
+                        FD_SET(tcp_fd, &readfds);
+                    }
+                    if (park_pending_size(&connections[i]) > 0) {
+                        FD_SET(tcp_fd, &writefds);
+                    }
+                    max_fd = (tcp_fd > max_fd) ? tcp_fd : max_fd;
+                }
+                continue;
+            }
+            // 正在连接目标：等待目标端可写，客户端数据留在接收队列中
+            if (connections[i].state == CONN_STATE_CONNECTING) {
+                connecting_sessions++;
+                FD_SET(connections[i].target_fd, &writefds);
+                max_fd = (connections[i].target_fd > max_fd) ? connections[i].target_fd : max_fd;
+                continue;
+            }
+            // 内核转发的一端收到数据时也会唤醒 select，但数据已被重定向，不放入 select，改为每秒检查一次
+            if (connections[i].kernel_relay) {
+                kernel_sessions++;
+            }
+            if (connections[i].client_fd > 0 && !connections[i].kernel_relay) {
                 FD_SET(connections[i].client_fd, &readfds);
                 max_fd = (connections[i].client_fd > max_fd) ? connections[i].client_fd : max_fd;
+
+                // 有待回放的暂存数据时等待客户端可写
+                if (park_pending_size(&connections[i]) > 0) {
+                    FD_SET(connections[i].client_fd, &writefds);
+                }
             }
-            if (connections[i].target_fd > 0) {
+            // 挂起会话继续读取目标端数据，暂存缓冲区满时停止读取（交给TCP流控）；
+            // 客户端写不动、暂存数据达到档位上限时同样停止读取
+            if (connections[i].target_fd > 0 && connections[i].kernel_relay != 1 &&
+                (connections[i].client_fd > 0 ? !socket_profile_backlogged(&connections[i])
+                                              : spill_space(&connection_info[i].park_buffer) > 0)) {
                 FD_SET(connections[i].target_fd, &readfds);
                 max_fd = (connections[i].target_fd > max_fd) ? connections[i].target_fd : max_fd;
             }
         }
         
-        int activity = select(max_fd + 1, &readfds, NULL, NULL, NULL);
+        if ((kernel_sessions > 0 || connecting_sessions > 0) && (ht_timeout < 0 || ht_timeout > 1000)) {
+            ht_timeout = 1000;
+        }
+
+        struct timeval select_timeout = { ht_timeout / 1000, (ht_timeout % 1000) * 1000 };
+        int activity = select(max_fd + 1, &readfds, &writefds, NULL, ht_timeout >= 0 ? &select_timeout : NULL);
         if (activity < 0) {
-            perror("select");
+            if (errno != EINTR) {
+                perror("select");
+            }
             continue;
         }
-        
-        // 处理新连接
-        if (FD_ISSET(listen_fd, &readfds)) {
-            struct sockaddr_in client_addr;
-            socklen_t addr_len = sizeof(client_addr);
-            int client_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &addr_len);
-
-            if (client_fd >= 0) {
-                // 首先检查是否有可重用的连接（快速重连）
-                int reused_connection = -1;
-                if (config.enable_fast_reconnect) {
-                    for (int i = 0; i < connection_count; i++) {
-                        if (connections[i].client_disconnected && connections[i].target_ready) {
-                            reused_connection = i;
-                            break;
-                        }
-                    }
-                }
+        uint64_t loop_start = metrics_now_us();
 
-                if (reused_connection >= 0) {
-                    // 重用现有连接
-                    log_message(LOG_INFO, "Reusing connection %d for fast reconnect", reused_connection);
+        // 内核转发的会话不会唤醒主循环，超时检查前先取回转发量和活动时间
+        int kernel_relay_tick = kernel_relay_sync_all(0);
 
-	            // 设置客户端socket为非阻塞模式并调整TCP参数
-	            if (set_nonblocking(client_fd) < 0) {
-	                log_message(LOG_WARNING, "Failed to set client socket non-blocking");
-	            }
-	            configure_tcp_socket(client_fd);
-
-                    connections[reused_connection].client_fd = client_fd;
-                    reset_connection_for_reuse(&connections[reused_connection]);
-
-                    char client_ip[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-
-                    log_message(LOG_INFO, "Fast reconnect successful: %s:%d -> %s:%d",
-                               client_ip, ntohs(client_addr.sin_port),
-                               config.target_ip, config.target_port);
-
-                } else if (connection_count < config.max_clients) {
-                // 健康检查已移除 - 强制连接目标服务器
-                log_message(LOG_INFO, "Accepting new connection - will attempt to connect to target");
-
-	                // 设置客户端socket为非阻塞模式并调整TCP参数
-	                if (set_nonblocking(client_fd) < 0) {
-	                    log_message(LOG_WARNING, "Failed to set client socket non-blocking");
-	                }
-	                configure_tcp_socket(client_fd);
-
-                // 初始化连接结构
-                memset(&connections[connection_count], 0, sizeof(connection_pair_t));
-                connections[connection_count].client_fd = client_fd;
-                connections[connection_count].target_fd = -1;
-                strcpy(connections[connection_count].target_ip, config.target_ip);
-                connections[connection_count].last_activity = time(NULL);
-                connections[connection_count].connection_start_time = time(NULL);
-                connections[connection_count].is_active = 1;
-                connections[connection_count].bytes_sent = 0;
-                connections[connection_count].bytes_received = 0;
-                connections[connection_count].ht_conn = NULL;
-                connections[connection_count].use_hybrid_transport = 0;
-
-                // 设置初始状态
-                set_connection_state(&connections[connection_count], CONN_STATE_CONNECTING, "new client connection");
-
-                // 初始化快速重连状态
-                connections[connection_count].client_disconnected = 0;
-                connections[connection_count].target_ready = 0;
-                connections[connection_count].disconnect_time = 0;
-                connections[connection_count].reconnect_attempts = 0;
-
-                int connection_success = 0;
-
-                // 根据配置选择传输模式
-                // 暂时禁用混合传输，确保RDP协议兼容性
-                if (0 && config.transport_mode != HT_MODE_TCP_ONLY) {
-                    // 尝试创建混合传输连接
-                    if (create_hybrid_connection(&connections[connection_count],
-                                               config.target_ip, config.target_port) == 0) {
-                        connection_success = 1;
-                    }
-                }
+        // 指标抓取
+        if (metrics_fd >= 0 && FD_ISSET(metrics_fd, &readfds)) {
+            metrics_handle_client(metrics_fd, render_metrics);
+        }
 
-                // 如果混合传输失败，回退到传统TCP
-	                if (!connection_success) {
-	                    int target_fd = connect_to_target(config.target_ip, config.target_port);
-	                    if (target_fd >= 0) {
-	                        // 设置目标socket为非阻塞模式并调整TCP参数
-	                        if (set_nonblocking(target_fd) < 0) {
-	                            log_message(LOG_WARNING, "Failed to set target socket non-blocking");
-	                        }
-	                        configure_tcp_socket(target_fd);
-
-	                        connections[connection_count].target_fd = target_fd;
-	                        connection_success = 1;
-	                        log_message(LOG_INFO, "Using traditional TCP transport");
-	                    }
-	                }
-
-                if (connection_success) {
-                    char client_ip[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-
-                    const char* transport_type = connections[connection_count].use_hybrid_transport ?
-                                               "hybrid" : "tcp";
-
-                    log_message(LOG_INFO, "New connection %d established (%s): %s:%d -> %s:%d",
-                               connection_count, transport_type, client_ip, ntohs(client_addr.sin_port),
-                               config.target_ip, config.target_port);
-
-                    // 更新连接状态为已连接
-                    set_connection_state(&connections[connection_count], CONN_STATE_CONNECTED, "target connection established");
-
-                    connection_count++;
-                    stats.total_connections++;
-                } else {
-                    log_message(LOG_ERR, "Failed to connect to target %s:%d", config.target_ip, config.target_port);
-                    close(client_fd);
+        // 控制命令
+        if (control_fd >= 0 && FD_ISSET(control_fd, &readfds)) {
+            handle_control_command(control_fd);
+        }
+
+        // RDP UDP 传输：转发可读socket上的数据报，关闭空闲超时的流
+        if (udp_relay) {
+            udp_relay_process(udp_relay, &readfds);
+            udp_relay_expire(udp_relay, time(NULL));
+        }
+
+        // 混合传输：监听器分发数据包，socket可读或定时事件到期的隧道收包、分流、重传和调度，
+        // 出口中继接受新的隧道和流
+        if (ht_listener) {
+            int ht_fds[HT_MAX_PENDING_TCP + 2];
+            int ht_fd_count = ht_listener_fds(ht_listener, ht_fds, HT_MAX_PENDING_TCP + 2);
+            for (int j = 0; j < ht_fd_count; j++) {
+                if (FD_ISSET(ht_fds[j], &readfds)) {
+                    ht_listener_process(ht_listener);
+                    break;
                 }
-                } else if (client_fd >= 0) {
-                log_message(LOG_WARNING, "Maximum connections reached, rejecting new connection");
-                close(client_fd);
             }
+        }
+        for (int i = 0; i < ht_tunnel_count; i++) {
+            if (tunnel_ready(ht_tunnels[i], &readfds)) {
+                ht_mux_process(ht_tunnels[i]);
+            }
+        }
+        if (ht_listener && !handover_draining) {
+            accept_hybrid_sessions();
+        }
+        
+        // 处理新连接：一次唤醒接受队列中的多个连接，每轮最多 accept_batch 个，
+        // 其余留到下一轮，连接风暴期间已有会话照常转发
+        if (listen_fd >= 0 && FD_ISSET(listen_fd, &readfds)) {
+            for (int accepted = 0; accepted < config.accept_batch; accepted++) {
+                struct sockaddr_in client_addr;
+                socklen_t addr_len = sizeof(client_addr);
+                int client_fd = accept4(listen_fd, (struct sockaddr*)&client_addr, &addr_len,
+                                        SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (client_fd < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) {
+                        continue;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        log_message(LOG_ERR, "accept failed: %s", strerror(errno));
+                    }
+                    break;
+                }
+                accept_client(client_fd, &client_addr);
             }
         }
 
@@ -1171,26 +3193,60 @@ int main(int argc, char *argv[]) {
             if (connections[i].use_hybrid_transport) {
                 // 使用混合传输模式
 
-                // 客户端到目标的数据转发
-                if (connections[i].client_fd > 0 && FD_ISSET(connections[i].client_fd, &readfds)) {
+                // TCP一侧（客户端或出口中继的RDP主机）到混合传输的数据转发
+                int tcp_fd = connections[i].ht_exit_side ? connections[i].target_fd : connections[i].client_fd;
+                if (tcp_fd > 0 && FD_ISSET(tcp_fd, &readfds)) {
                     int result = forward_data_hybrid(&connections[i], 1);
                     if (result < 0) {
                         connection_error = 1;
                     }
                 }
 
-                // 混合传输到客户端的数据转发（定期检查）
-                if (!connection_error) {
+                // 混合传输到TCP一侧的数据转发：流中有按序到达的数据（或已结束），或暂存数据可以继续写出
+                int park_pending = park_pending_size(&connections[i]) > 0;
+                if (!connection_error && connections[i].ht_stream &&
+                    ((!park_pending && ht_stream_readable(connections[i].ht_stream)) ||
+                     (park_pending && tcp_fd > 0 && FD_ISSET(tcp_fd, &writefds)))) {
                     int result = forward_data_hybrid(&connections[i], 0);
                     if (result < 0) {
                         connection_error = 1;
                     }
                 }
+            } else if (connections[i].state == CONN_STATE_CONNECTING) {
+                // 正在连接目标：可写时取得连接结果，超过 socket_timeout 仍未完成则放弃
+                if (FD_ISSET(connections[i].target_fd, &writefds)) {
+                    connection_error = finish_target_connect(&connections[i]) < 0;
+                } else if (config.socket_timeout > 0 &&
+                           now - connection_info[i].state_change_time > config.socket_timeout) {
+                    log_message(LOG_ERR, "Timed out connecting to target %s:%d",
+                               connection_info[i].target_ip, connection_info[i].target_port);
+                    stats.failed_connections++;
+                    connection_error = 1;
+                }
             } else {
                 // 使用传统TCP模式
 
+                // 内核转发的一端有用户态可读的数据（对端已不在 sockmap 中时被放行）或已关闭时照常处理
+                if (connections[i].kernel_relay && kernel_relay_tick) {
+                    if (kernel_relay_readable(connections[i].client_fd)) {
+                        FD_SET(connections[i].client_fd, &readfds);
+                    }
+                    if (connections[i].kernel_relay == 1 && kernel_relay_readable(connections[i].target_fd)) {
+                        FD_SET(connections[i].target_fd, &readfds);
+                    }
+                }
+
+                // 回放暂存数据到客户端
+                if (connections[i].client_fd > 0 && FD_ISSET(connections[i].client_fd, &writefds)) {
+                    if (spill_flush(&connection_info[i].park_buffer, connections[i].client_fd) < 0) {
+                        log_connection_error(&connections[i], errno, "send", 1);
+                        connection_error = 1;
+                    }
+                }
+
                 // 客户端到目标的数据转发
-                if (connections[i].client_fd > 0 && FD_ISSET(connections[i].client_fd, &readfds)) {
+                if (!connection_error && connections[i].client_fd > 0 &&
+                    FD_ISSET(connections[i].client_fd, &readfds)) {
                     int result = forward_data(connections[i].client_fd, connections[i].target_fd,
                                             &connections[i], 1);
                     if (result == -2 && config.enable_fast_reconnect) {
@@ -1220,6 +3276,14 @@ int main(int argc, char *argv[]) {
                 i--; // 因为cleanup_connection会移动数组元素
             }
         }
+
+        reap_tunnels();
+
+        metrics_hist_record(&stats.loop_lag, metrics_now_us() - loop_start);
+    }
+
+    if (shutdown_signal) {
+        log_message(LOG_INFO, "Received signal %d, shutting down gracefully...", (int)shutdown_signal);
     }
 
     // 清理所有连接
@@ -1227,14 +3291,34 @@ int main(int argc, char *argv[]) {
     for (int i = connection_count - 1; i >= 0; i--) {
         cleanup_connection(i);
     }
+    for (int i = 0; i < ht_tunnel_count; i++) {
+        ht_mux_destroy(ht_tunnels[i]);
+    }
+    ht_tunnel_count = 0;
+    ht_exit_tunnel = NULL;
+    free(ht_tunnels);
+    if (ht_listener) {
+        ht_listener_close(ht_listener);
+        ht_listener = NULL;
+    }
 
-    close(listen_fd);
+    if (listen_fd >= 0) {
+        close(listen_fd);
+    }
+    if (metrics_fd >= 0) {
+        close(metrics_fd);
+    }
+    control_close_listener(control_fd, config.control_socket);
+    udp_relay_destroy(udp_relay);
+    sockmap_relay_shutdown();
     free(connections);
+    free(connection_info);
 
     // 清理混合传输协议
     ht_cleanup();
 
     log_message(LOG_INFO, "RDP Forwarder shutdown complete");
+    async_log_stop();
     closelog();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include "sockmap_relay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+
+#ifndef SO_COOKIE
+#define SO_COOKIE 57
+#endif
+
+// 转发表的值：对端在 sockmap 中的位置和本端已重定向的字节数（程序中按偏移访问，布局不能改）
+typedef struct {
+    uint32_t peer;
+    uint32_t reserved;
+    uint64_t bytes;
+} sockmap_relay_entry_t;
+
+static int sockmap_fd = -1;
+static int table_fd = -1;
+static int prog_fd = -1;
+static int slot_count = 0;
+static uint64_t* slot_cookies = NULL;  // 每个槽位两端的 socket cookie，0表示不在转发表中
+static int* free_slots = NULL;
+static int free_count = 0;
+
+#define INSN(c, d, s, o, i) ((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+#define MOV64_REG(d, s) INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV64_IMM(d, i) INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ADD64_IMM(d, i) INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define LDX_MEM(size, d, s, o) INSN(BPF_LDX | BPF_MEM | size, d, s, o, 0)
+#define STX_MEM(size, d, s, o) INSN(BPF_STX | BPF_MEM | size, d, s, o, 0)
+#define STX_XADD(size, d, s, o) INSN(BPF_STX | BPF_XADD | size, d, s, o, 0)
+#define LD_MAP_FD(d, fd) INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), INSN(0, 0, 0, 0, 0)
+#define JEQ_IMM(d, i, o) INSN(BPF_JMP | BPF_JEQ | BPF_K, d, 0, o, i)
+#define JNE_IMM(d, i, o) INSN(BPF_JMP | BPF_JNE | BPF_K, d, 0, o, i)
+#define CALL(f) INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EXIT() INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+static int sys_bpf(int cmd, union bpf_attr* attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int map_create(int type, int key_size, int value_size, int max_entries) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int map_update(int fd, const void* key, const void* value) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uint64_t)(uintptr_t)key;
+    attr.value = (uint64_t)(uintptr_t)value;
+    attr.flags = BPF_ANY;
+    return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int map_lookup(int fd, const void* key, void* value) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uint64_t)(uintptr_t)key;
+    attr.value = (uint64_t)(uintptr_t)value;
+    return sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+static int map_delete(int fd, const void* key) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uint64_t)(uintptr_t)key;
+    return sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+// verdict 程序：按 socket cookie 查转发表，重定向到对端发出，成功后累加字节数；
+// 查不到或对端不在 sockmap 中时放行，数据进入本端接收队列
+static int load_program(void) {
+    struct bpf_insn prog[] = {
+        MOV64_REG(BPF_REG_6, BPF_REG_1),
+        CALL(BPF_FUNC_get_socket_cookie),
+        STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_0, -8),
+        LD_MAP_FD(BPF_REG_1, table_fd),
+        MOV64_REG(BPF_REG_2, BPF_REG_10),
+        ADD64_IMM(BPF_REG_2, -8),
+        CALL(BPF_FUNC_map_lookup_elem),
+        JEQ_IMM(BPF_REG_0, 0, 11),                                  // -> pass
+        MOV64_REG(BPF_REG_7, BPF_REG_0),
+        LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_7, offsetof(sockmap_relay_entry_t, peer)),
+        MOV64_REG(BPF_REG_1, BPF_REG_6),
+        LD_MAP_FD(BPF_REG_2, sockmap_fd),
+        MOV64_IMM(BPF_REG_4, 0),
+        CALL(BPF_FUNC_sk_redirect_map),
+        JNE_IMM(BPF_REG_0, SK_PASS, 3),                             // -> pass
+        LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_6, offsetof(struct __sk_buff, len)),
+        STX_XADD(BPF_DW, BPF_REG_7, BPF_REG_1, offsetof(sockmap_relay_entry_t, bytes)),
+        EXIT(),
+        // pass:
+        MOV64_IMM(BPF_REG_0, SK_PASS),
+        EXIT(),
+    };
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+    attr.expected_attach_type = BPF_SK_SKB_VERDICT;
+    attr.insns = (uint64_t)(uintptr_t)prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+    return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+int sockmap_relay_init(int max_sessions) {
+    if (prog_fd >= 0) {
+        return 0;
+    }
+    if (max_sessions <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    slot_cookies = calloc(max_sessions * 2, sizeof(uint64_t));
+    free_slots = malloc(max_sessions * sizeof(int));
+    if (!slot_cookies || !free_slots) {
+        sockmap_relay_shutdown();
+        errno = ENOMEM;
+        return -1;
+    }
+
+    sockmap_fd = map_create(BPF_MAP_TYPE_SOCKMAP, sizeof(uint32_t), sizeof(uint32_t), max_sessions * 2);
+    table_fd = map_create(BPF_MAP_TYPE_HASH, sizeof(uint64_t), sizeof(sockmap_relay_entry_t), max_sessions * 2);
+    if (sockmap_fd < 0 || table_fd < 0) {
+        int saved = errno;
+        sockmap_relay_shutdown();
+        errno = saved;
+        return -1;
+    }
+
+    prog_fd = load_program();
+    if (prog_fd < 0) {
+        int saved = errno;
+        sockmap_relay_shutdown();
+        errno = saved;
+        return -1;
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.target_fd = sockmap_fd;
+    attr.attach_bpf_fd = prog_fd;
+    attr.attach_type = BPF_SK_SKB_VERDICT;
+    if (sys_bpf(BPF_PROG_ATTACH, &attr) < 0) {
+        int saved = errno;
+        sockmap_relay_shutdown();
+        errno = saved;
+        return -1;
+    }
+
+    slot_count = max_sessions;
+    for (int i = 0; i < max_sessions; i++) {
+        free_slots[i] = max_sessions - 1 - i;
+    }
+    free_count = max_sessions;
+    return 0;
+}
+
+void sockmap_relay_shutdown(void) {
+    if (prog_fd >= 0) {
+        close(prog_fd);
+        prog_fd = -1;
+    }
+    if (sockmap_fd >= 0) {
+        close(sockmap_fd);
+        sockmap_fd = -1;
+    }
+    if (table_fd >= 0) {
+        close(table_fd);
+        table_fd = -1;
+    }
+    free(slot_cookies);
+    free(free_slots);
+    slot_cookies = NULL;
+    free_slots = NULL;
+    slot_count = 0;
+    free_count = 0;
+}
+
+int sockmap_relay_ready(void) {
+    return prog_fd >= 0;
+}
+
+static uint64_t socket_cookie(int fd) {
+    uint64_t cookie = 0;
+    socklen_t len = sizeof(cookie);
+    if (getsockopt(fd, SOL_SOCKET, SO_COOKIE, &cookie, &len) < 0) {
+        return 0;
+    }
+    return cookie;
+}
+
+// 删除一端的转发表项
+static void table_remove(int slot, int side) {
+    uint64_t* cookie = &slot_cookies[slot * 2 + side];
+    if (*cookie) {
+        map_delete(table_fd, cookie);
+        *cookie = 0;
+    }
+}
+
+int sockmap_relay_attach(int client_fd, int target_fd, int* target_in_user) {
+    *target_in_user = 0;
+    if (prog_fd < 0 || free_count == 0) {
+        errno = prog_fd < 0 ? ENODEV : ENOSPC;
+        return -1;
+    }
+
+    int slot = free_slots[--free_count];
+    uint32_t client_key = slot * 2;
+    uint32_t target_key = slot * 2 + 1;
+    uint64_t client_cookie = socket_cookie(client_fd);
+    uint64_t target_cookie = socket_cookie(target_fd);
+    sockmap_relay_entry_t client_entry = { target_key, 0, 0 };
+    sockmap_relay_entry_t target_entry = { client_key, 0, 0 };
+    uint32_t client_value = client_fd;
+    uint32_t target_value = target_fd;
+
+    if (!client_cookie || !target_cookie) {
+        free_slots[free_count++] = slot;
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    // 先写转发表，再放入目标端、最后放入客户端。RDP 由客户端先发起，这时目标端还没有数据；若已有数据
+    // （在放入目标端到放入客户端之间到达，对端不在 sockmap 中而被放行到目标端接收队列），目标到客户端
+    // 方向改由用户态转发，避免与之后重定向的数据乱序
+    slot_cookies[slot * 2] = client_cookie;
+    slot_cookies[slot * 2 + 1] = target_cookie;
+    if (map_update(table_fd, &client_cookie, &client_entry) < 0 ||
+        map_update(table_fd, &target_cookie, &target_entry) < 0 ||
+        map_update(sockmap_fd, &target_key, &target_value) < 0 ||
+        map_update(sockmap_fd, &client_key, &client_value) < 0) {
+        int saved = errno;
+        sockmap_relay_release(slot);
+        errno = saved;
+        return -1;
+    }
+
+    // 放入 sockmap 之前已在接收队列中的数据不会被 verdict 程序处理，要等下一次数据到达才一起重定向，
+    // 而 RDP 客户端发完首包后会一直等回应。重设 SO_RCVLOWAT（设为默认值1）会触发一次 data_ready，
+    // 让程序立即处理这些数据
+    int lowat = 1;
+    setsockopt(target_fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+
+    char byte;
+    if (recv(target_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0) {
+        table_remove(slot, 1);
+        *target_in_user = 1;
+    }
+    return slot;
+}
+
+int sockmap_relay_bytes(int slot, uint64_t* client_bytes, uint64_t* target_bytes) {
+    if (slot < 0 || slot >= slot_count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint64_t* totals[2] = { client_bytes, target_bytes };
+    for (int side = 0; side < 2; side++) {
+        sockmap_relay_entry_t entry;
+        *totals[side] = 0;
+        if (slot_cookies[slot * 2 + side] &&
+            map_lookup(table_fd, &slot_cookies[slot * 2 + side], &entry) == 0) {
+            *totals[side] = entry.bytes;
+        }
+    }
+    return 0;
+}
+
+void sockmap_relay_stop(int slot) {
+    if (slot < 0 || slot >= slot_count) {
+        return;
+    }
+    table_remove(slot, 0);
+    table_remove(slot, 1);
+}
+
+void sockmap_relay_release(int slot) {
+    if (slot < 0 || slot >= slot_count) {
+        return;
+    }
+    sockmap_relay_stop(slot);
+    for (uint32_t key = slot * 2; key < (uint32_t)slot * 2 + 2; key++) {
+        map_delete(sockmap_fd, &key);
+    }
+    free_slots[free_count++] = slot;
+}
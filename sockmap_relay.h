@@ -0,0 +1,32 @@
+#ifndef SOCKMAP_RELAY_H
+#define SOCKMAP_RELAY_H
+
+#include <stdint.h>
+
+// 内核转发：已建立的TCP会话两端放入 BPF sockmap，由挂在 sockmap 上的 sk_skb verdict 程序把一端收到的
+// 数据直接重定向到另一端发出，不再唤醒用户态。
+//   - 每个会话占 sockmap 中相邻的两个位置（客户端、目标端），转发表以 socket cookie 为键，
+//     值为对端位置和已转发的字节数
+//   - socket 不在转发表中或对端已不在 sockmap 中时，数据照常进入本端接收队列，由用户态读取
+// 不依赖 libbpf：程序以指令数组形式直接通过 bpf() 系统调用加载
+
+// 创建 sockmap 和转发表并加载、挂载程序，最多 max_sessions 个会话；失败返回 -1（errno）
+int sockmap_relay_init(int max_sessions);
+void sockmap_relay_shutdown(void);
+int sockmap_relay_ready(void);
+
+// 把会话两端交给内核转发，返回会话槽位；失败返回 -1（errno），两端仍由用户态转发。
+// 目标端在放入后已有待读数据时，该方向继续由用户态转发（*target_in_user 置1）
+int sockmap_relay_attach(int client_fd, int target_fd, int* target_in_user);
+
+// 两个方向在内核中已转发的字节数（客户端到目标、目标到客户端）
+int sockmap_relay_bytes(int slot, uint64_t* client_bytes, uint64_t* target_bytes);
+
+// 停止内核转发：删除两端的转发表项，之后到达的数据进入各自的接收队列由用户态读取。
+// socket 仍留在 sockmap 中（移出会丢弃其中尚未读取的数据），直到释放槽位
+void sockmap_relay_stop(int slot);
+
+// 会话结束：停止转发，把两端移出 sockmap 并回收槽位
+void sockmap_relay_release(int slot);
+
+#endif // SOCKMAP_RELAY_H
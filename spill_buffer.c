@@ -0,0 +1,245 @@
+#include "spill_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+// 全局限制
+static size_t session_mem_limit = 1024 * 1024;
+static size_t global_mem_limit = 64 * 1024 * 1024;
+static size_t session_file_limit = 0;
+static char spill_dir[256] = "";
+
+// 所有会话已分配的内存块总大小
+static size_t global_mem_in_use = 0;
+
+void spill_set_limits(size_t session_mem, size_t global_mem, size_t session_file, const char* dir) {
+    session_mem_limit = session_mem;
+    global_mem_limit = global_mem;
+    session_file_limit = session_file;
+    if (dir) {
+        strncpy(spill_dir, dir, sizeof(spill_dir) - 1);
+        spill_dir[sizeof(spill_dir) - 1] = '\0';
+    } else {
+        spill_dir[0] = '\0';
+    }
+}
+
+size_t spill_memory_in_use(void) {
+    return global_mem_in_use;
+}
+
+void spill_init(spill_buffer_t* sb) {
+    memset(sb, 0, sizeof(*sb));
+    sb->file_fd = -1;
+}
+
+void spill_release(spill_buffer_t* sb) {
+    if (!sb) {
+        return;
+    }
+
+    spill_chunk_t* chunk = sb->head;
+    while (chunk) {
+        spill_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    global_mem_in_use -= sb->mem_reserved;
+
+    if (sb->file_map) {
+        munmap(sb->file_map, sb->file_size);
+    }
+    if (sb->file_fd >= 0) {
+        close(sb->file_fd);
+    }
+
+    spill_init(sb);
+}
+
+size_t spill_pending(const spill_buffer_t* sb) {
+    return sb->mem_bytes + (sb->file_tail - sb->file_head);
+}
+
+// 文件部分是否启用
+static int spill_file_enabled(void) {
+    return session_file_limit > 0 && spill_dir[0] != '\0';
+}
+
+// 内存部分还能接受的字节数
+static size_t spill_mem_space(const spill_buffer_t* sb) {
+    size_t space = 0;
+    if (sb->tail) {
+        space = SPILL_CHUNK_SIZE - sb->tail->end;
+    }
+
+    size_t session_room = session_mem_limit > sb->mem_reserved ? session_mem_limit - sb->mem_reserved : 0;
+    size_t global_room = global_mem_limit > global_mem_in_use ? global_mem_limit - global_mem_in_use : 0;
+    size_t room = session_room < global_room ? session_room : global_room;
+
+    return space + (room / SPILL_CHUNK_SIZE) * SPILL_CHUNK_SIZE;
+}
+
+size_t spill_space(const spill_buffer_t* sb) {
+    size_t file_space = spill_file_enabled() ? session_file_limit - sb->file_tail : 0;
+
+    // 文件中还有数据时新数据只能追加到文件，保证回放顺序
+    if (sb->file_tail > sb->file_head) {
+        return file_space;
+    }
+    return spill_mem_space(sb) + file_space;
+}
+
+// 按需创建 mmap 临时文件
+static int spill_open_file(spill_buffer_t* sb) {
+    if (sb->file_map) {
+        return 0;
+    }
+
+    char path[300];
+    snprintf(path, sizeof(path), "%s/rdp_spill.XXXXXX", spill_dir);
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+
+    if (ftruncate(fd, session_file_limit) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    char* map = mmap(NULL, session_file_limit, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    sb->file_fd = fd;
+    sb->file_map = map;
+    sb->file_size = session_file_limit;
+    sb->file_head = 0;
+    sb->file_tail = 0;
+    return 0;
+}
+
+size_t spill_append(spill_buffer_t* sb, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    size_t accepted = 0;
+
+    // 优先写入内存（文件中无积压时）
+    if (sb->file_tail == sb->file_head) {
+        while (accepted < size) {
+            if (!sb->tail || sb->tail->end == SPILL_CHUNK_SIZE) {
+                if (sb->mem_reserved + SPILL_CHUNK_SIZE > session_mem_limit ||
+                    global_mem_in_use + SPILL_CHUNK_SIZE > global_mem_limit) {
+                    break;
+                }
+
+                spill_chunk_t* chunk = malloc(sizeof(spill_chunk_t));
+                if (!chunk) {
+                    break;
+                }
+                chunk->next = NULL;
+                chunk->start = 0;
+                chunk->end = 0;
+
+                if (sb->tail) {
+                    sb->tail->next = chunk;
+                } else {
+                    sb->head = chunk;
+                }
+                sb->tail = chunk;
+                sb->mem_reserved += SPILL_CHUNK_SIZE;
+                global_mem_in_use += SPILL_CHUNK_SIZE;
+            }
+
+            size_t copy = SPILL_CHUNK_SIZE - sb->tail->end;
+            if (copy > size - accepted) {
+                copy = size - accepted;
+            }
+            memcpy(sb->tail->data + sb->tail->end, bytes + accepted, copy);
+            sb->tail->end += copy;
+            sb->mem_bytes += copy;
+            accepted += copy;
+        }
+    }
+
+    // 内存写满后溢出到文件
+    if (accepted < size && spill_file_enabled() && spill_open_file(sb) == 0) {
+        size_t copy = sb->file_size - sb->file_tail;
+        if (copy > size - accepted) {
+            copy = size - accepted;
+        }
+        memcpy(sb->file_map + sb->file_tail, bytes + accepted, copy);
+        sb->file_tail += copy;
+        accepted += copy;
+    }
+
+    return accepted;
+}
+
+ssize_t spill_flush(spill_buffer_t* sb, int fd) {
+    ssize_t total = 0;
+
+    // 先回放内存中的数据
+    while (sb->head) {
+        spill_chunk_t* chunk = sb->head;
+        if (chunk->start < chunk->end) {
+            ssize_t sent = send(fd, chunk->data + chunk->start, chunk->end - chunk->start,
+                                MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return total;
+                }
+                return -1;
+            }
+            chunk->start += sent;
+            sb->mem_bytes -= sent;
+            total += sent;
+            if (chunk->start < chunk->end) {
+                continue;
+            }
+        }
+
+        // 当前块已发完；尾块保留以便继续追加
+        if (chunk == sb->tail && chunk->end < SPILL_CHUNK_SIZE) {
+            chunk->start = 0;
+            chunk->end = 0;
+            break;
+        }
+        sb->head = chunk->next;
+        if (!sb->head) {
+            sb->tail = NULL;
+        }
+        free(chunk);
+        sb->mem_reserved -= SPILL_CHUNK_SIZE;
+        global_mem_in_use -= SPILL_CHUNK_SIZE;
+    }
+
+    // 再回放文件中的数据
+    while (sb->file_head < sb->file_tail) {
+        ssize_t sent = send(fd, sb->file_map + sb->file_head, sb->file_tail - sb->file_head,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return total;
+            }
+            return -1;
+        }
+        sb->file_head += sent;
+        total += sent;
+    }
+
+    // 文件已清空，从头复用
+    if (sb->file_map) {
+        sb->file_head = 0;
+        sb->file_tail = 0;
+    }
+
+    return total;
+}
@@ -0,0 +1,53 @@
+#ifndef SPILL_BUFFER_H
+#define SPILL_BUFFER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// 快速重连挂起期间，目标端发往客户端的数据先暂存在这里：
+// 先使用内存块，超出内存上限后写入可选的 mmap 临时文件，客户端恢复后按顺序回放
+
+#define SPILL_CHUNK_SIZE 16384          // 单个内存块大小
+
+typedef struct spill_chunk {
+    struct spill_chunk* next;
+    size_t start;                       // 已发送到的位置
+    size_t end;                         // 已写入到的位置
+    char data[SPILL_CHUNK_SIZE];
+} spill_chunk_t;
+
+typedef struct {
+    // 内存部分（先进先出）
+    spill_chunk_t* head;
+    spill_chunk_t* tail;
+    size_t mem_bytes;                   // 内存中待发送字节数
+    size_t mem_reserved;                // 已分配的内存块总大小（计入全局计数）
+
+    // 文件部分（内存写满后使用，顺序追加）
+    int file_fd;
+    char* file_map;
+    size_t file_size;
+    size_t file_head;                   // 读位置
+    size_t file_tail;                   // 写位置
+} spill_buffer_t;
+
+// 全局限制：每会话内存上限、全局内存上限、每会话文件上限和文件目录（为空表示不使用文件）
+void spill_set_limits(size_t session_mem_limit, size_t global_mem_limit,
+                      size_t session_file_limit, const char* spill_dir);
+
+void spill_init(spill_buffer_t* sb);
+void spill_release(spill_buffer_t* sb);
+
+// 追加数据，返回实际接受的字节数（缓冲区满时小于 size）
+size_t spill_append(spill_buffer_t* sb, const void* data, size_t size);
+
+// 将暂存数据按顺序写入 fd，直到清空或 EAGAIN；返回发送字节数，出错返回 -1
+ssize_t spill_flush(spill_buffer_t* sb, int fd);
+
+size_t spill_pending(const spill_buffer_t* sb);
+size_t spill_space(const spill_buffer_t* sb);
+
+// 所有会话暂存缓冲区占用的内存字节数
+size_t spill_memory_in_use(void);
+
+#endif // SPILL_BUFFER_H
@@ -0,0 +1,90 @@
+#!/bin/bash
+
+# 热升级交接测试脚本：会话在交接前后保持连接
+
+echo "=== RDP Forwarder 热升级交接测试 ==="
+
+# 检查程序是否存在
+if [ ! -f "./rdp_forwarder" ]; then
+    echo "错误: rdp_forwarder 程序不存在，请先编译"
+    exit 1
+fi
+
+# 创建测试配置文件
+cat > test_handover.conf << EOF
+# 热升级测试配置
+target_ip=127.0.0.1
+target_port=3392
+listen_port=3391
+listen_interface=127.0.0.1
+control_socket=/tmp/rdp_forwarder_test.sock
+transport_mode=tcp
+EOF
+
+# 本地回显目标
+python3 -c "
+import socket, threading
+s = socket.socket(); s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(('127.0.0.1', 3392)); s.listen(16)
+def echo(c):
+    while True:
+        d = c.recv(65536)
+        if not d: break
+        c.sendall(d)
+while True:
+    c, _ = s.accept(); threading.Thread(target=echo, args=(c,), daemon=True).start()
+" &
+TARGET_PID=$!
+sleep 0.5
+
+echo "=== 启动旧进程 ==="
+./rdp_forwarder -c test_handover.conf > test_handover_old.log 2>&1 &
+OLD_PID=$!
+sleep 1
+
+echo "=== 建立会话并在会话中途交接 ==="
+python3 -c "
+import socket, subprocess, time, sys
+def roundtrip(c, msg):
+    c.sendall(msg); got = b''
+    while len(got) < len(msg):
+        d = c.recv(4096)
+        if not d: raise SystemExit('会话在交接后断开')
+        got += d
+    if got != msg: raise SystemExit('数据不一致')
+c = socket.create_connection(('127.0.0.1', 3391))
+roundtrip(c, b'before handover\n')
+new = subprocess.Popen(['./rdp_forwarder', '-c', 'test_handover.conf', '--takeover'],
+                       stdout=open('test_handover_new.log', 'w'), stderr=subprocess.STDOUT)
+open('test_handover.pid', 'w').write(str(new.pid))
+time.sleep(1)
+for i in range(100):
+    roundtrip(c, b'after handover %d\n' % i)
+print('✓ 已有会话在交接后继续转发')
+d = socket.create_connection(('127.0.0.1', 3391))
+roundtrip(d, b'new session\n')
+print('✓ 新进程接受新连接')
+"
+RESULT=$?
+NEW_PID=$(cat test_handover.pid 2>/dev/null)
+
+sleep 1
+if ps -p $OLD_PID > /dev/null; then
+    echo "✗ 旧进程未退出"
+    RESULT=1
+else
+    echo "✓ 旧进程已退出"
+fi
+
+echo ""
+echo "=== 清理 ==="
+kill $NEW_PID $OLD_PID $TARGET_PID 2>/dev/null
+wait 2>/dev/null
+rm -f test_handover.conf test_handover.pid test_handover_old.log test_handover_new.log
+
+if [ $RESULT -eq 0 ]; then
+    echo "✓ 测试完成"
+else
+    echo "✗ 测试失败"
+fi
+exit $RESULT
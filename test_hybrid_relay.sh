@@ -0,0 +1,96 @@
+#!/bin/bash
+
+# 混合传输中继测试脚本：入口转发器经混合传输连接出口转发器，出口转发器连接RDP主机
+
+echo "=== RDP Forwarder 混合传输中继测试 ==="
+
+# 检查程序是否存在
+if [ ! -f "./rdp_forwarder" ]; then
+    echo "错误: rdp_forwarder 程序不存在，请先编译"
+    exit 1
+fi
+
+# 出口中继：接受混合传输对端，转发到本地回显目标
+cat > test_relay_exit.conf << EOF
+target_ip=127.0.0.1
+target_port=3395
+listen_port=3394
+listen_interface=127.0.0.1
+ht_listen_port=3396
+transport_mode=tcp
+EOF
+
+# 入口：客户端连接3393，经混合传输发往出口中继（HT_LOCAL_ADDRS=127.0.0.1,127.0.0.2 测试多路径）
+cat > test_relay_entry.conf << EOF
+target_ip=127.0.0.1
+target_port=3395
+listen_port=3393
+listen_interface=127.0.0.1
+transport_mode=${TRANSPORT_MODE:-hybrid}
+ht_exit_ip=127.0.0.1
+ht_exit_port=3396
+ht_local_addrs=${HT_LOCAL_ADDRS:-}
+EOF
+
+# 本地回显目标
+python3 -c "
+import socket, threading
+s = socket.socket(); s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(('127.0.0.1', 3395)); s.listen(16)
+def echo(c):
+    while True:
+        d = c.recv(65536)
+        if not d: break
+        c.sendall(d)
+while True:
+    c, _ = s.accept(); threading.Thread(target=echo, args=(c,), daemon=True).start()
+" &
+TARGET_PID=$!
+sleep 0.5
+
+./rdp_forwarder -c test_relay_exit.conf > test_relay_exit.log 2>&1 &
+EXIT_PID=$!
+./rdp_forwarder -c test_relay_entry.conf > test_relay_entry.log 2>&1 &
+ENTRY_PID=$!
+sleep 1
+
+echo "=== 经中继收发数据 ==="
+python3 -c "
+import socket, os
+def roundtrip(c, msg):
+    c.sendall(msg); got = b''
+    while len(got) < len(msg):
+        d = c.recv(65536)
+        if not d: raise SystemExit('中继会话意外断开')
+        got += d
+    if got != msg: raise SystemExit('数据不一致')
+c = socket.create_connection(('127.0.0.1', 3393)); c.settimeout(10)
+for i in range(100):
+    roundtrip(c, b'input event %d\n' % i)
+print('✓ 小包往返正常')
+roundtrip(c, os.urandom(1024 * 1024))
+print('✓ 1MB 数据完整送达')
+d = socket.create_connection(('127.0.0.1', 3393)); d.settimeout(10)
+roundtrip(d, b'second session\n')
+roundtrip(c, b'first session still alive\n')
+print('✓ 多个会话共用出口中继端口')
+"
+RESULT=$?
+
+if ! grep -q "New relay session" test_relay_exit.log; then
+    echo "✗ 出口中继未经混合传输接受会话"
+    RESULT=1
+fi
+
+echo ""
+echo "=== 清理 ==="
+kill $ENTRY_PID $EXIT_PID $TARGET_PID 2>/dev/null
+wait 2>/dev/null
+rm -f test_relay_exit.conf test_relay_entry.conf test_relay_exit.log test_relay_entry.log
+
+if [ $RESULT -eq 0 ]; then
+    echo "✓ 测试完成"
+else
+    echo "✗ 测试失败"
+fi
+exit $RESULT
@@ -0,0 +1,85 @@
+#!/bin/bash
+
+# RDP UDP 传输转发测试：UDP流归属到同一客户端的TCP会话，空闲超时和会话结束后关闭
+
+echo "=== RDP Forwarder UDP 传输转发测试 ==="
+
+# 检查程序是否存在
+if [ ! -f "./rdp_forwarder" ]; then
+    echo "错误: rdp_forwarder 程序不存在，请先编译"
+    exit 1
+fi
+
+# 创建测试配置文件
+cat > test_udp_relay.conf << EOF2
+# UDP 传输转发测试配置
+target_ip=127.0.0.1
+target_port=3394
+listen_port=3393
+transport_mode=tcp
+udp_relay=1
+udp_flow_timeout=2
+EOF2
+
+# 本地目标：TCP回显，UDP回显时加前缀
+python3 -c "
+import socket, threading
+s = socket.socket(); s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(('127.0.0.1', 3394)); s.listen(16)
+def echo(c):
+    while True:
+        d = c.recv(65536)
+        if not d: break
+        c.sendall(d)
+def tcp():
+    while True:
+        c, _ = s.accept(); threading.Thread(target=echo, args=(c,), daemon=True).start()
+threading.Thread(target=tcp, daemon=True).start()
+u = socket.socket(socket.AF_INET, socket.SOCK_DGRAM); u.bind(('127.0.0.1', 3394))
+while True:
+    d, a = u.recvfrom(4096); u.sendto(b'E' + d, a)
+" &
+TARGET_PID=$!
+sleep 0.5
+
+./rdp_forwarder -c test_udp_relay.conf > test_udp_relay.log 2>&1 &
+FORWARDER_PID=$!
+sleep 1
+
+python3 -c "
+import socket, time
+u = socket.socket(socket.AF_INET, socket.SOCK_DGRAM); u.settimeout(0.5)
+def udp_roundtrip(msg):
+    u.sendto(msg, ('127.0.0.1', 3393))
+    try:
+        return u.recvfrom(4096)[0] == b'E' + msg
+    except socket.timeout:
+        return False
+if udp_roundtrip(b'no session'): raise SystemExit('✗ 没有TCP会话的UDP数据报被转发')
+print('✓ 没有TCP会话时丢弃UDP数据报')
+t = socket.create_connection(('127.0.0.1', 3393))
+t.sendall(b'hello'); t.recv(16)
+for i in range(100):
+    if not udp_roundtrip(b'datagram %d' % i): raise SystemExit('✗ UDP数据报 %d 未转发' % i)
+print('✓ UDP流随TCP会话转发')
+time.sleep(3.5)
+if not udp_roundtrip(b'after idle'): raise SystemExit('✗ 空闲超时后未重新建立UDP流')
+print('✓ 空闲超时后重新建立UDP流')
+t.close(); time.sleep(0.5)
+if udp_roundtrip(b'after close'): raise SystemExit('✗ TCP会话结束后UDP流仍在转发')
+print('✓ TCP会话结束后关闭UDP流')
+"
+RESULT=$?
+
+echo ""
+echo "=== 清理 ==="
+kill $FORWARDER_PID $TARGET_PID 2>/dev/null
+wait 2>/dev/null
+rm -f test_udp_relay.conf test_udp_relay.log
+
+if [ $RESULT -eq 0 ]; then
+    echo "✓ 测试完成"
+else
+    echo "✗ 测试失败"
+fi
+exit $RESULT
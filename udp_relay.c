@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+#include "udp_relay.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+// 批量收发缓冲区（只在事件循环线程使用，所有转发器共用）
+static struct mmsghdr batch_msgs[UDP_RELAY_BATCH];
+static struct iovec batch_iovs[UDP_RELAY_BATCH];
+static struct sockaddr_in batch_addrs[UDP_RELAY_BATCH];
+static int batch_flows[UDP_RELAY_BATCH];        // 每个数据报所属的流，-1表示丢弃
+static char batch_control[UDP_RELAY_BATCH][CMSG_SPACE(sizeof(struct in_pktinfo))];
+static uint8_t batch_buffers[UDP_RELAY_BATCH][UDP_RELAY_DGRAM_MAX];
+
+static unsigned int flow_hash(const struct sockaddr_in* client, struct in_addr local) {
+    uint64_t key = ((uint64_t)client->sin_addr.s_addr << 16) ^ client->sin_port ^
+                   ((uint64_t)local.s_addr << 32);
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (unsigned int)(key >> 32);
+}
+
+static int flow_find(udp_relay_t* relay, const struct sockaddr_in* client, struct in_addr local) {
+    int index = relay->buckets[flow_hash(client, local) & relay->bucket_mask];
+    while (index >= 0) {
+        udp_relay_flow_t* flow = &relay->flows[index];
+        if (flow->client.sin_addr.s_addr == client->sin_addr.s_addr &&
+            flow->client.sin_port == client->sin_port &&
+            flow->local.s_addr == local.s_addr) {
+            return index;
+        }
+        index = flow->next;
+    }
+    return -1;
+}
+
+// 新流：确认归属的TCP会话后创建连接到目标的 socket；失败返回 -1，数据报丢弃
+static int flow_open(udp_relay_t* relay, const struct sockaddr_in* client, struct in_addr local, time_t now) {
+    if (relay->free_head < 0) {
+        return -1;
+    }
+
+    unsigned long owner;
+    struct sockaddr_in target;
+    if (relay->owner_fn(client, &owner, &target) < 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&target, sizeof(target)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    int index = relay->free_head;
+    udp_relay_flow_t* flow = &relay->flows[index];
+    relay->free_head = flow->next;
+
+    memset(flow, 0, sizeof(*flow));
+    flow->client = *client;
+    flow->local = local;
+    flow->fd = fd;
+    flow->owner = owner;
+    flow->last_active = now;
+
+    unsigned int bucket = flow_hash(client, local) & relay->bucket_mask;
+    flow->next = relay->buckets[bucket];
+    relay->buckets[bucket] = index;
+    relay->flow_count++;
+    return index;
+}
+
+static void flow_close(udp_relay_t* relay, int index) {
+    udp_relay_flow_t* flow = &relay->flows[index];
+    int* link = &relay->buckets[flow_hash(&flow->client, flow->local) & relay->bucket_mask];
+    while (*link != index) {
+        link = &relay->flows[*link].next;
+    }
+    *link = flow->next;
+
+    close(flow->fd);
+    flow->fd = -1;
+    flow->next = relay->free_head;
+    relay->free_head = index;
+    relay->flow_count--;
+}
+
+udp_relay_t* udp_relay_create(int port, int max_flows, int idle_timeout,
+                              udp_relay_owner_fn owner_fn, udp_relay_account_fn account_fn) {
+    if (max_flows <= 0 || !owner_fn || !account_fn) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    udp_relay_t* relay = calloc(1, sizeof(udp_relay_t));
+    if (!relay) {
+        return NULL;
+    }
+    relay->fd = -1;
+    relay->idle_timeout = idle_timeout;
+    relay->owner_fn = owner_fn;
+    relay->account_fn = account_fn;
+    relay->max_flows = max_flows;
+
+    int buckets = 1;
+    while (buckets < max_flows * 2) {
+        buckets <<= 1;
+    }
+    relay->bucket_mask = buckets - 1;
+    relay->flows = calloc(max_flows, sizeof(udp_relay_flow_t));
+    relay->buckets = malloc(buckets * sizeof(int));
+    relay->dirty = malloc(max_flows * sizeof(int));
+    if (!relay->flows || !relay->buckets || !relay->dirty) {
+        udp_relay_destroy(relay);
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (int i = 0; i < buckets; i++) {
+        relay->buckets[i] = -1;
+    }
+    for (int i = 0; i < max_flows; i++) {
+        relay->flows[i].fd = -1;
+        relay->flows[i].next = i + 1 < max_flows ? i + 1 : -1;
+    }
+    relay->free_head = 0;
+
+    relay->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (relay->fd < 0) {
+        int saved = errno;
+        udp_relay_destroy(relay);
+        errno = saved;
+        return NULL;
+    }
+
+    // 监听所有本机地址时，回包需要从客户端发往的地址发出
+    int opt = 1;
+    setsockopt(relay->fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(relay->fd, IPPROTO_IP, IP_PKTINFO, &opt, sizeof(opt));
+    int sockbuf = UDP_RELAY_SOCKBUF;
+    setsockopt(relay->fd, SOL_SOCKET, SO_RCVBUF, &sockbuf, sizeof(sockbuf));
+    setsockopt(relay->fd, SOL_SOCKET, SO_SNDBUF, &sockbuf, sizeof(sockbuf));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(relay->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        int saved = errno;
+        udp_relay_destroy(relay);
+        errno = saved;
+        return NULL;
+    }
+    return relay;
+}
+
+void udp_relay_destroy(udp_relay_t* relay) {
+    if (!relay) {
+        return;
+    }
+    if (relay->flows) {
+        for (int i = 0; i < relay->max_flows; i++) {
+            if (relay->flows[i].fd >= 0) {
+                close(relay->flows[i].fd);
+            }
+        }
+    }
+    if (relay->fd >= 0) {
+        close(relay->fd);
+    }
+    free(relay->flows);
+    free(relay->buckets);
+    free(relay->dirty);
+    free(relay);
+}
+
+int udp_relay_fd_set(udp_relay_t* relay, fd_set* readfds) {
+    int max_fd = relay->fd;
+    FD_SET(relay->fd, readfds);
+    for (int i = 0; i < relay->max_flows; i++) {
+        if (relay->flows[i].fd >= 0) {
+            FD_SET(relay->flows[i].fd, readfds);
+            max_fd = relay->flows[i].fd > max_fd ? relay->flows[i].fd : max_fd;
+        }
+    }
+    return max_fd;
+}
+
+// 准备接收 [start, start + count) 的数据报；从监听socket接收时需要来源地址和目的地址
+static void batch_prepare_recv(int start, int count, int from_listener) {
+    for (int i = start; i < start + count; i++) {
+        struct msghdr* hdr = &batch_msgs[i].msg_hdr;
+        batch_iovs[i].iov_base = batch_buffers[i];
+        batch_iovs[i].iov_len = UDP_RELAY_DGRAM_MAX;
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_iov = &batch_iovs[i];
+        hdr->msg_iovlen = 1;
+        if (from_listener) {
+            hdr->msg_name = &batch_addrs[i];
+            hdr->msg_namelen = sizeof(batch_addrs[i]);
+            hdr->msg_control = batch_control[i];
+            hdr->msg_controllen = sizeof(batch_control[i]);
+        }
+        batch_msgs[i].msg_len = 0;
+    }
+}
+
+// 客户端发往的本机地址；没有 IP_PKTINFO 时为 0（由内核选择回包地址）
+static struct in_addr packet_local(struct msghdr* hdr) {
+    struct in_addr local = { 0 };
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo info;
+            memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+            local = info.ipi_addr;
+        }
+    }
+    return local;
+}
+
+static void account(udp_relay_t* relay, int index, int dir, size_t bytes) {
+    udp_relay_flow_t* flow = &relay->flows[index];
+    if (bytes > 0 && flow->pending[0] == 0 && flow->pending[1] == 0) {
+        relay->dirty[relay->dirty_count++] = index;
+    }
+    flow->pending[dir] += bytes;
+    relay->datagrams[dir]++;
+}
+
+// 发出 [start, end) 的数据报，发送缓冲区满时丢弃剩余部分（UDP 由 RDP 自行恢复）
+static void send_run(udp_relay_t* relay, int fd, int start, int end, int dir) {
+    int done = start;
+    while (done < end) {
+        int sent = sendmmsg(fd, &batch_msgs[done], end - done, MSG_DONTWAIT);
+        if (sent <= 0) {
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+                relay->dropped += end - done;
+                return;
+            }
+            // 这一个数据报发不出（如目标端口不可达的 ICMP 错误），跳过继续发送后面的
+            relay->dropped++;
+            done++;
+            continue;
+        }
+        for (int i = done; i < done + sent; i++) {
+            account(relay, batch_flows[i], dir, batch_msgs[i].msg_len);
+        }
+        done += sent;
+    }
+}
+
+// 发出 [0, count) 中未丢弃的数据报：客户端到目标方向同一个流的连续数据报合并为一次 sendmmsg，
+// 目标到客户端方向都从监听socket发出，不分流
+static void send_batch(udp_relay_t* relay, int count, int dir) {
+    int i = 0;
+    while (i < count) {
+        if (batch_flows[i] < 0) {
+            i++;
+            continue;
+        }
+        int j = i + 1;
+        while (j < count && batch_flows[j] >= 0 && (dir == 1 || batch_flows[j] == batch_flows[i])) {
+            j++;
+        }
+        send_run(relay, dir == 0 ? relay->flows[batch_flows[i]].fd : relay->fd, i, j, dir);
+        i = j;
+    }
+}
+
+// 监听socket上的一批客户端数据报转发到各流的目标；返回本批收到的数据报数
+static int relay_from_clients(udp_relay_t* relay, time_t now) {
+    batch_prepare_recv(0, UDP_RELAY_BATCH, 1);
+    int count = recvmmsg(relay->fd, batch_msgs, UDP_RELAY_BATCH, MSG_DONTWAIT, NULL);
+    if (count <= 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct msghdr* hdr = &batch_msgs[i].msg_hdr;
+        batch_flows[i] = -1;
+        if (hdr->msg_flags & MSG_TRUNC) {
+            relay->dropped++;
+            continue;
+        }
+
+        struct in_addr local = packet_local(hdr);
+        int flow = flow_find(relay, &batch_addrs[i], local);
+        if (flow < 0) {
+            flow = flow_open(relay, &batch_addrs[i], local, now);
+        }
+        if (flow < 0) {
+            relay->dropped++;
+            continue;
+        }
+        relay->flows[flow].last_active = now;
+        batch_flows[i] = flow;
+
+        // 已连接的 socket 发送时不需要地址
+        batch_iovs[i].iov_len = batch_msgs[i].msg_len;
+        hdr->msg_name = NULL;
+        hdr->msg_namelen = 0;
+        hdr->msg_control = NULL;
+        hdr->msg_controllen = 0;
+    }
+
+    send_batch(relay, count, 0);
+    return count;
+}
+
+// 可读的流 socket 上的目标回包汇总后从监听socket发回客户端，每个流每轮最多读一批
+static void relay_from_targets(udp_relay_t* relay, fd_set* readfds, time_t now) {
+    int count = 0;
+    for (int f = 0; f < relay->max_flows; f++) {
+        udp_relay_flow_t* flow = &relay->flows[f];
+        if (flow->fd < 0 || !FD_ISSET(flow->fd, readfds)) {
+            continue;
+        }
+        if (count == UDP_RELAY_BATCH) {
+            send_batch(relay, count, 1);
+            count = 0;
+        }
+
+        batch_prepare_recv(count, UDP_RELAY_BATCH - count, 0);
+        int received = recvmmsg(flow->fd, &batch_msgs[count], UDP_RELAY_BATCH - count, MSG_DONTWAIT, NULL);
+        if (received <= 0) {
+            continue;
+        }
+        flow->last_active = now;
+
+        for (int i = count; i < count + received; i++) {
+            struct msghdr* hdr = &batch_msgs[i].msg_hdr;
+            if (hdr->msg_flags & MSG_TRUNC) {
+                batch_flows[i] = -1;
+                relay->dropped++;
+                continue;
+            }
+            batch_flows[i] = f;
+            batch_iovs[i].iov_len = batch_msgs[i].msg_len;
+            hdr->msg_name = &flow->client;
+            hdr->msg_namelen = sizeof(flow->client);
+            if (flow->local.s_addr) {
+                hdr->msg_control = batch_control[i];
+                hdr->msg_controllen = sizeof(batch_control[i]);
+                memset(batch_control[i], 0, sizeof(batch_control[i]));
+                struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr);
+                cmsg->cmsg_level = IPPROTO_IP;
+                cmsg->cmsg_type = IP_PKTINFO;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+                struct in_pktinfo info;
+                memset(&info, 0, sizeof(info));
+                info.ipi_spec_dst = flow->local;
+                memcpy(CMSG_DATA(cmsg), &info, sizeof(info));
+            }
+        }
+        count += received;
+    }
+
+    if (count > 0) {
+        send_batch(relay, count, 1);
+    }
+}
+
+void udp_relay_process(udp_relay_t* relay, fd_set* readfds) {
+    time_t now = time(NULL);
+
+    if (FD_ISSET(relay->fd, readfds)) {
+        for (int round = 0; round < UDP_RELAY_LISTEN_BATCHES; round++) {
+            if (relay_from_clients(relay, now) < UDP_RELAY_BATCH) {
+                break;
+            }
+        }
+    }
+    relay_from_targets(relay, readfds, now);
+
+    // 按流汇总后计入所属会话
+    for (int i = 0; i < relay->dirty_count; i++) {
+        udp_relay_flow_t* flow = &relay->flows[relay->dirty[i]];
+        relay->account_fn(flow->owner, flow->pending[0], flow->pending[1]);
+        flow->pending[0] = 0;
+        flow->pending[1] = 0;
+    }
+    relay->dirty_count = 0;
+}
+
+int udp_relay_next_timeout(udp_relay_t* relay, time_t now) {
+    int timeout = -1;
+    for (int i = 0; i < relay->max_flows; i++) {
+        if (relay->flows[i].fd < 0) {
+            continue;
+        }
+        long remaining = (long)(relay->flows[i].last_active + relay->idle_timeout - now) * 1000;
+        if (remaining < 0) {
+            remaining = 0;
+        }
+        if (timeout < 0 || remaining < timeout) {
+            timeout = (int)remaining;
+        }
+    }
+    return timeout;
+}
+
+void udp_relay_expire(udp_relay_t* relay, time_t now) {
+    for (int i = 0; i < relay->max_flows; i++) {
+        if (relay->flows[i].fd >= 0 && now - relay->flows[i].last_active >= relay->idle_timeout) {
+            flow_close(relay, i);
+        }
+    }
+}
+
+void udp_relay_close_owner(udp_relay_t* relay, unsigned long owner) {
+    for (int i = 0; i < relay->max_flows; i++) {
+        if (relay->flows[i].fd >= 0 && relay->flows[i].owner == owner) {
+            flow_close(relay, i);
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef UDP_RELAY_H
+#define UDP_RELAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+
+// RDP UDP 传输（MS-RDPEUDP）转发：客户端在TCP会话之外向同一端口发起UDP流，
+// 每个流（客户端地址、端口和客户端发往的本机地址）对应一个连接到目标的UDP socket。
+//   - 客户端到目标：监听socket上 recvmmsg 批量收包，按流分组后对各流的 socket 用 sendmmsg 发出
+//   - 目标到客户端：各流 socket 上 recvmmsg 收包，汇总后在监听socket上用一次 sendmmsg 发回，
+//     回包经 IP_PKTINFO 从客户端发往的本机地址发出
+//   - 新流必须属于一个已建立的TCP会话（由调用方按客户端地址判断），随会话结束或空闲超时关闭
+
+#define UDP_RELAY_BATCH 32              // recvmmsg/sendmmsg 每次最多处理的数据报数
+#define UDP_RELAY_DGRAM_MAX 2048        // 单个数据报上限（RDP-UDP 不超过 1232 字节），超出的丢弃
+#define UDP_RELAY_SOCKBUF (1024 * 1024)  // 监听socket收发缓冲区，容纳所有流的突发图形数据
+#define UDP_RELAY_LISTEN_BATCHES 4      // 每次处理监听socket最多读取的批数，防止持续收包拖慢其他会话
+
+// 新流的归属：按客户端地址找到对应的TCP会话，给出会话编号和UDP目标地址；返回0接受，-1丢弃
+typedef int (*udp_relay_owner_fn)(const struct sockaddr_in* client, unsigned long* owner,
+                                  struct sockaddr_in* target);
+
+// 一轮处理后按流汇总的转发字节数
+typedef void (*udp_relay_account_fn)(unsigned long owner, size_t to_target, size_t to_client);
+
+typedef struct {
+    struct sockaddr_in client;      // 客户端地址和端口
+    struct in_addr local;           // 客户端发往的本机地址，回包从同一地址发出
+    int fd;                         // 连接到目标的UDP socket，-1表示空闲
+    int next;                       // 同一哈希桶中的下一个流（空闲时为空闲链表）
+    unsigned long owner;            // 所属TCP会话编号
+    time_t last_active;
+    size_t pending[2];              // 本轮尚未汇总的字节数：0 客户端到目标，1 目标到客户端
+} udp_relay_flow_t;
+
+typedef struct {
+    int fd;                         // 监听socket
+    int idle_timeout;               // 流空闲超时(秒)
+    udp_relay_flow_t* flows;
+    int max_flows;
+    int flow_count;
+    int free_head;
+    int* buckets;                   // 哈希桶 -> 第一个流，-1表示空
+    int bucket_mask;
+    udp_relay_owner_fn owner_fn;
+    udp_relay_account_fn account_fn;
+    int* dirty;                     // 本轮有待汇总字节数的流
+    int dirty_count;
+    uint64_t datagrams[2];          // 已转发的数据报数（方向同 pending）
+    uint64_t dropped;               // 超长、无归属会话、流表已满或发送失败丢弃的数据报数
+} udp_relay_t;
+
+// 在 port 上监听（所有本机地址），最多 max_flows 个流；失败返回 NULL（errno）
+udp_relay_t* udp_relay_create(int port, int max_flows, int idle_timeout,
+                              udp_relay_owner_fn owner_fn, udp_relay_account_fn account_fn);
+void udp_relay_destroy(udp_relay_t* relay);
+
+// 把监听socket和各流的 socket 加入 readfds，返回其中最大的 fd
+int udp_relay_fd_set(udp_relay_t* relay, fd_set* readfds);
+
+// 处理 readfds 中可读的 socket，转发后按流汇总字节数
+void udp_relay_process(udp_relay_t* relay, fd_set* readfds);
+
+// 距最早一个流空闲超时的毫秒数，没有流时返回 -1；到期的流由 udp_relay_expire 关闭
+int udp_relay_next_timeout(udp_relay_t* relay, time_t now);
+void udp_relay_expire(udp_relay_t* relay, time_t now);
+
+// TCP会话结束时关闭其所有流
+void udp_relay_close_owner(udp_relay_t* relay, unsigned long owner);
+
+#endif // UDP_RELAY_H